@@ -13,6 +13,8 @@
 
 #include <avr/io.h>
 #include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
 #include <avr/pgmspace.h>
 #include "uart.h"
 #include "mcp2515.h"
@@ -41,6 +43,22 @@ print_can_hex_detailed(can_t *msg)	{
 
 	uint8_t tmp = 0;
 	uint16_t xtmp = 0;
+
+#ifdef TRACE
+	// one record instead of a record per field
+	PRINT("CAN ID:0x%08lX D:%d D:0x%02x 0x%02x 0x%02x 0x%02x 0x%02x 0x%02x 0x%02x 0x%02x\n",
+			msg->id,
+			msg->length,
+			msg->data[0],
+			msg->data[1],
+			msg->data[2],
+			msg->data[3],
+			msg->data[4],
+			msg->data[5],
+			msg->data[6],
+			msg->data[7]);
+	return;
+#endif
 	
 	tmp = (msg->id >> 17) & 0xFF;
 	PRINT("C:0x%02X ", tmp);
@@ -121,3 +139,179 @@ print_can_hex_detailed(can_t *msg)	{
 			break;
 	}
 }
+
+// -----------------------------------------------------------------------------
+// Description: Send a received CAN message as binary capture record
+//
+// Details: Waits for space in the UART transmit buffer, so no record is cut
+// by the drop policy. Messages arriving meanwhile are kept in the CAN buffer
+// and the MCP2515, see the INT0 ISR. See CAPTURE_SYNC for the format.
+//
+// Called by: capture()
+//
+// Return: void
+// -----------------------------------------------------------------------------
+void
+capture_frame(const can_t *msg, uint32_t stamp, uint8_t lost)	{
+
+	uint8_t len = msg->length & 0x0F;
+	uint32_t id = msg->id;
+	uint8_t i;
+
+	if(len > 8)
+		len = 8;
+
+	if(lost > CAPTURE_LOSTMAX)
+		lost = CAPTURE_LOSTMAX;
+
+	while(uart_tx_free() < len + 10)
+		;
+
+	uart_putc(CAPTURE_SYNC);
+	uart_putc((lost << 4) | len);
+	for(i = 0; i < 4; i++, stamp >>= 8)
+		uart_putc(stamp);
+	for(i = 0; i < 4; i++, id >>= 8)
+		uart_putc(id);
+	for(i = 0; i < len; i++)
+		uart_putc(msg->data[i]);
+}
+
+#ifdef TRACE
+static uint16_t trace_drop;
+
+// -----------------------------------------------------------------------------
+// Description: Emit a binary trace record instead of formatting the message
+//
+// Details: The format string is only scanned for the size of the arguments,
+// formatting is done on the host by tools/tracedec.py with the ELF file of
+// this build. int args take 2 byte, long args 4 byte, %s and %S strings are 
+// copied with terminating '\0'. The first argument not fitting into
+// TRACE_ARGMAX ends the record, TRACE_TRUNC marks it. With TRACE_DROP a
+// record not fitting into the UART transmit buffer is dropped as a whole,
+// otherwise uart_putc() waits for space.
+//
+// Called by: PRINT()
+//
+// Return: void
+// -----------------------------------------------------------------------------
+void
+trace_P(const char *fmt, ...)	{
+
+	va_list ap;
+	uint8_t args[TRACE_ARGMAX];
+	uint8_t n = 0, size, i, trunc = 0;
+	uint16_t id = (uint16_t)fmt;
+	uint32_t val;
+	const char *s;
+	char c, l, pgm;
+
+	va_start(ap, fmt);
+
+	while(!trunc && (c = pgm_read_byte(fmt++)))	{
+
+		if(c != '%')
+			continue;
+
+		// skip flags, width and precision, '*' takes an int arg
+		l = 0;
+		while((c = pgm_read_byte(fmt++)))	{
+
+			if(c == 'l')
+				l = 1;
+			else if(c == '*')	{
+
+				val = va_arg(ap, unsigned int);
+				if(n + 2 > TRACE_ARGMAX)	{
+
+					trunc = 1;
+					break;
+				}
+				args[n++] = val;
+				args[n++] = val >> 8;
+			}
+			else if(!strchr("-+ #.h0123456789", c))
+				break;
+		}
+
+		if(trunc || c == 0)
+			break;
+
+		if(c == '%')
+			continue;
+
+		if(c == 's' || c == 'S')	{
+
+			pgm = (c == 'S');
+			s = va_arg(ap, const char *);
+			if(n >= TRACE_ARGMAX)	{
+
+				trunc = 1;
+				break;
+			}
+
+			for(i = 0; i < TRACE_STRMAX; i++)	{
+
+				c = pgm ? pgm_read_byte(s) : *s;
+				if(c == 0)
+					break;
+				if(n >= TRACE_ARGMAX - 1)	{
+
+					trunc = 1;
+					break;
+				}
+				args[n++] = c;
+				s++;
+			}
+			args[n++] = 0;
+			continue;
+		}
+
+		if(l)	{
+			val = va_arg(ap, uint32_t);
+			size = 4;
+		} else	{
+			val = va_arg(ap, unsigned int);
+			size = 2;
+		}
+
+		if(n + size > TRACE_ARGMAX)	{
+
+			trunc = 1;
+			break;
+		}
+
+		for(i = 0; i < size; i++, val >>= 8)
+			args[n++] = val;
+	}
+
+	va_end(ap);
+
+#if defined(TRACE_DROP) || (UART_TX_POLICY == UART_TX_DROP)
+	if(uart_tx_free() < n + 4)	{
+		trace_drop++;
+		return;
+	}
+#endif
+
+	uart_putc(TRACE_SYNC);
+	uart_putc(trunc ? (n | TRACE_TRUNC) : n);
+	uart_putc(id);
+	uart_putc(id >> 8);
+	for(i = 0; i < n; i++)
+		uart_putc(args[i]);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Number of trace records dropped because of full UART buffer
+//
+// Called by: div 
+//
+// Return: dropped records
+// -----------------------------------------------------------------------------
+uint16_t
+trace_dropped(void)	{
+
+	return(trace_drop);
+}
+#endif
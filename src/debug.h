@@ -16,12 +16,70 @@
 
 #define DEBUG 1
 
-#ifdef DEBUG
+// Binary trace instead of formatted output, decode with tools/tracedec.py
+//#define TRACE 1
+
+// Drop a trace record not fitting into the UART buffer instead of waiting,
+// counted by trace_dropped()
+//#define TRACE_DROP 1
+
+// Latency histograms of the update, printed after each session. Takes about
+// 200 Byte RAM, see latency.h. Off until the stack headroom of the target is
+// measured with RAMCHECK
+//#define LATENCY 1
+
+// Stack high water mark per update phase, warns if RAM gets low, see ram.c.
+// Scans the free RAM at each phase change, about 0.2ms three times a block
+//#define RAMCHECK 1
+
+#if defined(TRACE)
+#define	PRINT(string, ...)		trace_P(PSTR(string), ##__VA_ARGS__)
+#elif defined(DEBUG)
 #define	PRINT(string, ...)		printf_P(PSTR(string), ##__VA_ARGS__)
 #else
 #define	PRINT(string, ...)	do{} while(0)
 #endif
 
+// -----------------------------------------------------------------------------
+// Binary trace record:
+// TRACE_SYNC | arg length | format ID low | format ID high | args ...
+// The format ID is the flash address of the format string. TRACE_TRUNC in
+// the arg length marks a record cut at the first argument not fitting
+#define TRACE_SYNC	0xA5
+#define TRACE_TRUNC	0x80
+#define TRACE_ARGMAX	32		// max. bytes of raw arguments per record
+#define TRACE_STRMAX	12		// max. chars of a %s argument
+
+// -----------------------------------------------------------------------------
+// CAN capture record, see capture() in main.c, decode with tools/capdec.py:
+// CAPTURE_SYNC | lost << 4 | length | time us | id | data ...
+// Time and id take 4 byte little endian, lost counts the overflows of the
+// MCP2515 receive buffers before this one, each lost one message at least,
+// saturates at CAPTURE_LOSTMAX. A record takes 18 byte at most, 57600 baud
+// carry about 320 records/s.
+#define CAPTURE_SYNC	0x5A
+#define CAPTURE_LOSTMAX	15
+
+// -----------------------------------------------------------------------------
+// Benchmark phases: a BENCH build writes the phase to GPIOR1, the simulator
+// host/simavr.c counts the cycles until the next marker. Otherwise the 
+// phases feed the RAM check RAM_PHASE() of a RAMCHECK build.
+#define BENCH_OTHER		0		// boot, detection, delays
+#define BENCH_MOUNT		1		// SD card init and f_mount()
+#define BENCH_CATALOG	2		// file check and version reads of the SD
+#define BENCH_VERSION	3		// version requests of the MS2
+#define BENCH_CRC		4		// SD read and CRC of a block
+#define BENCH_STREAM	5		// SD read and CAN stream of a block
+#define BENCH_ACK		6		// block handshake, wait for ACK or request
+#define BENCH_BLOCK		0x40	// count a block, phase unchanged
+#define BENCH_DONE		0x80	// update finished, end of benchmark
+
+#if defined(BENCH)
+#define BENCH_PHASE(phase)	(GPIOR1 = (phase))
+#else
+#define BENCH_PHASE(phase)	RAM_PHASE(phase)
+#endif
+
 
 // -----------------------------------------------------------------------------
 // Global file handle
@@ -35,6 +93,15 @@ int putchar__(char c, FILE *stream);
 // Print CAN msg 
 void print_can_hex_detailed(can_t *msg);
 
+// -----------------------------------------------------------------------------
+// Emit CAN capture record
+void capture_frame(const can_t *msg, uint32_t stamp, uint8_t lost);
+
+// -----------------------------------------------------------------------------
+// Emit binary trace record
+void trace_P(const char *fmt, ...);
+uint16_t trace_dropped(void);
+
 #endif
 
 
@@ -0,0 +1,150 @@
+/*
+* ----------------------------------------------------------------------------
+* Small formatter of the config replies and the LCD
+*
+* Replaces sprintf() for the " .key=value\n" lines of the config replies
+* and the version line of the LCD, the output is the same as of %d and %ld.
+* Without DEBUG no vfprintf() is linked any more.
+*
+* Every function writes the terminating zero and returns a pointer to it,
+* so the calls chain. Numbers are converted by subtracting powers of ten,
+* the AVR has no divide and a 32 bit division by 10 costs about 600 cycles
+* per digit.
+*
+*  Version: 0.0.1
+*  
+* "THE BEER-WARE LICENSE" (Revision 42):
+* <karsten@rhen.de> wrote this file. As long as you retain this notice you
+* can do whatever you want with this stuff. If we meet some day, and you think
+* this stuff is worth it, you can buy me a beer in Flensburg, Germany
+* ----------------------------------------------------------------------------
+*/
+
+#include <inttypes.h>
+#include <avr/pgmspace.h>
+
+#include "fmt.h"
+
+static const uint32_t dec_pow[] PROGMEM = {
+
+	1000000000UL, 100000000UL, 10000000UL, 1000000UL, 100000UL,
+	10000UL, 1000UL, 100UL, 10UL
+};
+
+// -----------------------------------------------------------------------------
+// Description: Copy a string from flash
+//
+// Called by: divers
+//
+// Return: pointer to the terminating zero
+// -----------------------------------------------------------------------------
+char *
+fmt_P(char *dst, PGM_P s)	{
+
+	while((*dst = pgm_read_byte(s++)) != 0)
+		dst++;
+
+	return(dst);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Decimal number like %ld
+//
+// Details: Each digit is counted by subtracting its power of ten, at most 9
+// subtractions and one compare per digit.
+//
+// Called by: divers
+//
+// Return: pointer to the terminating zero
+// -----------------------------------------------------------------------------
+char *
+fmt_long(char *dst, int32_t val)	{
+
+	uint32_t u = val, d;
+	uint8_t i;
+	char c, lead = 0;
+
+	if(val < 0)	{
+		*dst++ = '-';
+		u = -u;
+	}
+
+	for(i = 0; i < sizeof(dec_pow) / sizeof(dec_pow[0]); i++)	{
+
+		d = pgm_read_dword(&dec_pow[i]);
+		if(u < d && !lead)
+			continue;
+
+		c = '0';
+		while(u >= d)	{
+			u -= d;
+			c++;
+		}
+
+		*dst++ = c;
+		lead = 1;
+	}
+
+	*dst++ = '0' + u;
+	*dst = 0;
+
+	return(dst);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Software version like "%d.%d" of high and low byte
+//
+// Called by: main
+//
+// Return: pointer to the terminating zero
+// -----------------------------------------------------------------------------
+char *
+fmt_ver(char *dst, uint16_t ver)	{
+
+	dst = fmt_long(dst, ver >> 8);
+	*dst++ = '.';
+
+	return(fmt_long(dst, ver & 0xFF));
+}
+
+// -----------------------------------------------------------------------------
+// Description: Config reply line " .key=value\n"
+//
+// Called by: process.c
+//
+// Return: pointer to the terminating zero
+// -----------------------------------------------------------------------------
+char *
+fmt_key(char *dst, PGM_P key, int32_t val)	{
+
+	*dst++ = ' ';
+	*dst++ = '.';
+	dst = fmt_P(dst, key);
+	*dst++ = '=';
+	dst = fmt_long(dst, val);
+	*dst++ = '\n';
+	*dst = 0;
+
+	return(dst);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Zero pad a config reply for the CAN stream
+//
+// Details: The stream sends 8 byte frames, the string and at least one zero
+// are padded with zeros to the next multiple of 8.
+//
+// Called by: process.c
+//
+// Return: padded length, the string length is end - buf
+// -----------------------------------------------------------------------------
+uint8_t
+fmt_pad8(char *buf, char *end)	{
+
+	uint8_t n = (((end - buf) / 8) + 1) * 8;
+
+	while(end < buf + n)
+		*end++ = 0;
+
+	return(n);
+}
@@ -0,0 +1,26 @@
+/*
+* ----------------------------------------------------------------------------
+* Small formatter of the config replies and the LCD
+*
+*  Version: 0.0.1
+*  
+* "THE BEER-WARE LICENSE" (Revision 42):
+* <karsten@rhen.de> wrote this file. As long as you retain this notice you
+* can do whatever you want with this stuff. If we meet some day, and you think
+* this stuff is worth it, you can buy me a beer in Flensburg, Germany
+* ----------------------------------------------------------------------------
+*/
+
+#ifndef FMT_H
+#define FMT_H
+
+#include <inttypes.h>
+#include <avr/pgmspace.h>
+
+char *fmt_P(char *dst, PGM_P s);
+char *fmt_long(char *dst, int32_t val);
+char *fmt_ver(char *dst, uint16_t ver);
+char *fmt_key(char *dst, PGM_P key, int32_t val);
+uint8_t fmt_pad8(char *buf, char *end);
+
+#endif
@@ -0,0 +1,26 @@
+/*
+* ----------------------------------------------------------------------------
+* Host build: EEPROM, the EEMEM variables are kept in RAM in their own
+* section, hal_eeprom_open() loads them from a file and saves them at exit
+*
+*  Version: 0.0.1
+*
+* "THE BEER-WARE LICENSE" (Revision 42):
+* <karsten@rhen.de> wrote this file. As long as you retain this notice you
+* can do whatever you want with this stuff. If we meet some day, and you think
+* this stuff is worth it, you can buy me a beer in Flensburg, Germany
+* ----------------------------------------------------------------------------
+*/
+
+#ifndef HOST_AVR_EEPROM_H
+#define HOST_AVR_EEPROM_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define EEMEM	__attribute__((section("hal_eeprom")))
+
+#define eeprom_read_block(dst, src, n)		memcpy((dst), (src), (n))
+#define eeprom_update_block(src, dst, n)	memcpy((dst), (src), (n))
+
+#endif
@@ -0,0 +1,32 @@
+/*
+* ----------------------------------------------------------------------------
+* Host build: interrupt control and ISR definition mapped to the HAL
+*
+*  Version: 0.0.1
+*
+* "THE BEER-WARE LICENSE" (Revision 42):
+* <karsten@rhen.de> wrote this file. As long as you retain this notice you
+* can do whatever you want with this stuff. If we meet some day, and you think
+* this stuff is worth it, you can buy me a beer in Flensburg, Germany
+* ----------------------------------------------------------------------------
+*/
+
+#ifndef HOST_AVR_INTERRUPT_H
+#define HOST_AVR_INTERRUPT_H
+
+#include "hal.h"
+
+#define cli()	hal_cli()
+#define sei()	hal_sei()
+
+// An ISR is a plain function, called by the HAL interrupt dispatcher
+#define ISR(vector, ...)	void vector(void); void vector(void)
+
+#define INT0_vect			hal_vect_int0
+#define PCINT1_vect			hal_vect_pcint1
+#define TIMER2_COMPA_vect	hal_vect_timer2_compa
+#define TIMER1_OVF_vect		hal_vect_timer1_ovf
+#define TIMER0_COMPA_vect	hal_vect_timer0_compa
+#define USART_UDRE_vect		hal_vect_usart_udre
+
+#endif
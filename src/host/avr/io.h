@@ -0,0 +1,155 @@
+/*
+* ----------------------------------------------------------------------------
+* Host build: ATmega328P I/O registers emulated by the HAL
+*
+* Registers are plain variables, see hal.c. The timer counters are read and
+* written through the HAL to follow the emulated clock.
+*
+*  Version: 0.0.1
+*
+* "THE BEER-WARE LICENSE" (Revision 42):
+* <karsten@rhen.de> wrote this file. As long as you retain this notice you
+* can do whatever you want with this stuff. If we meet some day, and you think
+* this stuff is worth it, you can buy me a beer in Flensburg, Germany
+* ----------------------------------------------------------------------------
+*/
+
+#ifndef HOST_AVR_IO_H
+#define HOST_AVR_IO_H
+
+#include <stdint.h>
+#include "hal.h"
+
+#define _BV(bit)	(1 << (bit))
+#define bit_is_set(sfr, bit)	((sfr) & _BV(bit))
+#define bit_is_clear(sfr, bit)	(!((sfr) & _BV(bit)))
+#define loop_until_bit_is_set(sfr, bit)		do {} while(bit_is_clear(sfr, bit))
+#define loop_until_bit_is_clear(sfr, bit)	do {} while(bit_is_set(sfr, bit))
+
+// -----------------------------------------------------------------------------
+// Ports
+extern volatile uint8_t PINB, DDRB, PORTB;
+extern volatile uint8_t PINC, DDRC, PORTC;
+extern volatile uint8_t PIND, DDRD, PORTD;
+
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PB6 6
+#define PB7 7
+#define PC0 0
+#define PC1 1
+#define PC2 2
+#define PC3 3
+#define PC4 4
+#define PC5 5
+#define PC6 6
+#define PD0 0
+#define PD1 1
+#define PD2 2
+#define PD3 3
+#define PD4 4
+#define PD5 5
+#define PD6 6
+#define PD7 7
+
+// -----------------------------------------------------------------------------
+// General purpose I/O registers, status register
+extern volatile uint8_t GPIOR0, GPIOR1, GPIOR2;
+#define SREG	hal_sreg
+
+// -----------------------------------------------------------------------------
+// External and pin change interrupts
+extern volatile uint8_t EICRA, EIMSK, EIFR;
+extern volatile uint8_t PCICR, PCIFR, PCMSK0, PCMSK1, PCMSK2;
+
+#define INT0	0
+#define INT1	1
+#define PCIE0	0
+#define PCIE1	1
+#define PCIE2	2
+#define PCINT8	0
+#define PCINT9	1
+#define PCINT10	2
+#define PCINT11	3
+#define PCINT12	4
+#define PCINT13	5
+#define PCINT14	6
+
+// -----------------------------------------------------------------------------
+// Timer0, Timer2: 8 bit, CTC mode on OCRnA
+extern volatile uint8_t TCCR0A, TCCR0B, OCR0A, OCR0B, TIMSK0, TIFR0;
+extern volatile uint8_t TCCR2A, TCCR2B, OCR2A, OCR2B, TIMSK2, TIFR2;
+#define TCNT0	(*hal_tcnt(0))
+#define TCNT2	(*hal_tcnt(2))
+
+#define WGM00	0
+#define WGM01	1
+#define WGM02	3
+#define CS00	0
+#define CS01	1
+#define CS02	2
+#define TOIE0	0
+#define OCIE0A	1
+#define OCIE0B	2
+#define OCF0A	1
+
+#define WGM20	0
+#define WGM21	1
+#define WGM22	3
+#define CS20	0
+#define CS21	1
+#define CS22	2
+#define TOIE2	0
+#define OCIE2A	1
+#define OCIE2B	2
+#define OCF2A	1
+
+// -----------------------------------------------------------------------------
+// Timer1: 16 bit, normal mode only, TIFR1 can only be read
+extern volatile uint8_t TCCR1A, TCCR1B, TIMSK1;
+#define TCNT1	(*hal_tcnt1())
+#define TIFR1	(*hal_tifr1())
+
+#define CS10	0
+#define CS11	1
+#define CS12	2
+#define TOIE1	0
+#define TOV1	0
+
+// -----------------------------------------------------------------------------
+// SPI, transfers itself are done by hal_spi_xfer()
+extern volatile uint8_t SPCR, SPSR, SPDR;
+
+#define SPR0	0
+#define SPR1	1
+#define CPHA	2
+#define CPOL	3
+#define MSTR	4
+#define DORD	5
+#define SPE		6
+#define SPIE	7
+#define SPI2X	0
+#define WCOL	6
+#define SPIF	7
+
+// -----------------------------------------------------------------------------
+// USART0, output goes to the HAL console
+extern volatile uint8_t UCSR0A, UCSR0B, UCSR0C, UBRR0H, UBRR0L, UDR0;
+
+#define RXC0	7
+#define TXC0	6
+#define UDRE0	5
+#define U2X0	1
+#define RXCIE0	7
+#define TXCIE0	6
+#define UDRIE0	5
+#define RXEN0	4
+#define TXEN0	3
+#define UCSZ00	1
+#define UCSZ01	2
+
+#endif
@@ -0,0 +1,41 @@
+/*
+* ----------------------------------------------------------------------------
+* Host build: flash access, the host has a single address space
+*
+*  Version: 0.0.1
+*
+* "THE BEER-WARE LICENSE" (Revision 42):
+* <karsten@rhen.de> wrote this file. As long as you retain this notice you
+* can do whatever you want with this stuff. If we meet some day, and you think
+* this stuff is worth it, you can buy me a beer in Flensburg, Germany
+* ----------------------------------------------------------------------------
+*/
+
+#ifndef HOST_AVR_PGMSPACE_H
+#define HOST_AVR_PGMSPACE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+
+#define PROGMEM
+#define PGM_P	const char *
+#define PSTR(s)	(s)
+
+#define pgm_read_byte(addr)		(*(const uint8_t *)(addr))
+#define pgm_read_word(addr)		(*(const uint16_t *)(addr))
+#define pgm_read_dword(addr)	(*(const uint32_t *)(addr))
+
+#define memcpy_P	memcpy
+#define memcmp_P	memcmp
+#define strcmp_P	strcmp
+#define strncmp_P	strncmp
+#define strcpy_P	strcpy
+#define strlen_P	strlen
+#define sprintf_P	sprintf
+
+// avr-libc formats, int is 16 bit and %S is a flash string, see hal.c
+int hal_printf_P(const char *fmt, ...);
+#define printf_P	hal_printf_P
+
+#endif
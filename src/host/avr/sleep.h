@@ -0,0 +1,26 @@
+/*
+* ----------------------------------------------------------------------------
+* Host build: sleep modes, sleep_cpu() waits for the next emulated interrupt
+*
+*  Version: 0.0.1
+*
+* "THE BEER-WARE LICENSE" (Revision 42):
+* <karsten@rhen.de> wrote this file. As long as you retain this notice you
+* can do whatever you want with this stuff. If we meet some day, and you think
+* this stuff is worth it, you can buy me a beer in Flensburg, Germany
+* ----------------------------------------------------------------------------
+*/
+
+#ifndef HOST_AVR_SLEEP_H
+#define HOST_AVR_SLEEP_H
+
+#include "hal.h"
+
+#define SLEEP_MODE_IDLE	0
+
+#define set_sleep_mode(mode)	do {} while(0)
+#define sleep_enable()			do {} while(0)
+#define sleep_disable()			do {} while(0)
+#define sleep_cpu()				hal_sleep()
+
+#endif
@@ -0,0 +1,406 @@
+/*
+* ----------------------------------------------------------------------------
+* Host build: CAN back ends and virtual CAN bus
+*
+* Selects the CAN back end ( the other nodes on the bus ) and connects it to
+* the emulated CAN controller. The register level MCP2515 is connected by a
+* virtual bus at HAL_CAN_BITRATE: each frame takes its time on the bus bit
+* by bit including stuff bits, arbitration decides between the controller
+* and the back end. The frame level controller in can_host.c exchanges frames
+* directly and only accounts the bus time.
+*
+*  Version: 0.0.1
+*
+* "THE BEER-WARE LICENSE" (Revision 42):
+* <karsten@rhen.de> wrote this file. As long as you retain this notice you
+* can do whatever you want with this stuff. If we meet some day, and you think
+* this stuff is worth it, you can buy me a beer in Flensburg, Germany
+* ----------------------------------------------------------------------------
+*/
+
+#include <string.h>
+#include <avr/io.h>
+#include "hal.h"
+
+extern const hal_can_t hal_can_null;
+extern const hal_can_t hal_can_socket;
+extern const hal_can_t hal_can_ms2;
+extern const hal_can_t hal_can_gb;
+extern const hal_can_t hal_can_replay;
+
+static const hal_can_t *const backends[] = {
+	&hal_can_null,
+	&hal_can_socket,
+	&hal_can_ms2,
+	&hal_can_gb,
+	&hal_can_replay,
+	0
+};
+
+const hal_can_t *hal_can = &hal_can_null;
+
+// Log of the frames exchanged with the back end
+static const hal_can_t *logged;
+static FILE *log_file;
+
+// Virtual bus
+static const hal_can_node_t *node;		// register level controller
+static bool busy;						// frame on the bus
+static bool from_node;					// frame sent by the controller
+static can_t frame;						// frame on the bus
+static uint64_t frame_end;				// cycle after intermission
+static bool slot_full;					// frame of the back end lost arbitration
+static can_t slot;
+
+static uint64_t bus_next(void);
+static void bus_run(uint64_t now);
+static int bus_fd(void);
+
+static hal_dev_t bus_dev = {"canbus", bus_next, bus_run, bus_fd, 0};
+
+
+// -----------------------------------------------------------------------------
+// Description: Select and open a CAN back end
+//
+// Details: spec is "name" or "name:arg", e.g. "socketcan:vcan0". The CAN
+// controller model is set up afterwards.
+//
+// Called by: host main
+//
+// Return: 0 on success otherwise -1
+// -----------------------------------------------------------------------------
+int
+hal_can_open(const char *spec)	{
+
+	const hal_can_t *const *be;
+	const char *arg = strchr(spec, ':');
+	size_t len = arg ? (size_t)(arg - spec) : strlen(spec);
+
+	for(be = backends; *be; be++)	{
+
+		if(strlen((*be)->name) == len && !strncmp((*be)->name, spec, len))	{
+
+			hal_can = *be;
+			if(hal_can->open(arg ? arg + 1 : ""))
+				return(-1);
+
+			hal_can_ctrl_init();
+			return(0);
+		}
+	}
+
+	return(-1);
+}
+
+void
+hal_can_list(FILE *f)	{
+
+	const hal_can_t *const *be;
+
+	for(be = backends; *be; be++)
+		fprintf(f, "  %-24s %s\n", (*be)->name, (*be)->help);
+}
+
+
+// -----------------------------------------------------------------------------
+// ---------*** Log in candump format ***---------------------------------------
+// -----------------------------------------------------------------------------
+
+static void
+log_frame(const can_t *msg)	{
+
+	uint64_t us = hal_now() / (F_CPU / 1000000UL);
+	uint8_t i;
+
+	fprintf(log_file, "(%llu.%06llu) can0 %08lX#",
+			(unsigned long long)(us / 1000000),
+			(unsigned long long)(us % 1000000), (unsigned long)msg->id);
+	for(i = 0; i < msg->length && i < 8; i++)
+		fprintf(log_file, "%02X", msg->data[i]);
+	fputc('\n', log_file);
+}
+
+static int
+log_open(const char *arg)	{
+
+	return(0);
+}
+
+static void
+log_send(const can_t *msg)	{
+
+	log_frame(msg);
+	logged->send(msg);
+}
+
+static uint64_t
+log_next(void)	{
+
+	return(logged->next());
+}
+
+static bool
+log_recv(can_t *msg)	{
+
+	if(!logged->recv(msg))
+		return(false);
+
+	log_frame(msg);
+	return(true);
+}
+
+static int
+log_fd(void)	{
+
+	return(logged->fd ? logged->fd() : -1);
+}
+
+static const hal_can_t hal_can_log_be = {
+	"log", "",
+	log_open, log_send, log_next, log_recv, log_fd
+};
+
+// -----------------------------------------------------------------------------
+// Description: Log the frames of the bus to a file
+//
+// Details: Wraps the opened back end, each frame sent or received by the
+// updater is written with the HAL time in the format of candump -L, so a log
+// can be compared with a captured trace or replayed.
+//
+// Called by: host main after hal_can_open()
+//
+// Return: 0 on success otherwise -1
+// -----------------------------------------------------------------------------
+int
+hal_can_log(const char *path)	{
+
+	if(!(log_file = fopen(path, "w")))
+		return(-1);
+
+	logged = hal_can;
+	hal_can = &hal_can_log_be;
+	return(0);
+}
+
+
+// -----------------------------------------------------------------------------
+// ---------*** Virtual bus ***-------------------------------------------------
+// -----------------------------------------------------------------------------
+
+// -----------------------------------------------------------------------------
+// Description: Number of bits of a frame on the bus
+//
+// Details: Extended data frame: SOF, 29 bit identifier with SRR and IDE, RTR,
+// r1, r0, DLC, data and CRC-15 are bit stuffed, after 5 equal bits a bit of
+// the opposite level is inserted. CRC delimiter, ACK slot and delimiter, EOF
+// and the intermission of 3 bits follow unstuffed.
+//
+// Called by: bus_arbitrate(), can_host.c
+//
+// Return: bits
+// -----------------------------------------------------------------------------
+uint16_t
+hal_can_bits(const can_t *msg)	{
+
+	uint8_t bits[128], len = msg->length > 8 ? 8 : msg->length;
+	uint16_t n = 0, crc = 0, stuffed, i;
+	uint8_t run = 0, last = 2, b;
+
+	bits[n++] = 0;								// SOF
+	for(i = 0; i < 11; i++)						// base identifier
+		bits[n++] = (msg->id >> (28 - i)) & 1;
+	bits[n++] = 1;								// SRR
+	bits[n++] = 1;								// IDE
+	for(i = 0; i < 18; i++)						// identifier extension
+		bits[n++] = (msg->id >> (17 - i)) & 1;
+	bits[n++] = 0;								// RTR
+	bits[n++] = 0;								// r1
+	bits[n++] = 0;								// r0
+	for(i = 0; i < 4; i++)
+		bits[n++] = (len >> (3 - i)) & 1;
+	for(i = 0; i < len * 8; i++)
+		bits[n++] = (msg->data[i / 8] >> (7 - i % 8)) & 1;
+
+	for(i = 0; i < n; i++)	{					// CRC-15, polynom 0x4599
+		b = bits[i] ^ ((crc >> 14) & 1);
+		crc = (crc << 1) & 0x7FFF;
+		if(b)
+			crc ^= 0x4599;
+	}
+	for(i = 0; i < 15; i++)
+		bits[n + i] = (crc >> (14 - i)) & 1;
+	n += 15;
+
+	for(i = 0, stuffed = 0; i < n; i++)	{
+
+		if(bits[i] == last)
+			run++;
+		else	{
+			last = bits[i];
+			run = 1;
+		}
+
+		if(run == 5)	{						// stuff bit starts a new run
+			stuffed++;
+			last = !last;
+			run = 1;
+		}
+	}
+
+	return(n + stuffed + 1 + 2 + 7 + 3);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Arbitration priority of a frame, lower wins
+//
+// Details: All frames are extended data frames, so the identifier is sent
+// in the order of its value.
+//
+// Return: identifier
+// -----------------------------------------------------------------------------
+static uint32_t
+bus_prio(const can_t *msg)	{
+
+	return(msg->id & 0x1FFFFFFF);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Start the next frame on the idle bus
+//
+// Details: The frame of the back end is fetched when due and kept if it loses
+// the arbitration against the controller.
+//
+// Called by: bus_run()
+//
+// Return: void
+// -----------------------------------------------------------------------------
+static void
+bus_arbitrate(uint64_t now)	{
+
+	can_t tx;
+	bool tx_ready;
+
+	if(!slot_full && hal_can->next() <= now && hal_can->recv(&slot))
+		slot_full = true;
+
+	tx_ready = node->tx(&tx);
+
+	if(tx_ready && (!slot_full || bus_prio(&tx) <= bus_prio(&slot)))	{
+
+		frame = tx;
+		from_node = true;
+
+	} else if(slot_full)	{
+
+		frame = slot;
+		from_node = false;
+		slot_full = false;
+
+	} else
+		return;
+
+	busy = true;
+	frame_end = now + hal_can_bits(&frame) * HAL_CAN_BIT;
+	hal_stats.bus_busy += hal_can_bits(&frame) * HAL_CAN_BIT;
+}
+
+static void
+bus_run(uint64_t now)	{
+
+	if(busy && frame_end <= now)	{
+
+		busy = false;
+
+		// acknowledged by the back end
+		if(from_node)	{
+			node->tx_done();
+			hal_can->send(&frame);
+		} else
+			node->rx(&frame);
+	}
+
+	if(!busy)
+		bus_arbitrate(now);
+}
+
+static uint64_t
+bus_next(void)	{
+
+	can_t tx;
+
+	if(busy)
+		return(frame_end);
+
+	if(slot_full || node->tx(&tx))
+		return(hal_now());
+
+	return(hal_can->next());
+}
+
+static int
+bus_fd(void)	{
+
+	return(hal_can->fd ? hal_can->fd() : -1);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Connect a register level CAN controller to the bus
+//
+// Called by: hal_can_ctrl_init() of the controller
+//
+// Return: void
+// -----------------------------------------------------------------------------
+void
+hal_can_attach(const hal_can_node_t *ctrl)	{
+
+	node = ctrl;
+	hal_dev_add(&bus_dev);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Check if the controller has sent all frames
+//
+// Called by: host main before exit
+//
+// Return: true if no frame is on the bus or waiting for it
+// -----------------------------------------------------------------------------
+bool
+hal_can_idle(void)	{
+
+	can_t tx;
+
+	return(!node || (!busy && !node->tx(&tx)));
+}
+
+
+// -----------------------------------------------------------------------------
+// ---------*** Back end null: no device connected ***--------------------------
+// -----------------------------------------------------------------------------
+
+static int
+null_open(const char *arg)	{
+
+	return(0);
+}
+
+static void
+null_send(const can_t *msg)	{
+
+}
+
+static uint64_t
+null_next(void)	{
+
+	return(HAL_NEVER);
+}
+
+static bool
+null_recv(can_t *msg)	{
+
+	return(false);
+}
+
+const hal_can_t hal_can_null = {
+	"null", "no device on the bus",
+	null_open, null_send, null_next, null_recv, 0
+};
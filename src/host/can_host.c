@@ -0,0 +1,301 @@
+/*
+* ----------------------------------------------------------------------------
+* Host build: CAN controller on frame level
+*
+* Implements the interface of mcp2515.h on top of the CAN back end of the
+* HAL. Like the MCP2515 two receive buffers with rollover are emulated, INT0
+* is active while one of them is full. The SPI time of the MCP2515 driver is
+* added per call, so the timing follows the real controller. Frames are
+* exchanged without delay, their time on the bus is only accounted.
+*
+* The register level model in mcp2515_emu.c replaces this file and mcp2515.c
+* of the firmware is used instead.
+*
+*  Version: 0.0.1
+*
+* "THE BEER-WARE LICENSE" (Revision 42):
+* <karsten@rhen.de> wrote this file. As long as you retain this notice you
+* can do whatever you want with this stuff. If we meet some day, and you think
+* this stuff is worth it, you can buy me a beer in Flensburg, Germany
+* ----------------------------------------------------------------------------
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <avr/io.h>
+#include "hal.h"
+
+// SPI bytes of the MCP2515 driver functions
+#define SPI_GET_STATUS	2		// SPI_RX_STATUS, SPI_READ_STATUS
+#define SPI_GET_MSG		18		// SPI_READ_RX + id + dlc + data, bit modify
+#define SPI_SND_MSG		17		// SPI_WRITE_TX + id + dlc + data, SPI_RTS
+
+static can_t rxb[2];			// receive buffers RXB0, RXB1
+static uint8_t rx_full;			// bit n: RXBn full
+static bool rx_ovr;				// RX1OVR of EFLG
+static can_mode_t ctrl_mode = NORMAL_MODE;	// see can_set_mode()
+
+static uint64_t can_next(void);
+static void can_run(uint64_t now);
+static int can_fd(void);
+
+static hal_dev_t can_dev = {"can", can_next, can_run, can_fd, 0};
+
+
+// -----------------------------------------------------------------------------
+// Description: Store a frame into the receive buffers
+//
+// Details: A frame goes to RXB0 or rolls over to RXB1, if both are full the
+// frame is lost like on the MCP2515.
+//
+// Called by: can_run(), can_send_message()
+//
+// Return: void
+// -----------------------------------------------------------------------------
+static void
+can_store(const can_t *msg)	{
+
+	if(!(rx_full & 1))	{
+		rxb[0] = *msg;
+		rx_full |= 1;
+	} else if(!(rx_full & 2))	{
+		rxb[1] = *msg;
+		rx_full |= 2;
+	} else	{
+		hal_stats.can_lost++;
+		rx_ovr = true;
+	}
+
+	hal_irq_line(HAL_IRQ_INT0, rx_full != 0);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Take over frames of the back end into the receive buffers
+//
+// Details: In loopback mode the controller is disconnected from the bus,
+// frames of the back end are dropped.
+//
+// Called by: HAL clock
+//
+// Return: void
+// -----------------------------------------------------------------------------
+static void
+can_run(uint64_t now)	{
+
+	can_t msg;
+
+	while(hal_can->next() <= now && hal_can->recv(&msg))	{
+
+		hal_stats.bus_busy += hal_can_bits(&msg) * HAL_CAN_BIT;
+
+		if(ctrl_mode != LOOPBACK_MODE)
+			can_store(&msg);
+	}
+}
+
+static uint64_t
+can_next(void)	{
+
+	return(hal_can->next());
+}
+
+static int
+can_fd(void)	{
+
+	return(hal_can->fd ? hal_can->fd() : -1);
+}
+
+
+// -----------------------------------------------------------------------------
+// Description: Connect the controller to the CAN back end
+//
+// Called by: hal_can_open()
+//
+// Return: void
+// -----------------------------------------------------------------------------
+void
+hal_can_ctrl_init(void)	{
+
+	hal_dev_add(&can_dev);
+}
+
+
+// -----------------------------------------------------------------------------
+// ---------*** Interface of mcp2515.h ***--------------------------------------
+// -----------------------------------------------------------------------------
+
+void
+can_reset(void)	{
+
+	hal_spi_spend(1);
+	hal_spend(HAL_MS(1));
+}
+
+bool
+can_config(void)	{
+
+	rx_full = 0;
+	ctrl_mode = NORMAL_MODE;
+	hal_spi_spend(23);
+
+	return(true);
+}
+
+bool
+can_init(void)	{
+
+	can_reset();
+	hal_spend(HAL_MS(10));
+
+	return(can_config());
+}
+
+// -----------------------------------------------------------------------------
+// Description: Read a message of RXB0 or RXB1
+//
+// Details: RXB0 is read first like by mcp2515.c
+//
+// Called by: INT0 ISR
+//
+// Return: 0 if no message available otherwise buffer number + 1
+// -----------------------------------------------------------------------------
+uint8_t
+can_get_message(can_t *msg)	{
+
+	uint8_t n;
+
+	if(!rx_full)	{
+		hal_spi_spend(SPI_GET_STATUS);
+		return(0);
+	}
+
+	n = (rx_full & 1) ? 0 : 1;
+	*msg = rxb[n];
+	rx_full &= ~(1 << n);
+	hal_irq_line(HAL_IRQ_INT0, rx_full != 0);
+
+	hal_stats.can_rx++;
+	hal_spi_spend(SPI_GET_STATUS + SPI_GET_MSG);
+
+	return(n + 1);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Overflows of the receive buffers since the last call
+//
+// Details: With rollover only RXB1 overflows. SPI time of the EFLG read and
+// the bit modify clearing it.
+//
+// Called by: rx_unmask()
+//
+// Return: 0 or 1
+// -----------------------------------------------------------------------------
+uint8_t
+can_rx_overflows(void)	{
+
+	uint8_t n = rx_ovr;
+
+	rx_ovr = false;
+	hal_spi_spend(n ? 3 + 4 : 3);
+	return(n);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Interrupt of a sent frame
+//
+// Details: Sending takes no bus time here, a buffer is always free and
+// can_send_message() never waits for it.
+//
+// Called by: INT0 ISR
+//
+// Return: void
+// -----------------------------------------------------------------------------
+void
+can_tx_irq(bool on)	{
+
+	hal_spi_spend(4 + 4);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Send a message
+//
+// Details: Listen only mode never sends, loopback mode receives the message
+// itself instead of sending it.
+//
+// Called by: div
+//
+// Return: buffer number
+// -----------------------------------------------------------------------------
+uint8_t
+can_send_message(const can_t *msg)	{
+
+	hal_spi_spend(SPI_GET_STATUS + SPI_SND_MSG);
+
+	if(ctrl_mode == LOOPBACK_MODE)
+		can_store(msg);
+
+	if(ctrl_mode != NORMAL_MODE)
+		return(1);
+
+	hal_stats.can_tx++;
+	hal_stats.bus_busy += hal_can_bits(msg) * HAL_CAN_BIT;
+	hal_can->send(msg);
+
+	return(1);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Switch the operation mode
+//
+// Details: SPI time of the bit modify and one CANSTAT poll
+//
+// Called by: div
+//
+// Return: void
+// -----------------------------------------------------------------------------
+void
+can_set_mode(can_mode_t mode)	{
+
+	ctrl_mode = mode;
+	hal_spi_spend(4 + 3);
+}
+
+void
+can_write_register(uint8_t adress, uint8_t data)	{
+
+	hal_spi_spend(3);
+}
+
+uint8_t
+can_read_register(uint8_t adress)	{
+
+	hal_spi_spend(3);
+	return(0);
+}
+
+uint8_t
+can_read_status(uint8_t type)	{
+
+	hal_spi_spend(SPI_GET_STATUS);
+	return(0);
+}
+
+void
+can_bit_modify(uint8_t adress, uint8_t mask, uint8_t data)	{
+
+	hal_spi_spend(4);
+}
+
+void
+can_write_id(const uint32_t *id)	{
+
+	hal_spi_spend(4);
+}
+
+uint8_t
+can_read_id(uint32_t *id)	{
+
+	hal_spi_spend(4);
+	return(1);
+}
+
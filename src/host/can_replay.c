@@ -0,0 +1,500 @@
+/*
+* ----------------------------------------------------------------------------
+* Host build: replay of a recorded CAN trace
+*
+* CAN back end "replay" plays the device side of a trace recorded on a real
+* bus, e.g. a CS2 updating a MS2 captured by the updater in listen only mode
+* ( tools/capdec.py ) or by candump -L. The frames of the reference master
+* are not replayed, the updater takes its part:
+*
+*   - device frames are sent with their original delay to the frame before
+*   - a master frame of the trace waits until the updater sends a frame of
+*     the same command, or is skipped if it is late by more than wait=ms
+*   - frames of the updater without counterpart in the trace are counted
+*
+* So process.c runs against the recorded device with the timing of the real
+* bus. At exit the delay of each protocol step ( command, sub command of the
+* boot loader ) to the frame before is printed for the reference master and
+* for the updater.
+*
+* The recording does not tell the sender, the frames of the master are told
+* by the protocol ( see protocol.c ): frames with the hash of the master,
+* 0x21 streams, boot loader block numbers, CRCs, ACKs and binary streams and
+* ping responses to a ping of the device. The hash is taken from the first
+* system command, config request response or block CRC if not given.
+*
+* Options as "replay:file[,key=value,...]":
+*
+*   master=n  hash of the reference master
+*   wait=ms   time a master frame waits for the updater, default 1000
+*   v=1       trace the replay to stderr
+*
+*  Version: 0.0.1
+*
+* "THE BEER-WARE LICENSE" (Revision 42):
+* <karsten@rhen.de> wrote this file. As long as you retain this notice you
+* can do whatever you want with this stuff. If we meet some day, and you think
+* this stuff is worth it, you can buy me a beer in Flensburg, Germany
+* ----------------------------------------------------------------------------
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <avr/io.h>
+#include "hal.h"
+#include "protocol.h"
+
+#define RPL_WINDOW	32			// master frames searched for a sent frame
+#define RPL_STEPS	32			// protocol steps of the latency report
+#define RPL_LINE	128
+#define RPL_DATA	0xFF		// sub command of binary stream frames
+
+typedef struct {
+	uint64_t us;				// time since the first frame
+	can_t msg;
+	bool master;				// sent by the reference master
+	bool done;					// replayed, matched or skipped
+} rpl_frame_t;
+
+typedef struct {
+	uint16_t key;				// command << 8 | sub command
+	uint32_t n;
+	uint64_t ref, ref_max;		// delay of the reference master in us
+	uint64_t own, own_max;		// delay of the updater in cycles
+} rpl_step_t;
+
+static rpl_frame_t *trace;
+static uint32_t frames, pos;
+static int master = -1;
+static uint64_t wait = HAL_MS(1000);
+static bool verbose;
+
+// time of the last frame on the bus in the trace and on the HAL clock
+static uint64_t anchor_us, anchor;
+static uint64_t last;
+static bool started;			// a frame was on the bus
+
+static rpl_step_t steps[RPL_STEPS];
+static uint8_t nsteps;
+static uint32_t st_sent, st_matched, st_skipped, st_replayed;
+
+
+// -----------------------------------------------------------------------------
+// Description: Command and sub command of a frame
+//
+// Details: Sub command of system and boot loader commands is data[4] after
+// the UID, the 8 byte frames of the boot loader are binary stream data.
+//
+// Return: command << 8 | sub command
+// -----------------------------------------------------------------------------
+static uint16_t
+step_key(const can_t *msg)	{
+
+	uint8_t cmd = (msg->id >> 17) & 0xFF;
+
+	if(cmd == CMD_BOOTLD_CAN && msg->length == 8)
+		return((cmd << 8) | RPL_DATA);
+
+	if((cmd == CMD_SYSTEM || cmd == CMD_BOOTLD_CAN) && msg->length > 4)
+		return((cmd << 8) | msg->data[4]);
+
+	return(cmd << 8);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Account the delay of a protocol step
+//
+// Called by: rpl_send()
+//
+// Return: void
+// -----------------------------------------------------------------------------
+static void
+step_add(uint16_t key, uint64_t ref, uint64_t own)	{
+
+	rpl_step_t *s;
+
+	for(s = steps; s < steps + nsteps && s->key != key; s++)
+		;
+
+	if(s == steps + RPL_STEPS)
+		return;
+
+	if(s == steps + nsteps)	{
+		nsteps++;
+		s->key = key;
+	}
+
+	s->n++;
+	s->ref += ref;
+	s->own += own;
+	if(ref > s->ref_max)
+		s->ref_max = ref;
+	if(own > s->own_max)
+		s->own_max = own;
+}
+
+// -----------------------------------------------------------------------------
+// Description: Time of a frame of the trace on the HAL clock
+//
+// Details: Relative to the last frame on the bus, a frame recorded before it
+// is due at once.
+//
+// Return: cycle
+// -----------------------------------------------------------------------------
+static uint64_t
+rpl_due(const rpl_frame_t *f)	{
+
+	if(f->us <= anchor_us)
+		return(anchor);
+
+	return(anchor + HAL_US(f->us - anchor_us));
+}
+
+static void
+rpl_anchor(const rpl_frame_t *f, uint64_t now)	{
+
+	anchor_us = f->us;
+	anchor = now;
+	last = now;
+	started = true;
+}
+
+static rpl_frame_t *
+rpl_head(void)	{
+
+	while(pos < frames && trace[pos].done)
+		pos++;
+
+	return(pos < frames ? &trace[pos] : 0);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Time of the next event of the trace
+//
+// Details: Due of the next device frame or the time a waiting master frame
+// is skipped.
+//
+// Return: cycle or HAL_NEVER
+// -----------------------------------------------------------------------------
+static uint64_t
+rpl_next(void)	{
+
+	rpl_frame_t *f = rpl_head();
+
+	if(!f)
+		return(HAL_NEVER);
+
+	return(rpl_due(f) + (f->master ? wait : 0));
+}
+
+// -----------------------------------------------------------------------------
+// Description: Receive the next device frame when due
+//
+// Details: Master frames the updater did not send in time are skipped.
+//
+// Called by: CAN controller
+//
+// Return: true if msg is filled
+// -----------------------------------------------------------------------------
+static bool
+rpl_recv(can_t *msg)	{
+
+	uint64_t now = hal_now();
+	rpl_frame_t *f;
+
+	while((f = rpl_head()) && f->master && rpl_due(f) + wait <= now)	{
+
+		if(verbose)
+			fprintf(stderr, "replay: %8.3f skip   %08lx\n",
+					(double)now / F_CPU, (unsigned long)f->msg.id);
+		f->done = true;
+		st_skipped++;
+		rpl_anchor(f, rpl_due(f));
+	}
+
+	if(!f || f->master || rpl_due(f) > now)
+		return(false);
+
+	if(verbose)
+		fprintf(stderr, "replay: %8.3f device %08lx\n",
+				(double)now / F_CPU, (unsigned long)f->msg.id);
+
+	*msg = f->msg;
+	f->done = true;
+	st_replayed++;
+	rpl_anchor(f, now);
+	return(true);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Match a frame of the updater with the next master frame
+//
+// Details: The next RPL_WINDOW master frames are searched for the command,
+// sub command and response bit of msg. Master frames before the match are
+// skipped, device frames before it are kept and follow at once.
+//
+// Called by: CAN controller
+//
+// Return: void
+// -----------------------------------------------------------------------------
+static void
+rpl_send(const can_t *msg)	{
+
+	uint64_t now = hal_now();
+	uint16_t key = step_key(msg);
+	uint32_t i, n = 0;
+	rpl_frame_t *f = 0;
+
+	st_sent++;
+
+	for(i = pos; i < frames && n < RPL_WINDOW; i++)	{
+
+		if(trace[i].done || !trace[i].master)
+			continue;
+
+		n++;
+		if(step_key(&trace[i].msg) == key &&
+				((trace[i].msg.id ^ msg->id) & (1UL << 16)) == 0)	{
+			f = &trace[i];
+			break;
+		}
+	}
+
+	if(!f)	{
+
+		if(verbose)
+			fprintf(stderr, "replay: %8.3f extra  %08lx\n",
+					(double)now / F_CPU, (unsigned long)msg->id);
+		last = now;
+		started = true;
+		return;
+	}
+
+	for(n = pos; n < i; n++)	{
+
+		if(trace[n].master && !trace[n].done)	{
+			trace[n].done = true;
+			st_skipped++;
+		}
+	}
+
+	if(verbose)
+		fprintf(stderr, "replay: %8.3f master %08lx\n",
+				(double)now / F_CPU, (unsigned long)msg->id);
+
+	if(started && f > trace)
+		step_add(key, f->us - f[-1].us, now - last);
+	st_matched++;
+	f->done = true;
+	rpl_anchor(f, now);
+}
+
+static void
+rpl_report(void)	{
+
+	rpl_step_t *s;
+
+	fprintf(stderr, "replay: %lu of %lu frames replayed, %lu of %lu sent "
+			"matched, %lu master frames skipped\n",
+			(unsigned long)st_replayed, (unsigned long)frames,
+			(unsigned long)st_matched, (unsigned long)st_sent,
+			(unsigned long)st_skipped);
+
+	if(!nsteps)
+		return;
+
+	fprintf(stderr, "replay: step       count  ref avg/max ms  own avg/max ms\n");
+	for(s = steps; s < steps + nsteps; s++)	{
+
+		if((s->key & 0xFF) == RPL_DATA)
+			fprintf(stderr, "replay: 0x%02x/data", s->key >> 8);
+		else
+			fprintf(stderr, "replay: 0x%02x/0x%02x", s->key >> 8, s->key & 0xFF);
+
+		fprintf(stderr, " %7lu %7.2f %7.2f %7.2f %7.2f\n", (unsigned long)s->n,
+				s->ref / 1000.0 / s->n, s->ref_max / 1000.0,
+				(double)s->own / s->n / HAL_MS(1),
+				(double)s->own_max / HAL_MS(1));
+	}
+}
+
+// -----------------------------------------------------------------------------
+// Description: Parse a line of a candump log
+//
+// Details: "(seconds.microseconds) interface id#data", data as hex bytes
+//
+// Return: 0 on success otherwise -1
+// -----------------------------------------------------------------------------
+static int
+parse_line(const char *line, uint64_t *us, can_t *msg)	{
+
+	unsigned long sec, usec;
+	char id[16], data[32];
+	const char *p;
+	unsigned int b;
+
+	if(sscanf(line, " (%lu.%lu) %*s %15[0-9A-Fa-f]#%31[0-9A-Fa-f]",
+			&sec, &usec, id, data) < 3)
+		return(-1);
+
+	if(!strchr(line, '#') || strchr(line, '#')[1] == '#')
+		return(-1);
+
+	*us = (uint64_t)sec * 1000000 + usec;
+	msg->id = strtoul(id, 0, 16);
+	msg->length = 0;
+
+	p = strchr(line, '#') + 1;
+	while(msg->length < 8 && sscanf(p, "%2x", &b) == 1)	{
+		msg->data[msg->length++] = b;
+		p += 2;
+	}
+
+	return(0);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Find the hash of the reference master
+//
+// Details: Only the master sends system commands, answers config requests
+// and sends the CRC of a flash block.
+//
+// Return: hash or -1
+// -----------------------------------------------------------------------------
+static int
+find_master(void)	{
+
+	const can_t *msg;
+	uint32_t i;
+	uint8_t cmd;
+	bool resp;
+
+	for(i = 0; i < frames; i++)	{
+
+		msg = &trace[i].msg;
+		cmd = (msg->id >> 17) & 0xFF;
+		resp = (msg->id >> 16) & 1;
+
+		if((cmd == CMD_SYSTEM && !resp) || (cmd == CMD_CFG_REQUEST && resp) ||
+				(cmd == CMD_BOOTLD_CAN && !resp && msg->length == 7 &&
+				 msg->data[4] == CMD_BOOTSUB_CRC))
+			return(msg->id & 0xFFFF);
+	}
+
+	return(-1);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Tell the frames of the master from the device frames
+//
+// Details: See the header. A ping response answers the last ping request,
+// so it is sent by the master if the request was not.
+//
+// Called by: rpl_open()
+//
+// Return: void
+// -----------------------------------------------------------------------------
+static void
+classify(void)	{
+
+	const can_t *msg;
+	bool ping_master = true, resp;
+	uint32_t i;
+	uint8_t cmd;
+
+	for(i = 0; i < frames; i++)	{
+
+		msg = &trace[i].msg;
+		cmd = (msg->id >> 17) & 0xFF;
+		resp = (msg->id >> 16) & 1;
+
+		if((msg->id & 0xFFFF) == (uint32_t)master || cmd == CMD_CFG_STREAM)
+			trace[i].master = true;
+		else if(cmd == CMD_BOOTLD_CAN && !resp)
+			trace[i].master = msg->length == 8 || (msg->length > 4 &&
+					(msg->data[4] == CMD_BOOTSUB_BLKN ||
+					 msg->data[4] == CMD_BOOTSUB_CRC || msg->data[4] == 0));
+		else if(cmd == CMD_PING)
+			trace[i].master = resp && !ping_master;
+
+		if(cmd == CMD_PING && !resp)
+			ping_master = trace[i].master;
+	}
+}
+
+// -----------------------------------------------------------------------------
+// Description: Load the trace and parse the options
+//
+// Called by: hal_can_open()
+//
+// Return: 0 on success otherwise -1
+// -----------------------------------------------------------------------------
+static int
+rpl_open(const char *arg)	{
+
+	char path[256], line[RPL_LINE];
+	const char *opt;
+	size_t len = strcspn(arg, ",");
+	uint64_t start = 0;
+	uint32_t size = 0;
+	rpl_frame_t f;
+	FILE *in;
+
+	if(!len || len >= sizeof(path))
+		return(-1);
+
+	memcpy(path, arg, len);
+	path[len] = 0;
+
+	for(opt = arg + len; *opt; opt += len)	{
+
+		opt++;
+		len = strcspn(opt, ",");
+		if(!strncmp(opt, "master=", 7))
+			master = strtoul(opt + 7, 0, 0);
+		else if(!strncmp(opt, "wait=", 5))
+			wait = strtod(opt + 5, 0) * HAL_US(1000);
+		else if(!strncmp(opt, "v=", 2))
+			verbose = atoi(opt + 2) != 0;
+		else
+			return(-1);
+	}
+
+	if(!(in = fopen(path, "r")))
+		return(-1);
+
+	memset(&f, 0, sizeof(f));
+	while(fgets(line, sizeof(line), in))	{
+
+		if(parse_line(line, &f.us, &f.msg))
+			continue;
+
+		if(frames == size)	{
+			size = size ? 2 * size : 1024;
+			if(!(trace = realloc(trace, size * sizeof(*trace))))
+				return(-1);
+		}
+
+		if(!frames)
+			start = f.us;
+		f.us = f.us >= start ? f.us - start : 0;
+		trace[frames++] = f;
+	}
+	fclose(in);
+
+	if(master < 0 && (master = find_master()) < 0)	{
+		fprintf(stderr, "replay: hash of the master not found, use master=\n");
+		return(-1);
+	}
+
+	classify();
+
+	atexit(rpl_report);
+	return(0);
+}
+
+const hal_can_t hal_can_replay = {
+	"replay", "replay:file[,key=value,...], device side of a candump log",
+	rpl_open, rpl_send, rpl_next, rpl_recv, 0
+};
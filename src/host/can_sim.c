@@ -0,0 +1,983 @@
+/*
+* ----------------------------------------------------------------------------
+* Host build: simulated MS2 and Gleisbox 60113 on the CAN bus
+*
+* CAN back ends "ms2" and "gb" answer the updater like the real devices do,
+* following the sequences documented in process.c:
+*
+*   MS2:   boot messages after power up and reset, ping requests until the
+*          updater answers as CS2 master, 0x20 version and data requests of
+*          lang, lokdb, ms2, ms2x and gb2 with 0x21 stream reception, boot
+*          loader with binary flash transfer.
+*   60113: boot loader waiting for bootInit, software start, ping response,
+*          binary flash transfer.
+*
+* Every received stream and flash block is checked by its CRC, flash block
+* numbers and stream hashes by their sequence. Responses are delayed by the
+* configured latencies. A summary is printed to stderr at exit.
+*
+* Options as "ms2:key=value,..." or "gb:key=value,...":
+*
+*   uid=n     UID of the device
+*   ver=n     software version, e.g. 0x0127
+*   lat=ms    response latency
+*   calc=ms   time to check and store a block
+*   boot=ms   MS2: reset to first boot message, 60113: software start
+*   png=ms    MS2: period of ping requests
+*   rto=ms    MS2: retry timeout of unanswered requests
+*   upd=list  MS2: outdated data, e.g. lang+ms2, all or none
+*   err=n     treat the n-th received block as corrupted
+*   sw=0      no valid software, the device stays in its boot loader
+*   v=1       trace the device to stderr
+*
+*  Version: 0.0.1
+*
+* "THE BEER-WARE LICENSE" (Revision 42):
+* <karsten@rhen.de> wrote this file. As long as you retain this notice you
+* can do whatever you want with this stuff. If we meet some day, and you think
+* this stuff is worth it, you can buy me a beer in Flensburg, Germany
+* ----------------------------------------------------------------------------
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <avr/io.h>
+#include "hal.h"
+#include "protocol.h"
+
+#define SIM_QUEUE	64			// frames sent by the device, power of 2
+#define SIM_QMASK	(SIM_QUEUE - 1)
+#define SIM_ITEMS	5			// MS2 version and data requests
+#define ITEM_MS2	2			// item updated by the boot loader
+#define SIM_RETRY	3			// request retries until an item is skipped
+#define SIM_CFGBLK	1024		// block size of data requests, see process.c
+#define BLWIN_MS	400			// ms MS2 boot loader waits for bootInit
+#define SIM_NAK		0xF2		// boot loader sub command of a failed CRC
+#define SIM_TEXT	64			// stored bytes of a version stream
+
+// Device states
+enum {
+	SIM_BOOT,		// MS2: reset, boot message pending
+	SIM_BLWIN,		// MS2: boot loader window, bootInit enters flash mode
+	SIM_BOOTLD,		// boot loader waits for bootInit
+	SIM_FLASH,		// boot loader receives binary blocks
+	SIM_START,		// 60113: software starting
+	SIM_APP,		// software running, MS2 sends ping requests
+	SIM_REQ,		// MS2: version and data requests
+	SIM_IDLE		// MS2: all requests done
+};
+
+static const char *const state_name[] = {
+	"boot", "blwin", "bootld", "flash", "start", "app", "req", "idle"
+};
+
+// MS2 requests, data name is requested if the version is outdated
+static const struct {
+	const char *ver;
+	const char *data;
+} items[SIM_ITEMS] = {
+	{"langver", "lang"},
+	{"ldbver", "lokdb"},
+	{"ms2ver", "ms2"},
+	{"ms2xver", "ms2x"},
+	{"gb2ver", "gb2"}
+};
+
+typedef struct {
+	uint64_t due;
+	can_t msg;
+} sim_frame_t;
+
+// Device configuration
+static const char *name;
+static uint8_t type;			// DEV_CON_MS2 or DEV_GFP_MS2
+static uint8_t magic;			// last block number of the flash transfer
+static uint16_t vpos;			// position of the version in the binary
+static uint32_t uid;
+static uint16_t version;
+static uint64_t lat, calc, boot, png, rto;
+static uint8_t outdated;		// bit n: items[n] is requested
+static uint32_t err;			// block to corrupt, 0 none
+static bool verbose;
+
+// Device state
+static uint8_t state;
+static uint64_t timer = HAL_NEVER;		// next state timeout
+static bool valid = true;				// software in flash valid
+static sim_frame_t queue[SIM_QUEUE];
+static uint8_t q_head, q_tail;
+static uint64_t q_last;					// due of the last queued frame
+
+// MS2 requests
+static uint8_t item, blkno, retry;
+static bool data;				// data of item requested, else version
+static bool req_sent;			// request sent, waiting for stream
+
+// 0x21 stream reception
+static bool cf_active;
+static uint16_t cf_len, cf_crc, cf_n, crc;
+static uint8_t text[SIM_TEXT];
+static bool corrupt;
+
+// Boot loader flash transfer
+static uint8_t blk;				// current block number, 0 none
+static uint16_t seq;			// expected hash of next stream frame
+static uint16_t newver;
+static bool flash_done;
+
+// Statistics
+static uint32_t st_files, st_cfbytes, st_blocks, st_flbytes;
+static uint32_t st_crcerr, st_seqerr, st_retries, st_rxblocks;
+
+
+// -----------------------------------------------------------------------------
+// ---------*** Helpers ***-----------------------------------------------------
+// -----------------------------------------------------------------------------
+
+static void
+trace(const char *fmt, ...)	__attribute__((format(printf, 1, 2)));
+
+static void
+trace(const char *fmt, ...)	{
+
+	va_list ap;
+
+	if(!verbose)
+		return;
+
+	fprintf(stderr, "%10.3f %s: ", (double)hal_now() * 1000 / F_CPU, name);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fputc('\n', stderr);
+}
+
+static void
+set_state(uint8_t s, uint64_t tmo)	{
+
+	if(s != state)
+		trace("%s -> %s", state_name[state], state_name[s]);
+
+	state = s;
+	timer = tmo;
+}
+
+// -----------------------------------------------------------------------------
+// Description: Update CRC by one byte like update_crc() of protocol.c
+//
+// Return: new CRC
+// -----------------------------------------------------------------------------
+static uint16_t
+crc_byte(uint16_t c, uint8_t ch)	{
+
+	uint8_t i;
+
+	c ^= ch << 8;
+	for(i = 0; i < 8; i++)
+		c = (c & 0x8000) ? (c << 1) ^ POLY : c << 1;
+
+	return(c);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Hash of the UID
+//
+// Details: Software uses the CS2 hash, see mcs2-const.h, the boot loader of
+// the 60113 the plain XOR of both UID halfs.
+//
+// Return: hash
+// -----------------------------------------------------------------------------
+static uint16_t
+hash(bool bootld)	{
+
+	uint16_t h = (uid >> 16) ^ (uid & 0xFFFF);
+
+	if(bootld && type == DEV_GFP_MS2)
+		return(h);
+
+	return(((h << 3) & 0xFC00) | 0x0300 | (h & 0x7F));
+}
+
+static bool
+uid_match(const can_t *msg)	{
+
+	uint32_t u = (uint32_t)msg->data[0] << 24 | (uint32_t)msg->data[1] << 16 |
+			(uint32_t)msg->data[2] << 8 | msg->data[3];
+
+	return(u == uid || u == 0);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Queue a frame sent by the device after delay
+//
+// Details: Frames keep their order on the bus, a frame is never due before
+// the previous one.
+//
+// Return: frame to fill in the data or 0 if the queue is full
+// -----------------------------------------------------------------------------
+static can_t *
+frame(uint64_t delay, uint8_t cmd, uint8_t resp, uint16_t h, uint8_t len)	{
+
+	sim_frame_t *f;
+	uint64_t due = hal_now() + delay;
+
+	if(((q_head + 1) & SIM_QMASK) == q_tail)	{
+		fprintf(stderr, "%s: send queue full\n", name);
+		return(0);
+	}
+
+	if(due < q_last)
+		due = q_last;
+
+	f = &queue[q_head];
+	q_head = (q_head + 1) & SIM_QMASK;
+	q_last = f->due = due;
+
+	memset(&f->msg, 0, sizeof(can_t));
+	f->msg.id = ((uint32_t)cmd << 17) | ((uint32_t)resp << 16) | h;
+	f->msg.length = len;
+
+	return(&f->msg);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Queue a frame with UID, sub command and optional bytes
+//
+// Return: void
+// -----------------------------------------------------------------------------
+static void
+frame_uid(uint64_t delay, uint8_t cmd, uint8_t resp, uint16_t h, uint8_t len,
+		uint8_t sub, uint8_t b5, uint8_t b6)	{
+
+	can_t *msg = frame(delay, cmd, resp, h, len);
+
+	if(!msg)
+		return;
+
+	msg->data[0] = uid >> 24;
+	msg->data[1] = uid >> 16;
+	msg->data[2] = uid >> 8;
+	msg->data[3] = uid;
+	msg->data[4] = sub;
+	msg->data[5] = b5;
+	msg->data[6] = b6;
+}
+
+// -----------------------------------------------------------------------------
+// Description: Queue the identification: UID, version and device type
+//
+// Details: Ping response and bootInit response of the boot loader
+//
+// Return: void
+// -----------------------------------------------------------------------------
+static void
+frame_ident(uint8_t cmd, bool bootld)	{
+
+	can_t *msg = frame(lat, cmd, RESPONSE, hash(bootld), 8);
+
+	if(!msg)
+		return;
+
+	msg->data[0] = uid >> 24;
+	msg->data[1] = uid >> 16;
+	msg->data[2] = uid >> 8;
+	msg->data[3] = uid;
+	msg->data[4] = version >> 8;
+	msg->data[5] = version;
+	msg->data[6] = 0;
+	msg->data[7] = type;
+}
+
+// -----------------------------------------------------------------------------
+// Description: Reset the device like a power up
+//
+// Details: Frames not sent yet are lost. The MS2 boots its boot loader, the
+// 60113 waits in the boot loader for bootInit.
+//
+// Return: void
+// -----------------------------------------------------------------------------
+static void
+reset(void)	{
+
+	q_tail = q_head;
+	cf_active = false;
+
+	if(type == DEV_CON_MS2)
+		set_state(SIM_BOOT, hal_now() + boot);
+	else
+		set_state(SIM_BOOTLD, HAL_NEVER);
+}
+
+
+// -----------------------------------------------------------------------------
+// ---------*** MS2 requests ***------------------------------------------------
+// -----------------------------------------------------------------------------
+
+// -----------------------------------------------------------------------------
+// Description: Send the current version or data request
+//
+// Details: A data request is the data name followed by the block number as
+// ASCII decimal in a second frame, see process_transfer().
+//
+// Return: void
+// -----------------------------------------------------------------------------
+static void
+request(void)	{
+
+	const char *req;
+	can_t *msg;
+
+	if(item == SIM_ITEMS)	{
+		set_state(SIM_IDLE, HAL_NEVER);
+		return;
+	}
+
+	req = data ? items[item].data : items[item].ver;
+	if((msg = frame(0, CMD_CFG_REQUEST, 0, hash(false), 8)))
+		memcpy(msg->data, req, strlen(req));		// names are up to 7 chars
+
+	if(data && (msg = frame(0, CMD_CFG_REQUEST, 0, hash(false), 8)))
+		snprintf((char *)msg->data, 8, "%d", blkno);
+
+	if(data)
+		trace("request %s block %d", items[item].data, blkno);
+	else
+		trace("request %s", items[item].ver);
+
+	req_sent = true;
+	cf_active = false;
+	timer = hal_now() + rto;
+}
+
+// -----------------------------------------------------------------------------
+// Description: Continue with the next request after delay
+//
+// Return: void
+// -----------------------------------------------------------------------------
+static void
+next_request(uint64_t delay)	{
+
+	req_sent = false;
+	retry = 0;
+	timer = hal_now() + delay;
+}
+
+static void
+next_item(uint64_t delay)	{
+
+	item++;
+	data = false;
+	next_request(delay);
+}
+
+// -----------------------------------------------------------------------------
+// Description: A 0x21 stream was received completely with valid CRC
+//
+// Details: An outdated version is followed by the data requests. The data
+// ends with a block shorter than SIM_CFGBLK. The MS2 binary is stored, the
+// boot loader flashes it after the next reset.
+//
+// Return: void
+// -----------------------------------------------------------------------------
+static void
+stream_done(void)	{
+
+	if(!data)	{
+
+		trace("%s: %.*s", items[item].ver, cf_len < SIM_TEXT ? cf_len : SIM_TEXT,
+				(char *)text);
+
+		if(outdated & (1 << item))	{
+			data = true;
+			blkno = 0;
+			next_request(lat);
+		} else
+			next_item(lat);
+
+		return;
+	}
+
+	st_cfbytes += cf_len;
+	hal_stats.payload += cf_len;
+	if(cf_len == SIM_CFGBLK)	{
+		blkno++;
+		next_request(calc);
+		return;
+	}
+
+	trace("%s complete, %d blocks", items[item].data, blkno + 1);
+	st_files++;
+	if(item != ITEM_MS2)
+		outdated &= ~(1 << item);
+
+	next_item(calc);
+}
+
+static void
+stream_error(void)	{
+
+	fprintf(stderr, "%s: CRC error %s block %d\n", name,
+			data ? items[item].data : items[item].ver, blkno);
+
+	st_crcerr++;
+	cf_active = false;
+	set_state(SIM_IDLE, HAL_NEVER);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Receive the 0x20 response and the following 0x21 stream
+//
+// Details: The stream header carries length and CRC. The updater pads the
+// stream to 8 bytes, a version text of a multiple of 8 bytes gets an extra
+// frame of zeros. So the stream is complete as soon as the length is reached
+// and the CRC matches. It is wrong if the CRC does not match one frame later
+// or when the request times out.
+//
+// Called by: sim_send()
+//
+// Return: void
+// -----------------------------------------------------------------------------
+static void
+cfg_frame(const can_t *msg)	{
+
+	uint8_t cmd = (msg->id >> 17) & 0xFF, i;
+	uint16_t c;
+
+	if(state != SIM_REQ || !req_sent)
+		return;
+
+	if(cmd == CMD_CFG_REQUEST && ((msg->id >> 16) & 1))	{
+
+		timer = hal_now() + rto;			// stream follows
+		return;
+	}
+
+	if(cmd != CMD_CFG_STREAM)
+		return;
+
+	if(msg->length == 6)	{
+
+		cf_active = true;
+		cf_len = (msg->data[2] << 8) | msg->data[3];
+		cf_crc = (msg->data[4] << 8) | msg->data[5];
+		cf_n = 0;
+		crc = 0xFFFF;
+		corrupt = (++st_rxblocks == err);
+		memset(text, 0, sizeof(text));
+
+		// empty last block, no stream follows
+		if(!cf_len)
+			stream_done();
+
+		return;
+	}
+
+	if(!cf_active || msg->length != 8)
+		return;
+
+	for(i = 0; i < 8; i++, cf_n++)	{
+
+		crc = crc_byte(crc, msg->data[i]);
+		if(cf_n < SIM_TEXT)
+			text[cf_n] = msg->data[i];
+	}
+
+	if(cf_n < cf_len)
+		return;
+
+	c = corrupt ? crc ^ 1 : crc;
+	if(c == cf_crc)	{
+		cf_active = false;
+		stream_done();
+	} else if(cf_n >= cf_len + 8)
+		stream_error();
+}
+
+
+// -----------------------------------------------------------------------------
+// ---------*** Boot loader ***-------------------------------------------------
+// -----------------------------------------------------------------------------
+
+static void
+flash_enter(void)	{
+
+	blk = 0;
+	flash_done = false;
+	newver = version;
+	set_state(SIM_FLASH, HAL_NEVER);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Start the software after bootStart
+//
+// Details: The new version is taken from the flashed binary. An incomplete
+// flash transfer leaves the device in the boot loader.
+//
+// Return: void
+// -----------------------------------------------------------------------------
+static void
+flash_start(void)	{
+
+	if(flash_done)	{
+
+		valid = true;
+		version = newver;
+		if(type == DEV_CON_MS2)
+			outdated &= ~(1 << ITEM_MS2);
+
+	} else if(blk)
+		valid = false;
+
+	trace("software start, version %d.%d%s", version >> 8, version & 0xFF,
+			valid ? "" : " invalid");
+
+	if(!valid)
+		set_state(SIM_BOOTLD, HAL_NEVER);
+	else if(type == DEV_CON_MS2)
+		set_state(SIM_BOOT, hal_now() + boot);
+	else
+		set_state(SIM_START, hal_now() + boot);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Receive a binary transfer of process_bintransfer()
+//
+// Details: Blocks are sent from the end of the binary with decrementing block
+// numbers down to the magic number. Each block is announced by its number,
+// followed by the stream with the hash counting from 0x300 and closed by its
+// CRC. The CRC is acknowledged after the block is checked and stored.
+//
+// Called by: sim_send()
+//
+// Return: void
+// -----------------------------------------------------------------------------
+static void
+flash_frame(const can_t *msg)	{
+
+	uint16_t h = msg->id & 0xFFFF, c;
+	uint8_t i;
+
+	if(msg->length == 8)	{				// stream
+
+		if(!blk)
+			return;
+
+		if(h != seq)	{
+			fprintf(stderr, "%s: stream hash 0x%04x expected 0x%04x\n",
+					name, h, seq);
+			st_seqerr++;
+		}
+
+		for(i = 0; i < 8; i++)	{
+
+			// version bytes are in the block at offset 0 of the binary
+			if(blk == magic && (h - 0x300) * 8 + i == vpos)
+				newver = (newver & 0xFF) | (msg->data[i] << 8);
+			if(blk == magic && (h - 0x300) * 8 + i == vpos + 1)
+				newver = (newver & 0xFF00) | msg->data[i];
+
+			crc = crc_byte(crc, msg->data[i]);
+		}
+
+		seq = h + 1;
+		st_flbytes += 8;
+		hal_stats.payload += 8;
+		return;
+	}
+
+	if(msg->length < 5 || !uid_match(msg))
+		return;
+
+	switch(msg->data[4])	{
+
+		case CMD_BOOTSUB_BLKN:
+
+			if(blk && msg->data[5] != blk - 1)	{
+				fprintf(stderr, "%s: block %d after block %d\n", name,
+						msg->data[5], blk);
+				st_seqerr++;
+			}
+
+			blk = msg->data[5];
+			seq = 0x300;
+			crc = 0xFFFF;
+			corrupt = (++st_rxblocks == err);
+			frame_uid(lat, CMD_BOOTLD_CAN, RESPONSE, hash(true), 6,
+					CMD_BOOTSUB_BLKN, blk, 0);
+			break;
+
+		case CMD_BOOTSUB_CRC:
+
+			c = corrupt ? crc ^ 1 : crc;
+			if(blk && c == ((msg->data[5] << 8) | msg->data[6]))	{
+
+				st_blocks++;
+				if(blk == magic)
+					flash_done = true;
+
+				frame_uid(calc, CMD_BOOTLD_CAN, RESPONSE, hash(true), 7,
+						CMD_BOOTSUB_CRC, c >> 8, c);
+			} else	{
+
+				fprintf(stderr, "%s: CRC error flash block %d\n", name, blk);
+				st_crcerr++;
+				frame_uid(calc, CMD_BOOTLD_CAN, RESPONSE, hash(true), 5,
+						SIM_NAK, 0, 0);
+			}
+			break;
+
+		case CMD_BOOTSUB_START:
+
+			flash_start();
+			break;
+	}
+}
+
+
+// -----------------------------------------------------------------------------
+// ---------*** Device ***------------------------------------------------------
+// -----------------------------------------------------------------------------
+
+// -----------------------------------------------------------------------------
+// Description: State timeouts
+//
+// Details: MS2 power up: boot message, boot loader window, start message and
+// ping requests every png until the updater answers. See init_MS2().
+//
+// Called by: sim_poll()
+//
+// Return: void
+// -----------------------------------------------------------------------------
+static void
+timeout(void)	{
+
+	switch(state)	{
+
+		case SIM_BOOT:
+
+			if(!valid)	{
+				set_state(SIM_BOOTLD, HAL_NEVER);
+				break;
+			}
+
+			frame(0, CMD_BOOTLD_CAN, 0, hash(false), 0);
+			set_state(SIM_BLWIN, hal_now() + HAL_MS(BLWIN_MS));
+			break;
+
+		case SIM_BLWIN:
+
+			frame_uid(0, CMD_BOOTLD_CAN, 0, hash(false), 5, CMD_BOOTSUB_START,
+					0, 0);
+			set_state(SIM_APP, hal_now() + png);
+			break;
+
+		case SIM_START:
+
+			set_state(SIM_APP, HAL_NEVER);
+			break;
+
+		case SIM_APP:
+
+			frame(0, CMD_PING, 0, hash(false), 0);
+			timer = hal_now() + png;
+			break;
+
+		case SIM_REQ:
+
+			if(!req_sent)	{
+				request();
+				break;
+			}
+
+			if(cf_active && cf_n >= cf_len)	{
+				stream_error();
+				break;
+			}
+
+			st_retries++;
+			if(++retry > SIM_RETRY)	{
+				trace("%s not answered, skipped", items[item].ver);
+				next_item(0);
+			}
+
+			request();
+			break;
+	}
+}
+
+static void
+sim_poll(void)	{
+
+	uint64_t now = hal_now();
+
+	while(timer <= now)	{
+
+		timer = HAL_NEVER;
+		timeout();
+	}
+}
+
+// -----------------------------------------------------------------------------
+// Description: Frame sent by the updater
+//
+// Called by: can_send_message() of the host CAN controller
+//
+// Return: void
+// -----------------------------------------------------------------------------
+static void
+sim_send(const can_t *msg)	{
+
+	uint8_t cmd = (msg->id >> 17) & 0xFF;
+	bool resp = (msg->id >> 16) & 1;
+
+	sim_poll();
+
+	switch(cmd)	{
+
+		case CMD_SYSTEM:
+
+			if(msg->length == 6 && msg->data[4] == CMD_SYSSUB_RESET &&
+					uid_match(msg))	{
+				trace("system reset");
+				reset();
+			}
+			break;
+
+		case CMD_PING:
+
+			if(resp)	{
+
+				// answer of the CS2 master starts the MS2 requests
+				if(state == SIM_APP && msg->length == 8 &&
+						msg->data[6] == 0xFF && msg->data[7] == 0xFF)	{
+
+					set_state(SIM_REQ, HAL_NEVER);
+					item = 0;
+					data = false;
+					next_request(lat);
+				}
+
+			} else if(state >= SIM_APP)
+				frame_ident(CMD_PING, false);
+			break;
+
+		case CMD_BOOTLD_CAN:
+
+			if(resp)
+				break;
+
+			if(!msg->length)	{			// bootInit
+
+				if(state == SIM_BOOTLD)	{
+					frame_ident(CMD_BOOTLD_CAN, true);
+					flash_enter();
+				} else if(state == SIM_BLWIN)
+					flash_enter();
+
+			} else if(state == SIM_FLASH)
+				flash_frame(msg);
+			break;
+
+		case CMD_CFG_REQUEST:
+		case CMD_CFG_STREAM:
+
+			cfg_frame(msg);
+			break;
+	}
+}
+
+static uint64_t
+sim_next(void)	{
+
+	sim_poll();
+
+	if(q_tail != q_head && queue[q_tail].due < timer)
+		return(queue[q_tail].due);
+
+	return(timer);
+}
+
+static bool
+sim_recv(can_t *msg)	{
+
+	sim_poll();
+
+	if(q_tail == q_head || queue[q_tail].due > hal_now())
+		return(false);
+
+	*msg = queue[q_tail].msg;
+	q_tail = (q_tail + 1) & SIM_QMASK;
+
+	return(true);
+}
+
+static void
+sim_report(void)	{
+
+	fprintf(stderr, "%s: version %d.%d%s, %s, %lu files %lu bytes, "
+			"flash %lu blocks %lu bytes, crc errors %lu, sequence errors %lu, "
+			"retries %lu\n", name, version >> 8, version & 0xFF,
+			valid ? "" : " invalid", state_name[state],
+			(unsigned long)st_files, (unsigned long)st_cfbytes,
+			(unsigned long)st_blocks, (unsigned long)st_flbytes,
+			(unsigned long)st_crcerr, (unsigned long)st_seqerr,
+			(unsigned long)st_retries);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Parse the list of outdated MS2 data
+//
+// Return: 0 on success otherwise -1
+// -----------------------------------------------------------------------------
+static int
+parse_upd(const char *s, size_t len)	{
+
+	uint8_t i;
+	size_t n;
+
+	outdated = 0;
+	while(len)	{
+
+		n = strcspn(s, "+");
+		if(n > len)
+			n = len;
+
+		if(n == 3 && !strncmp(s, "all", 3))
+			outdated = (1 << SIM_ITEMS) - 1;
+		else if(!(n == 4 && !strncmp(s, "none", 4)))	{
+
+			for(i = 0; i < SIM_ITEMS; i++)
+				if(strlen(items[i].data) == n && !strncmp(items[i].data, s, n))
+					break;
+
+			if(i == SIM_ITEMS)
+				return(-1);
+
+			outdated |= 1 << i;
+		}
+
+		s += n;
+		len -= n;
+		if(len)	{
+			s++;
+			len--;
+		}
+	}
+
+	return(0);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Parse the options "key=value,..."
+//
+// Return: 0 on success otherwise -1
+// -----------------------------------------------------------------------------
+static int
+parse(const char *arg)	{
+
+	const char *val;
+	size_t len;
+	char *end;
+	double ms;
+
+	while(*arg)	{
+
+		len = strcspn(arg, ",");
+		if(!(val = memchr(arg, '=', len)))
+			return(-1);
+		val++;
+
+		ms = strtod(val, &end);
+		if(!strncmp(arg, "upd=", 4))	{
+			if(parse_upd(val, len - 4))
+				return(-1);
+		} else if(end != arg + len)
+			return(-1);
+		else if(!strncmp(arg, "uid=", 4))
+			uid = strtoul(val, 0, 0);
+		else if(!strncmp(arg, "ver=", 4))
+			version = strtoul(val, 0, 0);
+		else if(!strncmp(arg, "lat=", 4))
+			lat = ms * HAL_US(1000);
+		else if(!strncmp(arg, "calc=", 5))
+			calc = ms * HAL_US(1000);
+		else if(!strncmp(arg, "boot=", 5))
+			boot = ms * HAL_US(1000);
+		else if(!strncmp(arg, "png=", 4) && ms > 0)
+			png = ms * HAL_US(1000);
+		else if(!strncmp(arg, "rto=", 4) && ms > 0)
+			rto = ms * HAL_US(1000);
+		else if(!strncmp(arg, "err=", 4))
+			err = ms;
+		else if(!strncmp(arg, "sw=", 3))
+			valid = ms != 0;
+		else if(!strncmp(arg, "v=", 2))
+			verbose = ms != 0;
+		else
+			return(-1);
+
+		arg += len;
+		if(*arg)
+			arg++;
+	}
+
+	return(0);
+}
+
+static int
+ms2_open(const char *arg)	{
+
+	name = "ms2";
+	type = DEV_CON_MS2;
+	magic = MS2_BIN_MAGIC;
+	vpos = 0xFC;
+	uid = 0x4D533200;
+	version = 0x0200;
+	lat = HAL_MS(1);
+	calc = HAL_MS(50);
+	boot = HAL_MS(300);
+	png = HAL_MS(1000);
+	rto = HAL_MS(500);
+	outdated = (1 << SIM_ITEMS) - 1;
+
+	if(parse(arg))
+		return(-1);
+
+	reset();
+	atexit(sim_report);
+	return(0);
+}
+
+static int
+gb_open(const char *arg)	{
+
+	name = "gb";
+	type = DEV_GFP_MS2;
+	magic = GFP_BIN_MAGIC;
+	vpos = 6;
+	uid = 0x47436663;
+	version = 0x0127;
+	lat = HAL_MS(1);
+	calc = HAL_MS(50);
+	boot = HAL_MS(400);
+	png = rto = HAL_MS(1000);
+
+	if(parse(arg))
+		return(-1);
+
+	reset();
+	atexit(sim_report);
+	return(0);
+}
+
+const hal_can_t hal_can_ms2 = {
+	"ms2", "ms2[:key=value,...], simulated MS2",
+	ms2_open, sim_send, sim_next, sim_recv, 0
+};
+
+const hal_can_t hal_can_gb = {
+	"gb", "gb[:key=value,...], simulated Gleisbox 60113",
+	gb_open, sim_send, sim_next, sim_recv, 0
+};
@@ -0,0 +1,124 @@
+/*
+* ----------------------------------------------------------------------------
+* Host build: CAN back end on a Linux socketcan interface
+*
+* Connects the updater to a real bus ( e.g. USB CAN adapter at 250 kbit/s )
+* or to a vcan interface. Use it with the realtime clock.
+*
+*  Version: 0.0.1
+*
+* "THE BEER-WARE LICENSE" (Revision 42):
+* <karsten@rhen.de> wrote this file. As long as you retain this notice you
+* can do whatever you want with this stuff. If we meet some day, and you think
+* this stuff is worth it, you can buy me a beer in Flensburg, Germany
+* ----------------------------------------------------------------------------
+*/
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include "hal.h"
+
+static int sock = -1;
+
+// -----------------------------------------------------------------------------
+// Description: Open a raw CAN socket on the given interface
+//
+// Called by: hal_can_open()
+//
+// Return: 0 on success otherwise -1
+// -----------------------------------------------------------------------------
+static int
+socket_open(const char *ifname)	{
+
+	struct sockaddr_can addr;
+	struct ifreq ifr;
+
+	if((sock = socket(PF_CAN, SOCK_RAW, CAN_RAW)) < 0)
+		return(-1);
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, *ifname ? ifname : "can0", IFNAMSIZ - 1);
+	if(ioctl(sock, SIOCGIFINDEX, &ifr) < 0)
+		goto fail;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.can_family = AF_CAN;
+	addr.can_ifindex = ifr.ifr_ifindex;
+	if(bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		goto fail;
+
+	fcntl(sock, F_SETFL, O_NONBLOCK);
+	return(0);
+
+fail:
+	close(sock);
+	sock = -1;
+	return(-1);
+}
+
+static void
+socket_send(const can_t *msg)	{
+
+	struct can_frame frame;
+
+	memset(&frame, 0, sizeof(frame));
+	frame.can_id = (msg->id & CAN_EFF_MASK) | CAN_EFF_FLAG;
+	frame.can_dlc = msg->length & 0x0F;
+	memcpy(frame.data, msg->data, frame.can_dlc);
+
+	if(write(sock, &frame, sizeof(frame)) != sizeof(frame))
+		perror("socketcan write");
+}
+
+// -----------------------------------------------------------------------------
+// Description: Frames are due at once when the socket is readable
+//
+// Called by: HAL clock
+//
+// Return: hal_now() if a frame is waiting otherwise HAL_NEVER
+// -----------------------------------------------------------------------------
+static uint64_t
+socket_next(void)	{
+
+	struct pollfd pfd = {sock, POLLIN, 0};
+
+	return(poll(&pfd, 1, 0) > 0 ? hal_now() : HAL_NEVER);
+}
+
+static bool
+socket_recv(can_t *msg)	{
+
+	struct can_frame frame;
+
+	while(read(sock, &frame, sizeof(frame)) == sizeof(frame))	{
+
+		// the updater only uses extended data frames
+		if(!(frame.can_id & CAN_EFF_FLAG) || (frame.can_id & CAN_RTR_FLAG))
+			continue;
+
+		msg->id = frame.can_id & CAN_EFF_MASK;
+		msg->length = frame.can_dlc > 8 ? 8 : frame.can_dlc;
+		memcpy(msg->data, frame.data, msg->length);
+		return(true);
+	}
+
+	return(false);
+}
+
+static int
+socket_fd(void)	{
+
+	return(sock);
+}
+
+const hal_can_t hal_can_socket = {
+	"socketcan", "socketcan:<if>, Linux CAN interface, realtime clock",
+	socket_open, socket_send, socket_next, socket_recv, socket_fd
+};
@@ -0,0 +1,965 @@
+/*
+* ----------------------------------------------------------------------------
+* Hardware abstraction layer of the host build
+*
+* Emulated registers, interrupt dispatcher, clock, Timer0/1/2, pins, SPI bus
+* and console. See hal.h
+*
+*  Version: 0.0.1
+*
+* "THE BEER-WARE LICENSE" (Revision 42):
+* <karsten@rhen.de> wrote this file. As long as you retain this notice you
+* can do whatever you want with this stuff. If we meet some day, and you think
+* this stuff is worth it, you can buy me a beer in Flensburg, Germany
+* ----------------------------------------------------------------------------
+*/
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <poll.h>
+#include <avr/io.h>
+#include "hal.h"
+
+#define HAL_FDMAX	8		// max. files to wait for in realtime mode
+
+// -----------------------------------------------------------------------------
+// Emulated registers
+volatile uint8_t PINB, DDRB, PORTB;
+volatile uint8_t PINC, DDRC, PORTC;
+volatile uint8_t PIND, DDRD, PORTD;
+volatile uint8_t GPIOR0, GPIOR1, GPIOR2;
+volatile uint8_t EICRA, EIMSK, EIFR;
+volatile uint8_t PCICR, PCIFR, PCMSK0, PCMSK1, PCMSK2;
+volatile uint8_t TCCR0A, TCCR0B, OCR0A, OCR0B, TIMSK0, TIFR0;
+volatile uint8_t TCCR2A, TCCR2B, OCR2A, OCR2B, TIMSK2, TIFR2;
+volatile uint8_t TCCR1A, TCCR1B, TIMSK1;
+volatile uint8_t SPCR, SPSR, SPDR;
+volatile uint8_t UCSR0A, UCSR0B, UCSR0C, UBRR0H, UBRR0L, UDR0;
+volatile uint8_t hal_sreg;
+
+hal_stats_t hal_stats;
+FILE *hal_console;
+
+// -----------------------------------------------------------------------------
+// Interrupt service routines, defined by the firmware sources if used
+void hal_vect_int0(void) __attribute__((weak));
+void hal_vect_pcint1(void) __attribute__((weak));
+void hal_vect_timer2_compa(void) __attribute__((weak));
+void hal_vect_timer1_ovf(void) __attribute__((weak));
+void hal_vect_timer0_compa(void) __attribute__((weak));
+void hal_vect_usart_udre(void) __attribute__((weak));
+
+static void (*const vect[HAL_IRQ_MAX])(void) = {
+	hal_vect_int0,
+	hal_vect_pcint1,
+	hal_vect_timer2_compa,
+	hal_vect_timer1_ovf,
+	hal_vect_timer0_compa,
+	hal_vect_usart_udre
+};
+
+static uint8_t irq_flag[HAL_IRQ_MAX];		// edge triggered, cleared by ISR
+static bool irq_level[HAL_IRQ_MAX];		// level triggered
+static uint32_t isr_count;				// ISRs served
+static uint32_t isr_mark;				// isr_count at last cli()
+
+static const hal_clock_t *clk;
+static hal_dev_t *devs;
+
+// -----------------------------------------------------------------------------
+// Timer0 and Timer2, CTC mode on OCRnA or normal mode
+typedef struct {
+	volatile uint8_t *tccra, *tccrb, *ocra;
+	const uint16_t *presc;		// prescaler by clock select bits
+	uint8_t irq;
+	uint16_t div;				// current prescaler, 0 timer stopped
+	uint64_t start;				// cycle of counter value 0
+	uint64_t period;			// cycles of one counter cycle
+	uint64_t due;				// cycle of next compare match, 0 unknown
+	volatile uint8_t tcnt;		// counter register
+	uint8_t tcnt_rd;			// counter value handed out last
+	hal_dev_t dev;
+} hal_timer_t;
+
+static const uint16_t presc0[8] = {0, 1, 8, 64, 256, 1024, 0, 0};
+static const uint16_t presc2[8] = {0, 1, 8, 32, 64, 128, 256, 1024};
+
+static uint64_t timer0_next(void);
+static uint64_t timer2_next(void);
+static void timer0_run(uint64_t now);
+static void timer2_run(uint64_t now);
+
+static hal_timer_t timer[2] = {
+	{
+		.tccra = &TCCR0A, .tccrb = &TCCR0B, .ocra = &OCR0A,
+		.presc = presc0, .irq = HAL_IRQ_TIMER0_COMPA,
+		.dev = {"timer0", timer0_next, timer0_run, 0, 0}
+	},
+	{
+		.tccra = &TCCR2A, .tccrb = &TCCR2B, .ocra = &OCR2A,
+		.presc = presc2, .irq = HAL_IRQ_TIMER2_COMPA,
+		.dev = {"timer2", timer2_next, timer2_run, 0, 0}
+	}
+};
+
+// -----------------------------------------------------------------------------
+// Timer1, free running in normal mode
+static uint64_t timer1_next(void);
+static void timer1_run(uint64_t now);
+
+static struct {
+	uint16_t div;				// current prescaler, 0 timer stopped
+	uint64_t start;				// cycle of counter value 0
+	uint64_t due;				// cycle of next overflow, 0 unknown
+	volatile uint16_t tcnt;		// counter register
+	uint16_t tcnt_rd;			// counter value handed out last
+	uint8_t tifr;				// TIFR1 handed out
+	hal_dev_t dev;
+} timer1 = {
+	.dev = {"timer1", timer1_next, timer1_run, 0, 0}
+};
+
+// -----------------------------------------------------------------------------
+// SPI bus
+static const hal_spi_t *spi_dev[HAL_CS_MAX];
+static uint8_t spi_cs = 0xFF;		// chip select lines, low active
+static uint8_t spi_rx;
+
+
+// -----------------------------------------------------------------------------
+// ---------*** Clock back ends ***---------------------------------------------
+// -----------------------------------------------------------------------------
+
+static uint64_t vclock;
+
+static void
+virtual_start(void)	{
+
+	vclock = 0;
+}
+
+static uint64_t
+virtual_now(void)	{
+
+	return(vclock);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Virtual clock jumps to the next event
+//
+// Details: The time only advances by the emulated hardware. Execution of the
+// firmware itself takes no time, a run is reproducible and not slowed down by
+// idle waits.
+//
+// Called by: hal_advance(), hal_sleep()
+//
+// Return: void
+// -----------------------------------------------------------------------------
+static void
+virtual_wait(uint64_t until, const int *fds, int nfds)	{
+
+	if(until != HAL_NEVER && until > vclock)
+		vclock = until;
+}
+
+static struct timespec rt_start;
+
+static void
+realtime_start(void)	{
+
+	clock_gettime(CLOCK_MONOTONIC, &rt_start);
+}
+
+static uint64_t
+realtime_now(void)	{
+
+	struct timespec ts;
+	uint64_t ns;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ns = (uint64_t)(ts.tv_sec - rt_start.tv_sec) * 1000000000ULL;
+	ns += ts.tv_nsec;
+	ns -= rt_start.tv_nsec;
+
+	return(ns * (F_CPU / 1000000UL) / 1000);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Realtime clock sleeps until the next event or external input
+//
+// Details: Used with back ends connected to real hardware, e.g. socketcan.
+//
+// Called by: hal_advance(), hal_sleep()
+//
+// Return: void
+// -----------------------------------------------------------------------------
+static void
+realtime_wait(uint64_t until, const int *fds, int nfds)	{
+
+	struct pollfd pfd[HAL_FDMAX];
+	struct timespec ts, *tmo = 0;
+	uint64_t now = realtime_now(), ns;
+	int i;
+
+	if(until != HAL_NEVER)	{
+
+		if(until <= now)
+			return;
+
+		ns = (until - now) * 1000 / (F_CPU / 1000000UL);
+		ts.tv_sec = ns / 1000000000ULL;
+		ts.tv_nsec = ns % 1000000000ULL;
+		tmo = &ts;
+	}
+
+	for(i = 0; i < nfds; i++)	{
+		pfd[i].fd = fds[i];
+		pfd[i].events = POLLIN;
+	}
+
+	ppoll(pfd, nfds, tmo, 0);
+}
+
+static const hal_clock_t clocks[] = {
+	{"virtual", virtual_start, virtual_now, virtual_wait},
+	{"realtime", realtime_start, realtime_now, realtime_wait},
+	{0}
+};
+
+
+// -----------------------------------------------------------------------------
+// ---------*** Interrupts ***--------------------------------------------------
+// -----------------------------------------------------------------------------
+
+// -----------------------------------------------------------------------------
+// Description: Check the enable bit of an interrupt source
+//
+// Called by: hal_dispatch()
+//
+// Return: true if enabled
+// -----------------------------------------------------------------------------
+static bool
+irq_enabled(uint8_t irq)	{
+
+	switch(irq)	{
+
+		case HAL_IRQ_INT0:			return(EIMSK & (1 << INT0));
+		case HAL_IRQ_PCINT1:		return(PCICR & (1 << PCIE1));
+		case HAL_IRQ_TIMER2_COMPA:	return(TIMSK2 & (1 << OCIE2A));
+		case HAL_IRQ_TIMER1_OVF:	return(TIMSK1 & (1 << TOIE1));
+		case HAL_IRQ_TIMER0_COMPA:	return(TIMSK0 & (1 << OCIE0A));
+		case HAL_IRQ_USART_UDRE:	return(UCSR0B & (1 << UDRIE0));
+	}
+
+	return(false);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Serve pending interrupts like the AVR
+//
+// Details: Each pending and enabled source is served once in the order of the
+// vector table with disabled interrupts. A level triggered source still
+// active is served again on the next call, so the main program proceeds in
+// between like on the AVR.
+//
+// Called by: div
+//
+// Return: true if an ISR was called
+// -----------------------------------------------------------------------------
+static bool
+hal_dispatch(void)	{
+
+	bool served = false;
+	uint8_t i;
+
+	for(i = 0; i < HAL_IRQ_MAX; i++)	{
+
+		if(!(hal_sreg & (1 << HAL_SREG_I)))
+			break;
+
+		if(!(irq_flag[i] || irq_level[i]) || !irq_enabled(i))
+			continue;
+
+		irq_flag[i] = 0;
+		hal_sreg &= ~(1 << HAL_SREG_I);
+		isr_count++;
+		hal_stats.irqs++;
+
+		if(vect[i])
+			vect[i]();
+
+		hal_sreg |= (1 << HAL_SREG_I);
+		served = true;
+	}
+
+	return(served);
+}
+
+void
+hal_irq_raise(uint8_t irq)	{
+
+	irq_flag[irq] = 1;
+}
+
+void
+hal_irq_line(uint8_t irq, bool active)	{
+
+	irq_level[irq] = active;
+}
+
+void
+hal_cli(void)	{
+
+	hal_sreg &= ~(1 << HAL_SREG_I);
+	isr_mark = isr_count;
+}
+
+void
+hal_sei(void)	{
+
+	hal_sreg |= (1 << HAL_SREG_I);
+	hal_dispatch();
+}
+
+
+// -----------------------------------------------------------------------------
+// ---------*** Event processing ***--------------------------------------------
+// -----------------------------------------------------------------------------
+
+void
+hal_dev_add(hal_dev_t *dev)	{
+
+	dev->link = devs;
+	devs = dev;
+}
+
+// -----------------------------------------------------------------------------
+// Description: Cycle of the next event of all devices
+//
+// Details: Files of the devices to wait for in realtime mode are collected.
+//
+// Called by: hal_advance(), hal_sleep()
+//
+// Return: cycle or HAL_NEVER
+// -----------------------------------------------------------------------------
+static uint64_t
+hal_next(int *fds, int *nfds)	{
+
+	uint64_t next = HAL_NEVER, t;
+	hal_dev_t *dev;
+	int fd;
+
+	*nfds = 0;
+	for(dev = devs; dev; dev = dev->link)	{
+
+		if((t = dev->next()) < next)
+			next = t;
+
+		if(dev->fd && (fd = dev->fd()) >= 0 && *nfds < HAL_FDMAX)
+			fds[(*nfds)++] = fd;
+	}
+
+	return(next);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Run all device events which are due now
+//
+// Called by: hal_advance(), hal_sleep()
+//
+// Return: void
+// -----------------------------------------------------------------------------
+static void
+hal_run(void)	{
+
+	uint64_t now = clk->now();
+	hal_dev_t *dev;
+
+	for(dev = devs; dev; dev = dev->link)	{
+
+		if(dev->next() <= now)
+			dev->run(now);
+	}
+}
+
+// -----------------------------------------------------------------------------
+// Description: Let the time pass until the given cycle
+//
+// Details: Device events on the way are processed and the interrupts are
+// served, like the AVR does in a busy loop.
+//
+// Called by: hal_spend()
+//
+// Return: void
+// -----------------------------------------------------------------------------
+static void
+hal_advance(uint64_t until)	{
+
+	int fds[HAL_FDMAX], nfds;
+	uint64_t next;
+
+	do	{
+
+		next = hal_next(fds, &nfds);
+		if(next > until)
+			next = until;
+
+		clk->wait(next, fds, nfds);
+		hal_run();
+		hal_dispatch();
+
+	} while(clk->now() < until);
+}
+
+uint64_t
+hal_now(void)	{
+
+	return(clk->now());
+}
+
+void
+hal_spend(uint64_t cycles)	{
+
+	hal_advance(clk->now() + cycles);
+}
+
+void
+hal_delay_us(double us)	{
+
+	hal_spend(us * (F_CPU / 1000000UL));
+}
+
+// -----------------------------------------------------------------------------
+// Description: sleep_cpu(), wait until an interrupt was served
+//
+// Details: On the AVR the instruction after sei() is executed before an
+// interrupt, so "cli(); check; sei(); sleep_cpu();" can not miss a wakeup.
+// sei() of the host serves the interrupts at once, so an ISR served since the
+// last cli() counts as wakeup.
+//
+// Called by: sleep_cpu()
+//
+// Return: void
+// -----------------------------------------------------------------------------
+void
+hal_sleep(void)	{
+
+	int fds[HAL_FDMAX], nfds;
+	uint64_t next, start = clk->now();
+
+	if(!(hal_sreg & (1 << HAL_SREG_I)))	{
+		fprintf(stderr, "hal: sleep with disabled interrupts\n");
+		exit(2);
+	}
+
+	if(isr_count == isr_mark)	{
+
+		do	{
+
+			next = hal_next(fds, &nfds);
+			if(next == HAL_NEVER && nfds == 0)	{
+				fprintf(stderr, "hal: sleep without wakeup source\n");
+				exit(2);
+			}
+
+			clk->wait(next, fds, nfds);
+			hal_run();
+
+		} while(!hal_dispatch());
+	}
+
+	isr_mark = isr_count;
+	hal_stats.sleep += clk->now() - start;
+}
+
+
+// -----------------------------------------------------------------------------
+// ---------*** Timer ***-------------------------------------------------------
+// -----------------------------------------------------------------------------
+
+// -----------------------------------------------------------------------------
+// Description: Synchronize a timer counter to the clock
+//
+// Details: A counter value written by the firmware since the last access
+// restarts the counter from this value.
+//
+// Called by: hal_tcnt(), timer_next()
+//
+// Return: void
+// -----------------------------------------------------------------------------
+static void
+timer_sync(hal_timer_t *t)	{
+
+	uint64_t now = clk->now();
+	uint16_t div = t->presc[*t->tccrb & 0x07];
+	uint16_t top = (*t->tccra & (1 << WGM01)) ? *t->ocra : 0xFF;
+
+	if(t->tcnt != t->tcnt_rd || div != t->div)	{
+
+		// written or prescaler changed: restart at current value
+		t->div = div;
+		t->start = now - (uint64_t)t->tcnt * div;
+		t->due = 0;
+
+	} else if(div)	{
+
+		t->tcnt = ((now - t->start) / div) % (top + 1);
+	}
+
+	t->tcnt_rd = t->tcnt;
+}
+
+// -----------------------------------------------------------------------------
+// Description: Cycle of the next compare match
+//
+// Details: The match is taken at the counter wrap around to 0. A changed
+// OCRnA takes effect at once.
+//
+// Called by: timer device
+//
+// Return: cycle or HAL_NEVER if the timer is stopped
+// -----------------------------------------------------------------------------
+static uint64_t
+timer_next(hal_timer_t *t)	{
+
+	uint64_t period;
+	uint16_t top = (*t->tccra & (1 << WGM01)) ? *t->ocra : 0xFF;
+
+	timer_sync(t);
+	if(!t->div)
+		return(HAL_NEVER);
+
+	period = (uint64_t)(top + 1) * t->div;
+	if(period != t->period || !t->due)	{
+		t->period = period;
+		t->due = t->start + ((clk->now() - t->start) / period + 1) * period;
+	}
+
+	return(t->due);
+}
+
+static uint64_t
+timer0_next(void)	{
+
+	return(timer_next(&timer[0]));
+}
+
+static uint64_t
+timer2_next(void)	{
+
+	return(timer_next(&timer[1]));
+}
+
+static void
+timer0_run(uint64_t now)	{
+
+	timer[0].due = 0;
+	hal_irq_raise(timer[0].irq);
+}
+
+static void
+timer2_run(uint64_t now)	{
+
+	timer[1].due = 0;
+	hal_irq_raise(timer[1].irq);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Access to the counter register TCNTn
+//
+// Called by: TCNT0, TCNT2
+//
+// Return: pointer to the counter synchronized to the clock
+// -----------------------------------------------------------------------------
+volatile uint8_t *
+hal_tcnt(uint8_t n)	{
+
+	hal_timer_t *t = &timer[n ? 1 : 0];
+
+	timer_sync(t);
+	return(&t->tcnt);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Synchronize Timer1 to the clock
+//
+// Details: Like timer_sync(), the counter counts from 0 to 0xFFFF.
+//
+// Called by: hal_tcnt1(), timer1_next()
+//
+// Return: void
+// -----------------------------------------------------------------------------
+static void
+timer1_sync(void)	{
+
+	uint64_t now = clk->now();
+	uint16_t div = presc0[TCCR1B & 0x07];
+
+	if(timer1.tcnt != timer1.tcnt_rd || div != timer1.div)	{
+
+		timer1.div = div;
+		timer1.start = now - (uint64_t)timer1.tcnt * div;
+		timer1.due = 0;
+
+	} else if(div)	{
+
+		timer1.tcnt = (now - timer1.start) / div;
+	}
+
+	timer1.tcnt_rd = timer1.tcnt;
+}
+
+// -----------------------------------------------------------------------------
+// Description: Cycle of the next Timer1 overflow
+//
+// Called by: timer device
+//
+// Return: cycle or HAL_NEVER if the timer is stopped
+// -----------------------------------------------------------------------------
+static uint64_t
+timer1_next(void)	{
+
+	uint64_t period;
+
+	timer1_sync();
+	if(!timer1.div)
+		return(HAL_NEVER);
+
+	period = 0x10000ULL * timer1.div;
+	if(!timer1.due)
+		timer1.due = timer1.start +
+			((clk->now() - timer1.start) / period + 1) * period;
+
+	return(timer1.due);
+}
+
+static void
+timer1_run(uint64_t now)	{
+
+	timer1.due = 0;
+	hal_irq_raise(HAL_IRQ_TIMER1_OVF);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Access to the Timer1 registers TCNT1 and TIFR1
+//
+// Details: TOV1 is set while the overflow interrupt is pending. The clock
+// runs the overflow before any code sees the wrapped counter, so both are
+// consistent like on the AVR.
+//
+// Called by: TCNT1, TIFR1
+//
+// Return: pointer to the register
+// -----------------------------------------------------------------------------
+volatile uint16_t *
+hal_tcnt1(void)	{
+
+	timer1_sync();
+	return(&timer1.tcnt);
+}
+
+volatile uint8_t *
+hal_tifr1(void)	{
+
+	timer1.tifr = irq_flag[HAL_IRQ_TIMER1_OVF] ? (1 << TOV1) : 0;
+	return(&timer1.tifr);
+}
+
+
+// -----------------------------------------------------------------------------
+// ---------*** Pins, SPI ***---------------------------------------------------
+// -----------------------------------------------------------------------------
+
+// -----------------------------------------------------------------------------
+// Description: Drive an input pin from outside
+//
+// Details: Only PORTC raises a pin change interrupt ( PCINT1 ).
+//
+// Called by: host main, device back ends
+//
+// Return: void
+// -----------------------------------------------------------------------------
+void
+hal_pin(volatile uint8_t *pin, uint8_t bit, uint8_t level)	{
+
+	uint8_t old = *pin;
+
+	if(level)
+		*pin |= (1 << bit);
+	else
+		*pin &= ~(1 << bit);
+
+	if(pin == &PINC && ((old ^ *pin) & PCMSK1))
+		hal_irq_raise(HAL_IRQ_PCINT1);
+}
+
+void
+hal_spi_attach(uint8_t cs, const hal_spi_t *spi)	{
+
+	spi_dev[cs] = spi;
+}
+
+// -----------------------------------------------------------------------------
+// Description: Set chip select line
+//
+// Called by: MCP_CS_LOW, MCP_CS_HIGH, MMC_CS_LOW, MMC_CS_HIGH
+//
+// Return: void
+// -----------------------------------------------------------------------------
+void
+hal_spi_cs(uint8_t cs, uint8_t level)	{
+
+	uint8_t old = spi_cs;
+
+	if(level)
+		spi_cs |= (1 << cs);
+	else
+		spi_cs &= ~(1 << cs);
+
+	if(((old ^ spi_cs) & (1 << cs)) && spi_dev[cs] && spi_dev[cs]->select)
+		spi_dev[cs]->select(!level);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Transfer time of SPI bytes
+//
+// Details: SPI clock by SPR1:0 and SPI2X like the AVR
+//
+// Called by: div
+//
+// Return: cycles
+// -----------------------------------------------------------------------------
+uint64_t
+hal_spi_cycles(uint16_t bytes)	{
+
+	static const uint8_t div[4] = {4, 16, 64, 128};
+	uint8_t d = div[SPCR & ((1 << SPR1) | (1 << SPR0))];
+
+	if(SPSR & (1 << SPI2X))
+		d /= 2;
+
+	return((uint64_t)bytes * 8 * d);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Transfer one byte on the SPI bus
+//
+// Details: The byte is sent to the device with active chip select, without
+// device 0xFF is read like a open MISO line.
+//
+// Called by: spi.c
+//
+// Return: received byte
+// -----------------------------------------------------------------------------
+uint8_t
+hal_spi_xfer(uint8_t data)	{
+
+	uint8_t cs, rx = 0xFF;
+
+	for(cs = 0; cs < HAL_CS_MAX; cs++)	{
+
+		if(!(spi_cs & (1 << cs)) && spi_dev[cs] && spi_dev[cs]->xfer)	{
+			rx = spi_dev[cs]->xfer(data);
+			break;
+		}
+	}
+
+	hal_stats.spi_bytes++;
+	hal_spend(hal_spi_cycles(1));
+
+	return(rx);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Account SPI bytes of a device emulated on frame level
+//
+// Called by: can_host.c, sd_image.c
+//
+// Return: void
+// -----------------------------------------------------------------------------
+void
+hal_spi_spend(uint16_t bytes)	{
+
+	hal_stats.spi_bytes += bytes;
+	hal_spend(hal_spi_cycles(bytes));
+}
+
+void
+hal_spi_start(uint8_t data)	{
+
+	spi_rx = hal_spi_xfer(data);
+}
+
+uint8_t
+hal_spi_wait(void)	{
+
+	return(spi_rx);
+}
+
+
+// -----------------------------------------------------------------------------
+// ---------*** EEPROM ***------------------------------------------------------
+// -----------------------------------------------------------------------------
+
+// EEMEM variables of the firmware, see avr/eeprom.h
+extern uint8_t __start_hal_eeprom[], __stop_hal_eeprom[];
+static const char *eeprom_path;
+
+static void
+eeprom_save(void)	{
+
+	FILE *f = fopen(eeprom_path, "wb");
+
+	if(!f || fwrite(__start_hal_eeprom, 1, __stop_hal_eeprom - __start_hal_eeprom,
+			f) != (size_t)(__stop_hal_eeprom - __start_hal_eeprom))
+		perror(eeprom_path);
+	if(f)
+		fclose(f);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Keep the EEPROM in a file
+//
+// Details: A missing or short file reads as erased EEPROM. The EEPROM is
+// written back at exit.
+//
+// Called by: host main
+//
+// Return: 0
+// -----------------------------------------------------------------------------
+int
+hal_eeprom_open(const char *path)	{
+
+	FILE *f = fopen(path, "rb");
+
+	if(f)	{
+		if(fread(__start_hal_eeprom, 1, __stop_hal_eeprom - __start_hal_eeprom, f)) {}
+		fclose(f);
+	}
+
+	eeprom_path = path;
+	atexit(eeprom_save);
+	return(0);
+}
+
+
+// -----------------------------------------------------------------------------
+// ---------*** Console ***-----------------------------------------------------
+// -----------------------------------------------------------------------------
+
+int
+hal_console_open(const char *spec)	{
+
+	if(!strcmp(spec, "-"))
+		hal_console = stdout;
+	else if(!strcmp(spec, "null"))
+		hal_console = fopen("/dev/null", "w");
+	else
+		hal_console = fopen(spec, "w");
+
+	return(hal_console ? 0 : -1);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Convert a format string of avr-libc to the host
+//
+// Details: int of the AVR is 16 bit and long 32 bit, so a "%ld" argument is a
+// uint32_t, which is a int on the host. The length modifier l is removed and
+// a flash string %S is a normal string.
+//
+// Called by: hal_printf_P(), hal_sprintf()
+//
+// Return: void
+// -----------------------------------------------------------------------------
+static void
+avr_format(char *d, size_t size, const char *fmt)	{
+
+	char *end = d + size - 1;
+	bool spec = false;
+
+	for(; *fmt && d < end; fmt++)	{
+
+		if(!spec)	{
+			spec = (*fmt == '%');
+			*d++ = *fmt;
+			continue;
+		}
+
+		if(*fmt == 'l')
+			continue;
+
+		*d++ = (*fmt == 'S') ? 's' : *fmt;
+		if(strchr("diouxXcspS%", *fmt))
+			spec = false;
+	}
+	*d = 0;
+}
+
+int
+hal_printf_P(const char *fmt, ...)	{
+
+	char buf[256];
+	va_list ap;
+	int n;
+
+	avr_format(buf, sizeof(buf), fmt);
+	va_start(ap, fmt);
+	n = vfprintf(hal_console, buf, ap);
+	va_end(ap);
+
+	return(n);
+}
+
+#undef sprintf
+int
+hal_sprintf(char *s, const char *fmt, ...)	{
+
+	char buf[256];
+	va_list ap;
+	int n;
+
+	avr_format(buf, sizeof(buf), fmt);
+	va_start(ap, fmt);
+	n = vsprintf(s, buf, ap);
+	va_end(ap);
+
+	return(n);
+}
+
+
+// -----------------------------------------------------------------------------
+// Description: Initialize the emulated hardware
+//
+// Details: Input pins read high by the pull ups, no device connected.
+//
+// Called by: host main
+//
+// Return: 0 on success, -1 on unknown clock
+// -----------------------------------------------------------------------------
+int
+hal_init(const char *name)	{
+
+	const hal_clock_t *c;
+
+	for(c = clocks; c->name; c++)
+		if(!strcmp(c->name, name))
+			clk = c;
+
+	if(!clk)
+		return(-1);
+
+	if(!hal_console)
+		hal_console = stdout;
+
+	PINB = PINC = PIND = 0xFF;
+	memset(__start_hal_eeprom, 0xFF, __stop_hal_eeprom - __start_hal_eeprom);
+	hal_dev_add(&timer[0].dev);
+	hal_dev_add(&timer[1].dev);
+	hal_dev_add(&timer1.dev);
+
+	clk->start();
+	return(0);
+}
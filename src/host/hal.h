@@ -0,0 +1,189 @@
+/*
+* ----------------------------------------------------------------------------
+* Hardware abstraction layer of the host build
+*
+* Runs the update logic natively on Linux. The HAL emulates the parts of the
+* ATmega328P used by the firmware ( registers, interrupts, Timer0/2, SPI,
+* pins ) on an emulated clock and connects pluggable back ends:
+*
+*   clock:   virtual ( time advances by emulated hardware only ) or realtime
+*   CAN:     null, socketcan:<if>, simulated ms2 and gb, see hal_can_t,
+*            seen by a frame level or a register level MCP2515
+*   SD:      FAT image file read by the disk_* interface of FatFs or by
+*            mmc.c from a SPI level SD card
+*   console: printf_P() output to stdout, a file or null
+*
+*  Version: 0.0.1
+*
+* "THE BEER-WARE LICENSE" (Revision 42):
+* <karsten@rhen.de> wrote this file. As long as you retain this notice you
+* can do whatever you want with this stuff. If we meet some day, and you think
+* this stuff is worth it, you can buy me a beer in Flensburg, Germany
+* ----------------------------------------------------------------------------
+*/
+
+#ifndef HAL_H
+#define HAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "mcp2515.h"
+
+#define HAL_NEVER	UINT64_MAX		// no event pending
+
+#define HAL_US(us)	((uint64_t)(us) * (F_CPU / 1000000UL))	// us to cycles
+#define HAL_MS(ms)	((uint64_t)(ms) * (F_CPU / 1000UL))		// ms to cycles
+
+// -----------------------------------------------------------------------------
+// Status register, only the interrupt flag is emulated
+#define HAL_SREG_I	7
+extern volatile uint8_t hal_sreg;
+
+void hal_cli(void);
+void hal_sei(void);
+
+// -----------------------------------------------------------------------------
+// Interrupt sources in order of the AVR vector table ( priority )
+enum {
+	HAL_IRQ_INT0,
+	HAL_IRQ_PCINT1,
+	HAL_IRQ_TIMER2_COMPA,
+	HAL_IRQ_TIMER1_OVF,
+	HAL_IRQ_TIMER0_COMPA,
+	HAL_IRQ_USART_UDRE,
+	HAL_IRQ_MAX
+};
+
+void hal_irq_raise(uint8_t irq);		// edge: set interrupt flag
+void hal_irq_line(uint8_t irq, bool active);	// level: INT0 low
+
+// -----------------------------------------------------------------------------
+// Clock in CPU cycles of F_CPU since start
+typedef struct {
+	const char *name;
+	void (*start)(void);
+	uint64_t (*now)(void);
+	// idle until cycle is reached or one of fds is readable
+	void (*wait)(uint64_t until, const int *fds, int nfds);
+} hal_clock_t;
+
+uint64_t hal_now(void);
+void hal_spend(uint64_t cycles);		// busy time, interrupts are served
+void hal_delay_us(double us);
+void hal_sleep(void);					// sleep_cpu(), wait for an interrupt
+
+// -----------------------------------------------------------------------------
+// Emulated device, e.g. a timer or a CAN controller, run by the clock
+typedef struct hal_dev {
+	const char *name;
+	uint64_t (*next)(void);			// cycle of next event or HAL_NEVER
+	void (*run)(uint64_t now);		// process events due at now
+	int (*fd)(void);				// realtime: file to wait for or -1
+	struct hal_dev *link;
+} hal_dev_t;
+
+void hal_dev_add(hal_dev_t *dev);
+
+// -----------------------------------------------------------------------------
+// Timer counter, synchronized to the clock on each access
+volatile uint8_t *hal_tcnt(uint8_t timer);
+volatile uint16_t *hal_tcnt1(void);
+volatile uint8_t *hal_tifr1(void);		// TOV1: overflow interrupt pending
+
+// -----------------------------------------------------------------------------
+// Input pins, a change raises the pin change interrupt
+void hal_pin(volatile uint8_t *pin, uint8_t bit, uint8_t level);
+
+// -----------------------------------------------------------------------------
+// SPI bus, devices are attached to a chip select line
+enum {
+	HAL_CS_MCP,		// MCP_CS B,2
+	HAL_CS_SD,		// SD_CS B,1
+	HAL_CS_MAX
+};
+
+typedef struct {
+	const char *name;
+	void (*select)(bool active);
+	uint8_t (*xfer)(uint8_t data);
+} hal_spi_t;
+
+void hal_spi_attach(uint8_t cs, const hal_spi_t *spi);
+void hal_spi_cs(uint8_t cs, uint8_t level);
+uint8_t hal_spi_xfer(uint8_t data);
+void hal_spi_start(uint8_t data);
+uint8_t hal_spi_wait(void);
+uint64_t hal_spi_cycles(uint16_t bytes);	// transfer time by SPCR/SPSR
+void hal_spi_spend(uint16_t bytes);		// bytes of a frame level model
+
+// -----------------------------------------------------------------------------
+// CAN back end, frames on the bus seen by the controller of the updater
+typedef struct {
+	const char *name;
+	const char *help;
+	int (*open)(const char *arg);
+	void (*send)(const can_t *msg);		// frame sent by the updater
+	uint64_t (*next)(void);				// cycle of next received frame
+	bool (*recv)(can_t *msg);			// fetch a frame due at hal_now()
+	int (*fd)(void);					// realtime: file to wait for or -1
+} hal_can_t;
+
+extern const hal_can_t *hal_can;
+int hal_can_open(const char *spec);		// "name[:arg]"
+int hal_can_log(const char *path);		// log frames in candump format
+void hal_can_list(FILE *f);
+
+// Virtual bus between the back end and a register level CAN controller
+#define HAL_CAN_BITRATE	250000UL
+#define HAL_CAN_BIT		(F_CPU / HAL_CAN_BITRATE)	// cycles per bit
+
+typedef struct {
+	const char *name;
+	bool (*tx)(can_t *msg);				// frame waiting for transmission
+	void (*tx_done)(void);				// frame acknowledged
+	void (*rx)(const can_t *msg);		// frame received from the bus
+} hal_can_node_t;
+
+void hal_can_attach(const hal_can_node_t *ctrl);
+bool hal_can_idle(void);				// all frames of the controller sent
+uint16_t hal_can_bits(const can_t *msg);	// bits incl. stuffing and IFS
+void hal_can_ctrl_init(void);			// set up the controller model
+
+// -----------------------------------------------------------------------------
+// SD card back end
+int hal_sd_open(const char *spec);		// "image[:key=value,...]"
+
+// -----------------------------------------------------------------------------
+// EEPROM, erased ( 0xFF ) or loaded from file and saved at exit
+int hal_eeprom_open(const char *path);
+
+// -----------------------------------------------------------------------------
+// Console for printf_P()
+extern FILE *hal_console;
+int hal_console_open(const char *spec);	// "-", "null" or file name
+
+// Formatted output with int and long of the AVR, see hal_printf_P()
+int hal_sprintf(char *s, const char *fmt, ...);
+#define sprintf	hal_sprintf
+
+// -----------------------------------------------------------------------------
+// Statistics of the emulated hardware
+typedef struct {
+	uint64_t can_tx;		// frames sent by the updater
+	uint64_t can_rx;		// frames received by the updater
+	uint64_t can_lost;		// frames lost by receive buffer overflow
+	uint64_t bus_busy;		// cycles the CAN bus carried a frame
+	uint64_t spi_bytes;		// bytes transferred on the SPI bus
+	uint64_t sd_sectors;	// sectors read from the SD card
+	uint64_t payload;		// update data bytes received by the device
+	uint64_t irqs;			// interrupts served
+	uint64_t sleep;			// cycles spent in sleep_cpu()
+} hal_stats_t;
+
+extern hal_stats_t hal_stats;
+
+// -----------------------------------------------------------------------------
+int hal_init(const char *clock);
+
+#endif
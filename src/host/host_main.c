@@ -0,0 +1,328 @@
+/*
+* ----------------------------------------------------------------------------
+* Host build: run the update logic on Linux
+*
+* Replaces main() and init_HW() of main.c. The emulated hardware is set up
+* like init_HW() does, then the device is connected and the requested step
+* of the update is run.
+*
+* Usage: ms2upd [options] [detect|update|version|format|check|sdtest]
+*
+*  Version: 0.0.1
+*
+* "THE BEER-WARE LICENSE" (Revision 42):
+* <karsten@rhen.de> wrote this file. As long as you retain this notice you
+* can do whatever you want with this stuff. If we meet some day, and you think
+* this stuff is worth it, you can buy me a beer in Flensburg, Germany
+* ----------------------------------------------------------------------------
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/delay.h>
+
+#include "main.h"
+
+extern device_t device;		// defined in main.c
+
+static void
+usage(const char *prog)	{
+
+	fprintf(stderr,
+		"usage: %s [options] [detect|update|version|format|check|sdtest]\n"
+		"  -k clock    virtual ( default ) or realtime\n"
+		"  -c can      CAN back end, default null:\n", prog);
+	hal_can_list(stderr);
+	fprintf(stderr,
+		"  -s image    FAT image of the SD card, ms2upd-hw: image[:key=value,...]\n"
+		"  -o console  console output: - ( default ), null or file\n"
+		"  -l file     log the CAN frames in candump format\n"
+		"  -e file     EEPROM contents, loaded and saved on exit\n"
+		"\n"
+		"  detect      identify the connected device\n"
+		"  update      identify the device and run its update\n"
+		"  version     print versions of the binaries on the SD card\n"
+		"  format      compare the config reply formatter with sprintf\n"
+		"  check       look up every config name in the hash table\n"
+		"  sdtest      report the SD card and its read rate\n");
+	exit(1);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Initialize the hardware like init_HW() of main.c
+//
+// Called by: main
+//
+// Return: 0 on success otherwise 1
+// ----------------------------------------------------------------------------
+static uint8_t
+init_host(void)	{
+
+	// pin change interrupt on DEV_PRESENT
+	PRES_PCMSK |= (1 << PRES_PCINT);
+	PCICR |= (1 << PCIE1);
+
+	// 4ms tick of Timer0
+	init_tick_tasks();
+
+	// init 16Bit Timer1, free running, clk/1, time base of get_time_us()
+	TCCR1A = 0;
+	TCCR1B = (1 << CS10);
+	TIMSK1 |= (1 << TOIE1);
+
+	sei();
+	PRINT("MS2 Updater host build\n");
+
+	spi_init();
+
+	if(init_SD())	{
+
+		PRINT("Error: SD access FAILED\n");
+		return(1);
+	}
+
+	if(!can_init())	{
+
+		PRINT("Error: MCP2515 access FAILED\n");
+		return(1);
+	}
+
+	EIMSK |= (1 << INT0);
+
+	if(sd_card_known())
+		PRINT("SD card known\n");
+	else
+		sd_card_store();
+
+	return(0);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Plug in the device and identify it like main() does
+//
+// Called by: main
+//
+// Return: device type or 0
+// ----------------------------------------------------------------------------
+static uint8_t
+detect(void)	{
+
+	hal_pin(&PINC, PC5, 0);		// DEV_PRESENT low: device connected
+
+	while(!(Flags & (1 << DEVCONN)))
+		wait_irq();
+
+	_delay_ms(200);
+	detect_device(&device);
+
+	PRINT("Device type 0x%02x hash 0x%04x uid 0x%08lx version %d.%d\n",
+			device.type, device.hash, device.uid,
+			device.sversion >> 8, device.sversion & 0xFF);
+
+	return(device.type);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Build the version reply like process_filever() with fmt.c or,
+// as before, with sprintf()
+//
+// Called by: format
+//
+// Return: length of the reply
+// -----------------------------------------------------------------------------
+static int
+format_reply(char *bytes, uint8_t high, uint8_t low, int32_t size, int old)	{
+
+	char *p;
+
+	if(old)
+		return(sprintf(bytes," .vhigh=%d\n .vlow=%d\n .bytes=%ld\n",
+				high, low, (long)size));
+
+	p = fmt_key(bytes, PSTR("vhigh"), high);
+	p = fmt_key(p, PSTR("vlow"), low);
+	p = fmt_key(p, PSTR("bytes"), size);
+
+	return(p - bytes);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Compare fmt.c with sprintf() and time both
+//
+// Details: All version bytes with file sizes of every length must give the
+// same reply. The time per reply is host CPU time, the cycles on the AVR
+// are measured by the PRB_FORMAT probe, make PROBES=1.
+//
+// Called by: main
+//
+// Return: number of different replies
+// -----------------------------------------------------------------------------
+static uint8_t
+format(void)	{
+
+	static const int32_t size[] = { 0, 7, 10, 99, 4096, 65535, 205100,
+		1000000, 999999999, 2147483647, -1, -2147483647 - 1 };
+	char a[64], b[64];
+	struct timespec t0, t1;
+	double ns[2];
+	unsigned long diff = 0, n = 0;
+	int v, i, old, rep;
+
+	for(v = 0; v < 0x10000; v++)	{
+		for(i = 0; i < (int)(sizeof(size) / sizeof(size[0])); i++, n++)	{
+
+			if(format_reply(a, v >> 8, v & 0xFF, size[i], 1) !=
+					format_reply(b, v >> 8, v & 0xFF, size[i], 0) ||
+					strcmp(a, b))	{
+
+				if(diff++ < 10)
+					fprintf(stderr, "format: \"%s\" != \"%s\"\n", b, a);
+			}
+		}
+	}
+
+	for(old = 0; old < 2; old++)	{
+
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		for(rep = 0; rep < 1000000; rep++)
+			format_reply(a, rep >> 8, rep, rep * 7, old);
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+
+		ns[old] = ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / rep;
+	}
+
+	fprintf(stderr, "format: %lu replies, %lu different, fmt %.1fns sprintf %.1fns"
+			" per reply\n", n, diff, ns[0], ns[1]);
+
+	return(diff ? 1 : 0);
+}
+
+int
+main(int argc, char **argv)	{
+
+	const char *clk = "virtual", *can = "null", *img = 0, *con = "-", *cmd;
+	const char *log = 0, *eep = 0;
+	uint8_t rt = 0;
+	int opt;
+
+	while((opt = getopt(argc, argv, "k:c:s:o:l:e:h")) != -1)	{
+
+		switch(opt)	{
+			case 'k': clk = optarg; break;
+			case 'c': can = optarg; break;
+			case 's': img = optarg; break;
+			case 'o': con = optarg; break;
+			case 'l': log = optarg; break;
+			case 'e': eep = optarg; break;
+			default: usage(argv[0]);
+		}
+	}
+
+	cmd = optind < argc ? argv[optind] : "detect";
+
+	if(!strcmp(cmd, "format"))
+		return(format());
+
+	if(!strcmp(cmd, "check"))	{
+		const char *name = check_callers();
+
+		if(name)
+			fprintf(stderr, "check: %.8s not found in fktSlot\n", name);
+		return(name ? 1 : 0);
+	}
+
+	if(hal_console_open(con))	{
+		perror(con);
+		return(1);
+	}
+
+	if(hal_init(clk))	{
+		fprintf(stderr, "unknown clock %s\n", clk);
+		return(1);
+	}
+
+	if(eep && hal_eeprom_open(eep))	{
+		perror(eep);
+		return(1);
+	}
+
+	if(hal_can_open(can))	{
+		fprintf(stderr, "can not open CAN back end %s\n", can);
+		return(1);
+	}
+
+	if(log && hal_can_log(log))	{
+		perror(log);
+		return(1);
+	}
+
+	if(img && hal_sd_open(img))	{
+		perror(img);
+		return(1);
+	}
+
+	if(init_host())
+		return(1);
+
+	PROBE_RESET();
+
+	if(!strcmp(cmd, "version"))	{
+
+		PRINT("050-ms2.bin %04x\n", get_ms2ver("050-ms2.bin"));
+		PRINT("016-gb2.bin %04x\n", get_gb2ver("016-gb2.bin"));
+
+	} else if(!strcmp(cmd, "sdtest"))	{
+
+		rt = sd_selftest() ? 0 : 1;
+
+	} else if(!strcmp(cmd, "detect"))	{
+
+		rt = detect() ? 0 : ENODEV;
+
+	} else if(!strcmp(cmd, "update"))	{
+
+		LAT_RESET();
+		switch(detect())	{
+
+			case DEV_GFP_MS2:
+				rt = process_60133Update();
+				break;
+
+			case DEV_CON_MS2:
+				rt = process_MS2Update(&device);
+				break;
+
+			default:
+				rt = ENODEV;
+				break;
+		}
+		LAT_DUMP();
+	} else
+		usage(argv[0]);
+
+	// frames still in the transmit buffers go out like on the board
+	while(!hal_can_idle())
+		hal_spend(HAL_CAN_BIT);
+
+	PRINT("scratch %u of %u\n", scratch_peak(), (unsigned)SCRATCH_SIZE);
+	PROBE_DUMP();
+	fflush(hal_console);
+	fprintf(stderr, "%s: rt=%d time=%.3fs can tx=%llu rx=%llu lost=%llu "
+			"spi=%llu sd=%llu payload=%llu sleep=%.1f%% bus=%.1f%%\n", cmd, rt,
+			(double)hal_now() / F_CPU,
+			(unsigned long long)hal_stats.can_tx,
+			(unsigned long long)hal_stats.can_rx,
+			(unsigned long long)hal_stats.can_lost,
+			(unsigned long long)hal_stats.spi_bytes,
+			(unsigned long long)hal_stats.sd_sectors,
+			(unsigned long long)hal_stats.payload,
+			hal_now() ? 100.0 * hal_stats.sleep / hal_now() : 0.0,
+			hal_now() ? 100.0 * hal_stats.bus_busy / hal_now() : 0.0);
+
+	return(rt);
+}
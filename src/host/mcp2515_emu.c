@@ -0,0 +1,672 @@
+/*
+* ----------------------------------------------------------------------------
+* Host build: MCP2515 on register level
+*
+* Emulates the MCP2515 behind the SPI bus of the HAL, so the driver mcp2515.c
+* of the firmware runs unchanged. Implemented are the SPI instructions, the
+* register file with its write restrictions, three transmit buffers with
+* priorities and abort, two receive buffers with filters, masks and rollover,
+* the interrupt flags with ICOD and the INT line, the operation modes and the
+* bit timing of CNF1..3. Frames are exchanged with the back end over the
+* virtual bus of can_bus.c and take their time on the bus.
+*
+* Not emulated: standard and remote frames ( the updater uses extended data
+* frames only ), error counters, one shot mode, sleep and wake up, the RXnBF
+* and TXnRTS pins.
+*
+*  Version: 0.0.1
+*
+* "THE BEER-WARE LICENSE" (Revision 42):
+* <karsten@rhen.de> wrote this file. As long as you retain this notice you
+* can do whatever you want with this stuff. If we meet some day, and you think
+* this stuff is worth it, you can buy me a beer in Flensburg, Germany
+* ----------------------------------------------------------------------------
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <avr/io.h>
+#include "hal.h"
+#include "mcp2515_defs.h"
+
+#define MCP_OSC		16000000UL		// crystal of the MCP2515
+
+// Operation modes of REQOP and OPMOD
+#define MODE_NORMAL		0
+#define MODE_SLEEP		1
+#define MODE_LOOPBACK	2
+#define MODE_LISTEN		3
+#define MODE_CONFIG		4
+
+#define MODE		(reg[CANSTAT] >> OPMOD0)
+#define TXBCTRL(n)	(TXB0CTRL + ((n) << 4))
+#define RXBCTRL(n)	(RXB0CTRL + ((n) << 4))
+
+static uint8_t reg[128];			// register file
+static uint8_t rx_hit[2];			// filter hit of RXBn for SPI_RX_STATUS
+static uint8_t tx_buf;				// buffer of the frame on the bus
+static bool bitrate_ok;				// CNF1..3 give HAL_CAN_BITRATE
+
+// State of the SPI instruction
+static struct {
+	uint8_t cmd;					// instruction, first byte
+	uint8_t n;						// bytes transferred since CS low
+	uint8_t addr;					// register address
+	uint8_t mask;					// mask of SPI_BIT_MODIFY
+} spi;
+
+// Start addresses of SPI_READ_RX and SPI_WRITE_TX by the n,m / a,b,c bits
+static const uint8_t read_rx[4] = {RXB0SIDH, RXB0D0, RXB1SIDH, RXB1D0};
+static const uint8_t write_tx[6] = {
+	TXB0SIDH, TXB0D0, TXB1SIDH, TXB1D0, TXB2SIDH, TXB2D0
+};
+
+static void update_int(void);
+static void tx_loopback(void);
+
+
+// -----------------------------------------------------------------------------
+// ---------*** Registers ***---------------------------------------------------
+// -----------------------------------------------------------------------------
+
+// -----------------------------------------------------------------------------
+// Description: Reset like the SPI_RESET instruction or power on
+//
+// Details: All registers are cleared, the controller starts in
+// configuration mode with CLKOUT enabled.
+//
+// Called by: mcp_xfer(), hal_can_ctrl_init()
+//
+// Return: void
+// -----------------------------------------------------------------------------
+static void
+mcp_reset(void)	{
+
+	memset(reg, 0, sizeof(reg));
+	reg[CANCTRL] = (MODE_CONFIG << REQOP0) | (1 << CLKEN) | 3;
+	reg[CANSTAT] = (MODE_CONFIG << OPMOD0);
+	rx_hit[0] = rx_hit[1] = 0;
+	bitrate_ok = false;
+	update_int();
+}
+
+// -----------------------------------------------------------------------------
+// Description: Check the bit timing of CNF1..3
+//
+// Details: bitrate = Fosc / ( 2 * ( BRP + 1 ) * TQ per bit ), a bit has
+// sync segment, PRSEG + 1, PHSEG1 + 1 and PHSEG2 + 1 TQ. PHSEG2 follows
+// PHSEG1 unless BTLMODE is set. Another bitrate than the bus has means no
+// frame is received or sent.
+//
+// Called by: set_mode()
+//
+// Return: true if the bitrate matches the bus
+// -----------------------------------------------------------------------------
+static bool
+check_bitrate(void)	{
+
+	uint8_t brp = reg[CNF1] & 0x3F;
+	uint8_t prseg = reg[CNF2] & 0x07;
+	uint8_t phseg1 = (reg[CNF2] >> PHSEG10) & 0x07;
+	uint8_t phseg2 = (reg[CNF2] & (1 << BTLMODE)) ? reg[CNF3] & 0x07 : phseg1;
+	uint32_t tq = 1 + (prseg + 1) + (phseg1 + 1) + (phseg2 + 1);
+	uint32_t rate = MCP_OSC / (2 * (brp + 1) * tq);
+
+	if(rate != HAL_CAN_BITRATE)	{
+		fprintf(stderr, "mcp2515: bitrate %lu but bus runs %lu bit/s\n",
+				(unsigned long)rate, (unsigned long)HAL_CAN_BITRATE);
+		return(false);
+	}
+
+	return(true);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Switch the operation mode requested by REQOP
+//
+// Details: The mode changes at once, the driver polls OPMOD. Leaving the
+// configuration mode locks CNF1..3, so the bitrate is checked here.
+//
+// Called by: reg_write()
+//
+// Return: void
+// -----------------------------------------------------------------------------
+static void
+set_mode(void)	{
+
+	uint8_t mode = reg[CANCTRL] >> REQOP0;
+
+	if(mode > MODE_CONFIG || mode == MODE)
+		return;
+
+	if(MODE == MODE_CONFIG)
+		bitrate_ok = check_bitrate();
+
+	reg[CANSTAT] = (reg[CANSTAT] & 0x1F) | (mode << OPMOD0);
+
+	if(mode == MODE_LOOPBACK)
+		tx_loopback();
+}
+
+// -----------------------------------------------------------------------------
+// Description: Bits of a register writable by SPI
+//
+// Details: Filters, masks, CNF and TXRTSCTRL only in configuration mode, a
+// transmit buffer only while its TXREQ is clear. Receive buffers, CANSTAT
+// and the error counters are read only.
+//
+// Called by: reg_write()
+//
+// Return: mask of writable bits
+// -----------------------------------------------------------------------------
+static uint8_t
+writable(uint8_t addr)	{
+
+	bool config = MODE == MODE_CONFIG;
+
+	switch(addr)	{
+
+		case BFPCTRL:	return(0x3F);
+		case TXRTSCTRL:	return(config ? 0x07 : 0);
+		case CANCTRL:	return(0xFF);
+		case CANINTE:	return(0xFF);
+		case CANINTF:	return(0xFF);
+		case EFLG:		return((1 << RX1OVR) | (1 << RX0OVR));
+		case RXB0CTRL:	return((1 << RXM1) | (1 << RXM0) | (1 << BUKT));
+		case RXB1CTRL:	return((1 << RXM1) | (1 << RXM0));
+		case TXB0CTRL:
+		case TXB1CTRL:
+		case TXB2CTRL:	return((1 << TXREQ) | (1 << TXP1) | (1 << TXP0));
+	}
+
+	if(addr < CANSTAT || (addr >= RXF3SIDH && addr <= RXF5EID0) ||
+	   (addr >= RXM0SIDH && addr <= CNF1))
+		return(config ? 0xFF : 0);
+
+	if(addr >= TXB0SIDH && addr <= TXB2D7 && (addr & 0x0F) <= 0x0D)
+		return((reg[addr & 0xF0] & (1 << TXREQ)) ? 0 : 0xFF);
+
+	return(0);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Registers SPI_BIT_MODIFY works on, on all others the mask is
+// ignored and the whole byte written.
+//
+// Return: true if bit modify is possible
+// -----------------------------------------------------------------------------
+static bool
+modifiable(uint8_t addr)	{
+
+	switch(addr)	{
+
+		case BFPCTRL: case TXRTSCTRL: case CANCTRL:
+		case CNF3: case CNF2: case CNF1:
+		case CANINTE: case CANINTF: case EFLG:
+		case TXB0CTRL: case TXB1CTRL: case TXB2CTRL:
+		case RXB0CTRL: case RXB1CTRL:
+			return(true);
+	}
+
+	return(false);
+}
+
+static uint8_t
+reg_read(uint8_t addr)	{
+
+	addr &= 0x7F;
+
+	// CANSTAT and CANCTRL are mapped to the end of every row
+	if((addr & 0x0F) >= CANSTAT)
+		addr &= 0x0F;
+
+	return(reg[addr]);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Write a register by SPI_WRITE, SPI_WRITE_TX or SPI_BIT_MODIFY
+//
+// Details: Only the bits of mask and writable() change. The overflow flags
+// of EFLG can only be cleared. Side effects of CANCTRL, the interrupt
+// registers and TXREQ follow at once.
+//
+// Called by: mcp_xfer()
+//
+// Return: void
+// -----------------------------------------------------------------------------
+static void
+reg_write(uint8_t addr, uint8_t data, uint8_t mask)	{
+
+	uint8_t n, old;
+
+	addr &= 0x7F;
+	if((addr & 0x0F) >= CANSTAT)
+		addr &= 0x0F;
+
+	mask &= writable(addr);
+	if(addr == EFLG)
+		mask &= ~data;
+
+	old = reg[addr];
+	reg[addr] = (old & ~mask) | (data & mask);
+
+	switch(addr)	{
+
+		case CANCTRL:
+			if(reg[CANCTRL] & (1 << ABAT))	{
+				for(n = 0; n < 3; n++)	{
+					if(reg[TXBCTRL(n)] & (1 << TXREQ))
+						reg[TXBCTRL(n)] = (reg[TXBCTRL(n)] & ~(1 << TXREQ)) |
+										  (1 << ABTF);
+				}
+			}
+			set_mode();
+			break;
+
+		case RXB0CTRL:
+			// BUKT1 is a read only copy of BUKT
+			reg[RXB0CTRL] = (reg[RXB0CTRL] & ~(1 << BUKT1)) |
+							((reg[RXB0CTRL] >> 1) & (1 << BUKT1));
+			break;
+
+		case TXB0CTRL:
+		case TXB1CTRL:
+		case TXB2CTRL:
+			if((reg[addr] & ~old) & (1 << TXREQ))	{
+				reg[addr] &= ~((1 << ABTF) | (1 << MLOA) | (1 << TXERR));
+				if(reg[CANCTRL] & (1 << ABAT))
+					reg[addr] = (reg[addr] & ~(1 << TXREQ)) | (1 << ABTF);
+				tx_loopback();
+			}
+			break;
+	}
+
+	update_int();
+}
+
+// -----------------------------------------------------------------------------
+// Description: Interrupt code and INT line
+//
+// Details: ICOD shows the enabled interrupt of highest priority, INT is low
+// while any enabled flag is set.
+//
+// Called by: after each change of CANINTE or CANINTF
+//
+// Return: void
+// -----------------------------------------------------------------------------
+static void
+update_int(void)	{
+
+	// ICOD 1..7 of ERRIF, WAKIF, TX0IF, TX1IF, TX2IF, RX0IF, RX1IF
+	static const uint8_t prio[7] = {
+		ERRIF, WAKIF, TX0IF, TX1IF, TX2IF, RX0IF, RX1IF
+	};
+	uint8_t pending = reg[CANINTE] & reg[CANINTF], icod = 0, i;
+
+	for(i = 0; i < 7 && !icod; i++)	{
+		if(pending & (1 << prio[i]))
+			icod = i + 1;
+	}
+
+	reg[CANSTAT] = (reg[CANSTAT] & ~0x0E) | (icod << ICOD0);
+	hal_irq_line(HAL_IRQ_INT0, pending != 0);
+}
+
+
+// -----------------------------------------------------------------------------
+// ---------*** Transmit and receive ***----------------------------------------
+// -----------------------------------------------------------------------------
+
+// -----------------------------------------------------------------------------
+// Description: Pending transmit buffer of highest priority
+//
+// Details: TXP decides, on equal TXP the higher buffer number wins.
+//
+// Return: buffer number or 0xFF if none pending
+// -----------------------------------------------------------------------------
+static uint8_t
+tx_next(void)	{
+
+	uint8_t n, best = 0xFF;
+
+	for(n = 0; n < 3; n++)	{
+
+		if(!(reg[TXBCTRL(n)] & (1 << TXREQ)))
+			continue;
+
+		if(best == 0xFF || (reg[TXBCTRL(n)] & 0x03) >= (reg[TXBCTRL(best)] & 0x03))
+			best = n;
+	}
+
+	return(best);
+}
+
+static void
+tx_frame(uint8_t n, can_t *msg)	{
+
+	const uint8_t *b = &reg[TXBCTRL(n)];
+
+	msg->id = ((uint32_t)b[1] << 21) | ((uint32_t)(b[2] & 0xE0) << 13) |
+			  ((uint32_t)(b[2] & 0x03) << 16) | ((uint32_t)b[3] << 8) | b[4];
+	msg->length = b[5] & 0x0F;
+	if(msg->length > 8)
+		msg->length = 8;
+	memcpy(msg->data, &b[6], msg->length);
+}
+
+static void
+tx_complete(uint8_t n)	{
+
+	reg[TXBCTRL(n)] &= ~(1 << TXREQ);
+	reg[CANINTF] |= (1 << (TX0IF + n));
+	hal_stats.can_tx++;
+	update_int();
+}
+
+// -----------------------------------------------------------------------------
+// Description: Identifier of a filter or mask as 29 bit value
+//
+// Return: identifier
+// -----------------------------------------------------------------------------
+static uint32_t
+reg_id(uint8_t addr)	{
+
+	const uint8_t *r = &reg[addr];
+
+	return(((uint32_t)r[0] << 21) | ((uint32_t)(r[1] & 0xE0) << 13) |
+		   ((uint32_t)(r[1] & 0x03) << 16) | ((uint32_t)r[2] << 8) | r[3]);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Filter of a receive buffer matching the frame
+//
+// Details: RXM = 3 receives every frame. Otherwise a filter matches if its
+// EXIDE is set and all bits of the mask are equal.
+//
+// Return: filter number or 0xFF
+// -----------------------------------------------------------------------------
+static uint8_t
+rx_filter(uint8_t n, uint32_t id)	{
+
+	static const uint8_t filter[6] = {
+		RXF0SIDH, RXF1SIDH, RXF2SIDH, RXF3SIDH, RXF4SIDH, RXF5SIDH
+	};
+	uint8_t f = n ? 2 : 0, last = n ? 5 : 1;
+	uint32_t mask = reg_id(n ? RXM1SIDH : RXM0SIDH);
+
+	if(((reg[RXBCTRL(n)] >> RXM0) & 3) == 3)
+		return(f);
+
+	for(; f <= last; f++)	{
+
+		if(!(reg[filter[f] + 1] & (1 << EXIDE)))
+			continue;
+
+		if(!((id ^ reg_id(filter[f])) & mask))
+			return(f);
+	}
+
+	return(0xFF);
+}
+
+static void
+rx_store(uint8_t n, const can_t *msg, uint8_t filhit)	{
+
+	uint8_t *b = &reg[RXBCTRL(n)];
+	uint8_t len = msg->length > 8 ? 8 : msg->length;
+
+	b[1] = msg->id >> 21;
+	b[2] = ((msg->id >> 13) & 0xE0) | (1 << IDE) | ((msg->id >> 16) & 0x03);
+	b[3] = msg->id >> 8;
+	b[4] = msg->id;
+	b[5] = len;
+	memcpy(&b[6], msg->data, len);
+
+	// FILHIT of RXB1 is 0 or 1 after rollover, RX_STATUS shows 6 or 7
+	b[0] = (b[0] & ~(n ? 0x07 : 0x01)) | filhit;
+	rx_hit[n] = (n && filhit < 2) ? filhit + 6 : filhit;
+
+	reg[CANINTF] |= (1 << (RX0IF + n));
+	hal_stats.can_rx++;
+	update_int();
+}
+
+// -----------------------------------------------------------------------------
+// Description: Accept a frame of the bus
+//
+// Details: A frame matching RXB0 goes there, if RXB0 is full it rolls over
+// to RXB1 when BUKT is set. A frame for a full buffer is lost and sets the
+// overflow flag of the buffer and ERRIF.
+//
+// Called by: can_bus.c, tx_loopback()
+//
+// Return: void
+// -----------------------------------------------------------------------------
+static void
+rx_frame(const can_t *msg)	{
+
+	uint8_t f, n;
+
+	if((f = rx_filter(0, msg->id)) != 0xFF)	{
+
+		n = 0;
+		if((reg[CANINTF] & (1 << RX0IF)) && (reg[RXB0CTRL] & (1 << BUKT)))
+			n = 1;
+
+	} else if((f = rx_filter(1, msg->id)) != 0xFF)
+		n = 1;
+	else
+		return;
+
+	if(reg[CANINTF] & (1 << (RX0IF + n)))	{
+
+		reg[EFLG] |= (1 << (RX0OVR + n));
+		reg[CANINTF] |= (1 << ERRIF);
+		hal_stats.can_lost++;
+		update_int();
+		return;
+	}
+
+	rx_store(n, msg, f);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Loopback mode, pending frames are received at once
+//
+// Called by: set_mode(), reg_write()
+//
+// Return: void
+// -----------------------------------------------------------------------------
+static void
+tx_loopback(void)	{
+
+	can_t msg;
+	uint8_t n;
+
+	if(MODE != MODE_LOOPBACK)
+		return;
+
+	while((n = tx_next()) != 0xFF)	{
+
+		tx_frame(n, &msg);
+		tx_complete(n);
+		rx_frame(&msg);
+	}
+}
+
+
+// -----------------------------------------------------------------------------
+// ---------*** Node on the virtual bus ***-------------------------------------
+// -----------------------------------------------------------------------------
+
+static bool
+node_tx(can_t *msg)	{
+
+	if(MODE != MODE_NORMAL || !bitrate_ok)
+		return(false);
+
+	if((tx_buf = tx_next()) == 0xFF)
+		return(false);
+
+	tx_frame(tx_buf, msg);
+	return(true);
+}
+
+static void
+node_tx_done(void)	{
+
+	tx_complete(tx_buf);
+}
+
+static void
+node_rx(const can_t *msg)	{
+
+	if((MODE == MODE_NORMAL || MODE == MODE_LISTEN) && bitrate_ok)
+		rx_frame(msg);
+}
+
+static const hal_can_node_t node = {
+	"mcp2515", node_tx, node_tx_done, node_rx
+};
+
+
+// -----------------------------------------------------------------------------
+// ---------*** SPI ***---------------------------------------------------------
+// -----------------------------------------------------------------------------
+
+static void
+mcp_select(bool active)	{
+
+	// SPI_READ_RX clears the RXnIF flag when CS goes high
+	if(!active && (spi.cmd & 0xF9) == SPI_READ_RX && spi.n > 1)	{
+		reg[CANINTF] &= ~(1 << ((spi.cmd & 0x04) ? RX1IF : RX0IF));
+		update_int();
+	}
+
+	spi.n = 0;
+}
+
+static uint8_t
+read_status(void)	{
+
+	uint8_t f = reg[CANINTF];
+
+	return(((f >> RX0IF) & 1) | (((f >> RX1IF) & 1) << 1) |
+		   (((reg[TXB0CTRL] >> TXREQ) & 1) << 2) | (((f >> TX0IF) & 1) << 3) |
+		   (((reg[TXB1CTRL] >> TXREQ) & 1) << 4) | (((f >> TX1IF) & 1) << 5) |
+		   (((reg[TXB2CTRL] >> TXREQ) & 1) << 6) | (((f >> TX2IF) & 1) << 7));
+}
+
+static uint8_t
+rx_status(void)	{
+
+	uint8_t f = reg[CANINTF] & ((1 << RX1IF) | (1 << RX0IF));
+
+	// buffers full, extended data frame and filter hit, RXB0 first
+	if(!f)
+		return(0);
+
+	return((f << 6) | 0x10 | ((f & (1 << RX0IF)) ? rx_hit[0] : rx_hit[1]));
+}
+
+// -----------------------------------------------------------------------------
+// Description: One byte of an SPI instruction
+//
+// Details: The first byte after CS low is the instruction. Reads and writes
+// continue on the next address while CS stays low, status instructions
+// repeat their byte.
+//
+// Called by: hal_spi_xfer()
+//
+// Return: byte on MISO
+// -----------------------------------------------------------------------------
+static uint8_t
+mcp_xfer(uint8_t data)	{
+
+	uint8_t rx = 0xFF, n = spi.n;
+
+	if(spi.n < 0xFF)
+		spi.n++;
+
+	if(!n)	{
+
+		spi.cmd = data;
+
+		if(data == SPI_RESET)
+			mcp_reset();
+		else if((data & 0xF9) == SPI_READ_RX)
+			spi.addr = read_rx[(data >> 1) & 0x03];
+		else if((data & 0xF8) == SPI_WRITE_TX && (data & 0x07) < 6)
+			spi.addr = write_tx[data & 0x07];
+		else if((data & 0xF8) == SPI_RTS)	{
+
+			for(n = 0; n < 3; n++)	{
+				if(data & (1 << n))
+					reg_write(TXBCTRL(n), 1 << TXREQ, 1 << TXREQ);
+			}
+		}
+
+		return(rx);
+	}
+
+	switch(spi.cmd)	{
+
+		case SPI_READ:
+			if(n == 1)
+				spi.addr = data;
+			else
+				rx = reg_read(spi.addr++);
+			break;
+
+		case SPI_WRITE:
+			if(n == 1)
+				spi.addr = data;
+			else
+				reg_write(spi.addr++, data, 0xFF);
+			break;
+
+		case SPI_BIT_MODIFY:
+			if(n == 1)
+				spi.addr = data;
+			else if(n == 2)
+				spi.mask = data;
+			else if(n == 3)
+				reg_write(spi.addr, data,
+						  modifiable(spi.addr & 0x7F) ? spi.mask : 0xFF);
+			break;
+
+		case SPI_READ_STATUS:
+			rx = read_status();
+			break;
+
+		case SPI_RX_STATUS:
+			rx = rx_status();
+			break;
+
+		default:
+			if((spi.cmd & 0xF9) == SPI_READ_RX)
+				rx = reg_read(spi.addr++);
+			else if((spi.cmd & 0xF8) == SPI_WRITE_TX)
+				reg_write(spi.addr++, data, 0xFF);
+			break;
+	}
+
+	return(rx);
+}
+
+static const hal_spi_t mcp = {"mcp2515", mcp_select, mcp_xfer};
+
+// -----------------------------------------------------------------------------
+// Description: Power on the MCP2515 and connect it to SPI and CAN bus
+//
+// Called by: hal_can_open()
+//
+// Return: void
+// -----------------------------------------------------------------------------
+void
+hal_can_ctrl_init(void)	{
+
+	mcp_reset();
+	hal_spi_attach(HAL_CS_MCP, &mcp);
+	hal_can_attach(&node);
+}
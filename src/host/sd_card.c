@@ -0,0 +1,668 @@
+/*
+* ----------------------------------------------------------------------------
+* Host build: SD card on SPI level
+*
+* Emulates a SD card in SPI mode behind the SPI bus of the HAL, so the driver
+* mmc.c of the firmware runs unchanged. The sectors are read from a FAT image
+* file. Implemented are CMD0, CMD8, CMD55/ACMD41, CMD58, CMD16, CMD17, CMD18
+* and CMD12 with the response latency NCR, the access time before each data
+* token, the initialization time of ACMD41 and the busy time after CMD12.
+* The latencies run on the clock of the HAL, so a faster SPI clock polls
+* more bytes. CMD9 and CMD10 send CSD and CID of the image, CMD6 the high
+* speed function and ACMD13 the speed class of the SD status.
+*
+* Options of hal_sd_open(): "image[:key=value,...]"
+*
+*   ncr=n     bytes before the response, 1..8 ( 1 )
+*   acc=us    access time before the first data token ( 400 )
+*   blk=us    access time before the next token of CMD18 ( 100 )
+*   init=ms   time until ACMD41 leaves the idle state ( 10 )
+*   busy=us   busy time after CMD12 ( 50 )
+*   hc=0|1    SDSC with byte addresses or SDHC ( 1 )
+*   hs=0|1    CMD6 high speed function ( 1 )
+*   class=n   speed class 0, 2, 4, 6 or 10 of the SD status ( 4 )
+*   psn=n     serial number of the CID ( inode of the image )
+*   v=1       trace the commands to stderr
+*
+*  Version: 0.0.1
+*
+* "THE BEER-WARE LICENSE" (Revision 42):
+* <karsten@rhen.de> wrote this file. As long as you retain this notice you
+* can do whatever you want with this stuff. If we meet some day, and you think
+* this stuff is worth it, you can buy me a beer in Flensburg, Germany
+* ----------------------------------------------------------------------------
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <avr/io.h>
+#include "hal.h"
+
+// R1 response bits
+#define R1_IDLE			0x01
+#define R1_ILLEGAL		0x04
+#define R1_ADDRESS		0x20
+#define R1_PARAM		0x40
+
+#define TOKEN_START		0xFE	// start of a data block
+
+// State of the card output on MISO
+enum {
+	OUT_IDLE,			// 0xFF
+	OUT_RESP,			// NCR bytes, then the response
+	OUT_TOKEN,			// 0xFF until the access time passed
+	OUT_DATA,			// data block and CRC
+	OUT_BUSY			// 0x00 until the busy time passed
+};
+
+static int img = -1;
+static uint32_t sectors;			// size of the image
+
+// Options
+static uint8_t ncr = 1;
+static uint64_t acc, blk, init, busy;
+static bool hc = true;
+static bool hs = true;
+static uint8_t speed_class = 4;
+static uint32_t psn;
+static bool psn_set;
+static bool hs_active;				// switched by CMD6
+static bool verbose;
+
+// Card
+static bool spi_mode;				// CMD0 received
+static bool idle;					// idle state until ACMD41 passed
+static bool app;					// CMD55 received, next is ACMD
+static uint64_t init_start;			// first ACMD41
+
+// Command on MOSI
+static uint8_t cmd[6];
+static uint8_t cmd_len;
+
+// Output on MISO
+static uint8_t out;					// OUT_*
+static uint8_t out_next;			// state after the response
+static uint8_t resp[5];
+static uint8_t resp_len, resp_pos, resp_wait;
+static uint64_t ready;				// end of access or busy time
+static bool multi;					// CMD18 in progress
+static uint32_t sector;				// next sector to send
+static uint8_t block[512 + 2];		// data and CRC
+static uint16_t block_pos, block_len;
+static bool reg;					// block is a register, not a sector
+
+// Statistics
+static struct {
+	uint32_t cmds;					// commands
+	uint32_t single;				// CMD17
+	uint32_t multi;					// CMD18
+	uint32_t blocks;				// data blocks sent
+	uint64_t ncr;					// bytes waiting for responses
+	uint64_t token;					// bytes waiting for data tokens
+	uint64_t busy;					// bytes waiting for busy end
+	uint64_t bytes;					// bytes with CS low
+} st;
+
+
+// -----------------------------------------------------------------------------
+// Description: CRC16 of a data block, polynom 0x1021, start value 0
+//
+// Return: CRC
+// -----------------------------------------------------------------------------
+static uint16_t
+crc16(const uint8_t *p, uint16_t len)	{
+
+	uint16_t crc = 0;
+	uint8_t i;
+
+	while(len--)	{
+
+		crc ^= (uint16_t)*p++ << 8;
+		for(i = 0; i < 8; i++)
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+
+	return(crc);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Read the next sector of the image into the block buffer
+//
+// Return: true on success
+// -----------------------------------------------------------------------------
+static bool
+load_block(void)	{
+
+	uint16_t crc;
+
+	if(sector >= sectors ||
+	   pread(img, block, 512, (off_t)sector * 512) != 512)
+		return(false);
+
+	crc = crc16(block, 512);
+	block[512] = crc >> 8;
+	block[513] = crc;
+	block_pos = 0;
+	block_len = 512 + 2;
+
+	sector++;
+	st.blocks++;
+	hal_stats.sd_sectors++;
+
+	return(true);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Load a register or status block of len bytes
+//
+// Details: The data token follows the response without access time.
+//
+// Return: void
+// -----------------------------------------------------------------------------
+static void
+load_reg(uint16_t len)	{
+
+	uint16_t crc = crc16(block, len);
+
+	block[len] = crc >> 8;
+	block[len + 1] = crc;
+	block_pos = 0;
+	block_len = len + 2;
+	reg = true;
+	multi = false;
+	ready = hal_now();
+}
+
+// -----------------------------------------------------------------------------
+// Description: CSD of the image, ver 2.0 for SDHC, ver 1.0 for SDSC
+//
+// Return: void
+// -----------------------------------------------------------------------------
+static void
+load_csd(void)	{
+
+	uint32_t c;
+	uint8_t m = 0;
+
+	memset(block, 0, 16);
+	block[1] = 0x0E;					// TAAC 1ms
+	block[3] = hs_active ? 0x5A : 0x32;	// TRAN_SPEED 50 or 25MHz
+	block[4] = 0x5B;					// CCC 0x5B5, class 10 switch
+	block[5] = 0x59;					// READ_BL_LEN 512
+	block[15] = 0x01;
+
+	if(hc)	{
+
+		c = sectors >> 10;				// C_SIZE of 512kB
+		c = c ? c - 1 : 0;
+		block[0] = 0x40;
+		block[7] = (c >> 16) & 0x3F;
+		block[8] = c >> 8;
+		block[9] = c;
+	} else {
+
+		while(m < 7 && (sectors >> (m + 2)) > 4096)
+			m++;
+		c = sectors >> (m + 2);			// ( C_SIZE + 1 ) << ( C_SIZE_MULT + 2 )
+		c = c ? c - 1 : 0;
+		block[6] = (c >> 10) & 3;
+		block[7] = c >> 2;
+		block[8] = c << 6;
+		block[9] = m >> 1;
+		block[10] = m << 7;
+	}
+
+	load_reg(16);
+}
+
+// -----------------------------------------------------------------------------
+// Description: CID of the emulated card
+//
+// Return: void
+// -----------------------------------------------------------------------------
+static void
+load_cid(void)	{
+
+	memset(block, 0, 16);
+	memcpy(&block[1], "HBEMUSD", 7);	// OID and PNM
+	block[8] = 0x10;					// PRV 1.0
+	block[9] = psn >> 24;
+	block[10] = psn >> 16;
+	block[11] = psn >> 8;
+	block[12] = psn;
+	block[13] = 0x01;					// MDT 2024-01
+	block[14] = 0x81;
+	block[15] = 0x01;
+
+	load_reg(16);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Status of CMD6, function 1 of group 1 is high speed
+//
+// Details: Bit 31 of arg switches, otherwise the function is queried only.
+//
+// Return: void
+// -----------------------------------------------------------------------------
+static void
+load_switch(uint32_t arg)	{
+
+	uint8_t fn = arg & 0x0F;
+
+	memset(block, 0, 64);
+	block[1] = hs ? 200 : 100;			// max. current mA
+	block[13] = hs ? 0x03 : 0x01;		// group 1 functions supported
+
+	if(fn == 0x0F)
+		fn = hs_active ? 1 : 0;			// no change
+	else if(fn > 1 || (fn && !hs))
+		fn = 0x0F;						// not supported
+	else if(arg & 0x80000000UL)
+		hs_active = fn;
+
+	block[16] = fn;
+
+	load_reg(64);
+}
+
+// -----------------------------------------------------------------------------
+// Description: SD status of ACMD13, speed class only
+//
+// Return: void
+// -----------------------------------------------------------------------------
+static void
+load_status(void)	{
+
+	memset(block, 0, 64);
+	block[8] = speed_class == 10 ? 4 : speed_class / 2;
+
+	load_reg(64);
+}
+
+static void
+respond(uint8_t r1, uint8_t len, uint8_t next)	{
+
+	resp[0] = r1;
+	resp_len = len;
+	resp_pos = 0;
+	resp_wait = ncr;
+	out = OUT_RESP;
+	out_next = next;
+}
+
+// -----------------------------------------------------------------------------
+// Description: Execute a complete command of 6 bytes
+//
+// Details: The CRC is not checked, mmc.c sends a valid one only for CMD0 and
+// CMD8. Other commands than the ones of mmc.c are illegal.
+//
+// Called by: card_xfer()
+//
+// Return: void
+// -----------------------------------------------------------------------------
+static void
+command(void)	{
+
+	uint8_t index = cmd[0] & 0x3F, acmd = app;
+	uint32_t arg = ((uint32_t)cmd[1] << 24) | ((uint32_t)cmd[2] << 16) |
+				   ((uint32_t)cmd[3] << 8) | cmd[4];
+	uint8_t r1 = idle ? R1_IDLE : 0;
+
+	st.cmds++;
+	app = false;
+
+	if(verbose)
+		fprintf(stderr, "%10.3f sd: %sCMD%d 0x%08lx\n",
+				(double)hal_now() / HAL_MS(1), acmd ? "A" : "",
+				index, (unsigned long)arg);
+
+	// before CMD0 the card is in SD mode and does not answer
+	if(!spi_mode && index != 0)
+		return;
+
+	switch(index)	{
+
+		case 0:							// GO_IDLE_STATE
+			spi_mode = idle = true;
+			multi = false;
+			hs_active = false;
+			init_start = 0;
+			respond(R1_IDLE, 1, OUT_IDLE);
+			break;
+
+		case 8:							// SEND_IF_COND, echo voltage and pattern
+			resp[1] = 0;
+			resp[2] = 0;
+			resp[3] = cmd[3] & 0x0F;
+			resp[4] = cmd[4];
+			respond(r1, 5, OUT_IDLE);
+			break;
+
+		case 55:						// APP_CMD
+			app = true;
+			respond(r1, 1, OUT_IDLE);
+			break;
+
+		case 41:						// SD_SEND_OP_COND
+			if(!acmd)	{
+				respond(r1 | R1_ILLEGAL, 1, OUT_IDLE);
+				break;
+			}
+
+			if(!init_start)
+				init_start = hal_now();
+			if(hal_now() - init_start >= init)
+				idle = false;
+
+			respond(idle ? R1_IDLE : 0, 1, OUT_IDLE);
+			break;
+
+		case 58:						// READ_OCR, 3.2..3.4V, power up and CCS
+			resp[1] = idle ? 0 : 0x80 | (hc ? 0x40 : 0);
+			resp[2] = 0xFF;
+			resp[3] = 0x80;
+			resp[4] = 0;
+			respond(r1, 5, OUT_IDLE);
+			break;
+
+		case 16:						// SET_BLOCKLEN, only 512 bytes
+			respond(r1 | (arg == 512 ? 0 : R1_PARAM), 1, OUT_IDLE);
+			break;
+
+		case 17:						// READ_SINGLE_BLOCK
+		case 18:						// READ_MULTIPLE_BLOCK
+			if(idle)	{
+				respond(r1 | R1_ILLEGAL, 1, OUT_IDLE);
+				break;
+			}
+
+			sector = hc ? arg : arg / 512;
+			if((!hc && (arg & 511)) || sector >= sectors)	{
+				respond(R1_ADDRESS, 1, OUT_IDLE);
+				break;
+			}
+
+			if(index == 17)
+				st.single++;
+			else
+				st.multi++;
+
+			multi = index == 18;
+			reg = false;
+			ready = hal_now() + acc;
+			respond(0, 1, OUT_TOKEN);
+			break;
+
+		case 9:							// SEND_CSD
+		case 10:						// SEND_CID
+			if(idle)	{
+				respond(r1 | R1_ILLEGAL, 1, OUT_IDLE);
+				break;
+			}
+
+			if(index == 9)
+				load_csd();
+			else
+				load_cid();
+			respond(0, 1, OUT_TOKEN);
+			break;
+
+		case 6:							// SWITCH_FUNC
+			if(idle)	{
+				respond(r1 | R1_ILLEGAL, 1, OUT_IDLE);
+				break;
+			}
+
+			load_switch(arg);
+			respond(0, 1, OUT_TOKEN);
+			break;
+
+		case 13:						// SD_STATUS, R2
+			if(idle || !acmd)	{
+				respond(r1 | R1_ILLEGAL, 1, OUT_IDLE);
+				break;
+			}
+
+			load_status();
+			resp[1] = 0;
+			respond(0, 2, OUT_TOKEN);
+			break;
+
+		case 12:						// STOP_TRANSMISSION
+			// the byte after the command is a stuff byte
+			multi = false;
+			ready = hal_now() + busy;
+			respond(r1, 1, OUT_BUSY);
+			resp_wait++;
+			break;
+
+		default:
+			respond(r1 | R1_ILLEGAL, 1, OUT_IDLE);
+			break;
+	}
+}
+
+// -----------------------------------------------------------------------------
+// Description: Next byte of the card on MISO
+//
+// Called by: card_xfer()
+//
+// Return: byte
+// -----------------------------------------------------------------------------
+static uint8_t
+output(void)	{
+
+	uint8_t rx;
+
+	switch(out)	{
+
+		case OUT_RESP:
+			if(resp_wait)	{
+				resp_wait--;
+				st.ncr++;
+				return(0xFF);
+			}
+
+			rx = resp[resp_pos++];
+			if(resp_pos == resp_len)
+				out = out_next;
+			return(rx);
+
+		case OUT_TOKEN:
+			if(hal_now() < ready)	{
+				st.token++;
+				return(0xFF);
+			}
+
+			if(!reg && !load_block())	{
+				out = OUT_IDLE;
+				multi = false;
+				return(0x08);			// data error token: out of range
+			}
+
+			out = OUT_DATA;
+			return(TOKEN_START);
+
+		case OUT_DATA:
+			rx = block[block_pos++];
+			if(block_pos == block_len)	{
+
+				if(multi)	{
+					ready = hal_now() + blk;
+					out = OUT_TOKEN;
+				} else
+					out = OUT_IDLE;
+			}
+			return(rx);
+
+		case OUT_BUSY:
+			if(hal_now() < ready)	{
+				st.busy++;
+				return(0x00);
+			}
+
+			out = OUT_IDLE;
+			return(0xFF);
+	}
+
+	return(0xFF);
+}
+
+// -----------------------------------------------------------------------------
+// Description: One byte on the SPI bus while CS is low
+//
+// Details: MISO and MOSI are shifted at the same time: the card sends its
+// next byte and receives the command bytes. A command starts with a byte
+// 01xxxxxx, also while a block of CMD18 is sent.
+//
+// Called by: hal_spi_xfer()
+//
+// Return: byte on MISO
+// -----------------------------------------------------------------------------
+static uint8_t
+card_xfer(uint8_t data)	{
+
+	uint8_t rx = output();
+
+	st.bytes++;
+
+	if(cmd_len || (data & 0xC0) == 0x40)	{
+
+		cmd[cmd_len++] = data;
+		if(cmd_len == sizeof(cmd))	{
+			cmd_len = 0;
+			command();
+		}
+	}
+
+	return(rx);
+}
+
+static void
+card_select(bool active)	{
+
+	// a command is only taken complete
+	cmd_len = 0;
+}
+
+static const hal_spi_t card = {"sd", card_select, card_xfer};
+
+static void
+card_report(void)	{
+
+	fprintf(stderr, "sd: %lu commands, CMD17 %lu, CMD18 %lu, %lu blocks, "
+			"wait bytes: response %llu, token %llu, busy %llu, "
+			"%llu bytes selected\n",
+			(unsigned long)st.cmds, (unsigned long)st.single,
+			(unsigned long)st.multi, (unsigned long)st.blocks,
+			(unsigned long long)st.ncr, (unsigned long long)st.token,
+			(unsigned long long)st.busy, (unsigned long long)st.bytes);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Parse the options "key=value,..."
+//
+// Return: 0 on success otherwise -1
+// -----------------------------------------------------------------------------
+static int
+parse(const char *arg)	{
+
+	const char *val;
+	size_t len;
+	char *end;
+	double v;
+
+	while(*arg)	{
+
+		len = strcspn(arg, ",");
+		if(!(val = memchr(arg, '=', len)))
+			return(-1);
+		val++;
+
+		v = strtod(val, &end);
+		if(end != arg + len || v < 0)
+			return(-1);
+		else if(!strncmp(arg, "ncr=", 4) && v >= 1 && v <= 8)
+			ncr = v;
+		else if(!strncmp(arg, "acc=", 4))
+			acc = v * HAL_US(1);
+		else if(!strncmp(arg, "blk=", 4))
+			blk = v * HAL_US(1);
+		else if(!strncmp(arg, "init=", 5))
+			init = v * HAL_US(1000);
+		else if(!strncmp(arg, "busy=", 5))
+			busy = v * HAL_US(1);
+		else if(!strncmp(arg, "hc=", 3))
+			hc = v != 0;
+		else if(!strncmp(arg, "hs=", 3))
+			hs = v != 0;
+		else if(!strncmp(arg, "class=", 6) && (v == 10 || (v <= 6 &&
+				!((int)v & 1))))
+			speed_class = v;
+		else if(!strncmp(arg, "psn=", 4))	{
+			psn = v;
+			psn_set = true;
+		} else if(!strncmp(arg, "v=", 2))
+			verbose = v != 0;
+		else
+			return(-1);
+
+		arg += len;
+		if(*arg)
+			arg++;
+	}
+
+	return(0);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Open the image and insert the card
+//
+// Details: spec is "image" or "image:key=value,..."
+//
+// Called by: host main
+//
+// Return: 0 on success otherwise -1
+// -----------------------------------------------------------------------------
+int
+hal_sd_open(const char *spec)	{
+
+	const char *opt = strrchr(spec, ':');
+	char path[256];
+	struct stat sb;
+	size_t len;
+
+	if(opt && !strchr(opt, '='))
+		opt = 0;
+
+	len = opt ? (size_t)(opt - spec) : strlen(spec);
+	if(len >= sizeof(path))
+		return(-1);
+	memcpy(path, spec, len);
+	path[len] = 0;
+
+	acc = HAL_US(400);
+	blk = HAL_US(100);
+	init = HAL_MS(10);
+	busy = HAL_US(50);
+
+	if(opt && parse(opt + 1))	{
+		fprintf(stderr, "sd: invalid options %s\n", opt + 1);
+		return(-1);
+	}
+
+	if((img = open(path, O_RDONLY)) < 0 || fstat(img, &sb))
+		return(-1);
+
+	sectors = sb.st_size / 512;
+	if(!psn_set)
+		psn = sb.st_ino;
+	hal_spi_attach(HAL_CS_SD, &card);
+	atexit(card_report);
+
+	return(0);
+}
@@ -0,0 +1,132 @@
+/*
+* ----------------------------------------------------------------------------
+* Host build: SD card back end on a FAT image file
+*
+* Low level disk interface of FatFs like mmc.c, sectors are read from an
+* image file. The SPI time of mmc.c for a single block read is added per
+* sector, so the timing follows the real card access. The SPI clock is set
+* like mmc.c does for a card of 25MHz without high speed, the registers of
+* the card are not emulated.
+*
+*  Version: 0.0.1
+*
+* "THE BEER-WARE LICENSE" (Revision 42):
+* <karsten@rhen.de> wrote this file. As long as you retain this notice you
+* can do whatever you want with this stuff. If we meet some day, and you think
+* this stuff is worth it, you can buy me a beer in Flensburg, Germany
+* ----------------------------------------------------------------------------
+*/
+
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <avr/io.h>
+#include "hal.h"
+#include "mmc.h"
+
+// SPI bytes of mmc.c per sector: wait ready, command, response, data token,
+// data, CRC and deselect
+#define SPI_SECTOR	(1 + 6 + 1 + 1 + 512 + 2 + 1)
+
+// SPI bytes of disk_initialize(): dummy clocks, CMD0, CMD8, ACMD41, CMD58,
+// CMD9 with the CSD and CMD6 with the switch status
+#define SPI_INIT	(100 + 4 * 9 + 4 + 4 + 2 * (9 + 1) + 16 + 64 + 2 * 2)
+
+static mmc_clock_t Clock;
+
+static int img = -1;
+static volatile DSTATUS Stat = STA_NOINIT;
+
+int
+hal_sd_open(const char *path)	{
+
+	img = open(path, O_RDONLY);
+	return(img < 0 ? -1 : 0);
+}
+
+DSTATUS
+disk_initialize(BYTE pdrv)	{
+
+	Clock.spi_khz = spi_clock(SPI_INIT_KHZ);
+	hal_spi_spend(SPI_INIT);
+
+	if(img >= 0)	{
+		Stat &= ~STA_NOINIT;
+		Clock.tran_khz = 25000;
+		Clock.hs = HS_SUPPORTED;
+		Clock.spi_khz = spi_clock(SPI_MAX_KHZ);
+	}
+
+	return(Stat);
+}
+
+DSTATUS
+disk_status(BYTE pdrv)	{
+
+	return(Stat);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Read sectors of the image
+//
+// Details: Every sector is read by a single block command like mmc.c does,
+// see disk_read() there.
+//
+// Called by: FatFS API in ff.c
+//
+// Return: Status byte
+// ----------------------------------------------------------------------------
+DRESULT
+disk_read(BYTE pdrv, BYTE *buff, DWORD sector, UINT count)	{
+
+	if(pdrv || !count)
+		return RES_PARERR;
+
+	if(Stat & STA_NOINIT)
+		return RES_NOTRDY;
+
+	for(; count; count--, sector++, buff += 512)	{
+
+		hal_stats.sd_sectors++;
+		hal_spi_spend(SPI_SECTOR);
+
+		if(pread(img, buff, 512, (off_t)sector * 512) != 512)
+			return RES_ERROR;
+	}
+
+	return RES_OK;
+}
+
+// -----------------------------------------------------------------------------
+// Description: Card state like mmc.c, without the card registers
+//
+// Called by: sd.c
+//
+// Return: Status byte
+// ----------------------------------------------------------------------------
+DRESULT
+disk_ioctl(BYTE pdrv, BYTE cmd, void *buff)	{
+
+	if(pdrv)
+		return RES_PARERR;
+
+	if(Stat & STA_NOINIT)
+		return RES_NOTRDY;
+
+	switch(cmd)	{
+
+		case GET_SECTOR_COUNT:
+			*(DWORD*)buff = lseek(img, 0, SEEK_END) / 512;
+			return RES_OK;
+
+		case MMC_GET_TYPE:
+			*(BYTE*)buff = CT_SD2 | CT_BLOCK;
+			return RES_OK;
+
+		case MMC_GET_CLOCK:
+			*(mmc_clock_t*)buff = Clock;
+			return RES_OK;
+	}
+
+	return RES_PARERR;
+}
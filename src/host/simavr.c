@@ -0,0 +1,388 @@
+/*
+* ----------------------------------------------------------------------------
+* Cycle benchmark: main.elf under simavr
+*
+* Runs the firmware built with BENCH on a simulated ATmega328P at F_CPU.
+* The register level MCP2515, the SPI level SD card and the CAN back ends of
+* the host build are attached to the SPI pins, CS lines and INT0 of the
+* simulated AVR. This file provides the part of hal.h these models use on
+* the cycle counter of simavr.
+*
+* The device is plugged in and the START key held down from the beginning.
+* The firmware writes BENCH_* markers to GPIOR1 ( see debug.h ), the cycles
+* of each phase are counted until the next marker. The run ends with
+* BENCH_DONE, the result is printed as CSV to stdout:
+*
+*   phase,entries,cycles,min,max,per_block
+*
+* Usage: simbench [-c can] [-s image[:options]] [-o console] [-l seconds] elf
+*
+*  Version: 0.0.1
+*
+* "THE BEER-WARE LICENSE" (Revision 42):
+* <karsten@rhen.de> wrote this file. As long as you retain this notice you
+* can do whatever you want with this stuff. If we meet some day, and you think
+* this stuff is worth it, you can buy me a beer in Flensburg, Germany
+* ----------------------------------------------------------------------------
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <simavr/sim_avr.h>
+#include <simavr/sim_elf.h>
+#include <simavr/sim_irq.h>
+#include <simavr/sim_io.h>
+#include <simavr/sim_cycle_timers.h>
+#include <simavr/avr_ioport.h>
+#include <simavr/avr_spi.h>
+#include <simavr/avr_uart.h>
+
+#include "hal.h"
+#include "debug.h"
+
+#define SIM_MCU		"atmega328p"
+#define SIM_GPIOR1	0x4A			// data address of GPIOR1
+#define SIM_PHASES	7				// BENCH_OTHER .. BENCH_ACK
+
+static avr_t *avr;
+static const hal_spi_t *spi_dev[HAL_CS_MAX];
+static uint8_t spi_cs = 0xFF;		// chip select lines, low active
+static hal_dev_t *devs;
+static FILE *console;
+
+static avr_irq_t *spi_in;			// MISO to the AVR
+static avr_irq_t *int0_pin;			// PD2, MCP2515 INT
+static avr_irq_t *pres_pin;			// PC5, DEV_PRESENT
+static avr_irq_t *key_pin;			// PD7, START key
+
+hal_stats_t hal_stats;
+
+// Cycles of the benchmark phases
+static const char *const phase_name[SIM_PHASES] = {
+	"other", "mount", "catalog", "version", "crc", "stream", "ack"
+};
+
+static struct {
+	uint32_t entries;
+	uint64_t cycles, min, max;
+} phase[SIM_PHASES];
+
+static uint8_t cur;					// current phase
+static uint64_t since;				// cycle of the last marker
+static uint32_t blocks;
+static bool done;
+
+
+// -----------------------------------------------------------------------------
+// ---------*** HAL on simavr ***-----------------------------------------------
+// -----------------------------------------------------------------------------
+
+uint64_t
+hal_now(void)	{
+
+	return(avr->cycle);
+}
+
+static avr_cycle_count_t dev_timer(avr_t *avr, avr_cycle_count_t when,
+								   void *param);
+
+// -----------------------------------------------------------------------------
+// Description: Schedule the next event of the emulated devices
+//
+// Details: One cycle timer of simavr runs the devices. It is set again after
+// each change of their state by the AVR ( SPI byte, CS line ).
+//
+// Return: void
+// -----------------------------------------------------------------------------
+static void
+dev_schedule(void)	{
+
+	hal_dev_t *dev;
+	uint64_t next = HAL_NEVER, t;
+
+	for(dev = devs; dev; dev = dev->link)	{
+		if((t = dev->next()) < next)
+			next = t;
+	}
+
+	avr_cycle_timer_cancel(avr, dev_timer, 0);
+
+	if(next != HAL_NEVER)
+		avr_cycle_timer_register(avr, next > avr->cycle ? next - avr->cycle : 1,
+								 dev_timer, 0);
+}
+
+static avr_cycle_count_t
+dev_timer(avr_t *avr, avr_cycle_count_t when, void *param)	{
+
+	hal_dev_t *dev;
+
+	for(dev = devs; dev; dev = dev->link)	{
+		if(dev->next() <= avr->cycle)
+			dev->run(avr->cycle);
+	}
+
+	dev_schedule();
+	return(0);
+}
+
+void
+hal_dev_add(hal_dev_t *dev)	{
+
+	dev->link = devs;
+	devs = dev;
+}
+
+void
+hal_irq_line(uint8_t irq, bool active)	{
+
+	// INT0 of the MCP2515 is low active
+	if(irq == HAL_IRQ_INT0)
+		avr_raise_irq(int0_pin, !active);
+}
+
+void
+hal_spi_attach(uint8_t cs, const hal_spi_t *spi)	{
+
+	spi_dev[cs] = spi;
+}
+
+// -----------------------------------------------------------------------------
+// Description: Byte sent by the SPI master, answer on MISO
+//
+// Called by: simavr at the end of the transfer
+//
+// Return: void
+// -----------------------------------------------------------------------------
+static void
+spi_hook(struct avr_irq_t *irq, uint32_t value, void *param)	{
+
+	uint8_t cs, rx = 0xFF;
+
+	for(cs = 0; cs < HAL_CS_MAX; cs++)	{
+
+		if(!(spi_cs & (1 << cs)) && spi_dev[cs] && spi_dev[cs]->xfer)	{
+			rx = spi_dev[cs]->xfer(value);
+			break;
+		}
+	}
+
+	hal_stats.spi_bytes++;
+	avr_raise_irq(spi_in, rx);
+	dev_schedule();
+}
+
+// -----------------------------------------------------------------------------
+// Description: CS line changed, param is the HAL_CS_* number
+//
+// Return: void
+// -----------------------------------------------------------------------------
+static void
+cs_hook(struct avr_irq_t *irq, uint32_t value, void *param)	{
+
+	uint8_t cs = (uintptr_t)param, old = spi_cs;
+
+	if(value)
+		spi_cs |= (1 << cs);
+	else
+		spi_cs &= ~(1 << cs);
+
+	if(((old ^ spi_cs) & (1 << cs)) && spi_dev[cs] && spi_dev[cs]->select)
+		spi_dev[cs]->select(!value);
+
+	dev_schedule();
+}
+
+static void
+uart_hook(struct avr_irq_t *irq, uint32_t value, void *param)	{
+
+	if(console)
+		fputc(value, console);
+}
+
+
+// -----------------------------------------------------------------------------
+// ---------*** Benchmark phases ***--------------------------------------------
+// -----------------------------------------------------------------------------
+
+// -----------------------------------------------------------------------------
+// Description: Marker written to GPIOR1 by the firmware
+//
+// Details: The cycles since the last marker belong to the current phase.
+// BENCH_BLOCK only counts a block, BENCH_DONE stops the simulation.
+//
+// Called by: simavr on write to GPIOR1
+//
+// Return: void
+// -----------------------------------------------------------------------------
+static void
+marker(avr_t *avr, avr_io_addr_t addr, uint8_t v, void *param)	{
+
+	uint64_t c = avr->cycle - since;
+
+	avr->data[addr] = v;
+
+	if(v == BENCH_BLOCK)	{
+		blocks++;
+		return;
+	}
+
+	if(v != cur)	{
+
+		phase[cur].entries++;
+		phase[cur].cycles += c;
+		if(!phase[cur].min || c < phase[cur].min)
+			phase[cur].min = c;
+		if(c > phase[cur].max)
+			phase[cur].max = c;
+
+		since = avr->cycle;
+	}
+
+	if(v == BENCH_DONE)
+		done = true;
+	else if(v < SIM_PHASES)
+		cur = v;
+}
+
+static void
+report(const char *elf)	{
+
+	uint64_t total = 0;
+	uint8_t i;
+
+	printf("phase,entries,cycles,min,max,per_block\n");
+
+	for(i = 0; i < SIM_PHASES; i++)	{
+
+		total += phase[i].cycles;
+		printf("%s,%lu,%llu,%llu,%llu,%llu\n", phase_name[i],
+				(unsigned long)phase[i].entries,
+				(unsigned long long)phase[i].cycles,
+				(unsigned long long)phase[i].min,
+				(unsigned long long)phase[i].max,
+				(unsigned long long)(blocks ? phase[i].cycles / blocks : 0));
+	}
+
+	printf("blocks,%lu,0,0,0,0\n", (unsigned long)blocks);
+	printf("total,1,%llu,0,0,0\n", (unsigned long long)total);
+
+	fprintf(stderr, "%s: %s after %.3fs, spi=%llu can tx=%llu rx=%llu "
+			"lost=%llu sd=%llu\n", elf, done ? "done" : "NOT done",
+			(double)avr->cycle / F_CPU,
+			(unsigned long long)hal_stats.spi_bytes,
+			(unsigned long long)hal_stats.can_tx,
+			(unsigned long long)hal_stats.can_rx,
+			(unsigned long long)hal_stats.can_lost,
+			(unsigned long long)hal_stats.sd_sectors);
+}
+
+static void
+usage(const char *prog)	{
+
+	fprintf(stderr,
+		"usage: %s [options] main.elf\n"
+		"  -c can      CAN back end, default gb:\n", prog);
+	hal_can_list(stderr);
+	fprintf(stderr,
+		"  -s image    FAT image of the SD card, image[:key=value,...]\n"
+		"  -o console  UART output: null ( default ), - ( stderr ) or file\n"
+		"  -l seconds  limit of simulated time, default 600\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)	{
+
+	const char *can = "gb", *img = 0, *con = "null";
+	double limit = 600;
+	elf_firmware_t fw;
+	uint32_t flags;
+	int opt, state;
+
+	while((opt = getopt(argc, argv, "c:s:o:l:h")) != -1)	{
+
+		switch(opt)	{
+			case 'c': can = optarg; break;
+			case 's': img = optarg; break;
+			case 'o': con = optarg; break;
+			case 'l': limit = atof(optarg); break;
+			default: usage(argv[0]);
+		}
+	}
+
+	if(optind >= argc || !img)
+		usage(argv[0]);
+
+	memset(&fw, 0, sizeof(fw));
+	if(elf_read_firmware(argv[optind], &fw))	{
+		perror(argv[optind]);
+		return(1);
+	}
+
+	if(!(avr = avr_make_mcu_by_name(SIM_MCU)))
+		return(1);
+
+	avr_init(avr);
+	avr->frequency = F_CPU;
+	avr_load_firmware(avr, &fw);
+
+	if(!strcmp(con, "-"))
+		console = stderr;
+	else if(strcmp(con, "null") && !(console = fopen(con, "w")))	{
+		perror(con);
+		return(1);
+	}
+
+	// pins and SPI
+	spi_in = avr_io_getirq(avr, AVR_IOCTL_SPI_GETIRQ(0), SPI_IRQ_INPUT);
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_SPI_GETIRQ(0),
+						    SPI_IRQ_OUTPUT), spi_hook, 0);
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'), 2),
+							cs_hook, (void *)(uintptr_t)HAL_CS_MCP);
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'), 1),
+							cs_hook, (void *)(uintptr_t)HAL_CS_SD);
+
+	int0_pin = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('D'), 2);
+	pres_pin = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('C'), 5);
+	key_pin = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('D'), 7);
+
+	// console on the UART, without the stdio dump of simavr
+	avr_ioctl(avr, AVR_IOCTL_UART_GET_FLAGS('0'), &flags);
+	flags &= ~AVR_UART_FLAG_STDIO;
+	avr_ioctl(avr, AVR_IOCTL_UART_SET_FLAGS('0'), &flags);
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'),
+							UART_IRQ_OUTPUT), uart_hook, 0);
+
+	avr_register_io_write(avr, SIM_GPIOR1, marker, 0);
+
+	if(hal_can_open(can))	{
+		fprintf(stderr, "can not open CAN back end %s\n", can);
+		return(1);
+	}
+
+	if(hal_sd_open(img))	{
+		perror(img);
+		return(1);
+	}
+
+	// device plugged in and START key pressed
+	avr_raise_irq(int0_pin, 1);
+	avr_raise_irq(pres_pin, 0);
+	avr_raise_irq(key_pin, 0);
+	dev_schedule();
+
+	do
+		state = avr_run(avr);
+	while(!done && avr->cycle < limit * F_CPU &&
+		  state != cpu_Done && state != cpu_Crashed);
+
+	if(console)
+		fflush(console);
+	report(argv[optind]);
+
+	return(done ? 0 : 1);
+}
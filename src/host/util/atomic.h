@@ -0,0 +1,42 @@
+/*
+* ----------------------------------------------------------------------------
+* Host build: atomic blocks on the emulated interrupt flag
+*
+*  Version: 0.0.1
+*
+* "THE BEER-WARE LICENSE" (Revision 42):
+* <karsten@rhen.de> wrote this file. As long as you retain this notice you
+* can do whatever you want with this stuff. If we meet some day, and you think
+* this stuff is worth it, you can buy me a beer in Flensburg, Germany
+* ----------------------------------------------------------------------------
+*/
+
+#ifndef HOST_UTIL_ATOMIC_H
+#define HOST_UTIL_ATOMIC_H
+
+#include "hal.h"
+
+static inline uint8_t
+hal_irq_save(void)	{
+
+	uint8_t sreg = hal_sreg;
+
+	hal_cli();
+	return(sreg);
+}
+
+static inline void
+hal_irq_restore(const uint8_t *sreg)	{
+
+	if(*sreg & (1 << HAL_SREG_I))
+		hal_sei();
+}
+
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_FORCEON
+
+#define ATOMIC_BLOCK(type)	\
+	for(uint8_t hal_sreg_save __attribute__((cleanup(hal_irq_restore))) = \
+		hal_irq_save(), hal_todo = 1; hal_todo; hal_todo = 0)
+
+#endif
@@ -0,0 +1,22 @@
+/*
+* ----------------------------------------------------------------------------
+* Host build: busy wait delays advance the emulated clock
+*
+*  Version: 0.0.1
+*
+* "THE BEER-WARE LICENSE" (Revision 42):
+* <karsten@rhen.de> wrote this file. As long as you retain this notice you
+* can do whatever you want with this stuff. If we meet some day, and you think
+* this stuff is worth it, you can buy me a beer in Flensburg, Germany
+* ----------------------------------------------------------------------------
+*/
+
+#ifndef HOST_UTIL_DELAY_H
+#define HOST_UTIL_DELAY_H
+
+#include "hal.h"
+
+#define _delay_us(us)	hal_delay_us(us)
+#define _delay_ms(ms)	hal_delay_us((ms) * 1000.0)
+
+#endif
@@ -0,0 +1,202 @@
+/*
+* ----------------------------------------------------------------------------
+* Latency histograms of the update protocol
+*
+* The time of a request is taken when it was handed to the CAN controller,
+* the time of the reply when the INT0 interrupt received it. So the request
+* latency is the time of the device plus the bus, the turnaround the time
+* we need to answer. All times in us of get_time_us().
+*
+*  Version: 0.0.1
+*  
+* "THE BEER-WARE LICENSE" (Revision 42):
+* <karsten@rhen.de> wrote this file. As long as you retain this notice you
+* can do whatever you want with this stuff. If we meet some day, and you think
+* this stuff is worth it, you can buy me a beer in Flensburg, Germany
+* ----------------------------------------------------------------------------
+*/
+
+#include <avr/io.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <avr/pgmspace.h>
+
+#include "main.h"
+
+#if defined(LATENCY)
+
+typedef struct {
+	uint16_t bin[LAT_BINS];		// counts, saturate at 0xFFFF
+	uint16_t n;
+	uint32_t min, max, sum;
+} lat_hist_t;
+
+static lat_hist_t hist[LAT_MAX];
+static const char lat_name[LAT_MAX][5] PROGMEM = {
+	"cfg", "blkn", "crc", "turn"};
+
+static uint8_t req_kind = LAT_MAX;	// pending request, LAT_MAX none
+static uint32_t req_time;
+static bool turn_armed;				// handled message not answered yet
+static uint32_t turn_time;
+
+// -----------------------------------------------------------------------------
+// Description: Add a latency to a histogram
+//
+// Called by: lat_reply(), lat_send()
+//
+// Return: void
+// -----------------------------------------------------------------------------
+static void
+lat_add(uint8_t kind, uint32_t us)	{
+
+	lat_hist_t *h = &hist[kind];
+	uint32_t lim = us / LAT_BIN0;
+	uint8_t b = 0;
+
+	while(lim && b < LAT_BINS - 1)	{
+		lim >>= 1;
+		b++;
+	}
+
+	if(h->bin[b] < 0xFFFF)
+		h->bin[b]++;
+
+	if(h->n < 0xFFFF)	{
+		h->n++;
+		h->sum += us;
+	}
+
+	if(us < h->min)
+		h->min = us;
+	if(us > h->max)
+		h->max = us;
+}
+
+// -----------------------------------------------------------------------------
+// Description: Clear all histograms, start of a session
+//
+// Called by: main
+//
+// Return: void
+// -----------------------------------------------------------------------------
+void
+lat_reset(void)	{
+
+	uint8_t i;
+
+	memset(hist, 0, sizeof(hist));
+	for(i = 0; i < LAT_MAX; i++)
+		hist[i].min = UINT32_MAX;
+
+	req_kind = LAT_MAX;
+	turn_armed = false;
+}
+
+// -----------------------------------------------------------------------------
+// Description: A request was sent, wait for its reply
+//
+// Details: A later request of the same kind restarts the measurement, e.g.
+// each snd_cfStream() of a block.
+//
+// Called by: process functions after sending the request
+//
+// Return: void
+// -----------------------------------------------------------------------------
+void
+lat_request(uint8_t kind)	{
+
+	req_kind = kind;
+	req_time = get_time_us();
+}
+
+// -----------------------------------------------------------------------------
+// Description: The message last read is the reply of the given kind
+//
+// Details: Counted only if a request of this kind is pending. The message is
+// handled in any case, so the next frame sent is our turnaround.
+//
+// Called by: process functions after reading the reply
+//
+// Return: void
+// -----------------------------------------------------------------------------
+void
+lat_reply(uint8_t kind)	{
+
+	uint32_t stamp = get_rx_stamp();
+
+	if(req_kind == kind)
+		lat_add(kind, stamp - req_time);
+
+	req_kind = LAT_MAX;
+	turn_time = stamp;
+	turn_armed = true;
+}
+
+// -----------------------------------------------------------------------------
+// Description: A frame was handed to the CAN controller
+//
+// Called by: protocol send functions
+//
+// Return: void
+// -----------------------------------------------------------------------------
+void
+lat_send(void)	{
+
+	if(turn_armed)	{
+		lat_add(LAT_TURN, get_time_us() - turn_time);
+		turn_armed = false;
+	}
+}
+
+// -----------------------------------------------------------------------------
+// Description: Print the histograms of the session
+//
+// Details: Per latency count, average, minimum and maximum in us, then the 
+// count of each used bin by its upper limit. Each line waits until the UART
+// sent the one before, so nothing is dropped.
+//
+// Called by: main
+//
+// Return: void
+// -----------------------------------------------------------------------------
+void
+lat_dump(void)	{
+
+	lat_hist_t *h;
+	uint8_t i, b;
+
+	for(i = 0; i < LAT_MAX; i++)	{
+
+		h = &hist[i];
+#ifndef HOST
+		uart_tx_flush();
+#endif
+		if(!h->n)	{
+			PRINT("lat %S n=0\n", lat_name[i]);
+			continue;
+		}
+
+		PRINT("lat %S n=%u avg=%lu min=%lu max=%lu us\n", lat_name[i], h->n,
+				(unsigned long)(h->sum / h->n),
+				(unsigned long)h->min, (unsigned long)h->max);
+
+		for(b = 0; b < LAT_BINS; b++)	{
+
+			if(!h->bin[b])
+				continue;
+
+#ifndef HOST
+			uart_tx_flush();
+#endif
+			if(b < LAT_BINS - 1)
+				PRINT("  <%lu %u\n", (unsigned long)LAT_BIN0 << b, h->bin[b]);
+			else
+				PRINT("  >=%lu %u\n", (unsigned long)LAT_BIN0 << (b - 1),
+						h->bin[b]);
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,55 @@
+/*
+* ----------------------------------------------------------------------------
+* Latency histograms of the update protocol
+*
+*  Version: 0.0.1
+*  
+* "THE BEER-WARE LICENSE" (Revision 42):
+* <karsten@rhen.de> wrote this file. As long as you retain this notice you
+* can do whatever you want with this stuff. If we meet some day, and you think
+* this stuff is worth it, you can buy me a beer in Flensburg, Germany
+* ----------------------------------------------------------------------------
+*/
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+// -----------------------------------------------------------------------------
+// Measured latencies, request -> reply of the device and own turnaround
+enum {
+	LAT_CFG,	// last config stream frame -> CMD_CFG_REQUEST
+	LAT_BLKN,	// CMD_BOOTSUB_BLKN -> ACK
+	LAT_CRC,	// CMD_BOOTSUB_CRC -> ACK
+	LAT_TURN,	// receive of a handled message -> next frame sent
+	LAT_MAX
+};
+
+// -----------------------------------------------------------------------------
+// Histogram bins in us: bin 0 < LAT_BIN0, bin n < LAT_BIN0 << n, the last
+// bin takes the rest ( >= 0.5s )
+#define LAT_BINS	16
+#define LAT_BIN0	32
+
+// -----------------------------------------------------------------------------
+// Compiled out without LATENCY, see debug.h
+#if defined(LATENCY)
+#define LAT_RESET()			lat_reset()
+#define LAT_REQUEST(kind)	lat_request(kind)
+#define LAT_REPLY(kind)		lat_reply(kind)
+#define LAT_SEND()			lat_send()
+#define LAT_DUMP()			lat_dump()
+#else
+#define LAT_RESET()			do{} while(0)
+#define LAT_REQUEST(kind)	do{} while(0)
+#define LAT_REPLY(kind)		do{} while(0)
+#define LAT_SEND()			do{} while(0)
+#define LAT_DUMP()			do{} while(0)
+#endif
+
+void lat_reset(void);
+void lat_request(uint8_t kind);
+void lat_reply(uint8_t kind);
+void lat_send(void);
+void lat_dump(void);
+
+#endif
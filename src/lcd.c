@@ -28,6 +28,21 @@
 #define LCD_FUNCTION_DEFAULT    LCD_FUNCTION_4BIT_2LINES 
 #endif
 
+#define LCD_CELLS	(LCD_LINES * LCD_DISP_LENGTH)
+
+// Framebuffer of the visible cells, lcd_refresh() writes the dirty ones
+static char lcd_fb[LCD_CELLS];
+static volatile uint8_t lcd_dirty[(LCD_CELLS + 7) / 8];
+static volatile uint8_t lcd_pending;	// a dirty bit may be set
+static volatile uint8_t lcd_hold;		// main loop writes, no refresh
+static uint8_t lcd_addr = 0xFF;		// DDRAM address counter, 0xFF unknown
+static uint8_t lcd_x, lcd_y;			// cursor
+
+static const uint8_t lcd_start[4] PROGMEM = {
+
+	LCD_START_LINE1, LCD_START_LINE2, LCD_START_LINE3, LCD_START_LINE4
+};
+
 
 // -----------------------------------------------------------------------------
 // Description: Toggle enable bit for given time
@@ -157,6 +172,9 @@ lcd_read(uint8_t rs)	{
 // -----------------------------------------------------------------------------
 // Description: Loops while LCD is busy, return address counter
 //
+// Details: Gives up after LCD_BUSY_POLLS reads, a missing or stuck display
+// does not hang the caller. Not used by the refresh in the tick ISR.
+//
 // Called by: divers
 //
 // Input:  void
@@ -166,10 +184,10 @@ lcd_read(uint8_t rs)	{
 static uint8_t
 lcd_waitbusy(void)	{
 
-	register uint8_t c;
+	uint16_t n = LCD_BUSY_POLLS;
 
 	// wait until busy flag is cleared 
-	while ( (c=lcd_read(0)) & (1<<LCD_BUSY)) {}
+	while((lcd_read(0) & (1<<LCD_BUSY)) && --n) {}
 
 	// the address counter is updated 4us after the busy flag is cleared
 	delay(LCD_DELAY_BUSY_FLAG);
@@ -180,42 +198,24 @@ lcd_waitbusy(void)	{
 
 
 // -----------------------------------------------------------------------------
-// Description: Move cursor to the start of next line or to the first line
-// 				 if the cursor is already on the last line.
+// Description: Mark a cell of the framebuffer for the refresh
 //
-// Called by: divers
+// Details: Only a changed character is marked. The refresh clears the bit
+// in its ISR, a bit set again meanwhile costs a second write only.
 //
-// Input:  pos	
+// Called by: lcd_putc(), lcd_data(), lcd_clrscr()
 //
 // Return: void
 // ----------------------------------------------------------------------------
-static inline void
-lcd_newline(uint8_t pos)	{
-
-	register uint8_t addressCounter;
-
-#if LCD_LINES==1
-	addressCounter = 0;
-#endif
-#if LCD_LINES==2
-	if ( pos < (LCD_START_LINE2) )
-	addressCounter = LCD_START_LINE2;
-	else
-	addressCounter = LCD_START_LINE1;
-#endif
+static void
+lcd_set(uint8_t n, char c)	{
 
-#if LCD_LINES==4
-	if ( pos < LCD_START_LINE3 )
-		addressCounter = LCD_START_LINE2;
-	else if ( (pos >= LCD_START_LINE2) && (pos < LCD_START_LINE4) )
-		addressCounter = LCD_START_LINE3;
-	else if ( (pos >= LCD_START_LINE3) && (pos < LCD_START_LINE2) )
-		addressCounter = LCD_START_LINE4;
-	else 
-		addressCounter = LCD_START_LINE1;
-#endif
+	if(lcd_fb[n] == c)
+		return;
 
-	lcd_command((1<<LCD_DDRAM)+addressCounter);
+	lcd_fb[n] = c;
+	lcd_dirty[n >> 3] |= (1 << (n & 7));
+	lcd_pending = 1;
 }
 
 
@@ -227,25 +227,62 @@ lcd_newline(uint8_t pos)	{
 Send LCD controller instruction command
 Input:   instruction to send to LCD controller, see HD44780 data sheet
 Returns: none
+The refresh is held meanwhile and sets the DDRAM address again after a
+command. The display is idle again on return, the refresh writes without
+a busy check.
 *************************************************************************/
 void
 lcd_command(uint8_t cmd)	{
 
+	lcd_hold = 1;
 	lcd_waitbusy();
 	lcd_write(cmd,0);
+	lcd_waitbusy();
+	lcd_addr = 0xFF;
+	lcd_hold = 0;
 }
 
 
 /*************************************************************************
-Send data byte to LCD controller 
-Input:   data to send to LCD controller, see HD44780 data sheet
+Define a custom character in CGRAM
+Input:   n     character code 0-7
+         rows  8 rows of 5 pixels, bit 4 is the left column
 Returns: none
+The character is shown by writing code n, lcd_data() or in a string for
+codes 1-7.
 *************************************************************************/
 void
-lcd_data(uint8_t data)	{
+lcd_defchar(uint8_t n, const uint8_t *rows)	{
 
+	uint8_t i;
+
+	lcd_hold = 1;
 	lcd_waitbusy();
-	lcd_write(data,1);
+	lcd_write((1<<LCD_CGRAM) | ((n & 7) << 3), 0);
+
+	for(i = 0; i < 8; i++)	{
+		lcd_waitbusy();
+		lcd_write(rows[i], 1);
+	}
+
+	lcd_waitbusy();
+	lcd_addr = 0xFF;	// back to DDRAM by the next refresh
+	lcd_hold = 0;
+}
+
+
+/*************************************************************************
+Write data byte to the framebuffer at the cursor
+Input:   data to display, e.g. a CGRAM character 0-7
+Returns: none
+*************************************************************************/
+void
+lcd_data(uint8_t data)	{
+
+	if(lcd_x < LCD_DISP_LENGTH)
+		lcd_set(lcd_y * LCD_DISP_LENGTH + lcd_x, data);
+
+	lcd_x++;
 }
 
 
@@ -253,42 +290,31 @@ lcd_data(uint8_t data)	{
 /*************************************************************************
 Set cursor to specified position
 Input:    x  horizontal position  (0: left most position)
-          y  vertical position    (0: first line)
+          y  vertical position    (0: first line, beyond: last line)
 Returns:  none
 *************************************************************************/
 void
 lcd_gotoxy(uint8_t x, uint8_t y)	{
 
-#if LCD_LINES==1
-    lcd_command((1<<LCD_DDRAM)+LCD_START_LINE1+x);
-#endif
-#if LCD_LINES==2
-    if ( y==0 ) 
-        lcd_command((1<<LCD_DDRAM)+LCD_START_LINE1+x);
-    else
-        lcd_command((1<<LCD_DDRAM)+LCD_START_LINE2+x);
-#endif
-#if LCD_LINES==4
-    if ( y==0 )
-        lcd_command((1<<LCD_DDRAM)+LCD_START_LINE1+x);
-    else if ( y==1)
-        lcd_command((1<<LCD_DDRAM)+LCD_START_LINE2+x);
-    else if ( y==2)
-        lcd_command((1<<LCD_DDRAM)+LCD_START_LINE3+x);
-    else // y==3 
-        lcd_command((1<<LCD_DDRAM)+LCD_START_LINE4+x);
-#endif
-
+	lcd_x = x;
+	lcd_y = (y < LCD_LINES) ? y : LCD_LINES - 1;
 }
 
 
 /*************************************************************************
 Clear display and set cursor to home position
+Only the cells not already blank are written by the refresh, no 1.6ms
+clear command.
 *************************************************************************/
 void
 lcd_clrscr(void)	{
 
-	lcd_command(1<<LCD_CLR);
+	uint8_t n;
+
+	for(n = 0; n < LCD_CELLS; n++)
+		lcd_set(n, ' ');
+
+	lcd_x = lcd_y = 0;
 }
 
 
@@ -298,7 +324,7 @@ Set cursor to home position
 void
 lcd_home(void)	{
 
-	lcd_command(1<<LCD_HOME);
+	lcd_x = lcd_y = 0;
 }
 
 
@@ -306,48 +332,27 @@ lcd_home(void)	{
 Display character at current cursor position 
 Input:    character to be displayed                                       
 Returns:  none
+Writes the framebuffer only. Characters right of the visible line are
+dropped like on the display, '\n' moves to the start of the next line.
 *************************************************************************/
 void
 lcd_putc(char c)	{
 
-	uint8_t pos;
-
-
-	pos = lcd_waitbusy();   // read busy-flag and address counter
 	if (c=='\n')	{
 
-	  lcd_newline(pos);
-
-	} else	{
-
-	#if LCD_WRAP_LINES==1
-		#if LCD_LINES==1
-		if ( pos == LCD_START_LINE1+LCD_DISP_LENGTH ) {
-			lcd_write((1<<LCD_DDRAM)+LCD_START_LINE1,0);
-		}
-		#elif LCD_LINES==2
-		if ( pos == LCD_START_LINE1+LCD_DISP_LENGTH ) {
-			lcd_write((1<<LCD_DDRAM)+LCD_START_LINE2,0);    
-		}else if ( pos == LCD_START_LINE2+LCD_DISP_LENGTH ){
-			lcd_write((1<<LCD_DDRAM)+LCD_START_LINE1,0);
-		}
-		#elif LCD_LINES==4
-		if ( pos == LCD_START_LINE1+LCD_DISP_LENGTH ) {
-			lcd_write((1<<LCD_DDRAM)+LCD_START_LINE2,0);    
-		}else if ( pos == LCD_START_LINE2+LCD_DISP_LENGTH ) {
-			lcd_write((1<<LCD_DDRAM)+LCD_START_LINE3,0);
-		}else if ( pos == LCD_START_LINE3+LCD_DISP_LENGTH ) {
-			lcd_write((1<<LCD_DDRAM)+LCD_START_LINE4,0);
-		}else if ( pos == LCD_START_LINE4+LCD_DISP_LENGTH ) {
-			lcd_write((1<<LCD_DDRAM)+LCD_START_LINE1,0);
-		}
-		#endif
+		lcd_x = 0;
+		lcd_y = (lcd_y + 1 < LCD_LINES) ? lcd_y + 1 : 0;
+		return;
+	}
 
-		lcd_waitbusy();
-	#endif
-		lcd_write(c, 1);
+#if LCD_WRAP_LINES==1
+	if(lcd_x == LCD_DISP_LENGTH)	{
+		lcd_x = 0;
+		lcd_y = (lcd_y + 1 < LCD_LINES) ? lcd_y + 1 : 0;
 	}
+#endif
 
+	lcd_data(c);
 }
 
 
@@ -385,6 +390,52 @@ lcd_puts_p(const char *progmem_s)	{
 }
 
 
+// -----------------------------------------------------------------------------
+// Description: Write changed cells of the framebuffer to the display
+//
+// Details: One write per call, the DDRAM address if the cell does not follow
+// the last one written, otherwise the character. The 4ms between two ticks
+// are far more than the 40us a write takes the display, so the busy flag is
+// not polled and the ISR runs for a few us only. A call with nothing to do
+// returns at once. All cells change in 34 ticks, 136ms.
+//
+// Called by: tick ISR, registered by init_tick_tasks()
+//
+// Return: void
+// ----------------------------------------------------------------------------
+void
+lcd_refresh(void)	{
+
+	uint8_t n, y, addr;
+
+	if(!lcd_pending || lcd_hold)
+		return;
+
+	for(n = 0; n < LCD_CELLS; n++)	{
+
+		if(!(lcd_dirty[n >> 3] & (1 << (n & 7))))
+			continue;
+
+		y = n / LCD_DISP_LENGTH;
+		addr = pgm_read_byte(&lcd_start[y]) + n - y * LCD_DISP_LENGTH;
+
+		// the character follows with the next tick
+		if(addr != lcd_addr)	{
+			lcd_write((1<<LCD_DDRAM) + addr, 0);
+			lcd_addr = addr;
+			return;
+		}
+
+		lcd_write(lcd_fb[n], 1);
+		lcd_addr = addr + 1;
+		lcd_dirty[n >> 3] &= ~(1 << (n & 7));
+		return;
+	}
+
+	lcd_pending = 0;
+}
+
+
 /*************************************************************************
 Initialize display and select type of cursor 
 Input:    dispAttr LCD_DISP_OFF            display off
@@ -396,6 +447,7 @@ Returns:  none
 void
 lcd_init(uint8_t dispAttr)	{
 
+	uint8_t n;
 
    // Initialize LCD to 4 bit I/O mode
 	SET_OUTPUT(LCD_RS);
@@ -430,7 +482,12 @@ lcd_init(uint8_t dispAttr)	{
 	// from now the LCD only accepts 4 bit I/O, we can use lcd_command()
 	lcd_command(LCD_FUNCTION_DEFAULT);	// function set: display lines
 	lcd_command(LCD_DISP_OFF);				// display off               
-	lcd_clrscr();								// display clear            
+	lcd_command(1<<LCD_CLR);				// display clear            
 	lcd_command(LCD_MODE_DEFAULT);		// set entry mode          
 	lcd_command(dispAttr);					// display/cursor control 
+
+	// the display is blank now, so is the framebuffer
+	for(n = 0; n < LCD_CELLS; n++)
+		lcd_fb[n] = ' ';
+	lcd_x = lcd_y = 0;
 }
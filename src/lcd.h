@@ -38,6 +38,10 @@
 #ifndef LCD_START_LINE4
 #define LCD_START_LINE4  0x54     /**< DDRAM address of first char of line 4 */
 #endif
+#ifndef LCD_BUSY_POLLS
+#define LCD_BUSY_POLLS    500     /**< busy flag reads before giving up, about 2ms */
+#endif
+
 #ifndef LCD_WRAP_LINES
 #define LCD_WRAP_LINES      0     /**< 0: no wrap, 1: wrap at end of visibile line */
 #endif
@@ -203,14 +207,32 @@ extern void lcd_command(uint8_t cmd);
 
 
 /**
- @brief    Send data byte to LCD controller 
+ @brief    Write data byte to the framebuffer at the cursor
  
  Similar to lcd_putc(), but without interpreting LF
- @param    data byte to send to LCD controller, see HD44780 data sheet
+ @param    data byte to display, e.g. a CGRAM character 0-7
  @return   none
 */
 extern void lcd_data(uint8_t data);
 
+/**
+ @brief    Define a custom character in CGRAM
+ 
+ @param    n code of the character 0-7
+ @param    rows 8 rows of 5 pixels, bit 4 is the left column
+ @return   none
+*/
+extern void lcd_defchar(uint8_t n, const uint8_t *rows);
+
+/**
+ @brief    Write one changed cell or its DDRAM address to the display
+ 
+ The other functions only write the framebuffer in RAM, the Timer0 tick
+ calls this
+ @return   none
+*/
+extern void lcd_refresh(void);
+
 
 /**
  @brief macros for automatically storing string constant in program memory
@@ -0,0 +1,150 @@
+/*
+* ----------------------------------------------------------------------------
+* Decoder of the LZ compressed update files
+*
+* The files of the data streams compress well, they are text and records.
+* tools/lzpack.py packs them with a small window LZ77, the decoder needs
+* only the window of LZ_WINDOW bytes and no table. Its input is mapped from
+* the FatFs sector window by the fill function, the output is decoded into
+* the window and passed on from there, so the bytes are not copied again
+* for the CRC and the CAN frames.
+*
+* The output of one call of lz_decode() is contiguous in the window, a call
+* stops at the end of the window. Each block starts at the begin of the
+* window, so requests of a size the window is a multiple of, like the 32
+* byte chunks of process.c, never wrap.
+*
+*  Version: 0.0.1
+*  
+* "THE BEER-WARE LICENSE" (Revision 42):
+* <karsten@rhen.de> wrote this file. As long as you retain this notice you
+* can do whatever you want with this stuff. If we meet some day, and you think
+* this stuff is worth it, you can buy me a beer in Flensburg, Germany
+* ----------------------------------------------------------------------------
+*/
+
+#include <inttypes.h>
+
+#include "main.h"
+
+// -----------------------------------------------------------------------------
+// Description: Next input byte
+//
+// Details: Maps the next input bytes by the fill function if all are used.
+// The end of input within a block is an error.
+//
+// Called by: lz_decode
+//
+// Return: the byte, -1 at the end of input
+// -----------------------------------------------------------------------------
+static int16_t
+lz_byte(lz_t *z)	{
+
+	if(!z->inlen && (z->inlen = z->fill(&z->in)) == 0)	{
+
+		z->err = 1;
+		return(-1);
+	}
+
+	z->inlen--;
+	return(*z->in++);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Start to decode a block
+//
+// Details: The input continues at the mapped bytes, after a seek inlen must
+// be set to 0. The output starts at the begin of the window.
+//
+// Called by: sd.c
+//
+// Return: void
+// -----------------------------------------------------------------------------
+void
+lz_block(lz_t *z, uint16_t size)	{
+
+	z->out = size;
+	z->done = 0;
+	z->pos = 0;
+	z->mlen = 0;
+	z->nflags = 0;
+	z->err = 0;
+}
+
+// -----------------------------------------------------------------------------
+// Description: Decode the next bytes of the block
+//
+// Details: Decodes up to len bytes, clipped to the rest of the block and
+// the end of the window. A match which does not fit goes on in the next
+// call. A match beyond the decoded bytes or the block end sets err.
+//
+// Called by: sd.c
+//
+// Return: The number of bytes at *data, 0 at the end of the block or on error
+// -----------------------------------------------------------------------------
+uint16_t
+lz_decode(lz_t *z, const uint8_t **data, uint16_t len)	{
+
+	uint8_t *w = z->win;
+	uint8_t pos = z->pos;
+	uint16_t n = 0;
+	int16_t c, l;
+	PROBE_BEGIN(PRB_LZ);
+
+	if(len > z->out)
+		len = z->out;
+	if(len > LZ_WINDOW - pos)
+		len = LZ_WINDOW - pos;
+	*data = &w[pos];
+
+	while(n < len)	{
+
+		if(z->mlen)	{
+
+			w[pos] = w[(uint8_t)(pos - z->mdist - 1)];
+			pos++;
+			n++;
+			z->mlen--;
+			continue;
+		}
+
+		if(!z->nflags)	{
+
+			if((c = lz_byte(z)) < 0)
+				break;
+			z->flags = c;
+			z->nflags = 8;
+		}
+
+		c = z->flags & 1;
+		z->flags >>= 1;
+		z->nflags--;
+
+		if(c)	{
+
+			if((c = lz_byte(z)) < 0)
+				break;
+			w[pos++] = c;
+			n++;
+		}	else	{
+
+			if((c = lz_byte(z)) < 0 || (l = lz_byte(z)) < 0)
+				break;
+			l += LZ_MINLEN;
+			if(c >= z->done + n || l > z->out - n)	{
+
+				z->err = 1;
+				break;
+			}
+			z->mdist = c;
+			z->mlen = l;
+		}
+	}
+
+	z->pos = pos;
+	z->out -= n;
+	z->done += n;
+
+	PROBE_END(PRB_LZ);
+	return(z->err ? 0 : n);
+}
@@ -0,0 +1,59 @@
+/*
+* ----------------------------------------------------------------------------
+* Decoder of the LZ compressed update files
+*
+*  Version: 0.0.1
+*  
+* "THE BEER-WARE LICENSE" (Revision 42):
+* <karsten@rhen.de> wrote this file. As long as you retain this notice you
+* can do whatever you want with this stuff. If we meet some day, and you think
+* this stuff is worth it, you can buy me a beer in Flensburg, Germany
+* ----------------------------------------------------------------------------
+*/
+
+#ifndef LZ_H
+#define LZ_H
+
+#include <inttypes.h>
+
+// -----------------------------------------------------------------------------
+// File of tools/lzpack.py, numbers little endian
+//
+//   0  'L' 'Z'			magic
+//   2  LZ_VERSION
+//   3  log2 of the block size, 8 .. 15
+//   4  uint32_t		size of the decoded file
+//   8  uint32_t[]		file offset of each block
+//      blocks
+//
+// A block decodes to block size bytes, the last one to the rest of the file.
+// A flag byte, LSB first, tells the next 8 tokens: 1 a literal byte, 0 a
+// match of 2 bytes, distance - 1 and length - LZ_MINLEN. Matches refer to
+// bytes of their block only, each block decodes on its own.
+#define LZ_MAGIC0	'L'
+#define LZ_MAGIC1	'Z'
+#define LZ_VERSION	1
+#define LZ_HEAD		8			// header before the block index
+#define LZ_WINDOW	256			// longest match distance, window of the decoder
+#define LZ_MINLEN	3			// shortest match
+
+typedef struct {
+
+	uint8_t win[LZ_WINDOW];					// last decoded bytes
+	uint16_t (*fill)(const uint8_t **in);	// maps the next input bytes
+	const uint8_t *in;						// mapped input bytes
+	uint16_t inlen;							// bytes left at in
+	uint16_t out;							// bytes left of the block
+	uint16_t done;							// bytes decoded of the block
+	uint16_t mlen;							// bytes left of the current match
+	uint8_t mdist;							// distance - 1 of the current match
+	uint8_t flags;							// token flags, LSB next
+	uint8_t nflags;							// flags left
+	uint8_t pos;							// write position in win
+	uint8_t err;							// corrupt or truncated block
+} lz_t;
+
+void lz_block(lz_t *z, uint16_t size);
+uint16_t lz_decode(lz_t *z, const uint8_t **data, uint16_t len);
+
+#endif
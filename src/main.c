@@ -22,21 +22,34 @@
 #include <string.h>
 #include <stdlib.h>
 #include <util/delay.h>
+#include <avr/sleep.h>
+#include <util/atomic.h>
 
 #include "main.h"
 
 // static function prototypes
+#ifndef HOST
 static void init_HW(void);
 static void connect(void);
 static void disconnect(void);
+static char get_key_press( char key_mask );
+static void capture(void);
+#endif
 
 // Debounced button
 volatile char key_state;
 volatile char key_press;
-static char get_key_press( char key_mask );
 
-// CAN RX-Buffer
+// Debounced device present
+volatile uint8_t dev_event;
+static volatile uint8_t pres_deb;
+
+// CAN RX-Buffer, receive time in us of each message
 static can_t rx_buffer[BUF_SIZE];
+static uint32_t rx_stamp[BUF_SIZE];
+static uint32_t rx_last;
+static volatile uint8_t rx_lost;
+static volatile bool rx_masked;		// INT0 masked by a full buffer
 volatile int posRead = 0;
 volatile int posWrite = 0;
 volatile bool lastOpWasWrite = false;
@@ -45,11 +58,25 @@ volatile bool lastOpWasWrite = false;
 device_t device;
 volatile uint16_t count = 0;
 
+// Timer1 overflows, upper part of the free running cycle counter
+static volatile uint32_t t1_ovf;
+
+// CPU idle time in us since idle_start, Timer1 time base of time_us()
+static uint32_t idle_us;
+static uint32_t idle_start;
+
+static void idle_sleep(void);
+static uint32_t time_us(void);
+
 
 // -----------------------------------------------------------------------------
 // Description: Handling generated interrupt by MCP2515. 
 // 
-// Details: Retrieve the CAN message and store it to the CAN buffer
+// Details: Retrieve the CAN message and store it to the CAN buffer with the
+// time of the interrupt. INT0 triggers on low level, it stays low as long as
+// the MCP2515 holds a message. With the buffer full INT0 is masked until
+// read_rx_stamped() frees a slot, meanwhile the two receive buffers of the
+// MCP2515 keep the next messages.
 //
 // Called by: ISR 
 //
@@ -57,33 +84,41 @@ volatile uint16_t count = 0;
 // -----------------------------------------------------------------------------
 ISR (INT0_vect)	{
 
+	uint32_t stamp = time_us();
+	PROBE_BEGIN(PRB_INT0);
 
 	if (posWrite == posRead && lastOpWasWrite) {
 		// Buffer Full!!!
 		SET(LED_ERROR);	
+		EIMSK &= ~(1<<INT0);
+		rx_masked = true;
+		PROBE_END(PRB_INT0);
 		return;
 	}
 
 	if (can_get_message(&rx_buffer[posWrite])) {
+		rx_stamp[posWrite] = stamp;
 		posWrite = (posWrite + 1) % BUF_SIZE;
-	} 
+		lastOpWasWrite = true;
+	} else
+		can_tx_irq(false);		// a sent frame, see can_send_message()
 
-	lastOpWasWrite = true;
+	PROBE_END(PRB_INT0);
 }
 
 
 // -----------------------------------------------------------------------------
-// Description: Handling time events by using bit flags
+// Description: Debounce the keys and the device present pin
 //
-// Called by: ISR will be called every 4ms @ 16MhZ
+// Called by: tick ISR every 4ms @ 16MhZ
 //
 // Return: void
 // -----------------------------------------------------------------------------
-ISR (TIMER0_COMPA_vect)	{
+static void
+key_tick(void)	{
 
 	//TODO use uint instead char
 	static char ct0, ct1;
-	static uint8_t ct3 = 0;
 	char i;
 
 	i = key_state ^ ~KEY_INPUT;				// key changed ?
@@ -93,43 +128,118 @@ ISR (TIMER0_COMPA_vect)	{
 	key_state ^= i;								// then toggle debounced state
 	key_press |= key_state & i;				// 0->1: key press detect
 
-	ct3++;
+	// device present pin stable for PRESCNT / PRESOFF ticks after last change?
+	if(pres_deb && !(--pres_deb))	{
 
-	if(ct3 == 4)	{ // increment every 16ms and reduce processing time
+		if(IS_SET(DEV_PRESENT))	{			// HIGH: no device
+
+			if(Flags & (1 << DEVCONN))	{
+				Flags &= ~(1 << DEVCONN);
+				dev_event |= (1 << EVT_DISCONNECT);
+			}
+		} else
+			Flags |= (1 << DEVCONN);
+	}
+}
+
+// -----------------------------------------------------------------------------
+// Description: Handling time events by using bit flags
+//
+// Called by: tick ISR every 16ms @ 16MhZ
+//
+// Return: void
+// -----------------------------------------------------------------------------
+static void
+flag_tick(void)	{
 
 //DEBUG
 TOGGLE(LED_MSG);
 
-		// remove message timeout flag
-		if(count == TMOCNT)
-			Flags &= ~(1 << TIMEOUT);
-		
-		// remove MS2 calculating message flag
-		if(count == DEVCCNT)
-			Flags &= ~(1 << DEVCALC);
-		
-		// remove MS2 connect wait flag
-		if(count == DEVCNT)
-			Flags &= ~(1 << DEVBOOT);
+	// remove message timeout flag
+	if(count == TMOCNT)
+		Flags &= ~(1 << TIMEOUT);
+	
+	// remove MS2 calculating message flag
+	if(count == DEVCCNT)
+		Flags &= ~(1 << DEVCALC);
+	
+	// remove MS2 connect wait flag
+	if(count == DEVCNT)
+		Flags &= ~(1 << DEVBOOT);
 
-		// remove check for reinsert lost SD Card
-		if(count == LOSTCNT)	
-			Flags &= ~(1 << LOSTCARD);
+	// remove check for reinsert lost SD Card
+	if(count == LOSTCNT)	
+		Flags &= ~(1 << LOSTCARD);
 
-		// remove ping count
-		if(count == PNGCNT)	
-			Flags &= ~(1 << FIRSTPNG);
+	// remove ping count
+	if(count == PNGCNT)	
+		Flags &= ~(1 << FIRSTPNG);
 
-		count++;
-		ct3 = 0;
-	}
+	// remove probe flag to repeat device probe
+	if(!(count & (PRBCNT - 1)))
+		Flags &= ~(1 << PROBE);
+
+	count++;
+}
+
+// -----------------------------------------------------------------------------
+// Description: Register the periodic work of the updater at the tick service
+//
+// Details: The order is the order of the calls in one tick.
+//
+// Called by: init_HW, init_host
+//
+// Return: void
+// -----------------------------------------------------------------------------
+void
+init_tick_tasks(void)	{
+
+	tick_init();
+	tick_every(1, key_tick);
+	tick_every(4, flag_tick);	// every 16ms and reduce processing time
+#ifndef HOST
+	tick_every(1, lcd_refresh);	// changed cells of the LCD framebuffer
+#endif
+}
+
+
+// -----------------------------------------------------------------------------
+// Description: Extend the free running Timer1 
+//
+// Details: Timer1 counts CPU cycles, it overflows every 4.096ms @ 16MHz.
+//
+// Called by: ISR
+//
+// Return: void
+// -----------------------------------------------------------------------------
+ISR (TIMER1_OVF_vect)	{
+
+	t1_ovf++;
+}
+
+
+// -----------------------------------------------------------------------------
+// Description: Device present pin DEV_PRESENT changed
+//
+// Details: Only restart the debounce counter, the new state is taken over by
+// Timer0 if the pin is stable for PRESCNT ticks, for PRESOFF ticks if the
+// device is gone. A current dip of a booting MS2 is no disconnect.
+//
+// Called by: ISR PCINT1
+//
+// Return: void
+// -----------------------------------------------------------------------------
+ISR (PCINT1_vect)	{
+
+	pres_deb = IS_SET(DEV_PRESENT) ? PRESOFF : PRESCNT;
 }
 
 
 // -----------------------------------------------------------------------------
 // Description: Return a buffer from CAN buffer pool
 //
-// Details: A returned buffer is marked to be to used again
+// Details: A returned buffer is marked to be to used again. Its receive time
+// is kept for get_rx_stamp().
 //
 // Called by: div 
 //
@@ -138,6 +248,42 @@ TOGGLE(LED_MSG);
 bool
 read_rx_buffer(can_t *msg)	{
 
+	return read_rx_stamped(msg, &rx_last);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Enable INT0 again after the ISR found the CAN buffer full
+//
+// Details: Adds the messages the MCP2515 lost meanwhile to rx_lost. Called
+// with disabled interrupts.
+//
+// Called by: read_rx_stamped(), clear_rx_buffer()
+//
+// Return: void
+// -----------------------------------------------------------------------------
+static void
+rx_unmask(void)	{
+
+	uint8_t n = can_rx_overflows();
+
+	rx_lost = (rx_lost > 0xFF - n) ? 0xFF : rx_lost + n;
+	rx_masked = false;
+	EIMSK |= (1<<INT0);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Return a buffer from CAN buffer pool with its receive time
+//
+// Details: Like read_rx_buffer(), stamp is set to the time in us of the INT0
+// interrupt of the message if not NULL.
+//
+// Called by: read_rx_buffer(), capture()
+//
+// Return: bool
+// -----------------------------------------------------------------------------
+bool
+read_rx_stamped(can_t *msg, uint32_t *stamp)	{
+
 	cli();
 
 	if (posWrite == posRead && !lastOpWasWrite) {
@@ -146,13 +292,56 @@ read_rx_buffer(can_t *msg)	{
 	}
 
 	memcpy(msg, &rx_buffer[posRead], sizeof(can_t));
+	if(stamp)
+		*stamp = rx_stamp[posRead];
 	posRead = (posRead + 1) % BUF_SIZE;
 	lastOpWasWrite = false;
 
+	if(rx_masked)
+		rx_unmask();
+
 	sei();
 	return true;
 }
 
+// -----------------------------------------------------------------------------
+// Description: Receive time of the message last returned by read_rx_buffer()
+//
+// Details: Also valid for messages returned by wait_rx_buffer().
+//
+// Called by: div
+//
+// Return: time in us, see get_time_us()
+// -----------------------------------------------------------------------------
+uint32_t
+get_rx_stamp(void)	{
+
+	return(rx_last);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Retrieve and clear the number of lost messages
+//
+// Details: Counts the overflows of the MCP2515 receive buffers while INT0
+// was masked by a full CAN buffer, saturates at 255. Each overflow lost one
+// message at least, the MCP2515 does not tell how many.
+//
+// Called by: capture()
+//
+// Return: lost messages since last call
+// -----------------------------------------------------------------------------
+uint8_t
+get_rx_lost(void)	{
+
+	uint8_t lost;
+
+	cli();
+	lost = rx_lost;
+	rx_lost = 0;
+	sei();
+	return lost;
+}
+
 // -----------------------------------------------------------------------------
 // Description: Reset read and write pointer to clear rx_buffer
 //
@@ -166,9 +355,253 @@ clear_rx_buffer(void)	{
 	cli();
 		posWrite = 0;
 		posRead = 0;
+		lastOpWasWrite = false;
+		if(rx_masked)
+			rx_unmask();
 	sei();
 }
 
+// -----------------------------------------------------------------------------
+// Description: Wait for a CAN message while the given flags are set
+//
+// Details: The CPU sleeps in idle mode until the next interrupt ( INT0, 
+// timer, pin change, UART ) and rechecks buffer and flags only after wakeup.
+// Buffer and flags are checked with disabled interrupts, so no wakeup can 
+// get lost between check and sleep.
+//
+// Called by: div 
+//
+// Return: true with msg filled, false if one of the flags was removed
+// -----------------------------------------------------------------------------
+bool
+wait_rx_buffer(can_t *msg, uint8_t flags)	{
+
+	while(1)	{
+
+		if(read_rx_buffer(msg))
+			return true;
+
+		cli();
+		if((Flags & flags) != flags)	{
+			sei();
+			return false;
+		}
+
+		if(posWrite == posRead && !lastOpWasWrite)
+			idle_sleep();
+		else
+			sei();
+	}
+}
+
+// -----------------------------------------------------------------------------
+// Description: Wait as long as the given flags are set
+//
+// Details: Like wait_rx_buffer() without checking the CAN buffer. The flags
+// are removed by the Timer0 ISR, the CPU sleeps in idle mode meanwhile.
+//
+// Called by: div 
+//
+// Return: 
+// -----------------------------------------------------------------------------
+void
+wait_flag(uint8_t flags)	{
+
+	while(1)	{
+
+		cli();
+		if((Flags & flags) != flags)	{
+			sei();
+			return;
+		}
+
+		idle_sleep();
+	}
+}
+
+// -----------------------------------------------------------------------------
+// Description: Sleep until the next interrupt
+//
+// Details: For polling loops which are woken up by the Timer0 tick at least.
+//
+// Called by: div 
+//
+// Return: 
+// -----------------------------------------------------------------------------
+void
+wait_irq(void)	{
+
+	cli();
+	idle_sleep();
+}
+
+// -----------------------------------------------------------------------------
+// Description: Enter idle sleep mode and count the time spent in sleep
+//
+// Details: Must be called with disabled interrupts! The instruction after 
+// sei() is always executed, so a pending interrupt wakes up sleep_cpu().
+// Return with enabled interrupts.
+//
+// Called by: wait_rx_buffer(), wait_flag(), wait_irq()
+//
+// Return: 
+// -----------------------------------------------------------------------------
+static void
+idle_sleep(void)	{
+
+	uint32_t start = time_us();
+
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	sleep_enable();
+	sei();
+	sleep_cpu();
+	sleep_disable();
+
+	cli();
+	idle_us += time_us() - start;
+	sei();
+}
+
+// -----------------------------------------------------------------------------
+// Description: Time since start in us
+//
+// Details: Taken from the free running Timer1 and its overflows, TCNT0 is 
+// reset by the timeouts and not usable. An overflow not served yet is taken
+// into account, so it can be called in an ISR. Must be called with disabled
+// interrupts! Wraps after 71 minutes.
+//
+// Called by: ISR INT0, get_time_us()
+//
+// Return: time in us
+// -----------------------------------------------------------------------------
+static uint32_t
+time_us(void)	{
+
+	uint32_t ovf = t1_ovf;
+	uint16_t tcnt = TCNT1;
+
+	if((TIFR1 & (1 << TOV1)) && tcnt < 0x8000)
+		ovf++;
+
+	return((ovf << 12) | (tcnt >> 4));
+}
+
+// -----------------------------------------------------------------------------
+// Description: Time since start in us
+//
+// Details: Same time base as the receive time of the CAN messages.
+//
+// Called by: div
+//
+// Return: time in us
+// -----------------------------------------------------------------------------
+uint32_t
+get_time_us(void)	{
+
+	uint32_t us;
+
+	cli();
+	us = time_us();
+	sei();
+	return(us);
+}
+
+// -----------------------------------------------------------------------------
+// Description: CPU cycles since start
+//
+// Details: Free running Timer1 and its overflows like time_us(), wraps after
+// 268s. Can be called in an ISR.
+//
+// Called by: PROBE_BEGIN(), PROBE_END()
+//
+// Return: cycles
+// -----------------------------------------------------------------------------
+uint32_t
+get_cycles(void)	{
+
+	uint32_t ovf;
+	uint16_t tcnt;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)	{
+
+		ovf = t1_ovf;
+		tcnt = TCNT1;
+		if((TIFR1 & (1 << TOV1)) && tcnt < 0x8000)
+			ovf++;
+	}
+
+	return((ovf << 16) | tcnt);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Restart measurement of CPU idle time
+//
+// Called by: div 
+//
+// Return: 
+// -----------------------------------------------------------------------------
+void
+idle_reset(void)	{
+
+	cli();
+	idle_us = 0;
+	idle_start = time_us();
+	sei();
+}
+
+// -----------------------------------------------------------------------------
+// Description: Retrieve CPU idle time since last idle_reset()
+//
+// Details: Sleep and elapsed time are both taken from the free running
+// Timer1, see time_us(). TCNT0 is reset by the timeouts of the protocol.
+//
+// Called by: div 
+//
+// Return: idle time in percent of elapsed time
+// -----------------------------------------------------------------------------
+uint8_t
+idle_percent(void)	{
+
+	uint32_t total, idle;
+
+	cli();
+	total = time_us() - idle_start;
+	idle = idle_us;
+	sei();
+
+	if(idle >= total)
+		return(100);
+
+	// idle * 100 overflows after 43s
+	if(total > UINT32_MAX / 100)
+		return(idle / (total / 100));
+
+	return((idle * 100) / total);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Retrieve posted device present events
+//
+// Details: Events are posted by the debounced pin change detection of 
+// DEV_PRESENT. Returned events are cleared. A connect is not posted, the
+// main loop waits for it in connect().
+//
+// Called by: div
+//
+// Return: evt_mask of posted events
+// ----------------------------------------------------------------------------
+uint8_t
+get_dev_event(uint8_t evt_mask)	{
+
+	cli();
+	evt_mask &= dev_event;
+	dev_event ^= evt_mask;
+	sei();
+	return evt_mask;
+}
+
+#ifndef HOST	// host build: see host/host_main.c
+
 // -----------------------------------------------------------------------------
 // Description: This is MAIN :-)
 //
@@ -179,31 +612,38 @@ clear_rx_buffer(void)	{
 int
 main(void)	{
 
-	char lcdmsg[32];
+	char *lcdmsg, *p;
 	uint8_t state = 0;
 	uint16_t filever = 0;
 
 	init_HW();
+	PROBE_RESET();
+	RAM_REPORT();
+
+	// START key hold at power up: record the CAN bus instead of updating
+	if(!(KEY_INPUT & (1 << KEY_START)))
+		capture();
 
 	while(1)	{			// the BIG main loop
 		
+		lcdmsg = scratch_alloc(40);	// "Found Gleisbox\nVer:255.255 -> 255.255\n"
+
 		// Loop to identify device
 		while(1)	{
 
 			lcd_clrscr();
 			lcd_gotoxy(0,0);
-			lcd_puts("Connect Device\n");
-			lcd_puts("Wait ...\n");
+			lcd_puts_P("Connect Device\n");
+			lcd_puts_P("Wait ...\n");
 
 			connect();
 			device.type = 0;
 			lcd_gotoxy(0,1);
-			lcd_puts("Check ...\n");
+			lcd_puts_P("Check ...\n");
 
 			_delay_ms(200); // need to give CAN bus of device time to response
 
-			if(init_MS2(&device))
-				init_60113(&device);
+			detect_device(&device);
 			
 			lcd_clrscr();
 			switch(device.type)	{
@@ -212,24 +652,20 @@ main(void)	{
 				// Make filename constants dynamic or #define
 				case DEV_CON_MS2:
 					
+					BENCH_PHASE(BENCH_CATALOG);
 					filever = get_ms2ver("050-ms2.bin");
-					sprintf(lcdmsg,"Found MS2\nVer:%d.%d -> %d.%d\n",
-						(device.sversion >> 8), 
-						(device.sversion & 0xFF),
-						(filever >> 8), 
-						(filever & 0xFF));
+					BENCH_PHASE(BENCH_OTHER);
+					p = fmt_P(lcdmsg, PSTR("Found MS2\nVer:"));
 
 					state = 1;
 					break;
 
 				case DEV_GFP_MS2:
 
+					BENCH_PHASE(BENCH_CATALOG);
 					filever = get_gb2ver("016-gb2.bin");
-					sprintf(lcdmsg,"Found Gleisbox\nVer:%d.%d -> %d.%d\n",
-						(device.sversion >> 8), 
-						(device.sversion & 0xFF),
-						(filever >> 8), 
-						(filever & 0xFF));
+					BENCH_PHASE(BENCH_OTHER);
+					p = fmt_P(lcdmsg, PSTR("Found Gleisbox\nVer:"));
 
 					state = 1;
 					break;
@@ -237,38 +673,44 @@ main(void)	{
 				default:
 					lcd_clrscr();
 					lcd_gotoxy(0,0);
-					lcd_puts("Unknown Device\n");
-					lcd_puts("Disconnet it!\n");
+					lcd_puts_P("Unknown Device\n");
+					lcd_puts_P("Disconnet it!\n");
 					_delay_ms(1000); 
 					disconnect();
-					_delay_ms(1000); // prevent bouncing
 					break;
 			}
 
-			if(state)
-				break;
+			if(state)	{
 
+				p = fmt_ver(p, device.sversion);
+				p = fmt_P(p, PSTR(" -> "));
+				p = fmt_ver(p, filever);
+				fmt_P(p, PSTR("\n"));
+				break;
+			}
 		}
 
 		state = 0;
 		lcd_puts(lcdmsg);
+		scratch_release(0);
 		_delay_ms(2000);
 
 		// Loop until START key was pressed	
 		lcd_gotoxy(0,0);
-		lcd_puts("Update?  START  \n");
+		lcd_puts_P("Update?  START  \n");
 		while(1)	{
 
 			// Run update sequence ( terryfying... lets cross fingers ) 
 			if(get_key_press(1 << KEY_START))	{
 
 				lcd_clrscr();
-				lcd_puts("Updating");
+				lcd_puts_P("Updating");
+				LAT_RESET();
 				switch(device.type)	{
 
 					case DEV_GFP_MS2:
 
-						lcd_puts(" GFP Box\n");
+						lcd_puts_P(" GFP Box\n");
 						process_60133Update();	
 						_delay_ms(2000);
 						state = 1;
@@ -276,7 +718,7 @@ main(void)	{
 
 					case DEV_CON_MS2:
 
-						lcd_puts(" MS2\n");
+						lcd_puts_P(" MS2\n");
 						process_MS2Update(&device);	
 						_delay_ms(2000);
 						state = 1;
@@ -286,19 +728,40 @@ main(void)	{
 
 						break;		
 				}
+				LAT_DUMP();
+				RAM_REPORT();
 			}
 
 			if(state)
 				break;
+
+			// device unplugged before START: identify the next one
+			if(get_dev_event(1 << EVT_DISCONNECT))
+				break;
+
+			// over UART 'p': print the cycle probes, 's': SD card self-test
+			if(uart_rx_ready())	{
+
+				switch(uart_getc())	{
+					case 'p': PROBE_DUMP(); break;
+					case 's': sd_selftest(); break;
+				}
+			}
+
+			wait_irq();		// key is debounced by Timer0
 		}
 
+		if(!state)
+			continue;
+
+		BENCH_PHASE(BENCH_DONE);
+
 		lcd_clrscr();
 		lcd_gotoxy(0,0);
-		lcd_puts(" SUCCESSFULL !\n");
-		lcd_puts("Do disconnect\n");
+		lcd_puts_P(" SUCCESSFULL !\n");
+		lcd_puts_P("Do disconnect\n");
 		_delay_ms(2000); // give time to startup
 		disconnect();
-		_delay_ms(1000); // prevent bouncing
 	}
 
 	return 0;
@@ -314,7 +777,7 @@ main(void)	{
 static void
 init_HW(void)	{
 
-	uint8_t vers[9];
+	uint8_t *vers;
 
 	// init I/O
 	SET_OUTPUT(LED_ERROR);
@@ -325,14 +788,21 @@ init_HW(void)	{
 	SET_INPUT(DEV_PRESENT);
 	SET_PULLUP(DEV_PRESENT);
 
+	// pin change interrupt on DEV_PRESENT, first debounce takes initial state
+	PRES_PCMSK |= (1 << PRES_PCINT);
+	PCICR |= (1 << PCIE1);
+	pres_deb = PRESCNT;
+
 	SET_INPUT(KEY);
 	SET_PULLUP(KEY);
 
-	// init 8Bit Timer0, CTC, clk/1024
-	TCCR0A |= (1 << WGM01);
-	TCCR0B |= (1 << CS02) | (1 << CS00);
-	OCR0A = 63; // 4ms @ 16Mhz
-	TIMSK0 |= (1 << OCIE0A);
+	// 4ms tick of Timer0
+	init_tick_tasks();
+
+	// init 16Bit Timer1, free running, clk/1, time base of get_time_us()
+	TCCR1A = 0;
+	TCCR1B = (1 << CS10);
+	TIMSK1 |= (1 << TOIE1);
 	
 	// UART init
 	uart_init(UART_BAUD_SELECT(57600UL, F_CPU));
@@ -344,56 +814,44 @@ init_HW(void)	{
 	stdout = &mystdout;
 	PRINT("MS2 Updater\n");
 
-	PRINT("LCD init  OK\n");
-	lcd_init(LCD_DISP_ON);
-	lcd_puts(" -REAKTIVATOR-\n");
-	lcd_puts(" Version 0.0.1\n");
-	_delay_ms(2000);
-	
-	// HW SPI init
+	// HW SPI init, reset the MCP2515, it restarts during the LCD init
 	spi_init();
 	PRINT("SPI init O.K.\n");
+	can_reset();
+
+	PRINT("LCD init  OK\n");
+	lcd_init(LCD_DISP_ON);
+	lcd_puts_P(" -REAKTIVATOR-\n");
+	lcd_puts_P(" Version 0.0.1\n");
 	
 	// SD-card init
+	BENCH_PHASE(BENCH_MOUNT);
 	while(1)	{
 
-		lcd_clrscr();
-		lcd_puts("Check SD-Card:");
+		lcd_gotoxy(0,1);
+		lcd_puts_P("Check SD-Card:");
 		if(init_SD())	{
 
 			PRINT("Error: SD access FAILED\n");
-			lcd_puts("NG\n");
+			lcd_puts_P("NG\n");
 			lcd_gotoxy(0,13);
-			lcd_puts("Insert SD-Card\n");
+			lcd_puts_P("Insert SD-Card\n");
 			_delay_ms(2000);
 		} else {
 
-			lcd_puts("OK\n");
+			lcd_puts_P("OK\n");
 			break;
 		}
 	}
-
-	// be sure sd-card and FS is working
-	if(sd_open_file("016-gb2.bin"))	{
-
-		PRINT("Cant read SD-card filesystem\n");
-		lcd_clrscr();
-		lcd_puts("ERROR!\n");
-		lcd_puts("Read SD-Card\n");
-		SET(LED_ERROR);
-		while(1);
-	}
-	sd_read_file(vers,8);
-	sd_close_file();
-	PRINT("TEST file %02x %02x\n",vers[6],vers[7]);
+	BENCH_PHASE(BENCH_OTHER);
 
 	// HW init of CAN controller
-	if(!can_init())	{
+	if(!can_config())	{
 		
 		PRINT("Error: MCP2515 access FAILED\n");
 		lcd_clrscr();
-		lcd_puts("ERROR!\n");
-		lcd_puts("Init CAN\n");
+		lcd_puts_P("ERROR!\n");
+		lcd_puts_P("Init CAN\n");
 		SET(LED_ERROR);
 		while(1);
 
@@ -404,6 +862,73 @@ init_HW(void)	{
 		EIMSK |= (1<<INT0); 
 		PRINT("MCP2515 access O.K.\n\n");
 	}
+
+	// be sure sd-card and FS is working, a known card passed it before
+	if(sd_card_known())	{
+
+		PRINT("SD card known\n");
+		return;
+	}
+
+	BENCH_PHASE(BENCH_CATALOG);
+	vers = scratch_alloc(9);
+	if(sd_open_file("016-gb2.bin"))	{
+
+		PRINT("Cant read SD-card filesystem\n");
+		lcd_clrscr();
+		lcd_puts_P("ERROR!\n");
+		lcd_puts_P("Read SD-Card\n");
+		SET(LED_ERROR);
+		while(1);
+	}
+	sd_read_file(vers,8);
+	sd_close_file();
+	BENCH_PHASE(BENCH_OTHER);
+	PRINT("TEST file %02x %02x\n",vers[6],vers[7]);
+	scratch_release(0);
+	sd_card_store();
+}
+
+// -----------------------------------------------------------------------------
+// Description: Record all CAN messages to UART
+//
+// Details: The MCP2515 listens only, it neither acknowledges nor sends, so 
+// the bus is recorded without disturbing e.g. a CS2 updating a MS2. Each 
+// message is sent as binary capture record with its receive time, see 
+// capture_frame(). Decode the UART output with tools/capdec.py. Runs until
+// reset.
+//
+// Called by: main
+//
+// Return: never
+// ----------------------------------------------------------------------------
+static void
+capture(void)	{
+
+	can_t msg;
+	uint32_t stamp;
+
+	lcd_clrscr();
+	lcd_puts_P("CAN Capture\n");
+	lcd_puts_P("Listen only\n");
+	PRINT("CAN capture\n");
+
+	can_set_mode(LISTEN_ONLY_MODE);
+	clear_rx_buffer();
+	get_rx_lost();
+
+	while(1)	{
+
+		cli();
+		if(posWrite == posRead && !lastOpWasWrite)	{
+			idle_sleep();
+			continue;
+		}
+		sei();
+
+		read_rx_stamped(&msg, &stamp);
+		capture_frame(&msg, stamp, get_rx_lost());
+	}
 }
 
 // -----------------------------------------------------------------------------
@@ -429,6 +954,7 @@ get_key_press( char key_mask )	{
 // Description: Wait until device connetced to physical CAN connector
 //
 // Details: If current used by devie > 30mA,  DEV_PRESENT is set to LOW.
+// The pin is debounced in background, DEVCONN holds the stable state.
 //
 // Called by: main()
 //
@@ -437,18 +963,17 @@ get_key_press( char key_mask )	{
 static void
 connect(void)	{
 
-	while(1)	{
+	while(!(Flags & (1 << DEVCONN)))
+		wait_irq();
 
-		if(! (IS_SET(DEV_PRESENT)))	{
-			break;
-		}
-	}
+	get_dev_event(1 << EVT_DISCONNECT);
 }
 
 // -----------------------------------------------------------------------------
 // Description: Wait until device is disconnected from physical CAN connector
 //
 // Details: If current used by device < 30mA,  DEV_PRESENT is set to HIGH.
+// The pin is debounced in background, DEVCONN holds the stable state.
 //
 // Called by: main()
 //
@@ -457,10 +982,9 @@ connect(void)	{
 static void
 disconnect(void)	{
 
-	while(1)	{
+	while(Flags & (1 << DEVCONN))
+		wait_irq();
 
-		if( (IS_SET(DEV_PRESENT)))	{
-			break;
-		}
-	}
+	get_dev_event(1 << EVT_DISCONNECT);
 }
+#endif
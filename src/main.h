@@ -24,6 +24,14 @@
 #include "process.h"
 #include "config.h"
 #include "debug.h"
+#include "tick.h"
+#include "latency.h"
+#include "probe.h"
+#include "ram.h"
+#include "scratch.h"
+#include "fmt.h"
+#include "lz.h"
+#include "progress.h"
 
 // -----------------------------------------------------------------------------
 // Global timeout timing
@@ -32,8 +40,34 @@ extern volatile uint16_t count;
 // -----------------------------------------------------------------------------
 // Retrieve CAN rx buffer from buffer pool
 bool read_rx_buffer(can_t *msg);
+bool read_rx_stamped(can_t *msg, uint32_t *stamp);
+uint32_t get_rx_stamp(void);
+uint8_t get_rx_lost(void);
 void clear_rx_buffer(void);
 
+// -----------------------------------------------------------------------------
+// Wait for events, CPU sleeps in idle mode meanwhile
+bool wait_rx_buffer(can_t *msg, uint8_t flags);
+void wait_flag(uint8_t flags);
+void wait_irq(void);
+
+// -----------------------------------------------------------------------------
+// Time in us of the free running Timer1, time base of the CAN receive times
+uint32_t get_time_us(void);
+
+// -----------------------------------------------------------------------------
+// Periodic work of the updater on the 4ms tick of tick.c
+void init_tick_tasks(void);
+
+// -----------------------------------------------------------------------------
+// Measurement of CPU idle time 
+void idle_reset(void);
+uint8_t idle_percent(void);
+
+// -----------------------------------------------------------------------------
+// Retrieve and clear posted device present events
+uint8_t get_dev_event(uint8_t evt_mask);
+
 // -----------------------------------------------------------------------------
 // CAN Buffer element size = 13 Byte
 #define BUF_SIZE 4
@@ -44,6 +78,18 @@ void clear_rx_buffer(void);
 #define KEY_START PD7	//Pin 13
 #define KEY D,7			//To set pull up 
 
+// -----------------------------------------------------------------------------
+// Device present detection by pin change interrupt, debounced by Timer0
+#define PRES_PCMSK	PCMSK1	// Pin change mask of DEV_PRESENT
+#define PRES_PCINT	PCINT13	// Pin change interrupt of DEV_PRESENT PC5
+#define PRESCNT	5			// Debounce device present 4ms * 5 = 20ms
+#define PRESOFF	250		// Debounce device gone 4ms * 250 = 1s, MS2 boot
+
+// Device present events, read by get_dev_event()
+enum {
+	EVT_DISCONNECT	// device was disconnected
+};
+
 // -----------------------------------------------------------------------------
 // Timing number multiplied by 16ms
 #define TMOCNT		4		// maximal message timeout 16ms * 4 = 64ms
@@ -51,6 +97,7 @@ void clear_rx_buffer(void);
 #define LOSTCNT	62		// Check for lost SD card 16ms * 62 = 992ms
 #define DEVCNT		625	// Wait for MS2 boot  = 10s 
 #define PNGCNT		150	// Wait for MS2 first ping = 2,4s
+#define PRBCNT		16		// Repeat device probe 16ms * 16 = 256ms, power of 2
 
 // -----------------------------------------------------------------------------
 // Fast flags
@@ -61,8 +108,8 @@ enum {
 	DEVCALC,	   // Device calculating timeout
 	TIMEOUT,		// Message timeout
 	FIRSTPNG,	// wait for first ping of device
-	RESERVED5,
-	RESERVED6,
+	PROBE,		// device probe sent, wait for next repeat
+	DEVCONN,	// debounced state of DEV_PRESENT, device connected
 	RESERVED7
 };
 
@@ -22,6 +22,17 @@
 #include "spi.h"
 #include "mcp2515.h"
 #include "mcp2515_defs.h"
+#include "tick.h"
+#include "main.h"				// wait_irq()
+
+// ----------------------------------------------------------------------------
+// Order of the queued frames. The MCP2515 sends the buffer of highest TXP
+// first and on equal TXP the higher buffer number, so TXP * 4 + buffer is the
+// sending order. Each frame gets the highest free key below the key of the
+// last one, that are up to 12 frames before the chain has to wait until all
+// buffers are sent and starts again at the top.
+static uint8_t tx_key;
+static uint8_t tx_txp[3];		// TXP in TXBnCTRL, 0 after the reset
 
 
 // -------------------------------------------------------------------------
@@ -83,18 +94,34 @@ uint8_t can_read_status(uint8_t type)
 }
 
 // -------------------------------------------------------------------------
-/*************** MCP2515 init ******************/
-bool can_init()
+/*************** MCP2515 reset ******************/
+// Reset leads to configure mode, the MCP2515 needs 10ms to restart before
+// can_config(), so the boot does other work meanwhile
+void can_reset(void)
 {
+	tx_txp[0] = tx_txp[1] = tx_txp[2] = 0;
 
-	// Reset MCP2515 lead to configure mode
 	MCP_CS_LOW;
 	spi_write_byte(SPI_RESET);
 	_delay_ms(1);
 	MCP_CS_HIGH;
+}
 
+// -------------------------------------------------------------------------
+/*************** MCP2515 init ******************/
+bool can_init()
+{
+	can_reset();
 	_delay_ms(10);			// restart MCP2515
 
+	return(can_config());
+}
+
+// -------------------------------------------------------------------------
+/*************** MCP2515 config ******************/
+// Configure the MCP2515 after can_reset() and its restart time
+bool can_config(void)
+{
 	// CNF3 -> CNF1 load register (Bittiming)
 	MCP_CS_LOW;
 	spi_write_byte(SPI_WRITE);
@@ -132,6 +159,27 @@ bool can_init()
 	return(true);
 }
 
+// ----------------------------------------------------------------------------
+// Request the operation mode, listen only receives without acknowledge and
+// without error frames, loopback receives the own messages only
+void can_set_mode(can_mode_t mode)
+{
+	uint8_t reg = 0;
+	
+	if (mode == LISTEN_ONLY_MODE) {
+		reg = (1<<REQOP1)|(1<<REQOP0);
+	}
+	else if (mode == LOOPBACK_MODE) {
+		reg = (1<<REQOP1);
+	}
+	
+	// set the new mode
+	can_bit_modify(CANCTRL, (1<<REQOP2)|(1<<REQOP1)|(1<<REQOP0), reg);
+	
+	// Wait for activating new mode
+	while ((can_read_register(CANSTAT) & 0xe0) != reg);
+}
+
 // ----------------------------------------------------------------------------
 uint8_t can_get_message(can_t *msg)
 {
@@ -182,6 +230,33 @@ uint8_t can_get_message(can_t *msg)
 	return (status & 0x07) + 1;
 }
 
+// ----------------------------------------------------------------------------
+// Overflows of the receive buffers since the last call, 0..2. Each overflow
+// lost one message at least, the MCP2515 does not count them.
+uint8_t can_rx_overflows(void)
+{
+	uint8_t eflg = can_read_register(EFLG) & ((1<<RX0OVR)|(1<<RX1OVR));
+
+	if (!eflg)
+		return 0;
+
+	can_bit_modify(EFLG, eflg, 0);
+
+	return (eflg == ((1<<RX0OVR)|(1<<RX1OVR))) ? 2 : 1;
+}
+
+// ----------------------------------------------------------------------------
+// Interrupt of a sent frame, armed by can_send_message() while it waits for
+// a free transmit buffer. Both clear the flags of the sent frames, the INT0
+// ISR switches it off if it finds no received message.
+void can_tx_irq(bool on)
+{
+	uint8_t mask = (1<<TX0IE)|(1<<TX1IE)|(1<<TX2IE);	// = TXnIF bits
+
+	can_bit_modify(CANINTF, mask, 0);
+	can_bit_modify(CANINTE, mask, on ? mask : 0);
+}
+
 // ----------------------------------------------------------------------------
 // Read ID from MCP2515 register
 uint8_t can_read_id(uint32_t *id)
@@ -230,65 +305,116 @@ void can_write_id(const uint32_t *id)
 	spi_write_byte(*((uint8_t *) id));
 }
 
-uint8_t can_send_message(const can_t *msg)	{
+// ----------------------------------------------------------------------------
+// Waits for a free buffer, at most TX_WAIT_MS if the bus does not take the
+// frames, e.g. without a device acknowledging them
+#define TX_WAIT_MS	20
 
-	uint8_t address = 0;
+uint8_t can_send_message(const can_t *msg)	{
 
-	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)	{
+	uint8_t address = 0xFF, wait = 0;
 
-		// Read status of MCP2515
-		uint8_t status = can_read_status(SPI_READ_STATUS);
-		
-		/* Statusbyte:
-		 *
-		 * Bit	Funktion
-		 *  2	TXB0CNTRL.TXREQ
-		 *  4	TXB1CNTRL.TXREQ
-		 *  6	TXB2CNTRL.TXREQ
-		 */
-
-		if (bit_is_clear(status, 2)) {
-			address = 0x00;
-		}
-		else if (bit_is_clear(status, 4)) {
-			address = 0x02;
-		} 
-		else if (bit_is_clear(status, 6)) {
-			address = 0x04;
-		}
-		else {
+	tick_start(TICK_CAN, TICK_MS(TX_WAIT_MS));
 
-			return 0;
-		}
-		
-		MCP_CS_LOW;
+	while (address == 0xFF) {
 
-		spi_write_byte(SPI_WRITE_TX | address);
-		can_write_id(&msg->id);
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)	{
 
-		uint8_t length = msg->length & 0x0f;
-		
-		// set message length
-		spi_write_byte(length);
+			// Read status of MCP2515
+			uint8_t status = can_read_status(SPI_READ_STATUS);
 			
-		// send data via SPI
-		for (uint8_t i=0;i<length;i++) {
-			spi_write_byte(msg->data[i]);
+			/* Statusbyte:
+			 *
+			 * Bit	Funktion
+			 *  2	TXB0CNTRL.TXREQ
+			 *  4	TXB1CNTRL.TXREQ
+			 *  6	TXB2CNTRL.TXREQ
+			 */
+
+			if (!(status & ((1<<2)|(1<<4)|(1<<6)))) {
+				tx_key = 16;
+			}
+
+			// a free buffer below the last frame, TXREQ at bit 2, 4, 6
+			for (uint8_t key = tx_key; key--; ) {
+				if ((key & 3) != 3 && bit_is_clear(status, 2 + ((key & 3) << 1))) {
+					tx_key = key;
+					address = (key & 3) << 1;
+					break;
+				}
+			}
+
+			if (address != 0xFF) {
+
+				uint8_t txp = tx_key >> 2;
+
+				MCP_CS_LOW;
+
+				// TXBnCTRL, id, length and data are consecutive
+				// registers, a changed priority is written with them
+				if (tx_txp[address >> 1] != txp) {
+
+					tx_txp[address >> 1] = txp;
+					spi_write_byte(SPI_WRITE);
+					spi_write_byte(TXB0CTRL + (address << 3));
+					spi_write_byte(txp);
+				}
+				else {
+					spi_write_byte(SPI_WRITE_TX | address);
+				}
+				can_write_id(&msg->id);
+
+				uint8_t length = msg->length & 0x0f;
+				
+				// set message length
+				spi_write_byte(length);
+					
+				// send data via SPI
+				for (uint8_t i=0;i<length;i++) {
+					spi_write_byte(msg->data[i]);
+				}
+
+				MCP_CS_HIGH;
+				_delay_us(1);
+				
+				// Send CAN message
+				// The last three bit in RTS command point to
+				// which buffer should send
+				MCP_CS_LOW;
+
+				address = (address == 0) ? 1 : address;
+				spi_write_byte(SPI_RTS | address);
+
+				MCP_CS_HIGH;
+			}
 		}
 
-		MCP_CS_HIGH;
-		_delay_us(1);
-		
-		// Send CAN message
-		// The last three bit in RTS command point to
-		// which buffer should send
-		MCP_CS_LOW;
+		if (address == 0xFF) {
+
+			if (!tick_left(TICK_CAN))
+				break;
+
+			// wake up by the next sent frame, the status is checked once
+			// more after arming it, then sleep until the next interrupt
+			if (wait != 1) {
+				ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+					can_tx_irq(true);
+				}
+				wait = 1;
+			}
+			else {
+				wait_irq();
+				wait = 2;
+			}
+		}
+	}
 
-		address = (address == 0) ? 1 : address;
-		spi_write_byte(SPI_RTS | address);
+	if (wait) {
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			can_tx_irq(false);
+		}
+	}
 
-		MCP_CS_HIGH;
-	}	
+	return (address == 0xFF) ? 0 : address;
 
-	return address;
 }
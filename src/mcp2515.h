@@ -42,6 +42,14 @@ typedef enum {
 bool
 can_init(void);
 
+// ----------------------------------------------------------------------------
+void
+can_reset(void);
+
+// ----------------------------------------------------------------------------
+bool
+can_config(void);
+
 // ----------------------------------------------------------------------------
 uint8_t
 can_get_message(can_t *msg);
@@ -54,6 +62,14 @@ can_send_message(const can_t *msg);
 void
 can_set_mode(can_mode_t mode);
 
+// ----------------------------------------------------------------------------
+uint8_t
+can_rx_overflows(void);
+
+// ----------------------------------------------------------------------------
+void
+can_tx_irq(bool on);
+
 // -------------------------------------------------------------------------
 void
 can_write_register( uint8_t adress, uint8_t data);
@@ -10,13 +10,16 @@
 */
 
 #include "mmc.h"
+#include "probe.h"
+#include "tick.h"
 
-static void			init_timer(void);
 static uint8_t 	mmc_enable(void);
 static void 		mmc_disable(void); 
 static uint8_t 	mmc_wait_ready (void);
 static uint8_t		mmc_send_cmd (	uint8_t cmd, uint32_t arg);
 static int			mmc_rx_datablock( uint8_t *buff, uint16_t btr);
+static int			mmc_rx_part(uint8_t *buff, uint16_t btr, uint16_t pos, uint8_t n);
+static void			mmc_set_clock(void);
 #if (TXB0104_OE == TRUE)
 static void			mmc_powerOn(void);
 static void			mmc_powerOff(void);
@@ -25,11 +28,17 @@ static void			mmc_powerOff(void);
 
 static BYTE CardType; //Cardtype (b0:MMC, b1:SDv1, b2:SDv2, b3:Block addressing)
 static volatile DSTATUS Stat = STA_NOINIT;	// Disk status 
-volatile uint8_t TimingDelay;
+static mmc_clock_t Clock;			// SPI clock of the card
 
 #include "uart.h"
 #include <avr/pgmspace.h>
 
+// TRAN_SPEED of the CSD: time value * 10 and rate unit in kHz / 10
+static const uint8_t tran_value[16] PROGMEM = {
+	0, 10, 12, 13, 15, 20, 25, 30, 35, 40, 45, 50, 55, 60, 70, 80
+};
+static const uint16_t tran_unit[4] PROGMEM = {10, 100, 1000, 10000};
+
 // -----------------------------------------------------------------------------
 // ---------*** PUBLIC Functions as low level interface for ELM ***-------------
 // -----------------------------------------------------------------------------
@@ -49,12 +58,14 @@ disk_initialize(BYTE pdrv)	{
 	uint8_t cmd, ty, ocr[4];
 	uint16_t n, j;
 
-	init_timer(); // Need 10ms increment of TimingDelay var
-
 	#if (TXB0104_OE == TRUE)
 		mmc_powerOn();
 	#endif
 
+	Clock.spi_khz = spi_clock(SPI_INIT_KHZ);
+	Clock.tran_khz = 0;
+	Clock.hs = HS_NONE;
+
 	mmc_disable();
 
 	for (n = 100; n; n--) spi_read_byte();	// 80+ dummy clocks
@@ -66,7 +77,7 @@ disk_initialize(BYTE pdrv)	{
 		if (mmc_send_cmd(CMD0, 0) == 1) {  	// Enter Idle state
 
 			j=0;
-			TimingDelay = 100;        	// Initialization timeout of 1000 msec
+			tick_start(TICK_SD_INIT, TICK_MS(1000));	// Initialization timeout of 1000 msec
 
 			if (mmc_send_cmd(CMD8, 0x1AA) == 1) {	// SDv2?
 
@@ -75,13 +86,13 @@ disk_initialize(BYTE pdrv)	{
 				}
 
 				if (ocr[2] == 0x01 && ocr[3] == 0xAA) { // The card can work at vdd range of 2.7-3.6V
-					while (TimingDelay) { // Wait for leaving idle state (ACMD41 with HCS bit)
+					while (tick_left(TICK_SD_INIT)) { // Wait for leaving idle state (ACMD41 with HCS bit)
 						mmc_send_cmd(CMD55, 0);
 						if(!mmc_send_cmd(ACMD41, 1UL << 30))
 							break;
 					}
 
-					while(TimingDelay) {
+					while(tick_left(TICK_SD_INIT)) {
 
 						if (mmc_send_cmd(CMD58, 0) == 0x00) { // Check CCS bit in the OCR
 							for (n = 0; n < 4; n++){
@@ -103,14 +114,14 @@ disk_initialize(BYTE pdrv)	{
 					cmd = CMD1;    								// MMCv3
 				}
 
-				while (TimingDelay && mmc_send_cmd(cmd, 0)); // Wait for leaving idle state
+				while (tick_left(TICK_SD_INIT) && mmc_send_cmd(cmd, 0)); // Wait for leaving idle state
 			}
 
 			if(ty != (CT_SD2 | CT_BLOCK)) {
-				while(TimingDelay && (mmc_send_cmd(CMD16, 512) != 0));
+				while(tick_left(TICK_SD_INIT) && (mmc_send_cmd(CMD16, 512) != 0));
 			}
 
-			if(!TimingDelay) ty = 0;
+			if(!tick_left(TICK_SD_INIT)) ty = 0;
 
 		} else { j--; }
 
@@ -121,9 +132,7 @@ disk_initialize(BYTE pdrv)	{
 
 	if(ty)	{
 		Stat &= ~STA_NOINIT;
-		#if (SPI_MAX_SPEED==TRUE)
-			spi_maxSpeed();
-		#endif
+		mmc_set_clock();
 	} else {
 
 		#if (TXB0104_OE == TRUE)
@@ -187,49 +196,89 @@ disk_read(BYTE pdrv, BYTE *buff, DWORD sector, UINT count)	{
 
 }
 
-
-
-// -----------------------------------------------------------------------------
-// ---------*** PRIVATE Functions for low level interface for ELM ***-----------
-// -----------------------------------------------------------------------------
-
-
 // -----------------------------------------------------------------------------
-// Description: Timer ISR
+// Description: Card registers and state
 //
-// Details: Must be called every 10ms. Need for timeout detection at SD-Card
+// Details: Elm-ChaN low level. GET_SECTOR_COUNT ( DWORD ) by the CSD,
+// MMC_GET_TYPE ( BYTE ), MMC_GET_CSD and MMC_GET_CID ( 16 bytes ),
+// MMC_GET_SDSTAT ( 64 bytes ) and MMC_GET_CLOCK ( mmc_clock_t ).
 // 
-// Called by: Timer 2 COMPA interrupt
+// Called by: sd.c
 //
-// Return: void
+// Return: Status byte
 // ----------------------------------------------------------------------------
-ISR(TIMER2_COMPA_vect)	{
+DRESULT
+disk_ioctl(BYTE pdrv, BYTE cmd, void *buff)	{
 
-	TimingDelay = (TimingDelay == 0) ? 0 : TimingDelay - 1 ;
-}
+	DRESULT res = RES_ERROR;
+	uint8_t n, csd[16];
+	DWORD csize;
 
+	if(pdrv)
+		return RES_PARERR;
 
-// -----------------------------------------------------------------------------
-// Description: Initialize timeout timer
-//
-// Details: Invoce every 10ms a overflow interrupt
-// 
-// Called by: disk_initialize(BYTE pdrv)
-//
-// Return: void
-// ----------------------------------------------------------------------------
-static void
-init_timer(void)	{
+	if(Stat & STA_NOINIT)
+		return RES_NOTRDY;
+
+	switch(cmd)	{
+
+		case GET_SECTOR_COUNT:
+			if(mmc_send_cmd(CMD9, 0) == 0 && mmc_rx_datablock(csd, 16))	{
+
+				if((csd[0] >> 6) == 1)	{	// CSD ver 2.0: C_SIZE of 512kB
+					csize = csd[9] + ((WORD)csd[8] << 8) + ((DWORD)(csd[7] & 63) << 16) + 1;
+					*(DWORD*)buff = csize << 10;
+				} else {					// CSD ver 1.XX and MMC
+					n = (csd[5] & 15) + ((csd[10] & 128) >> 7) + ((csd[9] & 3) << 1) + 2;
+					csize = (csd[8] >> 6) + ((WORD)csd[7] << 2) + ((WORD)(csd[6] & 3) << 10) + 1;
+					*(DWORD*)buff = csize << (n - 9);
+				}
+				res = RES_OK;
+			}
+			break;
+
+		case MMC_GET_TYPE:
+			*(BYTE*)buff = CardType;
+			res = RES_OK;
+			break;
+
+		case MMC_GET_CSD:
+		case MMC_GET_CID:
+			if(mmc_send_cmd(cmd == MMC_GET_CSD ? CMD9 : CMD10, 0) == 0 &&
+			   mmc_rx_datablock(buff, 16))
+				res = RES_OK;
+			break;
+
+		case MMC_GET_SDSTAT:
+			if(mmc_send_cmd(ACMD13, 0) == 0)	{
+				spi_read_byte();			// second byte of the R2 response
+				if(mmc_rx_datablock(buff, 64))
+					res = RES_OK;
+			}
+			break;
 
-	TimingDelay = 0;
+		case MMC_GET_CLOCK:
+			*(mmc_clock_t*)buff = Clock;
+			res = RES_OK;
+			break;
 
-	TCCR2A = (1 << WGM21); // CTC mode
-	TCCR2B = (1 << CS22 ) | (1 << CS21) | (1 << CS20); // clk / 1024
-	OCR2A = 156; // ISR every 10ms 
-	TIMSK2 = (1 << OCIE2A);
+		default:
+			res = RES_PARERR;
+			break;
+	}
+
+	mmc_disable();
 
+	return res;
 }
 
+
+
+// -----------------------------------------------------------------------------
+// ---------*** PRIVATE Functions for low level interface for ELM ***-----------
+// -----------------------------------------------------------------------------
+
+
 // -----------------------------------------------------------------------------
 // Description: Low level SPI command to SD Card
 //
@@ -241,6 +290,14 @@ static uint8_t
 mmc_send_cmd(uint8_t cmd,	uint32_t arg)	{
 	
 	uint8_t n, res;
+
+	// ACMD<n> is the command sequence of CMD55-CMD<n>
+	if (cmd & 0x80) {
+		cmd &= 0x7F;
+		res = mmc_send_cmd(CMD55, 0);
+		if (res > 1) return res;
+	}
+
 	// Select the card and wait for ready 
 	mmc_disable();
 	if ( FALSE == mmc_enable() ){
@@ -279,11 +336,11 @@ mmc_rx_datablock( uint8_t *buff, uint16_t btr)	{
 
 	BYTE token;
 
-	TimingDelay = 20;       	// Initialization timeout of 200 msec
+	tick_start(TICK_SD, TICK_MS(200));	// Initialization timeout of 200 msec
 
 	do {							// Wait for data packet in timeout of 200ms
 		token = spi_read_byte();
-	} while ((token == 0xFF) && TimingDelay);
+	} while ((token == 0xFF) && tick_left(TICK_SD));
 
 	if (token != 0xFE) return 0;	// If not valid data token, retutn with error
 
@@ -296,6 +353,88 @@ mmc_rx_datablock( uint8_t *buff, uint16_t btr)	{
 }
 
 
+// -----------------------------------------------------------------------------
+// Description: Low level SPI read a part of a data block from SD Card
+//
+// Details: Keeps n bytes from pos of the btr bytes of the block, for the
+// status blocks of 64 bytes without a buffer of their size.
+//
+// Called by: mmc_set_clock
+//
+// Return: 1 on success
+// ----------------------------------------------------------------------------
+static int
+mmc_rx_part(uint8_t *buff, uint16_t btr, uint16_t pos, uint8_t n)	{
+
+	BYTE token;
+	uint16_t i;
+
+	tick_start(TICK_SD, TICK_MS(200));
+
+	do {							// Wait for data packet in timeout of 200ms
+		token = spi_read_byte();
+	} while ((token == 0xFF) && tick_left(TICK_SD));
+
+	if (token != 0xFE) return 0;
+
+	for (i = 0; i < btr; i++) {
+		token = spi_read_byte();
+		if ((uint16_t)(i - pos) < n)
+			buff[i - pos] = token;
+	}
+
+	spi_write_byte(0xFF);			// Discard CRC 
+	spi_write_byte(0xFF);
+
+	return 1;
+}
+
+// -----------------------------------------------------------------------------
+// Description: Select the SPI clock of the initialized card
+//
+// Details: The clock is the TRAN_SPEED of the CSD, at most SPI_MAX_KHZ of
+// the board. A SD ver 2 card with the switch command class is asked by
+// CMD6 for high speed. The switch to 50MHz is only done if the board runs
+// faster than the default speed of 25MHz. A card without readable CSD
+// stays at the init clock.
+//
+// Called by: disk_initialize
+//
+// Return: void
+// ----------------------------------------------------------------------------
+static void
+mmc_set_clock(void)	{
+
+	uint8_t csd[16], sw = 0;
+
+	if (mmc_send_cmd(CMD9, 0) || !mmc_rx_datablock(csd, 16)) {
+		mmc_disable();
+		return;
+	}
+
+	Clock.tran_khz = (uint32_t)pgm_read_byte(&tran_value[(csd[3] >> 3) & 15]) *
+		((csd[3] & 4) ? 0 : pgm_read_word(&tran_unit[csd[3] & 3]));
+
+	// CCC class 10: switch, query function 1 of group 1 ( high speed )
+	if ((CardType & CT_SD2) && (csd[4] & 0x40) &&
+		mmc_send_cmd(CMD6, 0x00FFFFF1) == 0 && mmc_rx_part(&sw, 64, 13, 1) &&
+		(sw & 0x02)) {
+
+		Clock.hs = HS_SUPPORTED;
+#if (SPI_MAX_KHZ > 25000)
+		if (mmc_send_cmd(CMD6, 0x80FFFFF1) == 0 && mmc_rx_part(&sw, 64, 16, 1) &&
+			(sw & 0x0F) == 1) {
+			Clock.hs = HS_ACTIVE;
+			Clock.tran_khz = 50000;
+		}
+#endif
+	}
+	mmc_disable();
+
+	if (Clock.tran_khz)
+		Clock.spi_khz = spi_clock(Clock.tran_khz < SPI_MAX_KHZ ? Clock.tran_khz : SPI_MAX_KHZ);
+}
+
 // -----------------------------------------------------------------------------
 // Description: Low level SPI enable and wait for SD Card
 //
@@ -340,11 +479,11 @@ mmc_disable()	{
 static uint8_t
 mmc_wait_ready (void){
 
-	TimingDelay = 50;
+	tick_start(TICK_SD, TICK_MS(500));
 
 	do{
 		if(	 spi_read_byte() == 0xFF ) return TRUE;
-	}while ( TimingDelay );
+	}while ( tick_left(TICK_SD) );
 
 	return FALSE;
 }
@@ -24,12 +24,14 @@ extern "C" {
 #include "diskio.h"
 #include "spi.h"
 
-#define SPI_MAX_SPEED FALSE	// TRUE Switch max SPI speed after init MMC_Card
+#define SPI_INIT_KHZ	400		// SPI clock of the card init, 100..400kHz
+#define SPI_MAX_KHZ	8000	// highest SPI clock of the board, MCP2515 10MHz
 #define TXB0104_OE FALSE		// If HW need to drive TXB0104 by !OE select
 
 // Definitions for MMC/SDC command 
 #define CMD0	(0)			// GO_IDLE_STATE 
 #define CMD1	(1)			// SEND_OP_COND (MMC) 
+#define CMD6	(6)			// SWITCH_FUNC (SDC) 
 #define	ACMD41	(41)		// SEND_OP_COND (SDC)
 #define CMD8	(8)			// SEND_IF_COND 
 #define CMD9	(9)			// SEND_CSD 
@@ -53,6 +55,20 @@ extern "C" {
 #define CT_SDC		(CT_SD1|CT_SD2)	// SD 
 #define CT_BLOCK	0x08			// Block addressing 
 
+// disk_ioctl() of the SPI clock, buff is mmc_clock_t
+#define MMC_GET_CLOCK	64
+
+// CMD6 high speed of the card, mmc_clock_t hs
+#define HS_NONE		0			// not supported or no SD ver 2
+#define HS_SUPPORTED	1			// supported, the card runs default speed
+#define HS_ACTIVE		2			// switched to high speed
+
+typedef struct {
+	uint32_t tran_khz;				// max. clock of the card, CSD TRAN_SPEED
+	uint16_t spi_khz;				// SPI clock after the init
+	uint8_t hs;						// HS_*
+} mmc_clock_t;
+
 #ifdef __cplusplus
 }
 #endif
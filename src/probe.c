@@ -0,0 +1,135 @@
+/*
+* ----------------------------------------------------------------------------
+* Cycle probes of the hot paths
+*
+* PROBE_BEGIN() and PROBE_END() take the CPU cycles of the free running 
+* Timer1 around the probed code. Per probe count, minimum, maximum and total
+* cycles are kept, the cycles of an empty probe are subtracted.
+*
+*  Version: 0.0.1
+*  
+* "THE BEER-WARE LICENSE" (Revision 42):
+* <karsten@rhen.de> wrote this file. As long as you retain this notice you
+* can do whatever you want with this stuff. If we meet some day, and you think
+* this stuff is worth it, you can buy me a beer in Flensburg, Germany
+* ----------------------------------------------------------------------------
+*/
+
+#include <avr/io.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+
+#include "main.h"
+
+#if defined(PROBES)
+
+typedef struct {
+	uint16_t count;
+	uint32_t min, max;
+	uint32_t total;		// saturates at UINT32_MAX, 268s
+} probe_t;
+
+static probe_t probe[PRB_MAX];
+static const char probe_name[PRB_MAX][8] = {
+	"spiblk", "crc", "cansnd", "sdread", "sdseek", "int0", "tick", "format", "unlz"
+};
+static uint8_t probe_bias;		// cycles of an empty probe
+
+// -----------------------------------------------------------------------------
+// Description: Add the cycles of one pass of a probe
+//
+// Details: Called by PROBE_END() in ISRs too, so the table is updated with
+// disabled interrupts.
+//
+// Called by: PROBE_END()
+//
+// Return: void
+// -----------------------------------------------------------------------------
+void
+probe_add(uint8_t id, uint32_t cycles)	{
+
+	probe_t *p = &probe[id];
+
+	cycles = (cycles > probe_bias) ? cycles - probe_bias : 0;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)	{
+
+		if(p->count < 0xFFFF)
+			p->count++;
+
+		if(cycles < p->min)
+			p->min = cycles;
+		if(cycles > p->max)
+			p->max = cycles;
+
+		p->total = (p->total > UINT32_MAX - cycles) ? UINT32_MAX : 
+			p->total + cycles;
+	}
+}
+
+// -----------------------------------------------------------------------------
+// Description: Clear the table and measure the cycles of an empty probe
+//
+// Called by: main
+//
+// Return: void
+// -----------------------------------------------------------------------------
+void
+probe_reset(void)	{
+
+	uint8_t i;
+	uint32_t t;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)	{
+
+		memset(probe, 0, sizeof(probe));
+		for(i = 0; i < PRB_MAX; i++)
+			probe[i].min = UINT32_MAX;
+	}
+
+	t = get_cycles();
+	probe_bias = get_cycles() - t;
+}
+
+// -----------------------------------------------------------------------------
+// Description: Print the table
+//
+// Details: One line per probe in cycles, each line waits until the UART
+// sent the one before, so nothing is dropped.
+//
+// Called by: main
+//
+// Return: void
+// -----------------------------------------------------------------------------
+void
+probe_dump(void)	{
+
+	probe_t p;
+	uint8_t i;
+
+#ifndef HOST
+	uart_tx_flush();
+#endif
+	PRINT("probe count min max total cycles\n");
+	for(i = 0; i < PRB_MAX; i++)	{
+
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)	{
+			p = probe[i];
+		}
+
+#ifndef HOST
+		uart_tx_flush();
+#endif
+		if(!p.count)
+			p.min = 0;
+
+		PRINT("%-6s %u %lu %lu %lu\n", probe_name[i], p.count,
+				(unsigned long)p.min, (unsigned long)p.max,
+				(unsigned long)p.total);
+	}
+}
+
+#endif
@@ -0,0 +1,56 @@
+/*
+* ----------------------------------------------------------------------------
+* Cycle probes of the hot paths
+*
+*  Version: 0.0.1
+*  
+* "THE BEER-WARE LICENSE" (Revision 42):
+* <karsten@rhen.de> wrote this file. As long as you retain this notice you
+* can do whatever you want with this stuff. If we meet some day, and you think
+* this stuff is worth it, you can buy me a beer in Flensburg, Germany
+* ----------------------------------------------------------------------------
+*/
+
+#ifndef PROBE_H
+#define PROBE_H
+
+#include <inttypes.h>
+
+// -----------------------------------------------------------------------------
+// Probed code, times include the interrupts served meanwhile
+enum {
+	PRB_SPI_BLOCK,	// spi_read_block()
+	PRB_CRC,		// create_CRC()
+	PRB_CAN_SEND,	// can_send_message() of a protocol frame
+	PRB_SD_READ,	// sd_read_file(), sd_map_file()
+	PRB_SD_SEEK,	// f_lseek() of sd_seek_file()
+	PRB_INT0,		// ISR INT0, CAN receive
+	PRB_TICK,		// ISR Timer0 compare match, tick service
+	PRB_FORMAT,		// config reply formatting of the version functions
+	PRB_LZ,			// lz_decode() of a compressed file
+	PRB_MAX
+};
+
+// -----------------------------------------------------------------------------
+// Probes are compiled in by PROBES only, make PROBES=1
+#if defined(PROBES)
+#define PROBE_BEGIN(id)		uint32_t probe_ ## id = get_cycles()
+#define PROBE_END(id)		probe_add(id, get_cycles() - probe_ ## id)
+#define PROBE_RESET()		probe_reset()
+#define PROBE_DUMP()		probe_dump()
+#else
+#define PROBE_BEGIN(id)		do{} while(0)
+#define PROBE_END(id)		do{} while(0)
+#define PROBE_RESET()		do{} while(0)
+#define PROBE_DUMP()		do{} while(0)
+#endif
+
+// -----------------------------------------------------------------------------
+// CPU cycles of the free running Timer1, see main.c
+uint32_t get_cycles(void);
+
+void probe_add(uint8_t id, uint32_t cycles);
+void probe_reset(void);
+void probe_dump(void);
+
+#endif
@@ -12,6 +12,7 @@
 */
 
 #include <avr/io.h>
+#include <avr/pgmspace.h>
 #include <stdio.h>
 #include <inttypes.h>
 #include <string.h>
@@ -26,6 +27,12 @@
 // static prototyp
 static void start_MS2(uint16_t hash);
 static uint8_t update_MS2(void);
+static uint8_t find_caller(const uint8_t *name);
+static uint8_t ident_MS2(device_t *device);
+static uint8_t start_60113(void);
+static uint8_t ping_device(device_t *device);
+static void get_devInfo(device_t *device, can_t *msg);
+static uint16_t read_chunk(const uint8_t **data, uint16_t len, uint8_t *pad, uint8_t fill);
 
 // prototypes for caller
 uint8_t process_filever(char *fName);
@@ -40,13 +47,13 @@ struct msg_fkt {
 
 	uint8_t flashUpd;		// True if a binary flash update should be invoced
 	uint8_t reqCount;		// number of sub requests related to this request
-	char fktName[8];		// identify function by string
+	char fktName[8];		// identify function by the zero padded 8 byte name
 	char fName[12];		// appropiate file name
 	uint8_t (*function)(char *fName);
 };
 
 
-struct msg_fkt caller[] = 	{
+static const struct msg_fkt caller[] PROGMEM = 	{
 
 	{0,0, "langver","lang.ms2", process_filever},
 	{0,1, "lang", "lang.ms2", process_transfer},	
@@ -60,7 +67,27 @@ struct msg_fkt caller[] = 	{
 	{0,1, "gb2","016-gb2.bin", process_transfer}
 };
 
-#define FKTCOUNT 10		// Number of functions in caller array
+// Perfect hash of the names in caller[], index + 1 of the entry per slot.
+// Update it if a name is added to caller[], the host build checks every
+// name with check_callers()
+#define FKTHASH(n)	(((n)[0] + (n)[3] + (n)[5]) & (FKTSLOTS - 1))
+#define FKTSLOTS 32
+
+static const uint8_t fktSlot[FKTSLOTS] PROGMEM = {
+
+	[24] = 1,		// langver
+	[19] = 2,		// lang
+	[20] = 3,		// ldbver
+	[16] = 4,		// lokdb
+	[21] = 5,		// ms2ver
+	[13] = 6,		// ms2
+	[10] = 7,		// ms2xver
+	[5] = 8,		// ms2x
+	[15] = 9,		// gb2ver
+	[7] = 10		// gb2
+};
+
+#define FKTNONE 0xFF		// No function for the requested name
 #define VERCOUNT	5		// Number of version check functions
 
 
@@ -83,7 +110,7 @@ process_sysReset(void)	{
 
 	TCNT0 = count = 0;
 	Flags |= (1 << DEVCALC);
-	while(Flags & (1 << DEVCALC));		// wait 400ms for reset target
+	wait_flag(1 << DEVCALC);		// wait 400ms for reset target
 }
 
 
@@ -107,15 +134,12 @@ process_bootInit(void)	{
 
 	TCNT0 = count = 0;
 	Flags |= (1 << TIMEOUT);
-	while(Flags & (1 << TIMEOUT))	{
+	while(wait_rx_buffer(&msg, (1 << TIMEOUT)))	{
 
-		if(read_rx_buffer(&msg))	{
-
-			cmd = (msg.id >> 17) & 0xFF;
+		cmd = (msg.id >> 17) & 0xFF;
 
-			if(cmd == CMD_BOOTLD_CAN)	{
-				return(0);
-			}
+		if(cmd == CMD_BOOTLD_CAN)	{
+			return(0);
 		}
 	}
 
@@ -143,23 +167,22 @@ process_binBlock(uint8_t num)	{
 	can_t msg;
 
 	snd_binBlock(num);
+	LAT_REQUEST(LAT_BLKN);
 
 	TCNT0 = count = 0;
 	Flags |= (1 << TIMEOUT);
 
-	while(Flags & (1 << TIMEOUT))	{
+	while(wait_rx_buffer(&msg, (1 << TIMEOUT)))	{
 
-		if(read_rx_buffer(&msg))	{
-
-			cmd = (msg.id >> 17) & 0xFF;
+		cmd = (msg.id >> 17) & 0xFF;
 
-			if(cmd == CMD_BOOTLD_CAN ) {
+		if(cmd == CMD_BOOTLD_CAN ) {
 
-				if(msg.data[5] == num)
-					return(0);
-				else
-					return(1);
-			}
+			LAT_REPLY(LAT_BLKN);
+			if(msg.data[5] == num)
+				return(0);
+			else
+				return(1);
 		}
 	}
 
@@ -183,23 +206,22 @@ process_binCRC(void)	{
 	can_t msg;
 
 	snd_binCRC();
+	LAT_REQUEST(LAT_CRC);
 
 	TCNT0 = count = 0;
 	Flags |= (1 << DEVCALC);
 
-	while(Flags & (1 << DEVCALC))	{
+	while(wait_rx_buffer(&msg, (1 << DEVCALC)))	{
 
-		if(read_rx_buffer(&msg))	{
-
-			cmd = (msg.id >> 17) & 0xFF;
+		cmd = (msg.id >> 17) & 0xFF;
 
-			if(cmd == CMD_BOOTLD_CAN ) {
+		if(cmd == CMD_BOOTLD_CAN ) {
 
-				if(msg.data[4] == CMD_BOOTSUB_CRC)	{
-					return(0);
-				}else	{
-					return(1);
-				}
+			LAT_REPLY(LAT_CRC);
+			if(msg.data[4] == CMD_BOOTSUB_CRC)	{
+				return(0);
+			}else	{
+				return(1);
 			}
 		}
 	}
@@ -243,6 +265,37 @@ process_flashUpd(void)	{
 	return(init_MS2(&device));
 }
 
+// -----------------------------------------------------------------------------
+// Description: Next chunk of the opened file for CRC and stream
+//
+// Details: The chunk is mapped by sd_map_file() from the FatFs sector window
+// or the window of the decoder of a compressed file, the data is not copied. Only a short chunk at the end of file is copied to
+// pad, at least BUFSIZE byte, and filled with fill up to BUFSIZE. *data is
+// valid until the next call of a sd_*_file() function.
+//
+// Called by: process_bintransfer, process_transfer
+//
+// Return: The number of file bytes in the chunk, 0 on end of file
+// -----------------------------------------------------------------------------
+static uint16_t
+read_chunk(const uint8_t **data, uint16_t len, uint8_t *pad, uint8_t fill)	{
+
+	uint16_t n, j;
+
+	n = sd_map_file(data, len);
+
+	if(n % 8)	{
+
+		for(j = 0; j < n; j++)
+			pad[j] = (*data)[j];
+		for(; j < BUFSIZE; j++)
+			pad[j] = fill;
+		*data = pad;
+	}
+
+	return(n);
+}
+
 // -----------------------------------------------------------------------------
 // Description: Process binary data transfer
 //
@@ -258,10 +311,12 @@ process_flashUpd(void)	{
 uint8_t
 process_bintransfer(char *fName, uint16_t blksize, uint8_t magic)	{
 
-	uint8_t blknum = 0, retval = 0, blkcnt = 0,j;
-	uint16_t n = 0;
-	uint32_t seek = 0;
-	uint8_t buffer[BUFSIZE];
+	uint8_t blknum = 0, retval = 0, blkcnt = 0, done = 0;
+	uint16_t n = 0, left;
+	uint32_t seek = 0, sent = 0;
+	uint16_t top = scratch_mark();
+	uint8_t *buffer;
+	const uint8_t *data;
 
 	if(sd_open_file(fName))	{
 
@@ -269,52 +324,54 @@ process_bintransfer(char *fName, uint16_t blksize, uint8_t magic)	{
 		return(1);
 	}
 
+	buffer = scratch_alloc(BUFSIZE);
+
 	PRINT("Filesize:%d\n",sd_file_size());
 
 	blknum = (sd_file_size() / blksize) + magic;
 	seek = ((sd_file_size() / blksize) * blksize);
 
-	for(n = 0; n < BUFSIZE; n++)
-		buffer[n] = 0xFF;
-
 	PRINT("Number of Blocks: %d Seek:%d\n",blknum,seek);
+	PROGRESS_START((seek / blksize) + 1);
+	idle_reset();
 
 	// ANGST!
 	while(1)	{
 
+		BENCH_PHASE(BENCH_BLOCK);
+		BENCH_PHASE(BENCH_ACK);
 		sd_seek_file(&seek); //Seek to block position
 
 		if((retval = process_binBlock(blknum--)) != 0)
 			break;
 
-		// read 32 Byte util block end
-		while((n = sd_read_file(buffer, BUFSIZE)) > 0 )	{
-
-			//0xFF padding
-			if(n < BUFSIZE)	{
-				for(j = n; j < BUFSIZE; j++)
-					buffer[j] = 0xFF;
-			}
+		// 32 Byte from the sector window util block end, 0xFF padding
+		BENCH_PHASE(BENCH_STREAM);
+		left = blksize;
+		while(left && (n = read_chunk(&data, BUFSIZE, buffer, 0xFF)) > 0)	{
 
+			left -= n;
 			if(n % 8)
 				n = ((n / 8) + 1) * 8;
 
 			// update crc
-			create_CRC((char *)buffer, n, blkcnt);
+			BENCH_PHASE(BENCH_CRC);
+			create_CRC((const char *)data, n, blkcnt);
 
 			// snd stream data
-			snd_binStream((char *)buffer, n, blkcnt);
+			BENCH_PHASE(BENCH_STREAM);
+			snd_binStream((const char *)data, n, blkcnt);
+			sent += n;
 
 			blkcnt++;
-			// whole block was read
-			if((blksize / BUFSIZE) == blkcnt)	{
-				break;
-			}
 		}
 
+		BENCH_PHASE(BENCH_ACK);
 		if((retval = process_binCRC()) != 0)
 			break;
 
+		PROGRESS_BLOCK(++done, sent);
+
 		if(seek == 0)
 			break;
 
@@ -322,8 +379,11 @@ process_bintransfer(char *fName, uint16_t blksize, uint8_t magic)	{
 		blkcnt = 0;
 	}
 
+	BENCH_PHASE(BENCH_OTHER);
 	sd_close_file();
+	scratch_release(top);
 	snd_bootStart();
+	PRINT("Bin transfer idle %d%%\n",idle_percent());
 
 	return(retval);
 }
@@ -342,35 +402,38 @@ uint8_t
 process_filever(char *fName)	{
 
 	uint8_t i = 0;
-	uint8_t vers[2];
-	char bytes[48];
+	uint16_t top = scratch_mark();
+	uint8_t *vers = scratch_alloc(2);
+	uint32_t size;
+	char *bytes, *p;
 
 	PRINT("process_filever %s called\n",fName);
 	if(sd_open_file(fName))	{
 
+		scratch_release(top);
 		return(ENOFILE);
 	}
 
 	sd_read_file(vers, 2);
+	size = sd_file_size();
 	sd_close_file();
 
-	// init buffer
-	for(i = 0; i < 48; i++)
-		bytes[i] = 0;
-
 	// build command string
-	sprintf(bytes," .vhigh=%d\n .vlow=%d\n .bytes=%ld\n",
-			vers[0],
-			vers[1],
-			sd_file_size());
-
-	i = ((strlen(bytes) / 8 ) + 1) * 8;
+	bytes = scratch_alloc(48);
+	PROBE_BEGIN(PRB_FORMAT);
+	p = fmt_key(bytes, PSTR("vhigh"), vers[0]);
+	p = fmt_key(p, PSTR("vlow"), vers[1]);
+	p = fmt_key(p, PSTR("bytes"), size);
+	PROBE_END(PRB_FORMAT);
+
+	i = fmt_pad8(bytes, p);
 	create_CRC(bytes, i,0);
 
-	snd_cfCRC(strlen(bytes));
+	snd_cfCRC(p - bytes);
 	snd_cfStream(bytes, i);
 	//snd_ACK();
 	
+	scratch_release(top);
 	TCNT0 = count = 0;
 	return(0);
 }
@@ -389,38 +452,42 @@ uint8_t
 process_ldbver(char *fName)	{
 
 	uint8_t i = 0;
-	uint8_t vers[4];
-	char bytes[56];
+	uint16_t top = scratch_mark();
+	uint8_t *vers = scratch_alloc(4);
+	uint32_t size;
+	char *bytes, *p;
 
 	PRINT("process_ldbver %s called\n",fName);
 	if(sd_open_file(fName))	{
 
 		PRINT("Cant open File %s !\n",fName);
+		scratch_release(top);
 		return(ENOFILE);
 	}
 
 	sd_read_file(vers, 4);
-
-	// init buffer
-	for(i = 0; i < 56; i++)
-		bytes[i] = 0;
-
-	// build command string
-	sprintf(bytes," .version=%d\n .monat=%d\n .jahr=20%d\n .anzahl=%ld\n",
-			vers[0],
-			vers[2],
-			vers[0],
-			((sd_file_size() /64 ) -1));
-
+	size = sd_file_size();
 	sd_close_file();
 
-	i = ((strlen(bytes) / 8 ) + 1) * 8;
+	// build command string
+	bytes = scratch_alloc(56);
+	PROBE_BEGIN(PRB_FORMAT);
+	p = fmt_key(bytes, PSTR("version"), vers[0]);
+	p = fmt_key(p, PSTR("monat"), vers[2]);
+	p = fmt_P(p, PSTR(" .jahr=20"));
+	p = fmt_long(p, vers[0]);
+	p = fmt_P(p, PSTR("\n"));
+	p = fmt_key(p, PSTR("anzahl"), ((size /64 ) -1));
+	PROBE_END(PRB_FORMAT);
+
+	i = fmt_pad8(bytes, p);
 	create_CRC(bytes, i,0);
 
-	snd_cfCRC(strlen(bytes));
+	snd_cfCRC(p - bytes);
 	snd_cfStream(bytes, i);
 	//snd_ACK();
 	
+	scratch_release(top);
 	TCNT0 = count = 0;
 	return(0);
 }
@@ -442,10 +509,12 @@ process_ldbver(char *fName)	{
 uint8_t
 process_transfer(char *fName)	{
 
-	uint8_t cmd = 0, blknum = 0, blkcnt = 0, i = 0, n = 0, j = 0;
+	uint8_t cmd = 0, blknum = 0, blkcnt = 0, i = 0, n = 0;
 	uint16_t rdbyte = 0;
 	uint32_t fpos = 0, seek = 0, bytes = 0;
-	uint8_t buffer[BUFSIZE];
+	uint16_t top = scratch_mark();
+	uint8_t *buffer;
+	const uint8_t *data;
 	can_t msg;
 
 	PRINT("process_transfer %s called\n",fName);
@@ -456,68 +525,71 @@ process_transfer(char *fName)	{
 		return(ENOFILE);
 	}
 
+	buffer = scratch_alloc(BUFSIZE);
+
 	blknum = ((sd_file_size() / BLOCKSIZE) + 1);
 	PRINT("%d blocks for %ld bytes!\n",blknum,sd_file_size());
+	PROGRESS_START(blknum);
+	idle_reset();
 //	PRINT("Blk req 0 OK, transfer ");
 
 	for(blkcnt = 0; blkcnt < blknum; blkcnt ++)	{
 
+		BENCH_PHASE(BENCH_BLOCK);
 		if(blkcnt > 0)	{ // Block #0 already responded by dispatcher!
 			
 			// wait for request of next block
+			BENCH_PHASE(BENCH_ACK);
 			TCNT0 = count = cmd = rdbyte = 0;
 			Flags |= (1 << DEVCALC);
 
-			while(Flags & (1 << DEVCALC))	{
-
-				if(read_rx_buffer(&msg))	{
+			while(wait_rx_buffer(&msg, (1 << DEVCALC)))	{
 
-					cmd = (msg.id >> 17) & 0xFF;
+				cmd = (msg.id >> 17) & 0xFF;
 
 //					PRINT("Blk req ");
-					if(cmd == CMD_CFG_REQUEST)	{
-						//TODO
-						// get block counter and chek it?
-						// block ASCII decimal 61
-						//C:0x20 R:0 H:0x1F64 D:8 D:0x36 0x31 0x00 0x00 0x00 0x00 0x00 0x00
-
-						// reply block request
-						resp_cfg_request(msg.data);
+				if(cmd == CMD_CFG_REQUEST)	{
+					//TODO
+					// get block counter and chek it?
+					// block ASCII decimal 61
+					//C:0x20 R:0 H:0x1F64 D:8 D:0x36 0x31 0x00 0x00 0x00 0x00 0x00 0x00
+
+					// reply block request
+					LAT_REPLY(LAT_CFG);
+					resp_cfg_request(msg.data);
 //						PRINT("%d OK, transfer ",blkcnt);
-						break;
-					}
+					break;
 				}
 			}
 
 			if(cmd == 0)	{
 
+				BENCH_PHASE(BENCH_OTHER);
 				PRINT("No Blockrequest in time, abort\n");
 				sd_close_file();
+				scratch_release(top);
 				return(ETIMED);
 			}
 		 }
 
 		// read one block in buffer size steps to calculate CRC
+		BENCH_PHASE(BENCH_CRC);
 		for(i = 0; i < (BLOCKSIZE / BUFSIZE); i++)	{
 
-			n = sd_read_file(buffer, BUFSIZE);
+			//0x00 padding
+			n = read_chunk(&data, BUFSIZE, buffer, 0x00);
 
 			rdbyte += n;
 			if(n == 0) // End of file
 				break;
-			
-			//0x00 padding
-			if(n < BUFSIZE)	{
-				for(j = n; j < BUFSIZE; j++)
-					buffer[j] = 0x00;
-			}
 
 			if(n % 8)
 				n = ((n / 8) + 1) * 8;
 
-			create_CRC((char *)buffer, n, i);
+			create_CRC((const char *)data, n, i);
 		}
 
+		BENCH_PHASE(BENCH_STREAM);
 		snd_cfCRC(rdbyte);
 
 		// rewind fd to block pos in file
@@ -528,41 +600,37 @@ process_transfer(char *fName)	{
 		// read one block in buffer size steps 
 		for(i = 0; i < (BLOCKSIZE / BUFSIZE); i++)	{
 
-			n = sd_read_file(buffer, BUFSIZE);
-			
+			//0x00 padding
+			n = read_chunk(&data, BUFSIZE, buffer, 0x00);
+
 			if(n == 0) // End of file
 				break;
 
-			//0x00 padding
-			if(n < BUFSIZE)	{
-				for(j = n; j < BUFSIZE; j++)
-					buffer[j] = 0x00;
-			}
-
 			if(n % 8)
 				n = ((n / 8) + 1) * 8;
 
-			snd_cfStream((char *)buffer, n);
+			snd_cfStream((const char *)data, n);
 		}
+		LAT_REQUEST(LAT_CFG);
 
 		//DEBUG
 		bytes += rdbyte;
+		PROGRESS_BLOCK(blkcnt + 1, bytes);
 //		PRINT("Block#%d snd %d Btyes..%ld total",blkcnt,rdbyte,bytes);
 
+		BENCH_PHASE(BENCH_ACK);
 		TCNT0 = count = cmd = 0;
 		Flags |= (1 << DEVCALC);
 
-		while(Flags & (1 << DEVCALC))	{
-
-			if(read_rx_buffer(&msg))	{
+		while(wait_rx_buffer(&msg, (1 << DEVCALC)))	{
 
-				cmd = (msg.id >> 17) & 0xFF;
+			cmd = (msg.id >> 17) & 0xFF;
 
-				if(cmd == CMD_CFG_REQUEST)	{
+			if(cmd == CMD_CFG_REQUEST)	{
 
 //					PRINT(" Req Cfg OK\n");
-					break;
-				}
+				LAT_REPLY(LAT_CFG);
+				break;
 			}
 		}
 
@@ -573,14 +641,18 @@ process_transfer(char *fName)	{
 				break;
 			}else	{
 //				PRINT("\nNo config request in time, abort\n");
+				BENCH_PHASE(BENCH_OTHER);
 				sd_close_file();
+				scratch_release(top);
 				return(ETIMED);
 			}
 		}
 	}
 
-	PRINT("\n DONE OK\n");
+	BENCH_PHASE(BENCH_OTHER);
+	PRINT("\n DONE OK, idle %d%%\n",idle_percent());
 	sd_close_file();
+	scratch_release(top);
 	TCNT0 = count = 0;
 
 	return(REBOOT);
@@ -599,39 +671,41 @@ uint8_t
 process_ms2ver(char *fName)	{
 
 	uint8_t i = 0;
-	uint8_t vers[2];
+	uint16_t top = scratch_mark();
+	uint8_t *vers = scratch_alloc(2);
 	uint32_t seek = 0xFC;	// Magic position of 2 Byte version information
-	char bytes[48];
+	uint32_t size;
+	char *bytes, *p;
 
 	PRINT("process_ms2ver %s called\n",fName);
 	if(sd_open_file(fName))	{
 
+		scratch_release(top);
 		return(ENOFILE);
 	}
 
 	sd_seek_file(&seek);
 
 	sd_read_file(vers, 2);
-
-	// init buffer
-	for(i = 0; i < 48; i++)
-		bytes[i] = 0;
-
-	// build command string
-	sprintf(bytes," .vhigh=%d\n .vlow=%d\n .bytes=%ld\n",
-			vers[0],
-			vers[1],
-			sd_file_size());
-
+	size = sd_file_size();
 	sd_close_file();
 
-	i = ((strlen(bytes) / 8 ) + 1) * 8;
+	// build command string
+	bytes = scratch_alloc(48);
+	PROBE_BEGIN(PRB_FORMAT);
+	p = fmt_key(bytes, PSTR("vhigh"), vers[0]);
+	p = fmt_key(p, PSTR("vlow"), vers[1]);
+	p = fmt_key(p, PSTR("bytes"), size);
+	PROBE_END(PRB_FORMAT);
+
+	i = fmt_pad8(bytes, p);
 	create_CRC(bytes, i,0);
 
-	snd_cfCRC(strlen(bytes));
+	snd_cfCRC(p - bytes);
 	snd_cfStream(bytes, i);
 	//snd_ACK();
 	
+	scratch_release(top);
 	TCNT0 = count = 0;
 	return(0);
 }
@@ -649,36 +723,38 @@ uint8_t
 process_gb2ver(char *fName)	{
 
 	uint8_t i = 0;
-	uint8_t vers[8];
-	char bytes[48];
+	uint16_t top = scratch_mark();
+	uint8_t *vers = scratch_alloc(8);
+	uint32_t size;
+	char *bytes, *p;
 
 	PRINT("process_gb2ver %s called\n",fName);
 	if(sd_open_file(fName))	{
 
+		scratch_release(top);
 		return(ENOFILE);
 	}
 
 	sd_read_file(vers, 8);
-
-	// init buffer
-	for(i = 0; i < 48; i++)
-		bytes[i] = 0;
-
-	// build command string
-	sprintf(bytes," .vhigh=%d\n .vlow=%d\n .bytes=%ld\n",
-			vers[6],
-			vers[7],
-			sd_file_size());
-
+	size = sd_file_size();
 	sd_close_file();
 
-	i = ((strlen(bytes) / 8 ) + 1) * 8;
+	// build command string
+	bytes = scratch_alloc(48);
+	PROBE_BEGIN(PRB_FORMAT);
+	p = fmt_key(bytes, PSTR("vhigh"), vers[6]);
+	p = fmt_key(p, PSTR("vlow"), vers[7]);
+	p = fmt_key(p, PSTR("bytes"), size);
+	PROBE_END(PRB_FORMAT);
+
+	i = fmt_pad8(bytes, p);
 	create_CRC(bytes, i,0);
 
-	snd_cfCRC(strlen(bytes));
+	snd_cfCRC(p - bytes);
 	snd_cfStream(bytes, i);
 	//snd_ACK();
 	
+	scratch_release(top);
 	TCNT0 = count = 0;
 	return(0);
 }
@@ -686,7 +762,8 @@ process_gb2ver(char *fName)	{
 // -----------------------------------------------------------------------------
 // Description: Retrieve 60133 binary file version
 //
-// Details: Version information at Byte 7 and 8
+// Details: Version information at Byte 7 and 8, taken from the catalog
+// in EEPROM if the file is unchanged
 // 
 // Called by: divers
 //
@@ -696,27 +773,39 @@ uint16_t
 get_gb2ver(char *fName)	{
 
 	uint16_t i = 0;
-	uint8_t vers[9];
+	uint16_t top = scratch_mark();
+	uint8_t *vers = scratch_alloc(9);
 
 	if(sd_open_file(fName))	{
 
 		PRINT("Cant open file %s\n",fName);
+		scratch_release(top);
 		return(0);
 	}
 
+	if(sd_cat_version(SD_CAT_GB2, &i))	{
+
+		sd_close_file();
+		scratch_release(top);
+		return(i);
+	}
+
 	sd_read_file(vers,8);
 	sd_close_file();
 
 	i |= vers[6] << 8;
 	i |= vers[7];
+	sd_cat_store(SD_CAT_GB2, i);
 
+	scratch_release(top);
 	return(i);
 }
 
 // -----------------------------------------------------------------------------
 // Description: Retrieve MS2 binary file version
 //
-// Details: Version information at Byte 0xFC and 0xFD
+// Details: Version information at Byte 0xFC and 0xFD, taken from the
+// catalog in EEPROM if the file is unchanged
 // 
 // Called by: divers
 //
@@ -726,21 +815,32 @@ uint16_t
 get_ms2ver(char *fName)	{
 
 	uint16_t i = 0;
-	uint8_t vers[2];
+	uint16_t top = scratch_mark();
+	uint8_t *vers = scratch_alloc(2);
 	uint32_t seek = 0xFC;
 
 	if(sd_open_file(fName))	{
 
+		scratch_release(top);
 		return(0);
 	}
 
+	if(sd_cat_version(SD_CAT_MS2, &i))	{
+
+		sd_close_file();
+		scratch_release(top);
+		return(i);
+	}
+
 	sd_seek_file(&seek);
 	sd_read_file(vers, 2);
 	sd_close_file();
 
 	i |= vers[0] << 8;
 	i |= vers[1];
+	sd_cat_store(SD_CAT_MS2, i);
 
+	scratch_release(top);
 	return(i);
 }
 
@@ -805,27 +905,16 @@ init_60113(device_t *device)	{
 	TCNT0 = count = 0;
 	Flags |= (1 << TIMEOUT);
 
-	while(Flags & (1 << TIMEOUT))	{
+	while(wait_rx_buffer(&msg, (1 << TIMEOUT)))	{
 
-		if(read_rx_buffer(&msg))	{
+		cmd = (msg.id >> 17) & 0xFF;
 
-			cmd = (msg.id >> 17) & 0xFF;
+		if(cmd == CMD_BOOTLD_CAN ) {
 
-			if(cmd == CMD_BOOTLD_CAN ) {	
+			if((msg.id >> 16) & 1)	{
 
-				if((msg.id >> 16) & 1)	{
-
-					device->hash = msg.id & 0xFFFF;
-					device->uid |= (uint32_t)msg.data[0] << 24;
-					device->uid |= (uint32_t)msg.data[1] << 16;
-					device->uid |= (uint32_t)msg.data[2] << 8;
-					device->uid |= (uint32_t)msg.data[3];
-					device->sversion |= (uint16_t)msg.data[4] << 8;
-					device->sversion |= (uint16_t)msg.data[5];
-					device->type |= (uint8_t)msg.data[7];
-
-					break;
-				}
+				get_devInfo(device, &msg);
+				break;
 			}
 		}
 	}
@@ -836,38 +925,97 @@ init_60113(device_t *device)	{
 		return(1);
 	}
 
+	return(start_60113());
+}
+
+// -----------------------------------------------------------------------------
+// Description: Start the 60113 software after the bootInit was answered
+//
+// Details: Send the boot start command, wait until the 60113 software is up
+// and activate it by a ping.
+//
+// Called by: init_60113(), detect_device()
+//
+// Return: 0 on success otherwise 1
+// ----------------------------------------------------------------------------
+static uint8_t
+start_60113(void)	{
+
 	snd_bootStart();
 
 	TCNT0 = count = 0;
 	Flags |= (1 << DEVCALC);
-	while(Flags & (1 << DEVCALC));		// wait 480ms for boot up target
+	wait_flag(1 << DEVCALC);		// wait 480ms for boot up target
+
+	return(ping_device(0));
+}
+
+// -----------------------------------------------------------------------------
+// Description: Send a ping and wait for the response of the device
+//
+// Details: If device is given, UID, hash, SW-Version and device type of the
+// ping response are stored to it.
+//
+// Called by: start_60113(), ident_MS2(), detect_device()
+//
+// Return: 0 on success otherwise 1
+// ----------------------------------------------------------------------------
+static uint8_t
+ping_device(device_t *device)	{
+
+	uint8_t cmd = 0;
+	can_t msg;
 
 	snd_ping();
-	TCNT0 = count = cmd = 0;
+	TCNT0 = count = 0;
 	Flags |= (1 << TIMEOUT);
 
-	while(Flags & (1 << TIMEOUT))	{
+	while(wait_rx_buffer(&msg, (1 << TIMEOUT)))	{
 
-		if(read_rx_buffer(&msg))	{
+		cmd = (msg.id >> 17) & 0xFF;
 
-			cmd = (msg.id >> 17) & 0xFF;
+		if(cmd == CMD_PING && ((msg.id >> 16) & 1))	{
 
-			if(cmd == CMD_PING && ((msg.id >> 16) & 1))	{
+			PRINT("Get Ping response\n");
+			if(device)
+				get_devInfo(device, &msg);
 
-				PRINT("Get Ping response\n");
-				return(0);
-			}
+			return(0);
 		}
 	}
 
 	return(1);
 }
 
+// -----------------------------------------------------------------------------
+// Description: Store the identification of a device from a response message
+//
+// Details: Used for ping and bootInit responses. Both carry UID at byte 0-3,
+// SW-Version at byte 4-5 and device type at byte 7.
+//
+// Called by: init_60113(), ping_device(), detect_device()
+//
+// Return: void
+// ----------------------------------------------------------------------------
+static void
+get_devInfo(device_t *device, can_t *msg)	{
+
+	device->hash = msg->id & 0xFFFF;
+	device->uid = (uint32_t)msg->data[0] << 24;
+	device->uid |= (uint32_t)msg->data[1] << 16;
+	device->uid |= (uint32_t)msg->data[2] << 8;
+	device->uid |= (uint32_t)msg->data[3];
+	device->sversion = (uint16_t)msg->data[4] << 8;
+	device->sversion |= (uint16_t)msg->data[5];
+	device->type = (uint8_t)msg->data[7];
+}
+
 // -----------------------------------------------------------------------------
 // Description: process the MS2 update procedure
 //
 // Details:	Run some sequences
 //
+// 0) Flash a MS2 found without software by detect_device() ( sversion 0 )
 // 1) Start up the MS2 to send its version requests
 // 2) Dispatching all requests from MS2
 // 3) Reboot MS2 and get its uid, hash and flash version 
@@ -881,11 +1029,19 @@ process_MS2Update(device_t *device)	{
 	uint8_t rt = 0;
 	uint8_t flashOnce = 0;
 
+	if(!device->sversion)	{
+
+		if((rt = process_flashUpd()) != 0 || (rt = ping_device(device)) != 0)
+			return(rt);
+
+		flashOnce = 1;
+	}
+
 	while(1)	{
 
 		TCNT0 = count = 0;
 		Flags |= (1 << FIRSTPNG);
-		while(Flags & (1 << FIRSTPNG));		
+		wait_flag(1 << FIRSTPNG);		
 
 		start_MS2(device->hash);
 		rt = update_MS2();
@@ -931,7 +1087,7 @@ process_MS2Update(device_t *device)	{
 // Note:  If a timeout occures in this synchrounous sequence the 
 // initialization is failed completly
 //
-// Called by: main()
+// Called by: process_MS2Update(), process_flashUpd()
 //
 // Return: 0 on success otherwise 1
 // ----------------------------------------------------------------------------
@@ -945,71 +1101,156 @@ init_MS2(device_t *device)	{
 	TCNT0 = count = 0;
 	Flags |= (1 << DEVBOOT);
 
-	while(Flags & (1 << DEVBOOT))	{
+	while(wait_rx_buffer(&msg, (1 << DEVBOOT)))	{
 
-		if(read_rx_buffer(&msg))	{
+		cmd = (msg.id >> 17) & 0xFF;
 
-			cmd = (msg.id >> 17) & 0xFF;
+		if(cmd == CMD_BOOTLD_CAN)	{
 
-			if(cmd == CMD_BOOTLD_CAN)	{
+			if(ident_MS2(device) == 0)
+				return(0);
+
+			TCNT0 = count = 0;
+			Flags |= (1 << DEVBOOT);
+		}
+	}
+
+	PRINT("No MS2 !\n");
+	return(1);
+}
 
-				// Get additional message on MS2 Version > 1.83
-				// MS2 wait 400ms after sending start msg 
-				cmd = 0;
-				TCNT0 = count = 0;
-				Flags |= (1 << DEVCALC);
+// -----------------------------------------------------------------------------
+// Description: Identify a MS2 after its first boot message was received
+//
+// Details: A MS2 > 1.83 send an additional 0x1B message 400ms after the start
+// message. Wait for it, then ping the MS2 to get UID, hash and SW-Version.
+//
+// Called by: init_MS2(), detect_device()
+//
+// Return: 0 on success otherwise 1
+// ----------------------------------------------------------------------------
+static uint8_t
+ident_MS2(device_t *device)	{
 
-				while(Flags & (1 << DEVCALC))	{
+	uint8_t cmd = 0;
+	can_t msg;
 
-					if(read_rx_buffer(&msg))	{
+	// Get additional message on MS2 Version > 1.83
+	// MS2 wait 400ms after sending start msg 
+	TCNT0 = count = 0;
+	Flags |= (1 << DEVCALC);
 
-						cmd = (msg.id >> 17) & 0xFF;
+	while(wait_rx_buffer(&msg, (1 << DEVCALC)))	{
 
-						if(cmd == CMD_BOOTLD_CAN ) {	// Ignore 60113 start msg
-							snd_ping();
-							break;
-						}
-					}
-				}
+		cmd = (msg.id >> 17) & 0xFF;
 
-				if(!cmd) {		// MS2 Version <= 1.8.3 or deleted gb2 file
-					PRINT("VERSION <= 1.83 protocoll detect\n");
-					snd_ping();
-				}
+		if(cmd == CMD_BOOTLD_CAN)	// Ignore 60113 start msg
+			break;
+	}
 
-				TCNT0 = count = 0;
-				Flags |= (1 << TIMEOUT);
+	if(cmd != CMD_BOOTLD_CAN)		// MS2 Version <= 1.8.3 or deleted gb2 file
+		PRINT("VERSION <= 1.83 protocoll detect\n");
 
-				while(Flags & (1 << TIMEOUT))	{
+	return(ping_device(device));
+}
 
-					if(read_rx_buffer(&msg))	{
+// -----------------------------------------------------------------------------
+// Description: Identify the connected device in one detection run
+//
+// Details: Send the bootInit probe and watch for MS2 boot messages at the 
+// same time. A waiting 60113 responds the probe with its device type, a MS2
+// powered up by the connector send its 0x1B boot sequence by itself. The first
+// conclusive message decides which init sequence is continued. The probe is
+// repeated every PRBCNT ticks while the device is not ready yet.
+//
+// Sequence 60113:
+// UPD   ->C:0x1B R:0 H:0x3F17 D:0
+// 60113 <-C:0x1B R:1 H:0x2120 D:8 D:0x47 0x43 0x66 0x63 0x01 0x27 0x00 0x10
+//
+// Sequence MS2:
+// UPD   ->C:0x1B R:0 H:0x3F17 D:0
+// MS2 ->C:0x1B R:0 H:0x036C D:0
+// MS2 ->C:0x1B R:0 H:0x036C D:5 D:0x00 0x00 0x00 0x00 0x11
+//
+// Note: A Gleisbox is found in less than PRBCNT ticks instead of waiting for
+// the whole DEVCNT MS2 boot time first.
+//
+// Called by: main()
+//
+// Return: 0 on success otherwise ENODEV
+// ----------------------------------------------------------------------------
+uint8_t
+detect_device(device_t *device)	{
 
-						cmd = (msg.id >> 17) & 0xFF;
+	uint8_t cmd = 0;
+	can_t msg;
 
-						if(cmd == CMD_PING ) {	
+	TCNT0 = count = 0;
+	Flags |= (1 << DEVBOOT);
+	Flags &= ~(1 << PROBE);
 
-							if((msg.id >> 16) & 1)	{
+	while(Flags & (1 << DEVBOOT))	{
 
-								device->hash = msg.id & 0xFFFF;
-								device->uid |= (uint32_t)msg.data[0] << 24;
-								device->uid |= (uint32_t)msg.data[1] << 16;
-								device->uid |= (uint32_t)msg.data[2] << 8;
-								device->uid |= (uint32_t)msg.data[3];
-								device->sversion |= (uint16_t)msg.data[4] << 8;
-								device->sversion |= (uint16_t)msg.data[5];
-								device->type |= (uint8_t)msg.data[7];
+		// (re)send probe to a 60113 waiting in boot loader, only with the
+		// RX buffer drained: a queued MS2 boot message opens the window of
+		// the MS2 boot loader, a bootInit in it starts the flash mode
+		if(!read_rx_buffer(&msg))	{
 
-								return(0);
-							}
-						}
-					}
-				}
+			if(!(Flags & (1 << PROBE)))	{
+
+				Flags |= (1 << PROBE);
+				snd_bootInit();
 			}
+
+			if(!wait_rx_buffer(&msg, (1 << DEVBOOT) | (1 << PROBE)))
+				continue;
+		}
+
+		cmd = (msg.id >> 17) & 0xFF;
+
+		if(cmd != CMD_BOOTLD_CAN)
+			continue;
+
+		if(!((msg.id >> 16) & 1))	{		// MS2 boot message
+
+			PRINT("MS2 boot detect\n");
+			if(ident_MS2(device) == 0)
+				return(0);
+
+			break;
+		}
+
+		if(msg.length == 8 && msg.data[7] == DEV_GFP_MS2)	{
+
+			PRINT("60113 detect\n");
+			get_devInfo(device, &msg);
+			if(start_60113() == 0)
+				return(0);
+
+			break;
+		}
+
+		// the MS2 answered the probe in its boot loader, it does not answer
+		// a ping there: start its software and identify it after the boot
+		if(msg.length == 8 && msg.data[7] == DEV_CON_MS2)	{
+
+			PRINT("MS2 boot loader detect\n");
+			get_devInfo(device, &msg);
+			snd_bootStart();
+			if(init_MS2(device) == 0)
+				return(0);
+
+			// no valid software, the update flashes it first
+			PRINT("MS2 without software\n");
+			get_devInfo(device, &msg);
+			device->sversion = 0;
+			return(0);
 		}
 	}
 
-	PRINT("No MS2 !\n");
-	return(1);
+	PRINT("No device !\n");
+	device->type = 0;
+	return(ENODEV);
 }
 
 // -----------------------------------------------------------------------------
@@ -1031,25 +1272,79 @@ start_MS2(uint16_t hash)	{
 	TCNT0 = count = 0;
 	Flags |= (1 << TIMEOUT);
 
-	while(Flags & (1 << TIMEOUT))	{
-
-		if(read_rx_buffer(&msg))	{
+	while(wait_rx_buffer(&msg, (1 << TIMEOUT)))	{
 
-			cmd = (msg.id >> 17) & 0xFF;
+		cmd = (msg.id >> 17) & 0xFF;
 
-			if(cmd == CMD_PING)	{
+		if(cmd == CMD_PING)	{
 
-				// free rx_buffer
-				clear_rx_buffer();
+			// free rx_buffer
+			clear_rx_buffer();
 
-				// This initiate a data exchange cmd 0x20
-				// and is the start procedure of an MS2 update
-				resp_ping(hash);	 
-			}
+			// This initiate a data exchange cmd 0x20
+			// and is the start procedure of an MS2 update
+			resp_ping(hash);	 
 		}
 	}
 }
 
+// -----------------------------------------------------------------------------
+// Description: Find the caller entry of a requested config name
+//
+// Details:	 Hash the 8 data bytes of the request into fktSlot and compare the
+// bytes with the zero padded name of that entry in flash, no scan of
+// caller[]. The request is padded with zeros behind the end of the name
+// first, the protocol does not say what follows a name shorter than 8 bytes.
+//
+// Called by: update_MS2
+//
+// Return: index of the entry in caller[] or FKTNONE
+// -----------------------------------------------------------------------------
+static uint8_t
+find_caller(const uint8_t *name)	{
+
+	char key[sizeof(caller[0].fktName)];
+	uint8_t i;
+
+	i = strnlen((const char *)name, sizeof(key));
+	memcpy(key, name, i);
+	memset(key + i, 0, sizeof(key) - i);
+	i = pgm_read_byte(&fktSlot[FKTHASH(key)]);
+
+	if(i && (memcmp_P(key, caller[i - 1].fktName, sizeof(key)) == 0))
+		return(i - 1);
+
+	return(FKTNONE);
+}
+
+#ifdef HOST
+// -----------------------------------------------------------------------------
+// Description: Check fktSlot against the names in caller[]
+//
+// Details:	 Every name must be found by find_caller at its own index. A name
+// added or renamed without updating fktSlot fails here instead of leaving
+// its requests unanswered.
+//
+// Called by: check command of the host build, run by make host
+//
+// Return: name of the first entry not found or NULL
+// -----------------------------------------------------------------------------
+const char *
+check_callers(void)	{
+
+	uint8_t data[sizeof(caller[0].fktName)];
+	uint8_t i;
+
+	for(i = 0; i < sizeof(caller) / sizeof(caller[0]); i++)	{
+		memcpy_P(data, caller[i].fktName, sizeof(data));
+		if(find_caller(data) != i)
+			return(caller[i].fktName);
+	}
+
+	return(NULL);
+}
+#endif
+
 // -----------------------------------------------------------------------------
 // Description: MS2 config data request dispatcher
 //
@@ -1062,74 +1357,68 @@ static uint8_t
 update_MS2(void)	{
 
 	uint8_t cmd = 0, i = 0, callerID = 0, rt = ETIMED, vercnt = 0;;
-	uint8_t cfgName[9];
+	uint16_t top = scratch_mark();
+	uint8_t *cfgName = scratch_alloc(9);
+	struct msg_fkt fkt;
 	can_t msg;
 
 	TCNT0 = count = 0;
 	Flags |= (1 << DEVBOOT);
+	idle_reset();
 
-	while(Flags & (1 << DEVBOOT))	{
-
-		if(read_rx_buffer(&msg))	{
+	while(wait_rx_buffer(&msg, (1 << DEVBOOT)))	{
 
-			cmd = (msg.id >> 17) & 0xFF;
-
-			if(cmd == CMD_CFG_REQUEST)	{
+		cmd = (msg.id >> 17) & 0xFF;
 
-				cfgName[0] = msg.data[0];
-				cfgName[1] = msg.data[1];
-				cfgName[2] = msg.data[2];
-				cfgName[3] = msg.data[3];
-				cfgName[4] = msg.data[4];
-				cfgName[5] = msg.data[5];
-				cfgName[6] = msg.data[6];
-				cfgName[7] = msg.data[7];
-				cfgName[8] = 0;
+		if(cmd == CMD_CFG_REQUEST)	{
 
-				PRINT("MS2 request: %s -->\n ",cfgName);
+			LAT_REPLY(LAT_CFG);
+			memcpy(cfgName, msg.data, 8);
+			cfgName[8] = 0;
 
-				// Multiple request command
-				// Used by invoke transfer data
-				// to requester
-				if(callerID)	{
+			PRINT("MS2 request: %s -->\n ",cfgName);
 
-					PRINT("invoce transferfile\n");
-					resp_cfg_request(cfgName); // Respone requested block #0
+			// Multiple request command
+			// Used by invoke transfer data
+			// to requester
+			if(callerID)	{
 
-					rt = (*caller[callerID].function)(caller[callerID].fName);
+				PRINT("invoce transferfile\n");
+				resp_cfg_request(cfgName); // Respone requested block #0
 
-					if(caller[callerID].flashUpd)	{
-						PRINT("Need FLASH update\n");
-						return(FLASHUPD);
-					}else {
-						PRINT("Another request?? rt=%d\n",rt);
-						callerID = 0;
-					}
+				memcpy_P(&fkt, &caller[callerID], sizeof(fkt));
+				rt = (*fkt.function)(fkt.fName);
 
-				} else {
+				if(fkt.flashUpd)	{
+					PRINT("Need FLASH update\n");
+					scratch_release(top);
+					return(FLASHUPD);
+				}else {
+					PRINT("Another request?? rt=%d\n",rt);
+					callerID = 0;
+				}
 
-					for(i = 0; i < FKTCOUNT; i++)	{
+			} else if((i = find_caller(msg.data)) != FKTNONE)	{
 
-						if(strcmp(caller[i].fktName, (char *)cfgName) == 0 )	{
+				memcpy_P(&fkt, &caller[i], sizeof(fkt));
 
-							if(caller[i].reqCount)	{
+				if(fkt.reqCount)	{
 
-								callerID = i;
-								break;
+					callerID = i;
 
-							} else {
+				} else {
 
-								PRINT("invoce version control\n");
-								resp_cfg_request(cfgName);
-								rt = (*caller[i].function)(caller[i].fName);
-								vercnt++;
-								break;
-							}
-						}
-					}
+					PRINT("invoce version control\n");
+					BENCH_PHASE(BENCH_VERSION);
+					resp_cfg_request(cfgName);
+					rt = (*fkt.function)(fkt.fName);
+					LAT_REQUEST(LAT_CFG);
+					BENCH_PHASE(BENCH_OTHER);
+					vercnt++;
 				}
 			}
 		}
+
 		//short up if nothing to do
 		if((vercnt == VERCOUNT) && (callerID == 0)){
 			PRINT("Nothing to do...\n");
@@ -1137,6 +1426,7 @@ update_MS2(void)	{
 		}
 	}
 
-	PRINT("End dispatcher rt=%d\n",rt);
+	PRINT("End dispatcher rt=%d idle %d%%\n",rt,idle_percent());
+	scratch_release(top);
 	return(rt);
 }
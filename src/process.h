@@ -17,6 +17,7 @@
 
 uint8_t init_60113(device_t *device);
 uint8_t init_MS2(device_t *device);
+uint8_t detect_device(device_t *device);
 
 uint16_t get_gb2ver(char *fName);
 uint16_t get_ms2ver(char *fName);
@@ -30,9 +31,14 @@ uint8_t process_bintransfer(char *fName, uint16_t blksize, uint8_t magic);
 uint8_t process_60133Update(void);
 uint8_t process_MS2Update(device_t *device);
 
+#ifdef HOST
+const char *check_callers(void);
+#endif
+
 // Times and detection
 #define ENOMS2		1	// No MS2 found	
 #define ENOGFP		2	// No 60113 box found
+#define ENODEV		3	// No known device found
 #define ETIMED		9	// Time out
 #define ENOFILE	23 // No such file
 
@@ -0,0 +1,155 @@
+/*
+* ----------------------------------------------------------------------------
+* Transfer progress, throughput and remaining time on the LCD
+*
+* process_transfer() and process_bintransfer() report each block sent:
+*
+*   | 12/201 2273B/s|
+*   |#######     1:25|
+*
+* blocks done of all blocks, payload bytes per second since the start of
+* the transfer, a bar of PRG_BAR cells and the remaining time m:ss. The
+* screen only goes to the LCD framebuffer, the Timer0 tick writes the few
+* changed cells, so the transfer never waits for the display.
+*
+*  Version: 0.0.1
+*  
+* "THE BEER-WARE LICENSE" (Revision 42):
+* <karsten@rhen.de> wrote this file. As long as you retain this notice you
+* can do whatever you want with this stuff. If we meet some day, and you think
+* this stuff is worth it, you can buy me a beer in Flensburg, Germany
+* ----------------------------------------------------------------------------
+*/
+
+#include <avr/io.h>
+#include <inttypes.h>
+#include <string.h>
+#include <avr/pgmspace.h>
+
+#include "main.h"
+
+#if !defined(HOST)
+
+static uint32_t prg_start;		// us of progress_start()
+static uint8_t prg_total;		// blocks of the transfer
+static uint8_t prg_glyphs;		// bar characters are in CGRAM
+
+// -----------------------------------------------------------------------------
+// Description: Write text right aligned into a line
+//
+// Called by: progress_block()
+//
+// Return: void
+// -----------------------------------------------------------------------------
+static void
+prg_right(char *line, uint8_t end, const char *text)	{
+
+	uint8_t n = strlen(text);
+
+	if(n > end)
+		n = end;
+
+	memcpy(&line[end - n], text, n);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Start the progress of a transfer
+//
+// Details: Loads the bar characters into CGRAM at the first call, 5
+// characters filled 1 to 5 columns from the left.
+//
+// Called by: process_transfer(), process_bintransfer()
+//
+// Return: void
+// -----------------------------------------------------------------------------
+void
+progress_start(uint8_t total)	{
+
+	uint8_t rows[8], i;
+
+	if(!prg_glyphs)	{
+
+		for(i = 1; i <= 5; i++)	{
+
+			memset(rows, (0x1F << (5 - i)) & 0x1F, sizeof(rows));
+			rows[0] = rows[7] = 0;
+			lcd_defchar(PRG_GLYPH - 1 + i, rows);
+		}
+		prg_glyphs = 1;
+	}
+
+	prg_total = total ? total : 1;
+	prg_start = get_time_us();
+
+	lcd_clrscr();
+	progress_block(0, 0);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Show the progress after a block was sent
+//
+// Details: Rate and remaining time are computed from the time since
+// progress_start(), the remaining time is shown once a block is done. A few
+// hundred cycles for the divisions, the LCD is written by the refresh.
+//
+// Called by: process_transfer(), process_bintransfer()
+//
+// Return: void
+// -----------------------------------------------------------------------------
+void
+progress_block(uint8_t done, uint32_t bytes)	{
+
+	char line[LCD_DISP_LENGTH + 1], num[12], *p;
+	uint32_t ms = (get_time_us() - prg_start) / 1000;
+	uint8_t i, steps;
+
+	if(done > prg_total)
+		done = prg_total;
+
+	// blocks and rate
+	memset(line, ' ', LCD_DISP_LENGTH);
+	line[LCD_DISP_LENGTH] = 0;
+
+	p = fmt_long(num, done);
+	*p++ = '/';
+	fmt_long(p, prg_total);
+	prg_right(line, 7, num);
+
+	p = fmt_long(num, ms ? bytes * 1000 / ms : 0);
+	fmt_P(p, PSTR("B/s"));
+	prg_right(line, LCD_DISP_LENGTH, num);
+
+	lcd_gotoxy(0, 0);
+	lcd_puts(line);
+
+	// bar and remaining time
+	steps = (uint16_t)done * (PRG_BAR * 5) / prg_total;
+	memset(line, ' ', LCD_DISP_LENGTH);
+
+	for(i = 0; i < PRG_BAR; i++, steps -= 5)	{
+
+		if(steps >= 5)
+			line[i] = PRG_GLYPH + 4;
+		else	{
+			if(steps)
+				line[i] = PRG_GLYPH - 1 + steps;
+			break;
+		}
+	}
+
+	if(done)	{
+
+		ms = ms / done * (prg_total - done) / 1000;	// s left
+		p = fmt_long(num, ms / 60);
+		*p++ = ':';
+		*p++ = '0' + (ms % 60) / 10;
+		*p++ = '0' + ms % 10;
+		*p = 0;
+		prg_right(line, LCD_DISP_LENGTH, num);
+	}
+
+	lcd_gotoxy(0, 1);
+	lcd_puts(line);
+}
+
+#endif
@@ -0,0 +1,37 @@
+/*
+* ----------------------------------------------------------------------------
+* Transfer progress, throughput and remaining time on the LCD
+*
+*  Version: 0.0.1
+*  
+* "THE BEER-WARE LICENSE" (Revision 42):
+* <karsten@rhen.de> wrote this file. As long as you retain this notice you
+* can do whatever you want with this stuff. If we meet some day, and you think
+* this stuff is worth it, you can buy me a beer in Flensburg, Germany
+* ----------------------------------------------------------------------------
+*/
+
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <inttypes.h>
+
+// -----------------------------------------------------------------------------
+// Bar on the second line, 5 steps per cell by the CGRAM characters 1-5
+#define PRG_BAR		11		// cells of the bar
+#define PRG_GLYPH	1		// CGRAM code of the first bar character
+
+// -----------------------------------------------------------------------------
+// The host build has no LCD
+#if !defined(HOST)
+#define PROGRESS_START(total)			progress_start(total)
+#define PROGRESS_BLOCK(done, bytes)		progress_block(done, bytes)
+#else
+#define PROGRESS_START(total)			do{ (void)(total); } while(0)
+#define PROGRESS_BLOCK(done, bytes)		do{ (void)(done); (void)(bytes); } while(0)
+#endif
+
+void progress_start(uint8_t total);
+void progress_block(uint8_t done, uint32_t bytes);
+
+#endif
@@ -17,11 +17,15 @@
 #include "mcp2515.h"
 
 #include "protocol.h"
+#include "debug.h"
+#include "latency.h"
+#include "probe.h"
 
 extern device_t device; // defined in main.c
 static uint16_t my_crc;
 
 static void update_crc(char ch);
+static uint8_t send_frame(const can_t *msg);
 
 
 // -----------------------------------------------------------------------------
@@ -54,7 +58,7 @@ snd_binBlock(uint8_t num)	{
 
 //	print_can_hex_detailed(&msg);
 //	return(0);
-	return(can_send_message(&msg));
+	return(send_frame(&msg));
 }
 
 // -----------------------------------------------------------------------------
@@ -69,7 +73,7 @@ snd_binBlock(uint8_t num)	{
 // Return: address of used tx buffer on success otherwise -1
 // -----------------------------------------------------------------------------
 int
-snd_binStream(char *bytes, uint16_t len, uint8_t mode)	{
+snd_binStream(const char *bytes, uint16_t len, uint8_t mode)	{
 
 	uint8_t i = 0;
 	uint16_t j = 0;
@@ -95,7 +99,7 @@ snd_binStream(char *bytes, uint16_t len, uint8_t mode)	{
 		}
 
 //	print_can_hex_detailed(&msg);
-		can_send_message(&msg);
+		send_frame(&msg);
 	}
 
 	return(0);
@@ -133,7 +137,7 @@ snd_binCRC(void)	{
 
 //	print_can_hex_detailed(&msg);
 //	return(0);
-	return(can_send_message(&msg));
+	return(send_frame(&msg));
 
 }
 
@@ -165,7 +169,7 @@ snd_ACK(void)	{
 	msg.data[4] = 0;
 	msg.data[5] = 0;
 
-	return(can_send_message(&msg));
+	return(send_frame(&msg));
 }
 
 // -----------------------------------------------------------------------------
@@ -200,7 +204,7 @@ snd_cfCRC(uint16_t len)	{
 
 //	print_can_hex_detailed(&msg);
 //	return(0);
-	return(can_send_message(&msg));
+	return(send_frame(&msg));
 }
 
 // -----------------------------------------------------------------------------
@@ -215,7 +219,7 @@ snd_cfCRC(uint16_t len)	{
 // Return: address of used tx buffer on success otherwise -1
 // -----------------------------------------------------------------------------
 int
-snd_cfStream(char *bytes, uint16_t len)	{
+snd_cfStream(const char *bytes, uint16_t len)	{
 
 	uint8_t i = 0;
 	uint16_t j = 0;
@@ -238,7 +242,7 @@ snd_cfStream(char *bytes, uint16_t len)	{
 		}
 
 //		print_can_hex_detailed(&msg);
-		can_send_message(&msg);
+		send_frame(&msg);
 	}
 
 	return(0);
@@ -266,7 +270,7 @@ snd_ping(void)	{
 
 	msg.length = 0;
 		
-	return(can_send_message(&msg));
+	return(send_frame(&msg));
 }
 
 // -----------------------------------------------------------------------------
@@ -304,7 +308,7 @@ resp_ping(uint16_t hash)	{
 	msg.data[6] = 0xFF;
 	msg.data[7] = 0xFF;
 
-	return(can_send_message(&msg));
+	return(send_frame(&msg));
 }
 
 // -----------------------------------------------------------------------------
@@ -340,7 +344,7 @@ resp_cfg_request(uint8_t cfgName[8])	{
 	msg.data[7] = cfgName[7];
 
 //	print_can_hex_detailed(&msg);
-	return(can_send_message(&msg));
+	return(send_frame(&msg));
 }
 
 // -----------------------------------------------------------------------------
@@ -372,7 +376,7 @@ snd_sysReset(void)	{
 	msg.data[4] = CMD_SYSSUB_RESET;
 	msg.data[5] = 0xFF;
 
-	return(can_send_message(&msg));
+	return(send_frame(&msg));
 }
 
 // -----------------------------------------------------------------------------
@@ -396,7 +400,7 @@ snd_bootInit(void)	{
 
 	msg.length = 0;
 
-	return(can_send_message(&msg));
+	return(send_frame(&msg));
 }
 
 // -----------------------------------------------------------------------------
@@ -428,7 +432,7 @@ snd_bootStart(void)	{
 
 	//can_send_message(&msg);
 	msg.data[4] = CMD_BOOTSUB_START;
-	return(can_send_message(&msg));
+	return(send_frame(&msg));
 }
 
 // -----------------------------------------------------------------------------
@@ -442,9 +446,10 @@ snd_bootStart(void)	{
 // Return: void
 // -----------------------------------------------------------------------------
 void
-create_CRC(char *data, uint16_t len, uint8_t mode)	{
+create_CRC(const char *data, uint16_t len, uint8_t mode)	{
 
 	uint16_t i = 0;
+	PROBE_BEGIN(PRB_CRC);
 
 	if(! mode)
 		my_crc = 0xFFFF;
@@ -452,6 +457,8 @@ create_CRC(char *data, uint16_t len, uint8_t mode)	{
 	for( i = 0; i < len; i++)	{
 		update_crc(data[i]);
 	}
+
+	PROBE_END(PRB_CRC);
 }
 
 
@@ -481,3 +488,26 @@ update_crc(char ch) {
 		}
 	}
 }
+
+// -----------------------------------------------------------------------------
+// Description: Hand a frame to the CAN controller
+//
+// Details: All frames of the protocol are sent here, so the own turnaround
+// is measured, see latency.c
+// 
+// Called by: snd_*(), resp_*()
+//
+// Return: see can_send_message()
+// -----------------------------------------------------------------------------
+static uint8_t
+send_frame(const can_t *msg)	{
+
+	uint8_t rt;
+	PROBE_BEGIN(PRB_CAN_SEND);
+
+	rt = can_send_message(msg);
+	PROBE_END(PRB_CAN_SEND);
+
+	LAT_SEND();
+	return(rt);
+}
@@ -60,7 +60,7 @@ int snd_ping(void);
 int snd_cfCRC(uint16_t len);
 
 // ----------------------------------------------------------------------------
-int snd_cfStream(char *bytes, uint16_t len);
+int snd_cfStream(const char *bytes, uint16_t len);
 
 // ----------------------------------------------------------------------------
 int snd_ACK(void);
@@ -78,7 +78,7 @@ int snd_bootStart(void);
 int snd_binBlock(uint8_t num);
 
 // ----------------------------------------------------------------------------
-int snd_binStream(char *bytes, uint16_t len, uint8_t mode);
+int snd_binStream(const char *bytes, uint16_t len, uint8_t mode);
 
 // ----------------------------------------------------------------------------
 int snd_binCRC(void);
@@ -90,6 +90,6 @@ int resp_ping(uint16_t hash);
 int resp_cfg_request(uint8_t cfgName[8]);
 
 // ----------------------------------------------------------------------------
-void create_CRC(char *data, uint16_t len, uint8_t mode);
+void create_CRC(const char *data, uint16_t len, uint8_t mode);
 
 #endif
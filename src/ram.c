@@ -0,0 +1,144 @@
+/*
+* ----------------------------------------------------------------------------
+* Stack high water mark and RAM check
+*
+* The RAM between the end of the static variables ( _end, no heap is used )
+* and the top of the stack is painted with RAM_CANARY before main() runs.
+* Bytes still painted were never touched by the stack, so the painted bytes
+* above _end are the free RAM of the deepest stack so far.
+*
+* The update phases of BENCH_PHASE() check the high water mark, the phase
+* which pushed it down keeps the minimum. Less than RAM_WARN free bytes are
+* reported over the UART and by LED_ERROR.
+*
+*  Version: 0.0.1
+*  
+* "THE BEER-WARE LICENSE" (Revision 42):
+* <karsten@rhen.de> wrote this file. As long as you retain this notice you
+* can do whatever you want with this stuff. If we meet some day, and you think
+* this stuff is worth it, you can buy me a beer in Flensburg, Germany
+* ----------------------------------------------------------------------------
+*/
+
+#include <avr/io.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <avr/pgmspace.h>
+
+#include "main.h"
+
+#if defined(RAMCHECK) && !defined(HOST)
+
+// Linker symbols
+extern uint8_t __data_start;
+extern uint8_t _end;
+extern uint8_t __stack;
+
+static uint16_t ram_min[RAM_PHASES];	// free bytes per phase, 0 unknown
+static uint8_t ram_cur;					// current phase
+
+void ram_paint(void) __attribute__((naked, used, section(".init3")));
+
+// -----------------------------------------------------------------------------
+// Description: Paint the RAM above the static variables
+//
+// Details: Runs in .init3 before the static variables are initialized, the
+// stack pointer is set and the stack is still empty. Naked, no return.
+//
+// Called by: startup code
+//
+// Return: void
+// -----------------------------------------------------------------------------
+void
+ram_paint(void)	{
+
+	uint8_t *p = &_end;
+
+	while(p <= &__stack)
+		*p++ = RAM_CANARY;
+}
+
+// -----------------------------------------------------------------------------
+// Description: Bytes never touched by the stack
+//
+// Details: Counts the painted bytes from _end upwards, about 5 cycles per
+// byte.
+//
+// Called by: ram_phase(), ram_report()
+//
+// Return: free RAM of the deepest stack since boot
+// -----------------------------------------------------------------------------
+uint16_t
+ram_stack_free(void)	{
+
+	const uint8_t *p = &_end;
+
+	while(p <= &__stack && *p == RAM_CANARY)
+		p++;
+
+	return(p - &_end);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Update phase changes, check the high water mark
+//
+// Details: A new low of the free RAM is counted to the phase ending now. 
+// Block markers keep the phase, BENCH_DONE returns to BENCH_OTHER.
+//
+// Called by: BENCH_PHASE()
+//
+// Return: void
+// -----------------------------------------------------------------------------
+void
+ram_phase(uint8_t phase)	{
+
+	uint16_t free;
+
+	if(phase & BENCH_BLOCK)
+		return;
+
+	free = ram_stack_free();
+	if(!ram_min[ram_cur] || free < ram_min[ram_cur])	{
+
+		ram_min[ram_cur] = free;
+		if(free < RAM_WARN)	{
+			SET(LED_ERROR);
+			PRINT("RAM low: %u free in phase %u\n", free, ram_cur);
+		}
+	}
+
+	ram_cur = (phase < RAM_PHASES) ? phase : BENCH_OTHER;
+}
+
+// -----------------------------------------------------------------------------
+// Description: Print the RAM map, the scratch arena use and the free RAM per
+// phase
+//
+// Called by: main
+//
+// Return: void
+// -----------------------------------------------------------------------------
+void
+ram_report(void)	{
+
+	uint8_t i;
+
+	uart_tx_flush();
+	PRINT("RAM static %u stack %u free %u\n", 
+			(uint16_t)(&_end - &__data_start),
+			(uint16_t)(&__stack - &_end + 1), ram_stack_free());
+
+	uart_tx_flush();
+	PRINT("RAM scratch %u of %u\n", scratch_peak(), (unsigned)SCRATCH_SIZE);
+
+	for(i = 0; i < RAM_PHASES; i++)	{
+
+		if(!ram_min[i])
+			continue;
+
+		uart_tx_flush();
+		PRINT("RAM phase %u free %u\n", i, ram_min[i]);
+	}
+}
+
+#endif
@@ -0,0 +1,37 @@
+/*
+* ----------------------------------------------------------------------------
+* Stack high water mark and RAM check
+*
+*  Version: 0.0.1
+*  
+* "THE BEER-WARE LICENSE" (Revision 42):
+* <karsten@rhen.de> wrote this file. As long as you retain this notice you
+* can do whatever you want with this stuff. If we meet some day, and you think
+* this stuff is worth it, you can buy me a beer in Flensburg, Germany
+* ----------------------------------------------------------------------------
+*/
+
+#ifndef RAM_H
+#define RAM_H
+
+// -----------------------------------------------------------------------------
+// RAM between the static variables and the stack is painted at boot
+#define RAM_CANARY	0xC5
+#define RAM_WARN	128		// warn if less bytes were never touched
+#define RAM_PHASES	(BENCH_ACK + 1)	// update phases, see BENCH_PHASE()
+
+// -----------------------------------------------------------------------------
+// Compiled out without RAMCHECK and in the host build, see debug.h
+#if defined(RAMCHECK) && !defined(HOST)
+#define RAM_PHASE(phase)	ram_phase(phase)
+#define RAM_REPORT()		ram_report()
+#else
+#define RAM_PHASE(phase)	do{} while(0)
+#define RAM_REPORT()		do{} while(0)
+#endif
+
+uint16_t ram_stack_free(void);
+void ram_phase(uint8_t phase);
+void ram_report(void);
+
+#endif
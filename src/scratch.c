@@ -0,0 +1,105 @@
+/*
+* ----------------------------------------------------------------------------
+* Scratch arena of the transient buffers
+*
+* The protocol and file buffers of process.c and main.c and the decoder state
+* of an open compressed file ( sd.c ) are taken from one static arena instead
+* of the stack, so they share a region with a known worst case
+* ( SCRATCH_SIZE ) and the stack depth does not depend on the call path.
+*
+* Allocation is a bump of the arena top. A phase, a function or one request
+* of the dispatcher, takes the top with scratch_mark() before it allocates
+* and gives everything above back with scratch_release() when it ends. An
+* allocation beyond SCRATCH_SIZE is a bug, it stops the updater.
+*
+*  Version: 0.0.1
+*  
+* "THE BEER-WARE LICENSE" (Revision 42):
+* <karsten@rhen.de> wrote this file. As long as you retain this notice you
+* can do whatever you want with this stuff. If we meet some day, and you think
+* this stuff is worth it, you can buy me a beer in Flensburg, Germany
+* ----------------------------------------------------------------------------
+*/
+
+#include <avr/io.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "main.h"
+
+static uint8_t scratch[SCRATCH_SIZE];
+static uint16_t scratch_top;			// first free byte
+static uint16_t scratch_max;			// high water mark
+
+// -----------------------------------------------------------------------------
+// Description: Allocate a buffer from the arena
+//
+// Details: The buffer is not cleared. Stops with LED_ERROR if the arena is
+// too small.
+//
+// Called by: process.c, main
+//
+// Return: pointer to size bytes
+// -----------------------------------------------------------------------------
+void *
+scratch_alloc(uint16_t size)	{
+
+	uint8_t *p = &scratch[scratch_top];
+
+	if(size > SCRATCH_SIZE - scratch_top)	{
+
+		SET(LED_ERROR);
+		PRINT("Scratch overflow: %u + %u\n", scratch_top, size);
+#ifdef HOST
+		exit(2);
+#else
+		while(1);
+#endif
+	}
+
+	scratch_top += size;
+	if(scratch_top > scratch_max)
+		scratch_max = scratch_top;
+
+	return(p);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Current top of the arena
+//
+// Called by: process.c, main
+//
+// Return: mark for scratch_release()
+// -----------------------------------------------------------------------------
+uint16_t
+scratch_mark(void)	{
+
+	return(scratch_top);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Free all buffers allocated since the mark was taken
+//
+// Called by: process.c, main
+//
+// Return: void
+// -----------------------------------------------------------------------------
+void
+scratch_release(uint16_t mark)	{
+
+	scratch_top = mark;
+}
+
+// -----------------------------------------------------------------------------
+// Description: Most bytes of the arena used at once since boot
+//
+// Called by: ram_report()
+//
+// Return: high water mark
+// -----------------------------------------------------------------------------
+uint16_t
+scratch_peak(void)	{
+
+	return(scratch_max);
+}
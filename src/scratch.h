@@ -0,0 +1,31 @@
+/*
+* ----------------------------------------------------------------------------
+* Scratch arena of the transient buffers
+*
+*  Version: 0.0.1
+*  
+* "THE BEER-WARE LICENSE" (Revision 42):
+* <karsten@rhen.de> wrote this file. As long as you retain this notice you
+* can do whatever you want with this stuff. If we meet some day, and you think
+* this stuff is worth it, you can buy me a beer in Flensburg, Germany
+* ----------------------------------------------------------------------------
+*/
+
+#ifndef SCRATCH_H
+#define SCRATCH_H
+
+#include "lz.h"
+
+// -----------------------------------------------------------------------------
+// Size of the arena, the worst case is the version read of the main loop
+// with the LCD message ( 40 ), the version ( 9 ) and the decoder state of an
+// open compressed file ( sd_open_file() ). Without a file update_MS2() with
+// process_ldbver() needs 9 + 4 + 56 only.
+#define SCRATCH_SIZE	(40 + 9 + sizeof(lz_t))
+
+void *scratch_alloc(uint16_t size);
+uint16_t scratch_mark(void);
+void scratch_release(uint16_t mark);
+uint16_t scratch_peak(void);
+
+#endif
@@ -11,7 +11,15 @@
 * ----------------------------------------------------------------------------
 */
 
-#include "sd.h"
+#include <string.h>
+#include <avr/eeprom.h>
+
+#include "main.h"
+
+// sd_map_raw() hands out the data in the sector window of the FATFS object
+#if !FF_FS_TINY
+ #error "sd.c needs FF_FS_TINY 1 in ffconf.h"
+#endif
 
 // -----------------------------------------------------------------------------
 //  INTERFACE to MMC-lib 
@@ -20,6 +28,44 @@
 FATFS fs;
 FIL fd;
 
+// Identity of the mounted card
+static uint32_t sd_serial;			// volume serial number
+static uint32_t sd_clusters;		// clusters of the volume
+static uint32_t sd_psn;				// serial number of the CID, 0 unknown
+static uint32_t sd_stamp;			// date and time of the opened file
+
+// Compressed file opened instead of the requested one ( lz.h ), the decoder
+// state is taken from the scratch arena while the file is open
+static lz_t *lz;
+static uint16_t sd_lztop;			// arena mark of the decoder state
+static uint8_t sd_lz;				// 1 if the opened file is compressed
+static uint8_t sd_lzshift;			// log2 of its block size
+static uint32_t sd_lzsize;			// decoded size
+static uint32_t sd_lzpos;			// decoded file position
+static uint16_t sd_lzblk[2];		// last two started blocks ...
+static uint32_t sd_lzofs[2];		// ... and their file offsets
+static uint8_t sd_lzlast;			// entry of the last started block
+
+// Card identity and catalog of the last card, a file of the catalog is
+// unchanged if start cluster, size and date and time are the same
+typedef struct {
+
+	uint32_t sclust;
+	uint32_t size;
+	uint32_t stamp;
+	uint16_t ver;
+} sd_cat_t;
+
+typedef struct {
+
+	uint32_t serial;
+	uint32_t clusters;
+	uint32_t psn;
+	sd_cat_t cat[SD_CAT_MAX];
+} sd_cache_t;
+
+static sd_cache_t EEMEM sd_cache;
+
 // -----------------------------------------------------------------------------
 // Stub: Init access to SD Card
 //
@@ -30,15 +76,399 @@ FIL fd;
 uint8_t
 init_SD(void)	{
 
-	return(f_mount(&fs, "0:", 1));
+	uint8_t rt, *vsn, cid[16];
+
+	if((rt = f_mount(&fs, "0:", 1)) != 0)
+		return(rt);
+
+	sd_psn = 0;
+	if(disk_ioctl(0, MMC_GET_CID, cid) == RES_OK)
+		sd_psn = ((uint32_t)cid[9] << 24) | ((uint32_t)cid[10] << 16) |
+			((uint32_t)cid[11] << 8) | cid[12];
+
+	// the window still holds the boot sector, read by the mount
+	sd_serial = 0;
+	if(fs.winsect == fs.volbase)	{
+
+		vsn = &fs.win[(fs.fs_type == FS_FAT32) ? 67 : 39];	// BS_VolID(32)
+		sd_serial = vsn[0] | ((uint32_t)vsn[1] << 8) |
+			((uint32_t)vsn[2] << 16) | ((uint32_t)vsn[3] << 24);
+	}
+	sd_clusters = fs.n_fatent;
+
+	return(0);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Check the mounted card against the card in EEPROM
+//
+// Details: Volume serial number, cluster count and the serial number of
+// the CID identify the card, a card formatted again gets a new volume
+// serial number.
+//
+// Called by: init_HW
+//
+// Return: 1 if the card is known, it passed the test read before
+// ----------------------------------------------------------------------------
+uint8_t
+sd_card_known(void)	{
+
+	uint32_t id[3];
+
+	eeprom_read_block(id, &sd_cache.serial, sizeof(id));
+
+	return(sd_serial && id[0] == sd_serial && id[1] == sd_clusters &&
+		id[2] == sd_psn);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Store the mounted card in EEPROM
+//
+// Details: Clears the catalog of the former card. Only changed bytes are
+// written, a known card costs no EEPROM write.
+//
+// Called by: init_HW
+//
+// Return: void
+// ----------------------------------------------------------------------------
+void
+sd_card_store(void)	{
+
+	sd_cache_t c;
+
+	if(sd_card_known())
+		return;
+
+	memset(&c, 0xFF, sizeof(c));
+	c.serial = sd_serial;
+	c.clusters = sd_clusters;
+	c.psn = sd_psn;
+	eeprom_update_block(&c, &sd_cache, sizeof(c));
+}
+
+// -----------------------------------------------------------------------------
+// Description: Version of the opened file from the catalog in EEPROM
+//
+// Details: The entry is valid for the known card if start cluster, size
+// and the date and time of the directory entry of the opened file are
+// unchanged. An image written over the old one in place keeps its start
+// cluster and may keep its size, it gets a new date and time.
+//
+// Called by: get_gb2ver(), get_ms2ver()
+//
+// Return: 1 and the version in *ver if the entry is valid
+// ----------------------------------------------------------------------------
+uint8_t
+sd_cat_version(uint8_t idx, uint16_t *ver)	{
+
+	sd_cat_t e;
+
+	if(idx >= SD_CAT_MAX || !sd_card_known())
+		return(0);
+
+	eeprom_read_block(&e, &sd_cache.cat[idx], sizeof(e));
+	if(e.sclust != fd.obj.sclust || e.size != f_size(&fd) ||
+		e.stamp != sd_stamp)
+		return(0);
+
+	*ver = e.ver;
+	return(1);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Store the version of the opened file in the catalog
+//
+// Called by: get_gb2ver(), get_ms2ver()
+//
+// Return: void
+// ----------------------------------------------------------------------------
+void
+sd_cat_store(uint8_t idx, uint16_t ver)	{
+
+	sd_cat_t e;
+
+	if(idx >= SD_CAT_MAX || !sd_card_known())
+		return;
+
+	e.sclust = fd.obj.sclust;
+	e.size = f_size(&fd);
+	e.stamp = sd_stamp;
+	e.ver = ver;
+	eeprom_update_block(&e, &sd_cache.cat[idx], sizeof(e));
+}
+
+
+// -----------------------------------------------------------------------------
+// Description: Map the next bytes of the opened file without a copy
+//
+// Details: Reads one byte with f_read(), so FatFs loads the sector into its
+// window (FF_FS_TINY), and returns a pointer to the data in fs.win. The
+// length is clipped to len, the rest of the sector and the rest of the file,
+// the file position is advanced by the returned length with f_lseek(). It
+// stays within the sector in fs.win, so FatFs neither reads a sector nor
+// follows the cluster chain for it.
+//
+// Called by: sd_map_file, sd_lz_fill
+//
+// Return: The number of bytes mapped, 0 on end of file or failure
+// ----------------------------------------------------------------------------
+static uint16_t
+sd_map_raw(const uint8_t **data, uint16_t len)	{
+
+	UINT rd;
+	uint8_t c;
+	uint16_t ofs, n;
+	FSIZE_t left;
+
+	PROBE_BEGIN(PRB_SD_READ);
+	ofs = f_tell(&fd) % FF_MAX_SS;
+	if(f_read(&fd, &c, 1, &rd) || rd == 0)	{
+
+		PROBE_END(PRB_SD_READ);
+		return(0);
+	}
+
+	n = FF_MAX_SS - ofs;
+	left = f_size(&fd) - f_tell(&fd) + 1;
+	if(n > left)
+		n = left;
+	if(n > len)
+		n = len;
+
+	if(n > 1 && f_lseek(&fd, f_tell(&fd) + n - 1))	{
+
+		PROBE_END(PRB_SD_READ);
+		return(0);
+	}
+
+	*data = &fs.win[ofs];
+	PROBE_END(PRB_SD_READ);
+
+	return(n);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Input of the decoder, the rest of the current sector
+//
+// Called by: lz_decode
+//
+// Return: The number of bytes mapped, 0 on end of file
+// ----------------------------------------------------------------------------
+static uint16_t
+sd_lz_fill(const uint8_t **in)	{
+
+	return(sd_map_raw(in, FF_MAX_SS));
+}
+
+// -----------------------------------------------------------------------------
+// Description: Start to decode the block at the decoded file position
+//
+// Details: The input of the block starts at the file position less the
+// mapped bytes not used yet. The file offsets of the last two started
+// blocks are kept, the rewind of process_transfer() to the start of the
+// 1024 byte block needs no read of the index.
+//
+// Called by: sd_lz_map, sd_lz_seek
+//
+// Return: void
+// ----------------------------------------------------------------------------
+static void
+sd_lz_start(void)	{
+
+	uint16_t blk = sd_lzpos >> sd_lzshift;
+	uint32_t rest = sd_lzsize - sd_lzpos;
+
+	if(sd_lzblk[0] != blk && sd_lzblk[1] != blk)	{
+
+		sd_lzlast ^= 1;
+		sd_lzblk[sd_lzlast] = blk;
+		sd_lzofs[sd_lzlast] = f_tell(&fd) - lz->inlen;
+	}
+
+	lz_block(lz, (rest < (1UL << sd_lzshift)) ? rest : (1U << sd_lzshift));
+}
+
+// -----------------------------------------------------------------------------
+// Description: Decode the next bytes of the compressed file
+//
+// Details: The bytes are decoded into the window of the decoder and are
+// contiguous there, the length is clipped to len, the end of the window and
+// the end of the file. The blocks follow each other in the file, the next
+// one starts without a seek.
+//
+// Called by: sd_map_file, sd_read_file, sd_lz_seek
+//
+// Return: The number of bytes at *data, 0 on end of file or failure
+// ----------------------------------------------------------------------------
+static uint16_t
+sd_lz_map(const uint8_t **data, uint16_t len)	{
+
+	const uint8_t *p;
+	uint16_t n = 0, k;
+
+	while(n < len && sd_lzpos < sd_lzsize && !lz->err)	{
+
+		if(!lz->out)
+			sd_lz_start();
+
+		if((k = lz_decode(lz, &p, len - n)) == 0)	{
+
+			if(lz->err)
+				PRINT("Error: compressed file at %lu\n", sd_lzpos);
+			break;
+		}
+
+		if(!n)
+			*data = p;
+		n += k;
+		sd_lzpos += k;
+
+		// the window wrapped, the next bytes are not contiguous
+		if(lz->pos == 0)
+			break;
+	}
+
+	return(lz->err ? 0 : n);
 }
 
+// -----------------------------------------------------------------------------
+// Description: Seek in the compressed file
+//
+// Details: Within the block being decoded a seek forward decodes up to pos.
+// Otherwise the file offset of the block of pos is taken from the last
+// started blocks or the index of the file, its decode starts from there.
+// A read of the index fetches the entry of the block before too.
+//
+// Called by: sd_seek_file, sd_lz_open
+//
+// Return: 0 on success, 1 on failure
+// ----------------------------------------------------------------------------
+static uint8_t
+sd_lz_seek(uint32_t pos)	{
+
+	const uint8_t *p;
+	uint8_t b[8], i, j;
+	uint32_t ofs;
+	uint16_t blk;
+	UINT rd;
+
+	if(pos >= sd_lzsize)	{
+
+		sd_lzpos = sd_lzsize;
+		lz->out = 0;
+		return(0);
+	}
+
+	blk = pos >> sd_lzshift;
+	if(pos < sd_lzpos || blk != (sd_lzpos >> sd_lzshift))	{
+
+		if(sd_lzblk[0] != blk && sd_lzblk[1] != blk)	{
+
+			// the entries of blk - 1 and blk, blocks sent backwards
+			i = blk ? 1 : 0;
+			if(f_lseek(&fd, LZ_HEAD + 4UL * (blk - i)) ||
+				f_read(&fd, b, 8, &rd) || rd < 4U * (i + 1))
+				return(1);
+			for(j = 0; j <= i; j++)	{
+
+				sd_lzblk[j] = blk - i + j;
+				sd_lzofs[j] = b[4 * j] | ((uint32_t)b[4 * j + 1] << 8) |
+					((uint32_t)b[4 * j + 2] << 16) |
+					((uint32_t)b[4 * j + 3] << 24);
+			}
+			sd_lzlast = i;
+		}
+		ofs = sd_lzofs[sd_lzblk[1] == blk];
+
+		// within the cluster of the last read FatFs neither follows the
+		// chain nor reads a sector ( FF_FS_TINY )
+		if(f_lseek(&fd, ofs))
+			return(1);
+
+		lz->inlen = 0;
+		lz->err = 0;
+		sd_lzpos = (uint32_t)blk << sd_lzshift;
+		sd_lz_start();
+	}
+
+	while(sd_lzpos < pos && sd_lz_map(&p, (pos - sd_lzpos > LZ_WINDOW) ?
+		LZ_WINDOW : pos - sd_lzpos) > 0)
+		;
+
+	return(sd_lzpos != pos);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Check the header of the opened compressed file
+//
+// Details: Reads the header and starts the decode of the first block.
+//
+// Called by: sd_open_file
+//
+// Return: 0 if the file is compressed, otherwise 1
+// ----------------------------------------------------------------------------
+static uint8_t
+sd_lz_open(void)	{
+
+	uint8_t h[LZ_HEAD];
+	UINT rd;
+
+	if(f_read(&fd, h, LZ_HEAD, &rd) || rd != LZ_HEAD || h[0] != LZ_MAGIC0 ||
+		h[1] != LZ_MAGIC1 || h[2] != LZ_VERSION || h[3] < 8 || h[3] > 15)
+		return(1);
+
+	sd_lzshift = h[3];
+	sd_lzsize = h[4] | ((uint32_t)h[5] << 8) | ((uint32_t)h[6] << 16) |
+		((uint32_t)h[7] << 24);
+	sd_lzblk[0] = sd_lzblk[1] = 0xFFFF;
+	lz->fill = sd_lz_fill;
+	lz->out = 0;
+	lz->err = 0;
+
+	// no block started yet, the seek reads the index
+	sd_lzpos = sd_lzsize;
+	sd_lz = 1;
+	if(sd_lz_seek(0))	{
+
+		sd_lz = 0;
+		return(1);
+	}
+
+	return(0);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Open a file and take the date and time of its directory entry
+//
+// Details: The directory sector found by f_stat() is still in the window for
+// f_open(), the second lookup reads no sector.
+//
+// Called by: sd_open_file
+//
+// Return: FatFs result
+// ----------------------------------------------------------------------------
+static FRESULT
+sd_open(const char *name)	{
+
+	FILINFO fi;
+	FRESULT rt;
+
+	if((rt = f_stat(name, &fi)) == FR_OK &&
+		(rt = f_open(&fd, name, FA_READ)) == FR_OK)
+		sd_stamp = ((uint32_t)fi.fdate << 16) | fi.ftime;
+
+	return(rt);
+}
 
 // -----------------------------------------------------------------------------
 // Stub: Open given filename in current directory
 //
 // Details: search current opened dir_ent for given filename. 
 // The file name string must be terminated by \0 .
+// A compressed variant of the file, the base name with the extension .lz,
+// is opened instead if it exists. All sd_*_file() functions return the
+// decoded bytes then. Its decoder state is taken from the scratch arena
+// until sd_close_file().
 // 
 // !! Open READ-ONLY !!
 //
@@ -49,12 +479,34 @@ init_SD(void)	{
 uint8_t
 sd_open_file(char *filename)	{
 
-	return(f_open(&fd, filename, FA_READ));
+	char name[13];
+	uint8_t i;
+
+	for(i = 0; i < 8 && filename[i] && filename[i] != '.'; i++)
+		name[i] = filename[i];
+	memcpy(&name[i], ".lz", 4);
+
+	sd_lz = 0;
+	if(sd_open(name) == FR_OK)	{
+
+		sd_lztop = scratch_mark();
+		lz = scratch_alloc(sizeof(lz_t));
+		if(sd_lz_open() == 0)
+			return(0);
+		scratch_release(sd_lztop);
+		f_close(&fd);
+	}
+
+	return(sd_open(filename));
 }
 
 // -----------------------------------------------------------------------------
 // Stub: close SD card file descriptor
 //
+// Details: Releases the scratch arena to the mark of sd_open_file() if the
+// file is compressed, buffers allocated while the file was open are freed
+// too. Buffers needed after the close are allocated before the open.
+//
 // Called by: diverse
 //
 // Return: void
@@ -62,6 +514,9 @@ sd_open_file(char *filename)	{
 void
 sd_close_file(void)	{
 
+	if(sd_lz)
+		scratch_release(sd_lztop);
+	sd_lz = 0;
 	f_close(&fd);
 }
 
@@ -77,10 +532,16 @@ sd_close_file(void)	{
 uint8_t
 sd_seek_file(uint32_t *pos)	{
 
-	if(f_lseek(&fd, *pos))
+	uint8_t rt;
+
+	PROBE_BEGIN(PRB_SD_SEEK);
+	rt = sd_lz ? sd_lz_seek(*pos) : f_lseek(&fd, *pos);
+	PROBE_END(PRB_SD_SEEK);
+
+	if(rt)
 		return(1);
 
-	*pos = f_tell(&fd);
+	*pos = sd_tell_file();
 	return(0);
 }
 
@@ -94,7 +555,7 @@ sd_seek_file(uint32_t *pos)	{
 uint32_t
 sd_tell_file(void)	{
 
-	return(f_tell(&fd));
+	return(sd_lz ? sd_lzpos : f_tell(&fd));
 }
 
 // -----------------------------------------------------------------------------
@@ -109,21 +570,114 @@ sd_tell_file(void)	{
 uint16_t
 sd_read_file(uint8_t *buffer, uint16_t len)	{
 
-	uint16_t rd;
+	UINT rd = 0;
+	uint16_t n;
+	const uint8_t *p;
 
+	if(sd_lz)	{
+
+		while(rd < len && (n = sd_lz_map(&p, len - rd)) > 0)	{
+
+			memcpy(buffer + rd, p, n);
+			rd += n;
+		}
+		return(rd);
+	}
+
+	PROBE_BEGIN(PRB_SD_READ);
 	f_read(&fd, buffer, len, &rd);
+	PROBE_END(PRB_SD_READ);
 	return(rd);
 }
 
+// -----------------------------------------------------------------------------
+// Description: Map the next bytes of the opened file without a copy
+//
+// Details: The bytes are in the FatFs sector window, of a compressed file
+// in the window of the decoder. The length is clipped to len and to the end
+// of the sector or the decoder window, chunks of a size 256 is a multiple
+// of are never clipped before the end of file. The file position is
+// advanced by the returned length. The data is valid until the next call
+// of a sd_*_file() function.
+//
+// Called by: process_bintransfer, process_transfer
+//
+// Return: The number of bytes mapped, 0 on end of file or failure
+// ----------------------------------------------------------------------------
+uint16_t
+sd_map_file(const uint8_t **data, uint16_t len)	{
+
+	return(sd_lz ? sd_lz_map(data, len) : sd_map_raw(data, len));
+}
+
 // -----------------------------------------------------------------------------
 // Stub: return file size
 //
 // Called by: diverse
 //
-// Return: file size in bytes
+// Return: file size in bytes, of a compressed file the decoded size
 // ----------------------------------------------------------------------------
 uint32_t
 sd_file_size(void)	{
 
-	return(f_size(&fd));
+	return(sd_lz ? sd_lzsize : f_size(&fd));
+}
+
+// -----------------------------------------------------------------------------
+// Description: Report of the card and read throughput self-test
+//
+// Details: Prints type, capacity, clock, CID and speed class of the card.
+// Then SD_TEST_SECTORS sectors of the data area are read one by one into
+// the FatFs window, like f_read() does, and the rate is compared with the
+// byte rate of the SPI clock. A rate far below it points to the card, not
+// to the updater. The window is reloaded by the next file access.
+//
+// Called by: main ( 's' over UART ), host main
+//
+// Return: read rate in bytes/s, 0 on error
+// ----------------------------------------------------------------------------
+uint32_t
+sd_selftest(void)	{
+
+	uint8_t i, type, *reg;
+	uint16_t top;
+	mmc_clock_t clk;
+	DWORD sectors;
+	uint32_t t, rate;
+
+	if(disk_ioctl(0, MMC_GET_TYPE, &type) || disk_ioctl(0, MMC_GET_CLOCK, &clk))
+		return(0);
+
+	if(disk_ioctl(0, GET_SECTOR_COUNT, &sectors))
+		sectors = 0;
+	PRINT("SD type 0x%02x %lu MB, card %lu kHz, SPI %u kHz, high speed %u\n",
+		type, (unsigned long)(sectors >> 11), (unsigned long)clk.tran_khz,
+		clk.spi_khz, clk.hs);
+
+	top = scratch_mark();
+	reg = scratch_alloc(64);
+	if(disk_ioctl(0, MMC_GET_CID, reg) == RES_OK)
+		PRINT("SD CID mid 0x%02x oid %.2s pnm %.5s psn 0x%08lx\n", reg[0],
+			(char *)&reg[1], (char *)&reg[3], (unsigned long)sd_psn);
+	if(disk_ioctl(0, MMC_GET_SDSTAT, reg) == RES_OK)
+		PRINT("SD speed class %u\n", reg[8] == 4 ? 10 : reg[8] * 2);
+	scratch_release(top);
+
+	fs.winsect = (DWORD)0 - 1;			// the window is the buffer of the test
+	t = get_time_us();
+	for(i = 0; i < SD_TEST_SECTORS; i++)	{
+
+		if(disk_read(0, fs.win, fs.database + i, 1) != RES_OK)	{
+
+			PRINT("SD read FAILED\n");
+			return(0);
+		}
+	}
+	t = (get_time_us() - t + 500) / 1000;
+	rate = t ? (SD_TEST_SECTORS * 512UL * 1000) / t : 0;
+
+	PRINT("SD read %lu B/s, %lu%% of the SPI clock\n", (unsigned long)rate,
+		(unsigned long)(rate * 100 / (clk.spi_khz * 125UL)));
+
+	return(rate);
 }
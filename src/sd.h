@@ -18,8 +18,26 @@
 #include "ff.h"
 #include "diskio.h"
 
+// ----------------------------------------------------------------------------
+// Files of the catalog in EEPROM
+enum {
+	SD_CAT_GB2,		// 016-gb2.bin
+	SD_CAT_MS2,		// 050-ms2.bin
+	SD_CAT_MAX
+};
+
+// Sectors of the read self-test, 32kB
+#define SD_TEST_SECTORS	64
+
 // ----------------------------------------------------------------------------
 uint8_t init_SD(void);
+uint32_t sd_selftest(void);
+
+// ----------------------------------------------------------------------------
+uint8_t sd_card_known(void);
+void sd_card_store(void);
+uint8_t sd_cat_version(uint8_t idx, uint16_t *ver);
+void sd_cat_store(uint8_t idx, uint16_t ver);
 
 // ----------------------------------------------------------------------------
 uint8_t sd_open_file(char *filename);
@@ -35,6 +53,7 @@ void sd_close_file(void);
 
 // ----------------------------------------------------------------------------
 uint16_t sd_read_file(uint8_t *buffer, uint16_t len);
+uint16_t sd_map_file(const uint8_t **data, uint16_t len);
 
 // ----------------------------------------------------------------------------
 uint32_t sd_file_size(void);
@@ -12,6 +12,7 @@
 */
 
 #include "spi.h"
+#include "probe.h"
 
 void
 spi_init(void)	{
@@ -36,23 +37,43 @@ spi_init(void)	{
 }
 
 
-#if SPI_MAX_SPEED
 // *****************************************************************************
-void
-spi_maxSpeed() {
-	
-	//Set SPI speed to clock / 2 
+// Set the highest SPI clock of at most khz, clock / 2 up to clock / 128.
+// Returns the clock in kHz.
+uint16_t
+spi_clock(uint16_t khz) {
+
+	uint8_t k = 1;		// clock / 2^k
+
+	while(k < 7 && ((F_CPU / 1000UL) >> k) > khz)
+		k++;
+
+	// SPI2X halves the clock of SPR1:0, clock / 128 only without it
 	SPCR &= ~((1<<SPR0) | (1<<SPR1));
-	SPSR |= (1<<SPI2X);
+	if(k == 7)	{
+		SPCR |= (1<<SPR0) | (1<<SPR1);
+		SPSR &= ~(1<<SPI2X);
+	} else if(k & 1)	{
+		SPCR |= (k >> 1);
+		SPSR |= (1<<SPI2X);
+	} else	{
+		SPCR |= (k >> 1) - 1;
+		SPSR &= ~(1<<SPI2X);
+	}
+
+	return((F_CPU / 1000UL) >> k);
 }
-#endif
 
 // *****************************************************************************
 void
 spi_write_byte(uint8_t byte) {
 	
+#ifdef HOST
+	hal_spi_xfer(byte);
+#else
 	SPDR = byte;
 	loop_until_bit_is_set(SPSR,SPIF);
+#endif
 }
 
 
@@ -60,22 +81,34 @@ spi_write_byte(uint8_t byte) {
 uint8_t
 spi_read_byte(void) {
 	
+#ifdef HOST
+  return (hal_spi_xfer(0xff));
+#else
   SPDR = 0xff;
   loop_until_bit_is_set(SPSR,SPIF);
   return (SPDR);
+#endif
 }
 
 // *****************************************************************************
 void
 spi_read_block(uint8_t *p, uint16_t cnt)	{
 
+	PROBE_BEGIN(PRB_SPI_BLOCK);
+
 	do {
+#ifdef HOST
+			*p++ = hal_spi_xfer(0xFF);
+			*p++ = hal_spi_xfer(0xFF);
+#else
 			SPDR = 0xFF;
 			loop_until_bit_is_set(SPSR, SPIF);
 			*p++ = SPDR;
 			SPDR = 0xFF;
 			loop_until_bit_is_set(SPSR, SPIF);
 			*p++ = SPDR;
+#endif
 		} while (cnt -= 2);
 
+	PROBE_END(PRB_SPI_BLOCK);
 }
@@ -20,11 +20,16 @@
 
 //prototypes
 void spi_init(void);
-void spi_maxSpeed(void);
+uint16_t spi_clock(uint16_t khz);
 void spi_write_byte(uint8_t byte);
 uint8_t spi_read_byte(void);
 void spi_read_block(uint8_t *p, uint16_t cnt);
 
+#ifdef HOST
+// Host build: transfers by the HAL, see host/hal.h
+#define spi_start(data)	hal_spi_start(data)
+#define spi_wait()		hal_spi_wait()
+#else
 // ----------------------------------------------------------------------------
 extern __attribute__ ((gnu_inline)) inline void spi_start(uint8_t data) {
 	SPDR = data;
@@ -38,15 +43,13 @@ extern __attribute__ ((gnu_inline)) inline uint8_t spi_wait(void) {
 	
 	return SPDR;
 }
+#endif
 
 #ifndef TRUE
 	#define TRUE 	0x01
 	#define FALSE 	0x00
 #endif
 
-// enable to run SPI in maximal speed
-//#define SPI_MAX_SPEED	TRUE
-
 // ATMEGA328 HW SPI 
 #define	SPI_MOSI	B,3
 #define	SPI_MISO	B,4
@@ -58,11 +61,19 @@ extern __attribute__ ((gnu_inline)) inline uint8_t spi_wait(void) {
 #define	SD_CS B,1 	//SD Card reader
 
 // Short macros to set/reset chip select line
+#ifdef HOST
+#define MCP_CS_LOW 		hal_spi_cs(HAL_CS_MCP, 0)
+#define MCP_CS_HIGH		hal_spi_cs(HAL_CS_MCP, 1)
+
+#define MMC_CS_LOW 		hal_spi_cs(HAL_CS_SD, 0)
+#define MMC_CS_HIGH		hal_spi_cs(HAL_CS_SD, 1)
+#else
 #define MCP_CS_LOW 		RESET(MCP_CS)
 #define MCP_CS_HIGH		SET(MCP_CS)	
 
 #define MMC_CS_LOW 		RESET(SD_CS)	
 #define MMC_CS_HIGH		SET(SD_CS)
+#endif
 
 
 #endif
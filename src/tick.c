@@ -0,0 +1,158 @@
+/*
+* ----------------------------------------------------------------------------
+* Tick service: periodic callbacks and one-shot timers on Timer0
+*
+* One Timer0 compare match every 4ms serves all the time keeping of the
+* updater: the key and device present debouncer, the timeout flags of the
+* protocol and the LCD refresh run as periodic callbacks, the SD card driver
+* uses a one-shot timer for its timeouts. Timer2 with its own 10ms interrupt
+* is not needed anymore, it is free for measurements.
+*
+* The callbacks run in the ISR in the order of registration, so they must be
+* short. A one-shot timer is a down counter, started with tick_start() and
+* polled with tick_left(). It starts one tick above the given ticks, the
+* first tick may come right after the start, so it runs for the given ticks
+* at least and for one tick more at most.
+*
+*  Version: 0.0.1
+*
+* "THE BEER-WARE LICENSE" (Revision 42):
+* <karsten@rhen.de> wrote this file. As long as you retain this notice you
+* can do whatever you want with this stuff. If we meet some day, and you think
+* this stuff is worth it, you can buy me a beer in Flensburg, Germany
+* ----------------------------------------------------------------------------
+*/
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "main.h"
+
+typedef struct {
+
+	void (*fkt)(void);
+	uint8_t period;					// ticks between the calls
+	uint8_t cnt;						// ticks since the last call
+} tick_task_t;
+
+static tick_task_t tick_task[TICK_TASKS];
+static uint8_t tick_tasks;
+static volatile uint8_t tick_timer[TICK_TIMERS];
+
+volatile uint32_t systick = 0;
+
+
+// -----------------------------------------------------------------------------
+// Description: Tick of all periodic callbacks and one-shot timers
+//
+// Called by: ISR will be called every 4ms @ 16MhZ
+//
+// Return: void
+// -----------------------------------------------------------------------------
+ISR (TIMER0_COMPA_vect)	{
+
+	uint8_t i;
+	tick_task_t *t;
+	PROBE_BEGIN(PRB_TICK);
+
+	systick++;
+
+	for(i = 0; i < TICK_TIMERS; i++)
+		if(tick_timer[i])
+			tick_timer[i]--;
+
+	for(i = 0, t = tick_task; i < tick_tasks; i++, t++)	{
+
+		if(++t->cnt == t->period)	{
+
+			t->cnt = 0;
+			t->fkt();
+		}
+	}
+
+	PROBE_END(PRB_TICK);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Start Timer0 with the 4ms tick
+//
+// Called by: init_HW, init_host
+//
+// Return: void
+// -----------------------------------------------------------------------------
+void
+tick_init(void)	{
+
+	// init 8Bit Timer0, CTC, clk/1024
+	TCCR0A |= (1 << WGM01);
+	TCCR0B |= (1 << CS02) | (1 << CS00);
+	OCR0A = TICK_OCR; // 4ms @ 16Mhz
+	TIMSK0 |= (1 << OCIE0A);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Register a periodic callback
+//
+// Details: fkt is called from the ISR every period ticks. More than
+// TICK_TASKS callbacks are a bug, it stops the updater.
+//
+// Called by: init_tick_tasks
+//
+// Return: void
+// -----------------------------------------------------------------------------
+void
+tick_every(uint8_t period, void (*fkt)(void))	{
+
+	if(tick_tasks >= TICK_TASKS)	{
+
+		SET(LED_ERROR);
+		PRINT("Error: tick tasks %u\n", TICK_TASKS);
+#ifdef HOST
+		exit(2);
+#else
+		while(1);
+#endif
+	}
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)	{
+
+		tick_task[tick_tasks].fkt = fkt;
+		tick_task[tick_tasks].period = period;
+		tick_task[tick_tasks].cnt = 0;
+		tick_tasks++;
+	}
+}
+
+// -----------------------------------------------------------------------------
+// Description: Start a one-shot timer
+//
+// Details: Restarts a running timer, 0 stops it. The count starts at
+// ticks + 1, the next tick is 0 .. 4ms away, so tick_left() is not 0 before
+// ticks full ticks passed. Up to 254 ticks.
+//
+// Called by: divers
+//
+// Return: void
+// -----------------------------------------------------------------------------
+void
+tick_start(uint8_t timer, uint8_t ticks)	{
+
+	tick_timer[timer] = ticks ? ticks + 1 : 0;
+}
+
+// -----------------------------------------------------------------------------
+// Description: Remaining ticks of a one-shot timer
+//
+// Called by: divers
+//
+// Return: 0 if the timer expired
+// -----------------------------------------------------------------------------
+uint8_t
+tick_left(uint8_t timer)	{
+
+	return(tick_timer[timer]);
+}
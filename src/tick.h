@@ -0,0 +1,40 @@
+/*
+* ----------------------------------------------------------------------------
+* Tick service: periodic callbacks and one-shot timers on Timer0
+*
+*  Version: 0.0.1
+*
+* "THE BEER-WARE LICENSE" (Revision 42):
+* <karsten@rhen.de> wrote this file. As long as you retain this notice you
+* can do whatever you want with this stuff. If we meet some day, and you think
+* this stuff is worth it, you can buy me a beer in Flensburg, Germany
+* ----------------------------------------------------------------------------
+*/
+
+#ifndef TICK_H
+#define TICK_H
+
+// -----------------------------------------------------------------------------
+// Timer0 CTC, clk/1024, OCR0A 63: one tick every 4ms @ 16MHz
+#define TICK_OCR		63
+#define TICK_MS(ms)	(((ms) + 3) / 4)		// ticks of at least ms
+
+// Periodic callbacks, registered once at boot
+#define TICK_TASKS	3
+
+// One-shot timers, count down to 0 once per tick, up to 254 ticks ( 1016ms )
+enum {
+	TICK_SD,			// SD card command timeouts, mmc.c
+	TICK_SD_INIT,		// SD card init timeout, mmc.c
+	TICK_CAN,			// wait for a free transmit buffer, mcp2515.c
+	TICK_TIMERS
+};
+
+extern volatile uint32_t systick;	// free running 4ms tick
+
+void tick_init(void);
+void tick_every(uint8_t period, void (*fkt)(void));
+void tick_start(uint8_t timer, uint8_t ticks);
+uint8_t tick_left(uint8_t timer);
+
+#endif
@@ -1,6 +1,6 @@
 /*
 * ----------------------------------------------------------------------------
-* Very simple unbuffered interface to Serial UART
+* Simple interface to Serial UART, transmit buffered by interrupt
 *
 *  Version: 0.0.1
 *  
@@ -11,10 +11,49 @@
 * ----------------------------------------------------------------------------
 */
 
+#include <avr/interrupt.h>
 #include "uart.h"
 
+#define UART_TX_MASK	(UART_TX_BUFSIZE - 1)
+
+// Transmit ring buffer, head written by uart_putc(), tail by UDRE ISR
+static volatile unsigned char tx_buf[UART_TX_BUFSIZE];
+static volatile uint8_t tx_head;
+static volatile uint8_t tx_tail;
+static uint16_t tx_dropped;
+
+// -----------------------------------------------------------------------------
+// Description: UART data register empty, send next char of transmit buffer
+//
+// Details: The interrupt is disabled if the buffer is empty and enabled 
+// again by uart_putc().
+//
+// Called by: ISR
+//
+// Return: void
+// -----------------------------------------------------------------------------
+ISR (UART0_TRANSMIT_INTERRUPT)	{
+
+	uint8_t tail;
+
+	if(tx_head != tx_tail)	{
+
+		tail = (tx_tail + 1) & UART_TX_MASK;
+		tx_tail = tail;
+		UART0_DATA = tx_buf[tail];
+
+	} else	{
+
+		UART0_CONTROL &= ~(1 << UART0_UDRIE);
+	}
+}
+
 // -----------------------------------------------------------------------------
-// Description: Send one char and wait until UART send it
+// Description: Put one char to the transmit buffer
+//
+// Details: Return immediately, the char is send by the UDRE interrupt. If the
+// buffer is full the char is dropped or uart_putc() waits for space, see 
+// UART_TX_POLICY. With disabled interrupts the buffer is drained by polling.
 //
 // Called by: div 
 //
@@ -23,12 +62,74 @@
 void
 uart_putc(unsigned char data)	{
 
-	loop_until_bit_is_set(UART0_STATUS, UART0_UDRE);
-	UART0_DATA = data;								
+	uint8_t head = (tx_head + 1) & UART_TX_MASK;
+
+	while(head == tx_tail)	{		// buffer full
+
+#if (UART_TX_POLICY == UART_TX_DROP)
+		tx_dropped++;
+		return;
+#else
+		if(!(SREG & (1 << SREG_I)))	{
+
+			loop_until_bit_is_set(UART0_STATUS, UART0_UDRE);
+			tx_tail = (tx_tail + 1) & UART_TX_MASK;
+			UART0_DATA = tx_buf[tx_tail];
+		}
+#endif
+	}
+
+	tx_buf[head] = data;
+	tx_head = head;
+
+	UART0_CONTROL |= (1 << UART0_UDRIE);
 }	
 
 // -----------------------------------------------------------------------------
-// Description: Send a string and wait until UART send it
+// Description: Number of chars dropped because of a full transmit buffer
+//
+// Called by: div 
+//
+// Return: dropped chars since uart_init()
+// -----------------------------------------------------------------------------
+uint16_t
+uart_tx_dropped(void)	{
+
+	return(tx_dropped);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Free space in the transmit buffer
+//
+// Called by: trace_P()
+//
+// Return: number of chars uart_putc() can store without waiting or dropping
+// -----------------------------------------------------------------------------
+uint8_t
+uart_tx_free(void)	{
+
+	return((tx_tail - tx_head - 1) & UART_TX_MASK);
+}
+
+// -----------------------------------------------------------------------------
+// Description: Wait until the transmit buffer is empty
+//
+// Details: Interrupts must be enabled. Used before longer outputs, so a line
+// up to UART_TX_BUFSIZE - 1 chars is not dropped.
+//
+// Called by: lat_dump(), probe_dump()
+//
+// Return: void
+// -----------------------------------------------------------------------------
+void
+uart_tx_flush(void)	{
+
+	while(tx_head != tx_tail)
+		;
+}
+
+// -----------------------------------------------------------------------------
+// Description: Put a string to the transmit buffer
 //
 // Details: String MUST be terminated with '\0' !
 //
@@ -60,10 +161,24 @@ uart_getc(void)	{
   return UART0_DATA; 
 }
 
+// -----------------------------------------------------------------------------
+// Description: Check for a received char
+//
+// Called by: div 
+//
+// Return: not 0 if uart_getc() returns without waiting
+// -----------------------------------------------------------------------------
+uint8_t
+uart_rx_ready(void)	{
+
+	return(UART0_STATUS & (1 << UART0_RXC));
+}
+
 // -----------------------------------------------------------------------------
 // Description: Initialize UART and set baudrate. Slow but running :-)
 //
-// Details: Need nice UART_BAUD_SELECT() macro, NO interrupt handling!
+// Details: Need nice UART_BAUD_SELECT() macro. Transmit is done by the UDRE
+// interrupt, receive is polled.
 //
 // Called by: div 
 //
@@ -72,6 +187,9 @@ uart_getc(void)	{
 void
 uart_init(unsigned int baudrate)	{	
 
+	tx_head = tx_tail = 0;
+	tx_dropped = 0;
+
 #if defined( AT90_UART )
     /* set baud rate */
     UBRR = (unsigned char)baudrate; 
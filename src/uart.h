@@ -1,6 +1,6 @@
 /*
 * ----------------------------------------------------------------------------
-* Very simple unbuffered interface to Serial UART
+* Simple interface to Serial UART, transmit buffered by interrupt
 *
 *  Version: 0.0.1
 *  
@@ -31,6 +31,8 @@
  #define UART0_DATA     UDR  
  #define UART0_UDRE     UDRE
  #define UART0_RXC      RXC
+ #define UART0_UDRIE    UDRIE
+ #define UART0_TRANSMIT_INTERRUPT UART_UDRE_vect
 
 #elif defined(__AVR_AT90S2333__) || defined(__AVR_AT90S4433__)
  /* old AVR classic with one UART */
@@ -40,6 +42,8 @@
  #define UART0_DATA     UDR 
  #define UART0_UDRE     UDRE
  #define UART0_RXC      RXC
+ #define UART0_UDRIE    UDRIE
+ #define UART0_TRANSMIT_INTERRUPT UART_UDRE_vect
 
 #elif  defined(__AVR_ATmega8__)  || defined(__AVR_ATmega16__) || defined(__AVR_ATmega32__) \
   || defined(__AVR_ATmega323__)
@@ -50,6 +54,8 @@
  #define UART0_DATA     UDR
  #define UART0_UDRE     UDRE
  #define UART0_RXC      RXC
+ #define UART0_UDRIE    UDRIE
+ #define UART0_TRANSMIT_INTERRUPT USART_UDRE_vect
 
 #elif  defined(__AVR_ATmega8515__) || defined(__AVR_ATmega8535__)
   /* ATmega with one USART */
@@ -59,6 +65,8 @@
  #define UART0_DATA     UDR
  #define UART0_UDRE     UDRE
  #define UART0_RXC      RXC
+ #define UART0_UDRIE    UDRIE
+ #define UART0_TRANSMIT_INTERRUPT USART_UDRE_vect
 
 #elif defined(__AVR_ATmega163__) 
   /* ATmega163 with one UART */
@@ -68,6 +76,8 @@
  #define UART0_DATA     UDR
  #define UART0_UDRE     UDRE
  #define UART0_RXC      RXC
+ #define UART0_UDRIE    UDRIE
+ #define UART0_TRANSMIT_INTERRUPT UART_UDRE_vect
 
 #elif defined(__AVR_ATmega162__) 
  /* ATmega with two USART */
@@ -78,6 +88,8 @@
  #define UART0_DATA     UDR0
  #define UART0_UDRE     UDRE0
  #define UART0_RXC      RXC0
+ #define UART0_UDRIE    UDRIE0
+ #define UART0_TRANSMIT_INTERRUPT USART0_UDRE_vect
  #define UART1_STATUS   UCSR1A
  #define UART1_CONTROL  UCSR1B
  #define UART1_DATA     UDR1
@@ -93,6 +105,8 @@
  #define UART0_DATA     UDR0
  #define UART0_UDRE     UDRE0
  #define UART0_RXC      RXC0
+ #define UART0_UDRIE    UDRIE0
+ #define UART0_TRANSMIT_INTERRUPT USART0_UDRE_vect
  #define UART1_STATUS   UCSR1A
  #define UART1_CONTROL  UCSR1B
  #define UART1_DATA     UDR1
@@ -111,6 +125,8 @@
  #define UART0_DATA     UDR
  #define UART0_UDRE     UDRE
  #define UART0_RXC      RXC
+ #define UART0_UDRIE    UDRIE
+ #define UART0_TRANSMIT_INTERRUPT USART0_UDRE_vect
 
 #elif defined(__AVR_ATmega48__) ||defined(__AVR_ATmega88__) || defined(__AVR_ATmega168__) || \
       defined(__AVR_ATmega48P__) ||defined(__AVR_ATmega88P__) || defined(__AVR_ATmega168P__) || \
@@ -122,6 +138,8 @@
  #define UART0_DATA     UDR0
  #define UART0_UDRE     UDRE0
  #define UART0_RXC      RXC0
+ #define UART0_UDRIE    UDRIE0
+ #define UART0_TRANSMIT_INTERRUPT USART_UDRE_vect
 
 #elif defined(__AVR_ATtiny2313__)
  #define ATMEGA_USART
@@ -130,6 +148,8 @@
  #define UART0_DATA     UDR
  #define UART0_UDRE     UDRE
  #define UART0_RXC      RXC
+ #define UART0_UDRIE    UDRIE
+ #define UART0_TRANSMIT_INTERRUPT USART_UDRE_vect
 
 #elif defined(__AVR_ATmega329__) ||\
       defined(__AVR_ATmega649__) ||\
@@ -142,6 +162,8 @@
  #define UART0_DATA     UDR0
  #define UART0_UDRE     UDRE0
  #define UART0_RXC      RXC0
+ #define UART0_UDRIE    UDRIE0
+ #define UART0_TRANSMIT_INTERRUPT USART0_UDRE_vect
 
 #elif defined(__AVR_ATmega3290__) ||\
       defined(__AVR_ATmega6490__) 
@@ -153,6 +175,8 @@
  #define UART0_DATA     UDR0
  #define UART0_UDRE     UDRE0
  #define UART0_RXC      RXC0
+ #define UART0_UDRIE    UDRIE0
+ #define UART0_TRANSMIT_INTERRUPT USART0_UDRE_vect
 
 #elif defined(__AVR_ATmega2560__) || defined(__AVR_ATmega1280__) || defined(__AVR_ATmega640__)
 /* ATmega with two USART */
@@ -163,6 +187,8 @@
  #define UART0_DATA     UDR0
  #define UART0_UDRE     UDRE0
  #define UART0_RXC      RXC0
+ #define UART0_UDRIE    UDRIE0
+ #define UART0_TRANSMIT_INTERRUPT USART0_UDRE_vect
  #define UART1_STATUS   UCSR1A
  #define UART1_CONTROL  UCSR1B
  #define UART1_DATA     UDR1
@@ -177,6 +203,8 @@
  #define UART0_DATA     UDR0
  #define UART0_UDRE     UDRE0
  #define UART0_RXC      RXC0
+ #define UART0_UDRIE    UDRIE0
+ #define UART0_TRANSMIT_INTERRUPT USART0_UDRE_vect
 
 #elif defined(__AVR_ATmega164P__) || defined(__AVR_ATmega324P__) || defined(__AVR_ATmega644P__) || defined(__AVR_ATmega1284P__)
  /* ATmega with two USART */
@@ -187,6 +215,8 @@
  #define UART0_DATA     UDR0
  #define UART0_UDRE     UDRE0
  #define UART0_RXC      RXC0
+ #define UART0_UDRIE    UDRIE0
+ #define UART0_TRANSMIT_INTERRUPT USART0_UDRE_vect
  #define UART1_STATUS   UCSR1A
  #define UART1_CONTROL  UCSR1B
  #define UART1_DATA     UDR1
@@ -198,6 +228,24 @@
 #endif
 
 
+// -----------------------------------------------------------------------------
+// Transmit ring buffer drained by UDRE interrupt, size must be power of 2
+#ifndef UART_TX_BUFSIZE
+#define UART_TX_BUFSIZE	64
+#endif
+
+// Policy if the transmit buffer is full. Dropping cuts messages and boot
+// reports at random places, trace records can drop whole, see TRACE_DROP
+#define UART_TX_DROP		0	// drop the char, see uart_tx_dropped()
+#define UART_TX_BLOCK	1	// wait until the UDRE interrupt made space
+#ifndef UART_TX_POLICY
+#define UART_TX_POLICY	UART_TX_BLOCK
+#endif
+
+#if (UART_TX_BUFSIZE & (UART_TX_BUFSIZE - 1)) || (UART_TX_BUFSIZE > 256)
+ #error "UART_TX_BUFSIZE must be power of 2 and max 256"
+#endif
+
 // prototype
 // -----------------------------------------------------------------------------
 void uart_init(unsigned int baudrate);		
@@ -211,4 +259,16 @@ void uart_puts (const char *s);
 // -----------------------------------------------------------------------------
 unsigned char uart_getc(void);
 
+// -----------------------------------------------------------------------------
+uint8_t uart_rx_ready(void);
+
+// -----------------------------------------------------------------------------
+uint16_t uart_tx_dropped(void);
+
+// -----------------------------------------------------------------------------
+uint8_t uart_tx_free(void);
+
+// -----------------------------------------------------------------------------
+void uart_tx_flush(void);
+
 #endif
@@ -0,0 +1,78 @@
+#!/usr/bin/env python3
+#
+# capdec.py - decode a CAN capture of MS2upd into a candump log
+#
+# ----------------------------------------------------------------------------
+# "THE BEER-WARE LICENSE" (Revision 42):
+# <karsten@rhen.de> wrote this file. As long as you retain this notice you
+# can do whatever you want with this stuff. If we meet some day, and you think
+# this stuff is worth it, you can buy me a beer in Flensburg, Germany
+# ----------------------------------------------------------------------------
+#
+# Usage: capdec.py [capture [log]]
+#
+# Hold START while powering up the updater to record the CAN bus, save the
+# UART output ( 57600 baud ) to a file, e.g. while a CS2 updates a MS2. The
+# firmware sends a record per message ( see CAPTURE_SYNC in debug.h ):
+#   0x5A | lost << 4 | length | time us | id | data ...
+# Time and id are 4 byte little endian. Bytes outside of records, like the
+# boot messages, are skipped. lost counts the overflows of the MCP2515
+# receive buffers before the message, each lost one message at least, the
+# real number of lost messages is unknown.
+#
+# A record of 8 data bytes takes 18 bytes, at 57600 baud the capture keeps
+# up with about 320 messages/s. More fill the buffers and get lost.
+#
+# The output is a candump log ( candump -L ) with the time of the updater,
+# it is replayed by the host build:
+#   src/host/ms2upd -c replay:ms2.log -s sd.img update
+
+import struct
+import sys
+
+CAPTURE_SYNC = 0x5A
+CAN_EFF_MASK = 0x1FFFFFFF
+
+
+def records(data):
+	"""Yield (time us, lost, id, data) of the valid records."""
+	i = 0
+	while i + 10 <= len(data):
+		if data[i] != CAPTURE_SYNC:
+			i += 1
+			continue
+		lost, length = data[i + 1] >> 4, data[i + 1] & 0x0F
+		us, can_id = struct.unpack_from('<II', data, i + 2)
+		if length > 8 or can_id > CAN_EFF_MASK or i + 10 + length > len(data):
+			i += 1
+			continue
+		yield us, lost, can_id, data[i + 10:i + 10 + length]
+		i += 10 + length
+
+
+def main():
+	src = open(sys.argv[1], 'rb') if len(sys.argv) > 1 else sys.stdin.buffer
+	dst = open(sys.argv[2], 'w') if len(sys.argv) > 2 else sys.stdout
+
+	with src:
+		data = src.read()
+
+	wrap = last = 0
+	frames = lost = 0
+	for us, n, can_id, payload in records(data):
+		if us < last and last - us > 1 << 31:		# 32 bit us wrap, 71 min
+			wrap += 1 << 32
+		last = us
+		t = wrap + us
+		frames += 1
+		lost += n
+		dst.write('(%d.%06d) can0 %08X#%s\n' % (t // 1000000, t % 1000000,
+			can_id, payload.hex().upper()))
+
+	sys.stderr.write('%d frames, %d overflows%s\n' % (frames, lost,
+		', one lost frame at least each, 15 or more before a frame'
+		' count as 15' if lost else ''))
+
+
+if __name__ == '__main__':
+	main()
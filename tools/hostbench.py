@@ -0,0 +1,246 @@
+#!/usr/bin/env python3
+#
+# hostbench.py - update throughput benchmark of the MS2upd host build
+#
+# ----------------------------------------------------------------------------
+# "THE BEER-WARE LICENSE" (Revision 42):
+# <karsten@rhen.de> wrote this file. As long as you retain this notice you
+# can do whatever you want with this stuff. If we meet some day, and you think
+# this stuff is worth it, you can buy me a beer in Flensburg, Germany
+# ----------------------------------------------------------------------------
+#
+# Usage: hostbench.py [-d hostdir] [-b baseline] [-u] [-t %] [case=size,...]
+#
+# Runs the update of each case with the simulated devices of the host build
+# ( src/host/can_sim.c ) on ms2upd ( frame level ) and ms2upd-hw ( drivers
+# on emulated chips ) for every image size of the case:
+#
+#   gb2    016-gb2.bin   Gleisbox 60113 binary flash transfer
+#   ms2    050-ms2.bin   MS2 data stream and binary flash transfer
+#   lang   lang.ms2      MS2 data stream
+#   lokdb  flashdb.ms2   MS2 data stream
+#   langz  lang.lz       lang with a compressed file ( tools/lzpack.py )
+#   ms2z   050-ms2.lz    ms2 with a compressed file
+#   gb2z   016-gb2.lz    gb2 with a compressed file
+#
+# The file of the case gets the given size, the other files of the image
+# keep a small default size. The files are random bytes, the compressed
+# ones text records, they replace the file of the case on the image. Sizes take k and M as suffix, e.g. ms2=64k,200k.
+# A binary of a multiple of the flash block size ( 512 60113, 1024 MS2 ) ends
+# with an empty block the device rejects, that run fails.
+#
+# Reported per run on the virtual clock of the host build:
+#
+#   time     update time from plugging the device in to the last frame
+#   B/s      payload bytes received by the device per second
+#   frm/s    CAN frames sent and received by the updater per second
+#   sd/B     SD card bytes read per payload byte
+#   idle     part of the time the CPU sleeps
+#
+# The virtual clock makes the results exact, so they are compared with the
+# baseline file: a run slower by more than the tolerance ( default 1% ) or
+# with other changed counters is a regression, the exit code is 1. -u writes
+# the results of the runs into the baseline.
+
+import argparse
+import csv
+import os
+import random
+import re
+import subprocess
+import sys
+import tempfile
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import lzpack
+import mkfatimg
+
+SECTOR = 512
+
+# name, file on the SD card, CAN back end, default sizes, compressed
+CASES = [
+	('gb2', '016-gb2.bin', 'gb', '16000,60000', False),
+	('ms2', '050-ms2.bin', 'ms2:upd=ms2', '65000,205100', False),
+	('lang', 'lang.ms2', 'ms2:upd=lang', '8000,30000', False),
+	('lokdb', 'flashdb.ms2', 'ms2:upd=lokdb', '4000,12800', False),
+	('langz', 'lang.ms2', 'ms2:upd=lang', '30000', True),
+	('ms2z', '050-ms2.bin', 'ms2:upd=ms2', '205100', True),
+	('gb2z', '016-gb2.bin', 'gb', '60000', True),
+]
+
+# files of the image: name, default size, offset and value of the version
+FILES = [
+	('lang.ms2', 4096, 0, 0x0105),
+	('flashdb.ms2', 4096, 0, 0x0310),
+	('050-ms2.bin', 8192, 0xFC, 0x025a),
+	('051-ms2.bin', 4096, 0, 0x0101),
+	('016-gb2.bin', 8192, 6, 0x0130),
+]
+
+BUILDS = ['ms2upd', 'ms2upd-hw']
+
+FIELDS = ['case', 'size', 'build', 'time', 'bps', 'fps', 'sdpb', 'idle',
+	'frames', 'sectors', 'payload']
+
+STATS = re.compile(r'^update: rt=(\d+) time=([\d.]+)s can tx=(\d+) rx=(\d+) '
+	r'lost=(\d+) spi=(\d+) sd=(\d+) payload=(\d+) sleep=([\d.]+)%', re.M)
+
+
+def size(text):
+	m = re.fullmatch(r'(\d+)([kM]?)', text)
+	if not m:
+		sys.exit('%s: no size' % text)
+	return int(m.group(1)) * {'': 1, 'k': 1024, 'M': 1024 * 1024}[m.group(2)]
+
+
+def records(rnd, n):
+	"""Return n bytes of text records like a loco data base."""
+	data = bytearray()
+	while len(data) < n:
+		data += (b'[lok]\n .name=BR %03d %d\n .uid=0x%04x\n .adresse=%d\n'
+			b' .typ=%s\n .vmax=%d\n' % (rnd.randrange(1000), rnd.randrange(10),
+			rnd.getrandbits(16), rnd.randrange(1, 256),
+			rnd.choice((b'mm2_prg', b'mm2_dil8', b'mfx', b'dcc')),
+			rnd.randrange(255)))
+	return data[:n]
+
+
+def make_image(path, tmp, name, nbytes, packed=False):
+	"""Build the SD card image with file name of nbytes."""
+	specs = []
+	for fname, dflt, pos, ver in FILES:
+		n = nbytes if fname == name else dflt
+		rnd = random.Random(fname)
+		if fname == name and packed:
+			data = records(rnd, n)
+		else:
+			data = bytearray(rnd.getrandbits(8) for _ in range(n))
+		data[pos] = ver >> 8
+		data[pos + 1] = ver & 0xFF
+		src = os.path.join(tmp, fname)
+		if fname == name and packed:
+			src = os.path.splitext(src)[0] + '.lz'
+			data = lzpack.pack(bytes(data))
+		with open(src, 'wb') as f:
+			f.write(data)
+		specs.append(src)
+	mkfatimg.build(path, 8 if nbytes < 6 * 1024 * 1024 else 32, 1, specs)
+
+
+def run(binary, can, img):
+	"""Run the update, return dict of the results or None on failure."""
+	p = subprocess.run([binary, '-c', can, '-s', img, '-o', 'null', 'update'],
+		stdout=subprocess.DEVNULL, stderr=subprocess.PIPE,
+		universal_newlines=True)
+	m = STATS.search(p.stderr)
+	if not m or int(m.group(1)) or p.returncode or not int(m.group(8)):
+		sys.stderr.write(p.stderr)
+		return None
+	time = float(m.group(2))
+	frames = int(m.group(3)) + int(m.group(4))
+	sectors = int(m.group(7))
+	payload = int(m.group(8))
+	return {
+		'time': '%.3f' % time,
+		'bps': '%.0f' % (payload / time),
+		'fps': '%.1f' % (frames / time),
+		'sdpb': '%.3f' % (sectors * SECTOR / payload if payload else 0),
+		'idle': m.group(9),
+		'frames': str(frames),
+		'sectors': str(sectors),
+		'payload': str(payload),
+	}
+
+
+def load_baseline(path):
+	base = {}
+	if os.path.exists(path):
+		with open(path, newline='') as f:
+			for row in csv.DictReader(f):
+				base[(row['case'], row['size'], row['build'])] = row
+	return base
+
+
+def compare(row, ref, tol):
+	"""Return list of regressions of row against the baseline ref."""
+	bad = []
+	if float(row['time']) > float(ref['time']) * (1 + tol / 100):
+		bad.append('time %s > %s' % (row['time'], ref['time']))
+	for key in ('frames', 'sectors', 'payload'):
+		if row[key] != ref[key]:
+			bad.append('%s %s != %s' % (key, row[key], ref[key]))
+	return bad
+
+
+def main():
+	here = os.path.dirname(os.path.abspath(__file__))
+	ap = argparse.ArgumentParser(description='host build update benchmark')
+	ap.add_argument('-d', '--hostdir', default=os.path.join(here, '..', 'src',
+		'host'), help='directory of ms2upd and ms2upd-hw')
+	ap.add_argument('-b', '--baseline', default=os.path.join(here,
+		'hostbench.csv'), help='baseline results')
+	ap.add_argument('-u', '--update', action='store_true',
+		help='write the results as baseline')
+	ap.add_argument('-t', '--tolerance', type=float, default=1.0,
+		help='allowed time increase in %%')
+	ap.add_argument('sizes', nargs='*', help='case=size[,size...]')
+	args = ap.parse_args()
+
+	sizes = {c[0]: c[3] for c in CASES}
+	if args.sizes:
+		sizes = {}
+		for spec in args.sizes:
+			name, _, text = spec.partition('=')
+			if name not in [c[0] for c in CASES]:
+				sys.exit('unknown case %s' % name)
+			sizes[name] = text or [c[3] for c in CASES if c[0] == name][0]
+
+	base = load_baseline(args.baseline)
+	rows = []
+	failed = 0
+
+	print('%-6s %8s %-10s %9s %7s %7s %6s %6s  %s' % ('case', 'size',
+		'build', 'time', 'B/s', 'frm/s', 'sd/B', 'idle', 'baseline'))
+
+	with tempfile.TemporaryDirectory() as tmp:
+		for name, fname, can, _, packed in CASES:
+			if name not in sizes:
+				continue
+			for text in sizes[name].split(','):
+				n = size(text)
+				img = os.path.join(tmp, 'sd.img')
+				make_image(img, tmp, fname, n, packed)
+				for build in BUILDS:
+					res = run(os.path.join(args.hostdir, build), can, img)
+					if res is None:
+						print('%-6s %8d %-10s FAILED' % (name, n, build))
+						failed += 1
+						continue
+					row = dict(case=name, size=str(n), build=build, **res)
+					rows.append(row)
+					ref = base.get((name, str(n), build))
+					if ref is None:
+						note = 'new'
+					else:
+						bad = compare(row, ref, args.tolerance)
+						note = '; '.join(bad) if bad else '%+.1f%%' % (
+							100 * (float(row['time']) / float(ref['time']) - 1))
+						failed += bool(bad)
+					print('%-6s %8d %-10s %8ss %7s %7s %6s %5s%%  %s' % (name,
+						n, build, row['time'], row['bps'], row['fps'],
+						row['sdpb'], row['idle'], note))
+
+	if args.update:
+		for row in rows:
+			base[(row['case'], row['size'], row['build'])] = row
+		with open(args.baseline, 'w', newline='') as f:
+			w = csv.DictWriter(f, FIELDS, lineterminator='\n')
+			w.writeheader()
+			w.writerows(base.values())
+		return 0
+
+	return 1 if failed else 0
+
+
+if __name__ == '__main__':
+	sys.exit(main())
@@ -0,0 +1,173 @@
+#!/usr/bin/env python3
+#
+# lzpack.py - pack update files of MS2upd for the decoder of src/lz.c
+#
+# ----------------------------------------------------------------------------
+# "THE BEER-WARE LICENSE" (Revision 42):
+# <karsten@rhen.de> wrote this file. As long as you retain this notice you
+# can do whatever you want with this stuff. If we meet some day, and you think
+# this stuff is worth it, you can buy me a beer in Flensburg, Germany
+# ----------------------------------------------------------------------------
+#
+# Usage: lzpack.py [-b shift] [-o out] file ...
+#
+# Writes base.lz next to each file, e.g. lang.ms2 -> lang.lz. Copied on the
+# SD card, the updater sends the decoded bytes of base.lz instead of the file
+# of the same base name. Format see src/lz.h: a header, the index of the
+# blocks and the blocks, each packed on its own with matches of up to
+# 258 bytes at a distance of up to 256 bytes. -b sets the log2 of the block
+# size, default 9 ( 512 ), larger blocks pack a little better, a seek decodes
+# up to a block of bytes more.
+#
+# Each file is decoded again and compared before it is written.
+
+import argparse
+import os
+import struct
+import sys
+
+MAGIC = b'LZ'
+VERSION = 1
+WINDOW = 256
+MINLEN = 3
+MAXLEN = MINLEN + 255
+
+
+def match(block, pos, heads):
+	"""Return distance and length of the longest match at pos."""
+	best, dist = 0, 0
+	end = min(len(block), pos + MAXLEN)
+	for src in reversed(heads.get(block[pos:pos + MINLEN], [])):
+		if pos - src > WINDOW:
+			break
+		n = 0
+		while pos + n < end and block[src + n] == block[pos + n]:
+			n += 1
+		if n > best:
+			best, dist = n, pos - src
+			if n == end - pos:
+				break
+	return dist, best
+
+
+def pack_block(block):
+	"""Pack one block, greedy with one byte lazy matching."""
+	out = bytearray()
+	flags, nflags, group = 0, 0, bytearray()
+	heads = {}
+	pos = 0
+
+	def token(bit, data):
+		nonlocal flags, nflags, group
+		flags |= bit << nflags
+		group += data
+		nflags += 1
+		if nflags == 8:
+			out.append(flags)
+			out.extend(group)
+			flags, nflags, group = 0, 0, bytearray()
+
+	def insert(i):
+		heads.setdefault(block[i:i + MINLEN], []).append(i)
+
+	while pos < len(block):
+		dist, n = match(block, pos, heads)
+		if n >= MINLEN and pos + 1 < len(block):
+			insert(pos)
+			if match(block, pos + 1, heads)[1] > n + 1:
+				token(1, block[pos:pos + 1])
+				pos += 1
+				continue
+			heads[block[pos:pos + MINLEN]].pop()
+		if n >= MINLEN:
+			token(0, bytes((dist - 1, n - MINLEN)))
+			for i in range(pos, pos + n):
+				insert(i)
+			pos += n
+		else:
+			token(1, block[pos:pos + 1])
+			insert(pos)
+			pos += 1
+
+	if nflags:
+		out.append(flags)
+		out.extend(group)
+	return bytes(out)
+
+
+def pack(data, shift=9):
+	"""Return the compressed file of data."""
+	size = 1 << shift
+	blocks = [pack_block(data[i:i + size]) for i in range(0, len(data), size)]
+	head = MAGIC + bytes((VERSION, shift)) + struct.pack('<I', len(data))
+	ofs = len(head) + 4 * len(blocks)
+	index = bytearray()
+	for b in blocks:
+		index += struct.pack('<I', ofs)
+		ofs += len(b)
+	return head + bytes(index) + b''.join(blocks)
+
+
+def unpack(packed):
+	"""Return the decoded bytes of a compressed file, like src/lz.c."""
+	if packed[:2] != MAGIC or packed[2] != VERSION:
+		raise ValueError('no compressed file')
+	shift = packed[3]
+	size, = struct.unpack_from('<I', packed, 4)
+	out = bytearray()
+	for blk in range((size + (1 << shift) - 1) >> shift):
+		pos, = struct.unpack_from('<I', packed, 8 + 4 * blk)
+		end = min(size, (blk + 1) << shift)
+		start = len(out)
+		while len(out) < end:
+			flags = packed[pos]
+			pos += 1
+			for bit in range(8):
+				if len(out) >= end:
+					break
+				if flags >> bit & 1:
+					out.append(packed[pos])
+					pos += 1
+					continue
+				dist = packed[pos] + 1
+				n = packed[pos + 1] + MINLEN
+				pos += 2
+				if dist > len(out) - start or len(out) + n > end:
+					raise ValueError('bad match in block %d' % blk)
+				for _ in range(n):
+					out.append(out[-dist])
+	return bytes(out)
+
+
+def main():
+	ap = argparse.ArgumentParser(description='pack MS2upd update files')
+	ap.add_argument('-b', '--shift', type=int, default=9,
+		help='log2 of the block size, 8 .. 15')
+	ap.add_argument('-o', '--out', help='output file, one input file only')
+	ap.add_argument('files', nargs='+')
+	args = ap.parse_args()
+
+	if not 8 <= args.shift <= 15:
+		sys.exit('block size 2^%d out of 2^8 .. 2^15' % args.shift)
+	if args.out and len(args.files) > 1:
+		sys.exit('-o with more than one file')
+
+	for name in args.files:
+		with open(name, 'rb') as f:
+			data = f.read()
+		packed = pack(data, args.shift)
+		if unpack(packed) != data:
+			sys.exit('%s: decode check failed' % name)
+		out = args.out or os.path.splitext(name)[0] + '.lz'
+		with open(out, 'wb') as f:
+			f.write(packed)
+		print('%s: %d -> %d bytes %.1f%%%s' % (out, len(data), len(packed),
+			100.0 * len(packed) / len(data) if data else 0,
+			', not smaller, keep the plain file' if len(packed) >= len(data)
+			else ''))
+
+	return 0
+
+
+if __name__ == '__main__':
+	sys.exit(main())
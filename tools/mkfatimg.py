@@ -0,0 +1,117 @@
+#!/usr/bin/env python3
+#
+# mkfatimg.py - build a FAT16 SD card image for the host build of MS2upd
+#
+# ----------------------------------------------------------------------------
+# "THE BEER-WARE LICENSE" (Revision 42):
+# <karsten@rhen.de> wrote this file. As long as you retain this notice you
+# can do whatever you want with this stuff. If we meet some day, and you think
+# this stuff is worth it, you can buy me a beer in Flensburg, Germany
+# ----------------------------------------------------------------------------
+#
+# Usage: mkfatimg.py [-m MB] [-c sectors/cluster] image file[=name] ...
+#
+# The image has no partition table ( super floppy ) like FatFs accepts it.
+# Files are stored in the root directory with 8.3 names and in contiguous
+# clusters.
+
+import argparse
+import os
+import struct
+import sys
+
+SECTOR = 512
+ROOT_ENTRIES = 512
+RESERVED = 1
+NFATS = 2
+
+
+def short_name(name):
+	base, _, ext = name.upper().rpartition('.')
+	if not base:
+		base, ext = ext, ''
+	if len(base) > 8 or len(ext) > 3:
+		sys.exit('%s: no 8.3 file name' % name)
+	return (base.ljust(8) + ext.ljust(3)).encode('ascii')
+
+
+def layout(total, spc):
+	"""Return FAT size in sectors and number of clusters."""
+	root = ROOT_ENTRIES * 32 // SECTOR
+	fatsz = 1
+	while True:
+		data = total - RESERVED - NFATS * fatsz - root
+		clusters = data // spc
+		need = ((clusters + 2) * 2 + SECTOR - 1) // SECTOR
+		if need <= fatsz:
+			return fatsz, clusters
+		fatsz = need
+
+
+def build(path, size_mb, spc, files):
+	total = size_mb * 1024 * 1024 // SECTOR
+	fatsz, clusters = layout(total, spc)
+	if not 4085 <= clusters < 65525:
+		sys.exit('%d clusters: no FAT16, change size or cluster size' % clusters)
+
+	root_sec = RESERVED + NFATS * fatsz
+	data_sec = root_sec + ROOT_ENTRIES * 32 // SECTOR
+	img = bytearray(total * SECTOR)
+
+	# boot sector with BPB
+	bs = struct.pack('<3s8sHBHBHHBHHHII', b'\xEB\x3C\x90', b'MSWIN4.1',
+		SECTOR, spc, RESERVED, NFATS, ROOT_ENTRIES,
+		total if total < 0x10000 else 0, 0xF8, fatsz, 63, 255, 0,
+		total if total >= 0x10000 else 0)
+	bs += struct.pack('<BBBI11s8s', 0x80, 0, 0x29, 0x4D533255,
+		b'MS2UPD     ', b'FAT16   ')
+	img[0:len(bs)] = bs
+	img[510:512] = b'\x55\xAA'
+
+	fat = [0xFFF8, 0xFFFF]
+	root = bytearray()
+	csize = spc * SECTOR
+
+	for spec in files:
+		src, _, name = spec.partition('=')
+		with open(src, 'rb') as f:
+			data = f.read()
+		name = name or os.path.basename(src)
+		first = len(fat) if data else 0
+		n = (len(data) + csize - 1) // csize
+		if first + n > clusters + 2:
+			sys.exit('image full at %s' % name)
+		for i in range(n):
+			fat.append(first + i + 1 if i < n - 1 else 0xFFFF)
+		if data:
+			off = (data_sec + (first - 2) * spc) * SECTOR
+			img[off:off + len(data)] = data
+		root += struct.pack('<11sBBBHHHHHHHI', short_name(name), 0x20,
+			0, 0, 0, 0x5021, 0x5021, 0, 0, 0x5021, first, len(data))
+
+	if len(root) > ROOT_ENTRIES * 32:
+		sys.exit('too many files')
+
+	fat_bytes = struct.pack('<%dH' % len(fat), *fat)
+	for i in range(NFATS):
+		off = (RESERVED + i * fatsz) * SECTOR
+		img[off:off + len(fat_bytes)] = fat_bytes
+	img[root_sec * SECTOR:root_sec * SECTOR + len(root)] = root
+
+	with open(path, 'wb') as f:
+		f.write(img)
+
+
+def main():
+	ap = argparse.ArgumentParser(description='build a FAT16 image')
+	ap.add_argument('-m', '--size', type=int, default=8, help='size in MB')
+	ap.add_argument('-c', '--cluster', type=int, default=1,
+		help='sectors per cluster')
+	ap.add_argument('image')
+	ap.add_argument('files', nargs='*', help='file[=name in image]')
+	args = ap.parse_args()
+	build(args.image, args.size, args.cluster, args.files)
+
+
+if __name__ == '__main__':
+	main()
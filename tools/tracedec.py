@@ -0,0 +1,175 @@
+#!/usr/bin/env python3
+#
+# tracedec.py - decode the binary trace of MS2upd (debug.h, TRACE defined)
+#
+# ----------------------------------------------------------------------------
+# "THE BEER-WARE LICENSE" (Revision 42):
+# <karsten@rhen.de> wrote this file. As long as you retain this notice you
+# can do whatever you want with this stuff. If we meet some day, and you think
+# this stuff is worth it, you can buy me a beer in Flensburg, Germany
+# ----------------------------------------------------------------------------
+#
+# Usage: tracedec.py main.elf [capture]
+#
+# The firmware sends a record per PRINT():
+#   0xA5 | arg length | format ID low | format ID high | args ...
+# Bit 7 of the arg length ( TRACE_TRUNC ) marks a record cut at the first
+# argument not fitting, it is printed with <truncated>. The format ID is the flash address of the format string, the string itself
+# is read from the ELF file of the same build. Bytes outside of records are
+# passed through, so plain output (e.g. uart_puts) stays readable.
+
+import re
+import struct
+import sys
+
+TRACE_SYNC = 0xA5
+TRACE_TRUNC = 0x80
+
+SHF_ALLOC = 0x2
+SHT_NOBITS = 8
+FLASH_END = 0x800000		# avr-gcc data space starts at 0x800000
+
+
+def load_flash(path):
+	"""Return list of (addr, bytes) of the allocated flash sections."""
+	with open(path, 'rb') as f:
+		elf = f.read()
+	if elf[:4] != b'\x7fELF' or elf[4] != 1:
+		sys.exit('%s: no 32 bit ELF file' % path)
+	end = '<' if elf[5] == 1 else '>'
+	shoff, = struct.unpack_from(end + 'I', elf, 0x20)
+	shentsize, shnum = struct.unpack_from(end + 'HH', elf, 0x2E)
+	sections = []
+	for i in range(shnum):
+		(name, typ, flags, addr, off, size) = struct.unpack_from(
+			end + 'IIIIII', elf, shoff + i * shentsize)
+		if flags & SHF_ALLOC and typ != SHT_NOBITS and addr < FLASH_END:
+			sections.append((addr, elf[off:off + size]))
+	return sections
+
+
+def format_string(sections, addr, cache={}):
+	if addr not in cache:
+		cache[addr] = None
+		for base, data in sections:
+			if base <= addr < base + len(data):
+				s = data[addr - base:data.index(b'\0', addr - base)]
+				cache[addr] = s.decode('latin-1')
+				break
+	return cache[addr]
+
+
+SPEC = re.compile(r'%([-+ #0]*)(\*|\d+)?(?:\.(\*|\d+))?([hl]*)([a-zA-Z%])')
+
+
+def render(fmt, args):
+	"""Format with the same size rules as trace_P()."""
+	out = []
+	pos = 0
+	last = 0
+
+	def take(n, signed=False):
+		nonlocal pos
+		if pos + n > len(args):
+			raise IndexError
+		v = int.from_bytes(args[pos:pos + n], 'little', signed=signed)
+		pos += n
+		return v
+
+	def take_str():
+		nonlocal pos
+		end = args.find(b'\0', pos)
+		if end < 0:
+			raise IndexError
+		s = args[pos:end].decode('latin-1')
+		pos = end + 1
+		return s
+
+	for m in SPEC.finditer(fmt):
+		out.append(fmt[last:m.start()])
+		last = m.end()
+		flags, width, prec, length, conv = m.groups()
+		if conv == '%':
+			out.append('%')
+			continue
+		try:
+			if width == '*':
+				width = str(take(2, True))
+			if prec == '*':
+				prec = str(take(2, True))
+			spec = '%' + flags + (width or '') + ('.' + prec if prec else '')
+			if conv in 'sS':
+				out.append((spec + 's') % take_str())
+				continue
+			size = 4 if 'l' in length else 2
+			if conv in 'di':
+				out.append((spec + 'd') % take(size, True))
+			elif conv == 'u':
+				out.append((spec + 'd') % take(size))
+			elif conv == 'c':
+				out.append((spec + 'c') % chr(take(size) & 0xFF))
+			elif conv in 'xXo':
+				out.append((spec + conv) % take(size))
+			else:
+				out.append(m.group(0))
+				take(size)
+		except IndexError:
+			out.append('<?>')
+	out.append(fmt[last:])
+	return ''.join(out)
+
+
+def decode(sections, stream, out):
+	buf = b''
+	while True:
+		chunk = stream.read(4096)
+		if chunk:
+			buf += chunk
+		i = 0
+		while i < len(buf):
+			if buf[i] != TRACE_SYNC:
+				j = buf.find(bytes([TRACE_SYNC]), i)
+				j = len(buf) if j < 0 else j
+				out.write(buf[i:j].decode('latin-1'))
+				i = j
+				continue
+			if len(buf) - i < 4:
+				break
+			n = buf[i + 1] & ~TRACE_TRUNC
+			trunc = buf[i + 1] & TRACE_TRUNC
+			fid = buf[i + 2] | buf[i + 3] << 8
+			fmt = format_string(sections, fid)
+			if fmt is None:
+				# no record, resync behind this byte
+				out.write(chr(buf[i]))
+				i += 1
+				continue
+			if len(buf) - i < 4 + n:
+				break
+			text = render(fmt, buf[i + 4:i + 4 + n])
+			if trunc:
+				nl = text.endswith('\n')
+				text = text.rstrip('\n') + ' <truncated>' + ('\n' if nl else '')
+			out.write(text)
+			i += 4 + n
+		buf = buf[i:]
+		if not chunk:
+			if buf:
+				out.write('<truncated record>\n')
+			break
+		out.flush()
+
+
+def main():
+	if len(sys.argv) < 2:
+		sys.exit('usage: %s main.elf [capture]' % sys.argv[0])
+	sections = load_flash(sys.argv[1])
+	if len(sys.argv) > 2:
+		stream = open(sys.argv[2], 'rb')
+	else:
+		stream = sys.stdin.buffer
+	decode(sections, stream, sys.stdout)
+
+
+if __name__ == '__main__':
+	main()